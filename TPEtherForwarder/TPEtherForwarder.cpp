@@ -0,0 +1,746 @@
+// -*- C++ -*-
+/*!
+ * @file
+ * @brief
+ * @date
+ * @author
+ *
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "TPEtherForwarder.h"
+#include "AsyncLog.h"
+
+using DAQMW::FatalType::DATAPATH_DISCONNECTED;
+using DAQMW::FatalType::HEADER_DATA_MISMATCH;
+using DAQMW::FatalType::FOOTER_DATA_MISMATCH;
+using DAQMW::FatalType::USER_DEFINED_ERROR1;
+
+// Module specification
+// Change following items to suit your component's spec.
+static const char* tpetherforwarder_spec[] =
+{
+    "implementation_id", "TPEtherForwarder",
+    "type_name",         "TPEtherForwarder",
+    "description",       "TPEtherForwarder component",
+    "version",           "1.0",
+    "vendor",            "Kazuo Nakayoshi, KEK",
+    "category",          "example",
+    "activity_type",     "DataFlowComponent",
+    "max_instance",      "1",
+    "language",          "C++",
+    "lang_type",         "compile",
+    ""
+};
+
+/*
+ * Forward the stream to analysis nodes over TCP
+ *
+ * Receivers connect to listenPort; connections are accepted in
+ * daq_start() and during the run, and are kept over stop/start.
+ * Every block read from the InPort is sent to all receivers
+ * (distribution copy) or to one after the other (roundrobin).
+ *
+ * The payload is not copied: the buffer of the InPort sequence is
+ * taken over (get_buffer(1)) and sent with MSG_ZEROCOPY
+ * (ZeroCopySender.h), so the NIC reads it from here.  The buffer is
+ * freed when the last receiver's completion for it arrived.  Only
+ * blocks below zeroCopyMinBytes are copied into the socket buffer.
+ *
+ * A receiver holds at most maxQueueBlocks blocks not done yet.  When
+ * one is full, slowReceiverPolicy block stops reading the InPort (the
+ * upstream OutPort sees a full buffer) and drop skips the block for
+ * that receiver.
+ */
+
+static const unsigned long long SERVICE_INTERVAL_NS = 10000000ULL;
+
+TPEtherForwarder::TPEtherForwarder(RTC::Manager* manager)
+    : DAQMW::DaqComponentBase(manager),
+      m_InPort("tpetherforwarder_in", m_in_data),
+      m_next_receiver(0),
+      m_last_service_ns(0),
+      m_listen_fd(-1),
+      m_listen_port(0),
+      m_round_robin(false),
+      m_drop_slow(true),
+      m_max_queue_blocks(64),
+      m_zerocopy(true),
+      m_zc_min_bytes(16384),
+      m_send_header_footer(false),
+      m_stop_drain_ms(1000),
+      m_sndbuf_bytes(0),
+      m_max_receivers(16),
+      m_blocks_in(0),
+      m_unrouted(0),
+      m_handed_over(0),
+      m_copied_blocks(0),
+      m_blocked_ns(0),
+      m_blocked_waits(0),
+      m_connects(0),
+      m_disconnects(0)
+{
+    // Registration: InPort/OutPort/Service
+
+    // Set InPort buffers
+    registerInPort("tpetherforwarder_in", m_InPort);
+    m_InPort.addConnectorDataListener(ON_BUFFER_WRITE, m_wait.notifier());
+
+    init_command_port();
+    init_state_table();
+    set_comp_name("TPETHERFORWARDER");
+}
+
+TPEtherForwarder::~TPEtherForwarder()
+{
+    close_receivers();
+    for (unsigned int i = 0; i < m_free_blocks.size(); i++) {
+        delete m_free_blocks[i];
+    }
+    if (m_listen_fd >= 0) {
+        close(m_listen_fd);
+    }
+}
+
+RTC::ReturnCode_t TPEtherForwarder::onInitialize()
+{
+    TPLOG_DEBUG("TPEtherForwarder::onInitialize()");
+
+    return RTC::RTC_OK;
+}
+
+RTC::ReturnCode_t TPEtherForwarder::onExecute(RTC::UniqueId ec_id)
+{
+    daq_do();
+
+    return RTC::RTC_OK;
+}
+
+int TPEtherForwarder::daq_dummy()
+{
+    return 0;
+}
+
+int TPEtherForwarder::daq_configure()
+{
+    std::cerr << "*** TPEtherForwarder::configure" << std::endl;
+
+    ::NVList* paramList;
+    paramList = m_daq_service0.getCompParams();
+    parse_params(paramList);
+
+    if (m_listen_fd < 0 && open_listener() < 0) {
+        fatal_error_report(USER_DEFINED_ERROR1, "CANNOT LISTEN");
+    }
+
+    return 0;
+}
+
+int TPEtherForwarder::parse_params(::NVList* list)
+{
+    std::cerr << "param list length:" << (*list).length() << std::endl;
+
+    int len = (*list).length();
+    for (int i = 0; i < len; i+=2) {
+        std::string sname  = (std::string)(*list)[i].value;
+        std::string svalue = (std::string)(*list)[i+1].value;
+
+        std::cerr << "sname: " << sname << "  ";
+        std::cerr << "value: " << svalue << std::endl;
+
+        if ( sname == "listenAddr" ) {
+            m_listen_addr = svalue;
+        }
+        if ( sname == "listenPort" ) {
+            char* offset;
+            m_listen_port = (int)strtol(svalue.c_str(), &offset, 10);
+        }
+        if ( sname == "distribution" ) {
+            if (svalue == "copy") {
+                m_round_robin = false;
+            }
+            else if (svalue == "roundrobin") {
+                m_round_robin = true;
+            }
+            else {
+                std::cerr << "### ERROR: unknown distribution: "
+                          << svalue << std::endl;
+                fatal_error_report(USER_DEFINED_ERROR1, "BAD DISTRIBUTION");
+            }
+        }
+        if ( sname == "slowReceiverPolicy" ) {
+            if (svalue == "drop") {
+                m_drop_slow = true;
+            }
+            else if (svalue == "block") {
+                m_drop_slow = false;
+            }
+            else {
+                std::cerr << "### ERROR: unknown slowReceiverPolicy: "
+                          << svalue << std::endl;
+                fatal_error_report(USER_DEFINED_ERROR1, "BAD SLOWRECEIVERPOLICY");
+            }
+        }
+        if ( sname == "maxQueueBlocks" ) {
+            char* offset;
+            m_max_queue_blocks = (unsigned int)strtoul(svalue.c_str(), &offset, 10);
+            if (m_max_queue_blocks == 0) {
+                m_max_queue_blocks = 1;
+            }
+        }
+        if ( sname == "zeroCopy" ) {
+            m_zerocopy = (svalue == "yes");
+        }
+        if ( sname == "zeroCopyMinBytes" ) {
+            char* offset;
+            m_zc_min_bytes = (unsigned int)strtoul(svalue.c_str(), &offset, 10);
+        }
+        if ( sname == "sendHeaderFooter" ) {
+            m_send_header_footer = (svalue == "yes");
+        }
+        if ( sname == "stopDrainMs" ) {
+            char* offset;
+            m_stop_drain_ms = (unsigned int)strtoul(svalue.c_str(), &offset, 10);
+        }
+        if ( sname == "sndBufMB" ) {
+            char* offset;
+            m_sndbuf_bytes =
+                (unsigned int)strtoul(svalue.c_str(), &offset, 10)*1024*1024;
+        }
+        if ( sname == "maxReceivers" ) {
+            char* offset;
+            m_max_receivers = (unsigned int)strtoul(svalue.c_str(), &offset, 10);
+        }
+        if ( sname == "waitStrategy" ) {
+            if (m_wait.set_mode(svalue) < 0) {
+                std::cerr << "### WARNING: unknown waitStrategy: " << svalue
+                          << ", use spin" << std::endl;
+                m_wait.set_mode("spin");
+            }
+        }
+        if ( sname == "logLevel" ) {
+            if (AsyncLog::set_level(svalue) < 0) {
+                std::cerr << "### ERROR: unknown logLevel: " << svalue
+                          << std::endl;
+                fatal_error_report(USER_DEFINED_ERROR1, "BAD LOGLEVEL");
+            }
+        }
+    }
+
+    if (m_listen_port <= 0 || m_listen_port > 65535) {
+        std::cerr << "### ERROR: listenPort must be 1..65535" << std::endl;
+        fatal_error_report(USER_DEFINED_ERROR1, "BAD LISTENPORT");
+    }
+
+    return 0;
+}
+
+int TPEtherForwarder::open_listener()
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port   = htons(m_listen_port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (!m_listen_addr.empty() &&
+        inet_pton(AF_INET, m_listen_addr.c_str(), &addr.sin_addr) != 1) {
+        std::cerr << "### ERROR: bad listenAddr: " << m_listen_addr
+                  << std::endl;
+        return -1;
+    }
+
+    m_listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (m_listen_fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    int on = 1;
+    setsockopt(m_listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (bind(m_listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        listen(m_listen_fd, 16) < 0) {
+        std::cerr << "### ERROR: listen on port " << m_listen_port << ": "
+                  << strerror(errno) << std::endl;
+        close(m_listen_fd);
+        m_listen_fd = -1;
+        return -1;
+    }
+    fcntl(m_listen_fd, F_SETFL, fcntl(m_listen_fd, F_GETFL) | O_NONBLOCK);
+    std::cerr << "listening on port " << m_listen_port << std::endl;
+    return 0;
+}
+
+int TPEtherForwarder::daq_unconfigure()
+{
+    std::cerr << "*** TPEtherForwarder::unconfigure" << std::endl;
+
+    AsyncLog::flush();
+    close_receivers();
+    if (m_listen_fd >= 0) {
+        close(m_listen_fd);
+        m_listen_fd = -1;
+    }
+
+    return 0;
+}
+
+int TPEtherForwarder::daq_start()
+{
+    std::cerr << "*** TPEtherForwarder::start" << std::endl;
+
+    bool inport_conn = check_dataPort_connections( m_InPort );
+    if (!inport_conn) {
+        std::cerr << "### NO Connection" << std::endl;
+        fatal_error_report(DATAPATH_DISCONNECTED);
+    }
+
+    for (unsigned int i = 0; i < m_receivers.size(); i++) {
+        m_receivers[i]->sender.reset_stats();
+        m_receivers[i]->blocks = 0;
+        m_receivers[i]->drops  = 0;
+    }
+    m_blocks_in     = 0;
+    m_unrouted      = 0;
+    m_handed_over   = 0;
+    m_copied_blocks = 0;
+    m_blocked_ns    = 0;
+    m_blocked_waits = 0;
+    m_connects      = 0;
+    m_disconnects   = 0;
+    m_wait.reset_stats();
+
+    // receivers which connected since the last run
+    service_receivers(true);
+    std::cerr << "receivers: " << m_receivers.size() << std::endl;
+
+    gettimeofday(&m_tv_start, NULL);
+    return 0;
+}
+
+int TPEtherForwarder::daq_stop()
+{
+    std::cerr << "*** TPEtherForwarder::stop" << std::endl;
+
+    drain_receivers();
+    reset_InPort();
+
+    AsyncLog::flush();     // messages of the run before the report
+    gettimeofday(&m_tv_stop, NULL);
+    struct timeval tv_diff;
+    timersub(&m_tv_stop, &m_tv_start, &tv_diff);
+    double elapsed_sec = tv_diff.tv_sec + 0.000001*tv_diff.tv_usec;
+    unsigned long long total_bytes_size = get_total_byte_size();
+    double transfer_rate = total_bytes_size / elapsed_sec / 1024.0 / 1024.0;
+    std::cerr << "transfer_rate: " << transfer_rate << " MB/s" << std::endl;
+
+    report_stats();
+
+    return 0;
+}
+
+int TPEtherForwarder::daq_pause()
+{
+    std::cerr << "*** TPEtherForwarder::pause" << std::endl;
+
+    return 0;
+}
+
+int TPEtherForwarder::daq_resume()
+{
+    std::cerr << "*** TPEtherForwarder::resume" << std::endl;
+
+    return 0;
+}
+
+void TPEtherForwarder::service_receivers(bool force)
+{
+    unsigned long long now = mono_now_ns();
+    if (!force && now - m_last_service_ns < SERVICE_INTERVAL_NS) {
+        return;
+    }
+    m_last_service_ns = now;
+
+    accept_receivers();
+    // notices receivers which went away while nothing was sent
+    wait_receivers(0);
+}
+
+void TPEtherForwarder::accept_receivers()
+{
+    for (;;) {
+        int fd = accept(m_listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                TPLOG_RATE(AsyncLog::LEVEL_ERROR, 1, "accept: %s",
+                           strerror(errno));
+            }
+            return;
+        }
+        if (m_receivers.size() >= m_max_receivers) {
+            TPLOG_WARNING("maxReceivers (%u) reached, connection refused",
+                          m_max_receivers);
+            close(fd);
+            continue;
+        }
+        if (m_sndbuf_bytes > 0) {
+            int size = m_sndbuf_bytes;
+            setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+        }
+
+        ForwardReceiver* r = new ForwardReceiver();
+        r->sender.attach(fd, m_zerocopy, m_zc_min_bytes);
+        r->blocks = 0;
+        r->drops  = 0;
+        m_receivers.push_back(r);
+        m_connects++;
+        TPLOG_INFO("receiver %s connected, zero copy: %s",
+                   r->sender.peer().c_str(),
+                   r->sender.zerocopy() ? "yes" : "no");
+    }
+}
+
+void TPEtherForwarder::progress_receivers()
+{
+    unsigned int i = 0;
+    while (i < m_receivers.size()) {
+        ZeroCopySender& sender = m_receivers[i]->sender;
+        if (sender.progress() < 0) {
+            drop_receiver(i, "send failed");
+            continue;
+        }
+        void* cookie;
+        while ((cookie = sender.pop_done()) != 0) {
+            release_block(static_cast<ForwardBlock*>(cookie));
+        }
+        i++;
+    }
+}
+
+int TPEtherForwarder::wait_receivers(int timeout_ms)
+{
+    if (m_receivers.empty()) {
+        if (timeout_ms > 0) {
+            usleep(timeout_ms*1000);
+        }
+        return 0;
+    }
+
+    m_pollfds.resize(m_receivers.size());
+    for (unsigned int i = 0; i < m_receivers.size(); i++) {
+        m_pollfds[i].fd      = m_receivers[i]->sender.fd();
+        m_pollfds[i].events  = m_receivers[i]->sender.poll_events();
+        m_pollfds[i].revents = 0;
+    }
+    int ret = poll(&m_pollfds[0], m_pollfds.size(), timeout_ms);
+    if (ret <= 0) {
+        return ret;
+    }
+    // backwards, drop_receiver() moves the ones behind
+    for (unsigned int i = m_pollfds.size(); i-- > 0; ) {
+        if ((m_pollfds[i].revents & (POLLIN | POLLHUP)) &&
+            m_receivers[i]->sender.peer_closed()) {
+            drop_receiver(i, "closed by the receiver");
+        }
+    }
+    return ret;
+}
+
+void TPEtherForwarder::drain_receivers()
+{
+    unsigned long long deadline =
+        mono_now_ns() + m_stop_drain_ms*1000000ULL;
+    for (;;) {
+        progress_receivers();
+        bool pending = false;
+        for (unsigned int i = 0; i < m_receivers.size(); i++) {
+            if (m_receivers[i]->sender.pending() > 0) {
+                pending = true;
+            }
+        }
+        if (!pending) {
+            return;
+        }
+        if (mono_now_ns() >= deadline) {
+            break;
+        }
+        wait_receivers(1);
+    }
+
+    for (unsigned int i = m_receivers.size(); i-- > 0; ) {
+        if (m_receivers[i]->sender.pending() > 0) {
+            std::cerr << "### WARNING: " << m_receivers[i]->sender.peer()
+                      << ": " << m_receivers[i]->sender.pending()
+                      << " blocks not sent after stopDrainMs" << std::endl;
+            drop_receiver(i, "not drained at stop");
+        }
+    }
+}
+
+void TPEtherForwarder::drop_receiver(unsigned int i, const char* reason)
+{
+    ForwardReceiver* r = m_receivers[i];
+    TPLOG_WARNING("receiver %s disconnected: %s, %llu blocks sent, %llu dropped",
+                  r->sender.peer().c_str(), reason, r->blocks, r->drops);
+    if (AsyncLog::enabled(AsyncLog::LEVEL_INFO)) {
+        std::ostringstream os;
+        r->sender.print_stats(os);
+        AsyncLog::log_lines(AsyncLog::LEVEL_INFO, os.str());
+    }
+
+    std::vector<void*> cookies;
+    r->sender.take_all(cookies);
+    r->sender.abort();
+    for (unsigned int k = 0; k < cookies.size(); k++) {
+        release_block(static_cast<ForwardBlock*>(cookies[k]));
+    }
+    delete r;
+    m_receivers.erase(m_receivers.begin() + i);
+    if (m_next_receiver > i) {
+        m_next_receiver--;
+    }
+    m_disconnects++;
+}
+
+void TPEtherForwarder::close_receivers()
+{
+    for (unsigned int i = 0; i < m_receivers.size(); i++) {
+        std::vector<void*> cookies;
+        m_receivers[i]->sender.take_all(cookies);
+        m_receivers[i]->sender.abort();
+        for (unsigned int k = 0; k < cookies.size(); k++) {
+            release_block(static_cast<ForwardBlock*>(cookies[k]));
+        }
+        delete m_receivers[i];
+    }
+    m_receivers.clear();
+    m_next_receiver = 0;
+}
+
+bool TPEtherForwarder::can_take_block() const
+{
+    // copy: every receiver must have room, roundrobin: one of them
+    bool any_room = m_receivers.empty();
+    for (unsigned int i = 0; i < m_receivers.size(); i++) {
+        bool room = m_receivers[i]->sender.pending() < m_max_queue_blocks;
+        if (!room && !m_round_robin) {
+            return false;
+        }
+        any_room = any_room || room;
+    }
+    return any_room;
+}
+
+ForwardBlock* TPEtherForwarder::get_block()
+{
+    if (m_free_blocks.empty()) {
+        return new ForwardBlock();
+    }
+    ForwardBlock* block = m_free_blocks.back();
+    m_free_blocks.pop_back();
+    return block;
+}
+
+void TPEtherForwarder::release_block(ForwardBlock* block)
+{
+    if (--block->refs > 0) {
+        return;
+    }
+    m_in_data.data.freebuf(block->buf);
+    block->buf = 0;
+    m_free_blocks.push_back(block);
+}
+
+void TPEtherForwarder::send_to(ForwardReceiver* r, ForwardBlock* block,
+                               const unsigned char* data, unsigned int size)
+{
+    block->refs++;
+    r->sender.push(data, size, block);
+    r->sender.sample_outq();
+    r->blocks++;
+}
+
+int TPEtherForwarder::forward_block()
+{
+    unsigned int block_byte_size = m_in_data.data.length();
+    unsigned int data_byte_size =
+        block_byte_size - HEADER_BYTE_SIZE - FOOTER_BYTE_SIZE;
+    m_blocks_in++;
+
+    if (m_receivers.empty()) {
+        m_unrouted++;
+        return data_byte_size;
+    }
+
+    // take the buffer out of the sequence; the next read() allocates
+    // a new one instead of copying into this one
+    ForwardBlock* block = get_block();
+    block->buf = m_in_data.data.get_buffer(1);
+    if (block->buf != 0) {
+        m_handed_over++;
+    }
+    else {
+        // the sequence does not own its buffer
+        block->buf = m_in_data.data.allocbuf(block_byte_size);
+        memcpy(block->buf, &m_in_data.data[0], block_byte_size);
+        m_copied_blocks++;
+    }
+    block->refs = 1;                      // held until the end of this call
+
+    const unsigned char* data = block->buf;
+    unsigned int size = block_byte_size;
+    if (!m_send_header_footer) {
+        data += HEADER_BYTE_SIZE;
+        size  = data_byte_size;
+    }
+
+    unsigned int n = m_receivers.size();
+    if (m_round_robin) {
+        ForwardReceiver* target = 0;
+        for (unsigned int i = 0; i < n && target == 0; i++) {
+            ForwardReceiver* r = m_receivers[(m_next_receiver + i) % n];
+            if (r->sender.pending() < m_max_queue_blocks) {
+                target = r;
+                m_next_receiver = (m_next_receiver + i + 1) % n;
+            }
+        }
+        if (target != 0) {
+            send_to(target, block, data, size);
+        }
+        else {
+            m_receivers[m_next_receiver % n]->drops++;
+            m_next_receiver = (m_next_receiver + 1) % n;
+        }
+    }
+    else {
+        for (unsigned int i = 0; i < n; i++) {
+            ForwardReceiver* r = m_receivers[i];
+            if (r->sender.pending() < m_max_queue_blocks) {
+                send_to(r, block, data, size);
+            }
+            else {
+                r->drops++;
+            }
+        }
+    }
+    release_block(block);
+
+    return data_byte_size;
+}
+
+int TPEtherForwarder::reset_InPort()
+{
+    unsigned long long flushed = 0;
+    while (m_InPort.read()) {
+        flushed++;
+    }
+    TPLOG_DEBUG("TPEtherForwarder::InPort flushed: %llu blocks", flushed);
+    return 0;
+}
+
+void TPEtherForwarder::report_stats()
+{
+    unsigned long long bytes = 0;
+    for (unsigned int i = 0; i < m_receivers.size(); i++) {
+        bytes += m_receivers[i]->sender.bytes();
+    }
+    std::cerr << "blocks: " << m_blocks_in
+              << " without receiver: " << m_unrouted
+              << " forwarded bytes: " << bytes << std::endl;
+    std::cerr << "InPort buffers taken without copy: " << m_handed_over
+              << " copied: " << m_copied_blocks << std::endl;
+    if (!m_drop_slow) {
+        std::cerr << "blocked by full receivers: " << m_blocked_waits
+                  << " waits " << m_blocked_ns/1e6 << " ms" << std::endl;
+    }
+    std::cerr << "receivers: " << m_receivers.size()
+              << " connected: " << m_connects
+              << " disconnected: " << m_disconnects << std::endl;
+    for (unsigned int i = 0; i < m_receivers.size(); i++) {
+        ForwardReceiver* r = m_receivers[i];
+        std::cerr << "receiver" << i << " " << r->sender.peer()
+                  << " blocks: " << r->blocks
+                  << " dropped: " << r->drops << std::endl;
+        r->sender.print_stats(std::cerr);
+    }
+    m_wait.print_stats(std::cerr);
+}
+
+int TPEtherForwarder::daq_run()
+{
+    service_receivers(false);
+    progress_receivers();
+
+    if (!m_drop_slow && !can_take_block()) {
+        // leave the blocks in the InPort buffer until a receiver
+        // caught up, the upstream OutPort sees the back pressure
+        if (check_trans_lock()) {  // check if stop command has come
+            set_trans_unlock();    // transit to CONFIGURED state
+            return 0;
+        }
+        unsigned long long t_start = mono_now_ns();
+        wait_receivers(1);
+        m_blocked_ns += mono_now_ns() - t_start;
+        m_blocked_waits++;
+        return 0;
+    }
+
+    unsigned long long gen = m_wait.begin_poll();
+    bool ret = m_InPort.read();
+    if (ret == false) {
+        if (check_trans_lock()) {  // check if stop command has come
+            set_trans_unlock();    // transit to CONFIGURED state
+            return 0;
+        }
+        bool unsent = false;
+        for (unsigned int i = 0; i < m_receivers.size(); i++) {
+            unsent = unsent || m_receivers[i]->sender.has_unsent();
+        }
+        if (unsent) {
+            wait_receivers(1);
+        }
+        else {
+            m_wait.idle(gen);
+        }
+        return 0;
+    }
+    m_wait.got_data();
+
+    unsigned int block_byte_size = m_in_data.data.length();
+    if (block_byte_size < HEADER_BYTE_SIZE + FOOTER_BYTE_SIZE) {
+        TPLOG_ERROR("TPEtherForwarder: short block");
+        fatal_error_report(HEADER_DATA_MISMATCH);
+    }
+    if (m_in_data.data[0] != HEADER_MAGIC ||
+        m_in_data.data[block_byte_size - FOOTER_BYTE_SIZE] != FOOTER_MAGIC) {
+        TPLOG_ERROR("TPEtherForwarder: bad header/footer magic");
+        fatal_error_report(FOOTER_DATA_MISMATCH);
+    }
+
+    unsigned int data_byte_size = forward_block();
+    progress_receivers();
+
+    inc_sequence_num();
+    inc_total_data_size(data_byte_size);
+
+    return 0;
+}
+
+extern "C"
+{
+    void TPEtherForwarderInit(RTC::Manager* manager)
+    {
+        RTC::Properties profile(tpetherforwarder_spec);
+        manager->registerFactory(profile,
+                    RTC::Create<TPEtherForwarder>,
+                    RTC::Delete<TPEtherForwarder>);
+    }
+};
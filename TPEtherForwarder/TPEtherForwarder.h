@@ -0,0 +1,126 @@
+// -*- C++ -*-
+/*!
+ * @file
+ * @brief
+ * @date
+ * @author
+ *
+ */
+
+#ifndef TPETHERFORWARDER_H
+#define TPETHERFORWARDER_H
+
+#include "DaqComponentBase.h"
+
+#include <poll.h>
+#include <unistd.h>
+#include <sstream>
+#include <vector>
+
+#include "BlockTime.h"
+#include "WaitStrategy.h"
+#include "ZeroCopySender.h"
+
+using namespace RTC;
+
+/// one InPort block, shared by the receivers it is sent to
+struct ForwardBlock {
+    CORBA::Octet* buf;                    /// taken over from the InPort
+    unsigned int refs;
+};
+
+struct ForwardReceiver {
+    ZeroCopySender sender;
+    unsigned long long blocks;
+    unsigned long long drops;             /// queue full, slowReceiverPolicy drop
+};
+
+class TPEtherForwarder
+    : public DAQMW::DaqComponentBase
+{
+public:
+    TPEtherForwarder(RTC::Manager* manager);
+    ~TPEtherForwarder();
+
+    // The initialize action (on CREATED->ALIVE transition)
+    // former rtc_init_entry()
+    virtual RTC::ReturnCode_t onInitialize();
+
+    // The execution action that is invoked periodically
+    // former rtc_active_do()
+    virtual RTC::ReturnCode_t onExecute(RTC::UniqueId ec_id);
+
+private:
+    TimedOctetSeq          m_in_data;
+    InPort<TimedOctetSeq>  m_InPort;
+
+private:
+    int daq_dummy();
+    int daq_configure();
+    int daq_unconfigure();
+    int daq_start();
+    int daq_run();
+    int daq_stop();
+    int daq_pause();
+    int daq_resume();
+
+    int parse_params(::NVList* list);
+    int open_listener();
+    void service_receivers(bool force);
+    void accept_receivers();
+    void progress_receivers();
+    int wait_receivers(int timeout_ms);
+    void drain_receivers();
+    void drop_receiver(unsigned int i, const char* reason);
+    void close_receivers();
+    bool can_take_block() const;
+    int forward_block();
+    void send_to(ForwardReceiver* r, ForwardBlock* block,
+                 const unsigned char* data, unsigned int size);
+    ForwardBlock* get_block();
+    void release_block(ForwardBlock* block);
+    int reset_InPort();
+    void report_stats();
+
+    std::vector<ForwardReceiver*> m_receivers;
+    std::vector<ForwardBlock*> m_free_blocks;
+    std::vector<struct pollfd> m_pollfds;
+    unsigned int m_next_receiver;         /// round robin
+    unsigned long long m_last_service_ns;
+
+    int m_listen_fd;
+    std::string m_listen_addr;
+    int m_listen_port;
+    bool m_round_robin;                   /// distribution roundrobin, else copy
+    bool m_drop_slow;                     /// slowReceiverPolicy drop, else block
+    unsigned int m_max_queue_blocks;
+    bool m_zerocopy;
+    unsigned int m_zc_min_bytes;
+    bool m_send_header_footer;
+    unsigned int m_stop_drain_ms;
+    unsigned int m_sndbuf_bytes;
+    unsigned int m_max_receivers;
+
+    // statistics
+    unsigned long long m_blocks_in;
+    unsigned long long m_unrouted;        /// no receiver connected
+    unsigned long long m_handed_over;     /// buffer taken without a copy
+    unsigned long long m_copied_blocks;   /// buffer could not be taken
+    unsigned long long m_blocked_ns;      /// InPort not read, receivers full
+    unsigned long long m_blocked_waits;
+    unsigned long long m_connects;
+    unsigned long long m_disconnects;
+
+    WaitStrategy m_wait;
+
+    struct timeval m_tv_start;
+    struct timeval m_tv_stop;
+};
+
+
+extern "C"
+{
+    void TPEtherForwarderInit(RTC::Manager* manager);
+};
+
+#endif // TPETHERFORWARDER_H
@@ -0,0 +1,337 @@
+// -*- C++ -*-
+/*!
+ * @file ZeroCopySender.cpp
+ * @brief Non-blocking TCP send with MSG_ZEROCOPY completion tracking.
+ * @date
+ * @author
+ *
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/errqueue.h>
+#include <linux/sockios.h>
+
+#include "ZeroCopySender.h"
+#include "AsyncLog.h"
+
+// older headers
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+
+ZeroCopySender::ZeroCopySender()
+    : m_fd(-1), m_zerocopy(false), m_zc_min_bytes(0), m_unsent(0),
+      m_next_seq(0), m_completed(0)
+{
+    reset_stats();
+}
+
+ZeroCopySender::~ZeroCopySender()
+{
+    close();
+}
+
+int ZeroCopySender::attach(int fd, bool zerocopy, unsigned int zc_min_bytes)
+{
+    close();
+    m_fd           = fd;
+    m_zc_min_bytes = zc_min_bytes;
+    m_queue.clear();
+    m_done.clear();
+    m_unsent    = 0;
+    m_next_seq  = 0;
+    m_completed = 0;
+
+    fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) | O_NONBLOCK);
+
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    char host[INET_ADDRSTRLEN] = "?";
+    if (getpeername(m_fd, (struct sockaddr*)&addr, &len) == 0 &&
+        addr.sin_family == AF_INET) {
+        inet_ntop(AF_INET, &addr.sin_addr, host, sizeof(host));
+    }
+    char peer[64];
+    snprintf(peer, sizeof(peer), "%s:%d", host, ntohs(addr.sin_port));
+    m_peer = peer;
+
+    m_zerocopy = false;
+    if (zerocopy) {
+        int on = 1;
+        if (setsockopt(m_fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) == 0) {
+            m_zerocopy = true;
+        }
+        else {
+            TPLOG_WARNING("SO_ZEROCOPY not available (%s), %s gets plain send()",
+                          strerror(errno), m_peer.c_str());
+        }
+    }
+    return 0;
+}
+
+void ZeroCopySender::close()
+{
+    if (m_fd >= 0) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+}
+
+void ZeroCopySender::abort()
+{
+    // a plain close() would go on sending the queued pages in the
+    // background, after their owner freed them
+    if (m_fd >= 0) {
+        struct linger lg;
+        lg.l_onoff  = 1;
+        lg.l_linger = 0;
+        setsockopt(m_fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+    }
+    close();
+}
+
+void ZeroCopySender::push(const unsigned char* data, unsigned int size,
+                          void* cookie)
+{
+    if (size == 0) {
+        m_done.push_back(cookie);
+        return;
+    }
+    Entry e;
+    e.data     = data;
+    e.size     = size;
+    e.sent     = 0;
+    e.zc       = m_zerocopy && size >= m_zc_min_bytes;
+    e.last_seq = 0;
+    e.cookie   = cookie;
+    m_queue.push_back(e);
+    if (m_queue.size() > m_max_pending) {
+        m_max_pending = m_queue.size();
+    }
+}
+
+int ZeroCopySender::progress()
+{
+    if (m_fd < 0) {
+        return -1;
+    }
+    if (m_completed != m_next_seq && read_completions() < 0) {
+        return -1;
+    }
+    if (send_queued() < 0) {
+        return -1;
+    }
+    collect_done();
+    return 0;
+}
+
+int ZeroCopySender::send_queued()
+{
+    while (m_unsent < m_queue.size()) {
+        Entry& e = m_queue[m_unsent];
+        int flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+        if (e.zc) {
+            flags |= MSG_ZEROCOPY;
+        }
+        ssize_t n = send(m_fd, e.data + e.sent, e.size - e.sent, flags);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == ENOBUFS && e.zc && m_completed == m_next_seq) {
+                // nothing outstanding, so no completion will free
+                // option memory: copy this one
+                e.zc = false;
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) {
+                m_eagain++;
+                return 0;
+            }
+            TPLOG_WARNING("send to %s: %s", m_peer.c_str(), strerror(errno));
+            return -1;
+        }
+        if (e.zc) {
+            e.last_seq = m_next_seq++;
+            m_zc_sends++;
+            m_zc_bytes += n;
+        }
+        m_sends++;
+        m_bytes += n;
+        e.sent  += n;
+        if (e.sent == e.size) {
+            m_unsent++;
+        }
+    }
+    return 0;
+}
+
+int ZeroCopySender::read_completions()
+{
+    for (;;) {
+        char control[128];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (recvmsg(m_fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            TPLOG_WARNING("recvmsg MSG_ERRQUEUE from %s: %s",
+                          m_peer.c_str(), strerror(errno));
+            return -1;
+        }
+
+        for (struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != 0;
+             cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!(cm->cmsg_level == SOL_IP   && cm->cmsg_type == IP_RECVERR) &&
+                !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)) {
+                continue;
+            }
+            struct sock_extended_err serr;
+            memcpy(&serr, CMSG_DATA(cm), sizeof(serr));
+            if (serr.ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr.ee_errno != 0) {
+                continue;
+            }
+            // [ee_info, ee_data] are done
+            unsigned int n = serr.ee_data - serr.ee_info + 1;
+            m_completions += n;
+            if (serr.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                m_copied += n;
+            }
+            if ((int)(serr.ee_data + 1 - m_completed) > 0) {
+                m_completed = serr.ee_data + 1;
+            }
+        }
+    }
+}
+
+void ZeroCopySender::collect_done()
+{
+    while (m_unsent > 0) {
+        const Entry& e = m_queue.front();
+        if (e.zc && (int)(e.last_seq - m_completed) >= 0) {
+            break;             // the kernel may still read it
+        }
+        m_done.push_back(e.cookie);
+        m_queue.pop_front();
+        m_unsent--;
+    }
+}
+
+void* ZeroCopySender::pop_done()
+{
+    if (m_done.empty()) {
+        return 0;
+    }
+    void* cookie = m_done.back();
+    m_done.pop_back();
+    return cookie;
+}
+
+void ZeroCopySender::take_all(std::vector<void*>& cookies)
+{
+    for (unsigned int i = 0; i < m_queue.size(); i++) {
+        cookies.push_back(m_queue[i].cookie);
+    }
+    cookies.insert(cookies.end(), m_done.begin(), m_done.end());
+    m_queue.clear();
+    m_done.clear();
+    m_unsent = 0;
+}
+
+bool ZeroCopySender::peer_closed()
+{
+    // a receiver is not expected to send; whatever it sends is dropped
+    char buf[256];
+    for (;;) {
+        ssize_t n = recv(m_fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (n > 0) {
+            continue;
+        }
+        if (n == 0) {
+            return true;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        return errno != EAGAIN && errno != EWOULDBLOCK;
+    }
+}
+
+short ZeroCopySender::poll_events() const
+{
+    // POLLERR (completions in the error queue) is always reported
+    return has_unsent() ? (POLLIN | POLLOUT) : POLLIN;
+}
+
+int ZeroCopySender::sample_outq()
+{
+    int outq = 0;
+    if (ioctl(m_fd, SIOCOUTQ, &outq) < 0) {
+        return -1;
+    }
+    if ((unsigned int)outq > m_max_outq) {
+        m_max_outq = outq;
+    }
+    m_outq_sum += outq;
+    m_outq_samples++;
+    return outq;
+}
+
+void ZeroCopySender::reset_stats()
+{
+    m_bytes        = 0;
+    m_sends        = 0;
+    m_zc_bytes     = 0;
+    m_zc_sends     = 0;
+    m_completions  = 0;
+    m_copied       = 0;
+    m_eagain       = 0;
+    m_max_pending  = 0;
+    m_max_outq     = 0;
+    m_outq_sum     = 0;
+    m_outq_samples = 0;
+}
+
+void ZeroCopySender::print_stats(std::ostream& os) const
+{
+    os << m_peer << " bytes: " << m_bytes
+       << " send calls: " << m_sends
+       << " socket full: " << m_eagain << std::endl;
+    if (m_zerocopy) {
+        os << m_peer << " zerocopy bytes: " << m_zc_bytes
+           << " sends: " << m_zc_sends
+           << " completions: " << m_completions
+           << " copied by kernel: " << m_copied << std::endl;
+    }
+    os << m_peer << " max_pending_blocks: " << m_max_pending
+       << " send_queue max: " << m_max_outq << " bytes";
+    if (m_outq_samples > 0) {
+        os << " avg: " << m_outq_sum/m_outq_samples << " bytes";
+    }
+    os << std::endl;
+}
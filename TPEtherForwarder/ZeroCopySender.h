@@ -0,0 +1,120 @@
+// -*- C++ -*-
+/*!
+ * @file ZeroCopySender.h
+ * @brief Non-blocking TCP send with MSG_ZEROCOPY completion tracking.
+ * @date
+ * @author
+ *
+ */
+
+#ifndef ZEROCOPYSENDER_H
+#define ZEROCOPYSENDER_H
+
+#include <deque>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/*
+ * @class ZeroCopySender
+ * @brief Queue of caller owned buffers sent on one connected socket.
+ *
+ * push() only queues the buffer; progress() sends as much as the socket
+ * takes without blocking and reads the completion notifications.  With
+ * MSG_ZEROCOPY the kernel transmits from the caller's pages, so a
+ * buffer must not be changed or freed until its cookie is returned by
+ * pop_done(), i.e. until the kernel reported that it no longer uses
+ * those pages.  Buffers smaller than zc_min_bytes are sent with a plain
+ * send() (copied into the socket buffer), for them zero copy costs more
+ * than the copy; they are done as soon as they are handed over.
+ *
+ * Every successful send() with MSG_ZEROCOPY gets the next number of a
+ * 32 bit counter; the error queue returns ranges of completed numbers,
+ * in order for TCP.  If the kernel had to copy after all (e.g. on
+ * loopback, or the device cannot do scatter-gather) the range is
+ * flagged and counted as "copied".
+ *
+ * If SO_ZEROCOPY is not supported (kernel < 4.14) all buffers are sent
+ * with plain send().
+ */
+class ZeroCopySender
+{
+public:
+    ZeroCopySender();
+    virtual ~ZeroCopySender();
+
+    /// takes over the connected socket fd
+    int  attach(int fd, bool zerocopy, unsigned int zc_min_bytes);
+    void close();
+    /// close with RST: what the kernel still holds is discarded, so the
+    /// pending buffers may be freed right after
+    void abort();
+    bool is_open() const { return m_fd >= 0; }
+    int  fd() const { return m_fd; }
+    bool zerocopy() const { return m_zerocopy; }
+    const std::string& peer() const { return m_peer; }
+
+    void push(const unsigned char* data, unsigned int size, void* cookie);
+    /// -1: connection broken or closed by the peer
+    int  progress();
+    /// a buffer no longer used, 0 if none
+    void* pop_done();
+    /// buffers queued or waiting for their completion
+    unsigned int pending() const { return m_queue.size(); }
+    bool has_unsent() const { return m_unsent < m_queue.size(); }
+    /// cookies of all buffers not done yet, for close()
+    void take_all(std::vector<void*>& cookies);
+    /// poll() events to wait for
+    short poll_events() const;
+    /// after POLLIN/POLLHUP: true if the peer closed or reset
+    bool peer_closed();
+    /// bytes in the socket send queue (SIOCOUTQ), sampled into the stats
+    int  sample_outq();
+
+    void reset_stats();
+    void print_stats(std::ostream& os) const;
+
+    unsigned long long bytes() const { return m_bytes; }
+    unsigned long long zc_bytes() const { return m_zc_bytes; }
+    unsigned long long copied() const { return m_copied; }
+    unsigned long long completions() const { return m_completions; }
+
+private:
+    struct Entry {
+        const unsigned char* data;
+        unsigned int size;
+        unsigned int sent;
+        bool zc;
+        unsigned int last_seq;            /// of the last zero copy send
+        void* cookie;
+    };
+
+    int  send_queued();
+    int  read_completions();
+    void collect_done();
+
+    int m_fd;
+    std::string m_peer;
+    bool m_zerocopy;
+    unsigned int m_zc_min_bytes;
+    std::deque<Entry> m_queue;
+    unsigned int m_unsent;                /// index of the first unsent entry
+    unsigned int m_next_seq;              /// of the next zero copy send
+    unsigned int m_completed;             /// all numbers below are done
+    std::vector<void*> m_done;
+
+    // statistics
+    unsigned long long m_bytes;
+    unsigned long long m_sends;
+    unsigned long long m_zc_bytes;
+    unsigned long long m_zc_sends;
+    unsigned long long m_completions;
+    unsigned long long m_copied;          /// zero copy sends the kernel copied
+    unsigned long long m_eagain;          /// socket buffer full
+    unsigned int m_max_pending;
+    unsigned int m_max_outq;
+    unsigned long long m_outq_sum;
+    unsigned long long m_outq_samples;
+};
+
+#endif
@@ -0,0 +1,260 @@
+// -*- C++ -*-
+/*!
+ * @file EventFramer.cpp
+ * @brief Split logged blocks into events and check the framing.
+ * @date
+ * @author
+ *
+ */
+
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "EventFramer.h"
+
+EventFramer::EventFramer()
+    : m_fixed_size(0), m_len_offset(0), m_len_bytes(0),
+      m_len_big_endian(true), m_len_adjust(0), m_magic_bytes(0),
+      m_max_event_size(0), m_hdr_need(1), m_indexing(false),
+      m_block_framing(false)
+{
+    memset(m_magic, 0, sizeof(m_magic));
+    m_events        = 0;
+    m_spanning      = 0;
+    m_errors        = 0;
+    m_skipped_bytes = 0;
+    reset();
+}
+
+EventFramer::~EventFramer()
+{
+}
+
+void EventFramer::set_fixed(unsigned int event_byte_size)
+{
+    m_fixed_size = event_byte_size;
+    m_len_bytes  = 0;
+    m_hdr_need   = m_magic_bytes > 0 ? m_magic_bytes : 1;
+}
+
+int EventFramer::set_length_field(unsigned int offset,
+                                  unsigned int field_byte_size,
+                                  bool big_endian, int adjust)
+{
+    if (field_byte_size != 1 && field_byte_size != 2 && field_byte_size != 4) {
+        return -1;
+    }
+    if (offset + field_byte_size > sizeof(m_hdr)) {
+        return -1;
+    }
+    m_fixed_size     = 0;
+    m_len_offset     = offset;
+    m_len_bytes      = field_byte_size;
+    m_len_big_endian = big_endian;
+    m_len_adjust     = adjust;
+    m_hdr_need       = offset + field_byte_size;
+    if (m_magic_bytes > m_hdr_need) {
+        m_hdr_need = m_magic_bytes;
+    }
+    return 0;
+}
+
+int EventFramer::set_magic(unsigned int magic, unsigned int byte_size)
+{
+    if (byte_size > 4) {
+        return -1;
+    }
+    m_magic_bytes = byte_size;
+    for (unsigned int i = 0; i < byte_size; i++) {
+        m_magic[i] = (magic >> (8*(byte_size - 1 - i))) & 0xff;
+    }
+    if (m_magic_bytes > m_hdr_need) {
+        m_hdr_need = m_magic_bytes;
+    }
+    return 0;
+}
+
+void EventFramer::reset()
+{
+    m_hdr_len      = 0;
+    m_event_size   = 0;
+    m_remaining    = 0;
+    m_start_offset = 0;
+    m_start_branch = 0;
+    m_start_block_bytes = 0;
+    m_crossed      = false;
+    m_entries.clear();
+}
+
+bool EventFramer::check_header(unsigned int& event_size)
+{
+    if (m_magic_bytes > 0 && memcmp(m_hdr, m_magic, m_magic_bytes) != 0) {
+        return false;
+    }
+
+    if (m_fixed_size > 0) {
+        event_size = m_fixed_size;
+    }
+    else {
+        const unsigned char* f = &m_hdr[m_len_offset];
+        unsigned long long len = 0;
+        for (unsigned int i = 0; i < m_len_bytes; i++) {
+            unsigned int k = m_len_big_endian ? i : m_len_bytes - 1 - i;
+            len = (len << 8) | f[k];
+        }
+        long long size = (long long)len + m_len_adjust;
+        if (size <= 0 || size > 0xffffffffLL) {
+            return false;
+        }
+        event_size = size;
+    }
+
+    if (event_size < m_hdr_need) {
+        return false;
+    }
+    if (m_max_event_size > 0 && event_size > m_max_event_size) {
+        return false;
+    }
+    return true;
+}
+
+const unsigned char* EventFramer::find_magic(const unsigned char* p,
+                                             const unsigned char* end) const
+{
+#ifdef __SSE2__
+    // candidates: first two magic bytes match, 16 positions at a time
+    if (m_magic_bytes >= 2) {
+        const __m128i m0 = _mm_set1_epi8((char)m_magic[0]);
+        const __m128i m1 = _mm_set1_epi8((char)m_magic[1]);
+        while (end - p >= 17) {
+            __m128i b0 = _mm_loadu_si128((const __m128i*)p);
+            __m128i b1 = _mm_loadu_si128((const __m128i*)(p + 1));
+            unsigned int mask = _mm_movemask_epi8(
+                _mm_and_si128(_mm_cmpeq_epi8(b0, m0), _mm_cmpeq_epi8(b1, m1)));
+            while (mask != 0) {
+                const unsigned char* q = p + __builtin_ctz(mask);
+                if (q + m_magic_bytes > end ||
+                    memcmp(q, m_magic, m_magic_bytes) == 0) {
+                    return q;
+                }
+                mask &= mask - 1;
+            }
+            p += 16;
+        }
+    }
+#endif
+    for (; p < end; p++) {
+        unsigned int n = m_magic_bytes;
+        if (p + n > end) {
+            n = end - p;   // a magic word may continue in the next block
+        }
+        if (memcmp(p, m_magic, n) == 0) {
+            return p;
+        }
+    }
+    return end;
+}
+
+void EventFramer::end_event()
+{
+    if (m_indexing) {
+        EventIndexEntry e;
+        e.offset    = m_start_offset;
+        e.branch_no = m_start_branch;
+        e.byte_size = m_event_size;
+        e.block_bytes = m_start_block_bytes;
+        e.reserved  = 0;
+        m_entries.push_back(e);
+    }
+    m_events++;
+    if (m_crossed) {
+        m_spanning++;
+        m_crossed = false;
+    }
+    m_hdr_len = 0;
+}
+
+unsigned int EventFramer::feed(const unsigned char* data, unsigned int size,
+                               unsigned long long file_offset,
+                               unsigned int branch_no)
+{
+    const unsigned char* p   = data;
+    const unsigned char* end = data + size;
+    const unsigned char* hdr_start = 0;   // 0: header began in an earlier block
+    unsigned int errors = 0;
+
+    if (m_hdr_len > 0 || m_remaining > 0) {
+        m_crossed = true;
+    }
+
+    while (p < end) {
+        if (m_remaining > 0) {
+            unsigned long long n = end - p;
+            if (n > m_remaining) {
+                n = m_remaining;
+            }
+            p += n;
+            m_remaining -= n;
+            if (m_remaining == 0) {
+                end_event();
+            }
+            continue;
+        }
+
+        if (m_hdr_len == 0) {
+            m_start_offset = file_offset + (p - data);
+            m_start_branch = branch_no;
+            m_start_block_bytes = m_block_framing ? end - p : 0;
+            hdr_start = p;
+        }
+        unsigned int n = m_hdr_need - m_hdr_len;
+        if ((unsigned int)(end - p) < n) {
+            n = end - p;
+        }
+        memcpy(&m_hdr[m_hdr_len], p, n);
+        m_hdr_len += n;
+        p += n;
+        if (m_hdr_len < m_hdr_need) {
+            break;      // the rest comes with the next block
+        }
+
+        unsigned int event_size;
+        if (!check_header(event_size)) {
+            errors++;
+            m_errors++;
+            m_hdr_len = 0;
+            m_crossed = false;
+            const unsigned char* from = hdr_start ? hdr_start : data;
+            if (m_magic_bytes == 0) {
+                m_skipped_bytes += end - from;
+                break;
+            }
+            p = find_magic(hdr_start ? hdr_start + 1 : data, end);
+            m_skipped_bytes += p - from;
+            hdr_start = 0;
+            continue;
+        }
+
+        m_event_size = event_size;
+        m_remaining  = event_size - m_hdr_need;
+        if (m_remaining == 0) {
+            end_event();
+        }
+    }
+
+    return errors;
+}
+
+void EventFramer::print_stats(std::ostream& os) const
+{
+    os << "event_framing events: " << m_events
+       << " spanning: " << m_spanning
+       << " errors: " << m_errors
+       << " skipped_bytes: " << m_skipped_bytes << std::endl;
+    if (m_hdr_len > 0 || m_remaining > 0) {
+        os << "event_framing: incomplete event at end of run" << std::endl;
+    }
+}
@@ -0,0 +1,107 @@
+// -*- C++ -*-
+/*!
+ * @file EventFramer.h
+ * @brief Split logged blocks into events and check the framing.
+ * @date
+ * @author
+ *
+ */
+
+#ifndef EVENTFRAMER_H
+#define EVENTFRAMER_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "EventIndex.h"
+
+/*
+ * Events are either of fixed size (eventByteSize) or carry their
+ * length in a field at a fixed offset from the event start:
+ *
+ *   event size = length field + length adjust
+ *
+ * Optionally every event starts with a magic word (1..4 bytes, most
+ * significant byte first in the stream).  Events may span block
+ * boundaries; the part of an event header which arrived with the
+ * previous block is kept until the rest arrives.
+ *
+ * If an event header is broken (wrong magic, impossible length) the
+ * framer counts an error and searches for the next magic word in the
+ * block with a vectorized scan.  Without a magic word there is no way
+ * to find the next event, so framing restarts at the next block.
+ *
+ * For every complete event an EventIndexEntry is appended to entries()
+ * if indexing is enabled; the caller drains them.
+ */
+class EventFramer
+{
+public:
+    EventFramer();
+    virtual ~EventFramer();
+
+    void set_fixed(unsigned int event_byte_size);
+    /// field_byte_size: 1, 2 or 4
+    int  set_length_field(unsigned int offset, unsigned int field_byte_size,
+                          bool big_endian, int adjust);
+    /// byte_size 0: no magic word
+    int  set_magic(unsigned int magic, unsigned int byte_size);
+    void set_max_event_size(unsigned int max) { m_max_event_size = max; }
+    void set_indexing(bool on) { m_indexing = on; }
+    /// the file keeps a header and footer around each block
+    void set_block_framing(bool on) { m_block_framing = on; }
+    bool configured() const { return m_fixed_size > 0 || m_len_bytes > 0; }
+
+    /// forget a partial event (start of run)
+    void reset();
+
+    /// data: block payload, file_offset/branch_no: where it is stored.
+    /// returns the number of framing errors found in this block.
+    unsigned int feed(const unsigned char* data, unsigned int size,
+                      unsigned long long file_offset, unsigned int branch_no);
+
+    std::vector<EventIndexEntry>& entries() { return m_entries; }
+
+    unsigned long long events() const { return m_events; }
+    unsigned long long errors() const { return m_errors; }
+    void print_stats(std::ostream& os) const;
+
+private:
+    bool check_header(unsigned int& event_size);
+    const unsigned char* find_magic(const unsigned char* p,
+                                    const unsigned char* end) const;
+    void end_event();
+
+    /// configuration
+    unsigned int m_fixed_size;           /// 0: length field mode
+    unsigned int m_len_offset;
+    unsigned int m_len_bytes;
+    bool m_len_big_endian;
+    int m_len_adjust;
+    unsigned char m_magic[4];
+    unsigned int m_magic_bytes;
+    unsigned int m_max_event_size;
+    unsigned int m_hdr_need;             /// bytes needed to check an event
+    bool m_indexing;
+    bool m_block_framing;
+
+    /// current event
+    unsigned char m_hdr[8];
+    unsigned int m_hdr_len;
+    unsigned int m_event_size;
+    unsigned long long m_remaining;      /// bytes after the header
+    unsigned long long m_start_offset;
+    unsigned int m_start_branch;
+    unsigned int m_start_block_bytes;    /// rest of the block at the start
+    bool m_crossed;                      /// began in an earlier block
+
+    std::vector<EventIndexEntry> m_entries;
+
+    unsigned long long m_events;
+    unsigned long long m_spanning;       /// events across block boundaries
+    unsigned long long m_errors;
+    unsigned long long m_skipped_bytes;  /// dropped while resynchronizing
+};
+
+#endif
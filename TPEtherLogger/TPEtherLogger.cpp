@@ -14,11 +14,16 @@
  */
 
 #include "TPEtherLogger.h"
+#include "Crc32c.h"
 
 // Possible fatal errors for this component
 using DAQMW::FatalType::BAD_DIR;
 using DAQMW::FatalType::CANNOT_OPEN_FILE;
 using DAQMW::FatalType::CANNOT_WRITE_DATA;
+using DAQMW::FatalType::HEADER_DATA_MISMATCH;
+using DAQMW::FatalType::FOOTER_DATA_MISMATCH;
+using DAQMW::FatalType::SEQUENCE_NUM_MISMATCH;
+using DAQMW::FatalType::USER_DEFINED_ERROR1;
 
 // Module specification
 static const char* mylogger_spec[] = {
@@ -42,10 +47,46 @@ TPEtherLogger::TPEtherLogger(RTC::Manager* manager)
       m_filesOpened(false),
       m_in_status(BUF_SUCCESS),
       m_update_rate(100),
-      m_debug(false)
+      m_sequenceCheck(true),
+      m_saveHeaderFooter(false),
+      m_lat_report_interval_ns(10ULL*1000000000ULL),
+      m_lat_last_report_ns(0),
+      m_in_empty_reads(0),
+      m_in_empty_since(0),
+      m_port_report_ns(0),
+      m_port_last_report_ns(0),
+      m_last_block_byte_size(0),
+      m_check_block(&TPEtherLogger::check_block),
+      m_check_block_size(0),
+      m_tap_name("/tpetherlogger_tap"),
+      m_tap_slots(16),
+      m_tap_slot_size(1024*1024),
+      m_perf_enabled(false),
+      m_framing_mode("none"),
+      m_event_byte_size(0),
+      m_ev_len_offset(0),
+      m_ev_len_byte_size(0),
+      m_ev_len_big_endian(true),
+      m_ev_len_adjust(0),
+      m_ev_magic(0),
+      m_ev_magic_byte_size(0),
+      m_ev_max_byte_size(0),
+      m_ev_index(true),
+      m_ev_fatal(false),
+      m_stop_drain_ns(1000ULL*1000000ULL),
+      m_coalesced(false),
+      m_sub_seq(0),
+      m_sub_blocks(0),
+      m_checksum(false),
+      m_extent_store(""),
+      m_trace(false),
+      m_trace_dir("/tmp"),
+      m_trace_mb(64),
+      m_run_no(0)
 {
     // Registration: InPort/OutPort/Service
     registerInPort("tpetherlogger_in", m_InPort);
+    m_InPort.addConnectorDataListener(ON_BUFFER_WRITE, m_wait.notifier());
 
     init_command_port();
     init_state_table();
@@ -58,9 +99,7 @@ TPEtherLogger::~TPEtherLogger()
 
 RTC::ReturnCode_t TPEtherLogger::onInitialize()
 {
-    if (m_debug) {
-        std::cerr << "TPEtherLogger::onInitialize()" << std::endl;
-    }
+    TPLOG_DEBUG("TPEtherLogger::onInitialize()");
 
     return RTC::RTC_OK;
 }
@@ -80,12 +119,37 @@ int TPEtherLogger::daq_dummy()
 int TPEtherLogger::daq_configure()
 {
     std::cerr << "*** TPEtherLogger::configure" << std::endl;
+    unsigned long long t_configure = mono_now_ns();
     int ret = 0;
     m_isDataLogging = false;
 
     ::NVList* list = m_daq_service0.getCompParams();
     parse_params(list);
 
+    if (configure_framing() < 0) {
+        fatal_error_report(USER_DEFINED_ERROR1, "BAD EVENT FRAMING");
+    }
+
+    if (m_tap.enabled()) {
+        if (m_tap.open(m_tap_name, m_tap_slots, m_tap_slot_size) < 0) {
+            std::cerr << "### WARNING: TPEtherLogger: cannot open sample tap "
+                      << m_tap_name << std::endl;
+        }
+        else {
+            std::cerr << "TPEtherLogger: sample tap: " << m_tap_name
+                      << std::endl;
+        }
+    }
+
+    if (m_trace) {
+        Trace::enable(m_trace_mb*1024ULL*1024ULL);
+        Trace::set_thread_name("TPEtherLogger");
+        Trace::complete("configure", t_configure, mono_now_ns());
+    }
+    else {
+        Trace::enable(0);
+    }
+
     return ret;
 }
 
@@ -98,15 +162,13 @@ int TPEtherLogger::parse_params(::NVList* list)
 
     int length = (*list).length();
     for (int i = 0; i < length; i += 2) {
-        if (m_debug) {
-            std::cerr << "NVList[" << (*list)[i].name
-                      << "," << (*list)[i].value << "]" << std::endl;
-        }
         std::string sname  = (std::string)(*list)[i].value;
         std::string svalue = (std::string)(*list)[i + 1].value;
+        TPLOG_DEBUG("param %s: %s", sname.c_str(), svalue.c_str());
         if (sname == "eventByteSize") {
             unsigned int eventByteSize = atoi(svalue.c_str());
             set_event_byte_size(eventByteSize);
+            m_event_byte_size = eventByteSize;
             std::cerr << "ventByteSize:"
                       << eventByteSize << std::endl;
         }
@@ -128,20 +190,149 @@ int TPEtherLogger::parse_params(::NVList* list)
 
         if (sname == "monRate") {
             m_update_rate = atoi(svalue.c_str());
-            if (m_debug) {
-                std::cerr << "update rate:" << m_update_rate << std::endl;
+            TPLOG_DEBUG("update rate:%d", m_update_rate);
+        }
+
+        if (sname == "sequenceCheck") {
+            toLower(svalue);
+            m_sequenceCheck = (svalue != "no");
+            std::cerr << "TPEtherLogger: sequence check: "
+                      << (m_sequenceCheck ? "true" : "false") << std::endl;
+        }
+        if (sname == "saveHeaderFooter") {
+            toLower(svalue);
+            m_saveHeaderFooter = (svalue == "yes");
+            std::cerr << "TPEtherLogger: save header/footer: "
+                      << (m_saveHeaderFooter ? "true" : "false") << std::endl;
+        }
+
+        if (sname == "eventFraming") {
+            toLower(svalue);
+            m_framing_mode = svalue;
+        }
+        if (sname == "eventLengthOffset") {
+            m_ev_len_offset = strtoul(svalue.c_str(), NULL, 0);
+        }
+        if (sname == "eventLengthByteSize") {
+            m_ev_len_byte_size = strtoul(svalue.c_str(), NULL, 0);
+        }
+        if (sname == "eventLengthByteOrder") {
+            toLower(svalue);
+            m_ev_len_big_endian = (svalue != "little");
+        }
+        if (sname == "eventLengthAdjust") {
+            m_ev_len_adjust = strtol(svalue.c_str(), NULL, 0);
+        }
+        if (sname == "eventMagic") {
+            m_ev_magic = strtoul(svalue.c_str(), NULL, 0);
+        }
+        if (sname == "eventMagicByteSize") {
+            m_ev_magic_byte_size = strtoul(svalue.c_str(), NULL, 0);
+        }
+        if (sname == "eventMaxByteSize") {
+            m_ev_max_byte_size = strtoul(svalue.c_str(), NULL, 0);
+        }
+        if (sname == "eventIndex") {
+            toLower(svalue);
+            m_ev_index = (svalue != "no");
+        }
+        if (sname == "eventFramingFatal") {
+            toLower(svalue);
+            m_ev_fatal = (svalue == "yes");
+        }
+
+        if (sname == "logLevel") {
+            toLower(svalue);
+            if (AsyncLog::set_level(svalue) < 0) {
+                std::cerr << "### ERROR: unknown logLevel: " << svalue
+                          << std::endl;
+                fatal_error_report(USER_DEFINED_ERROR1, "BAD LOGLEVEL");
             }
         }
+
+        if (sname == "checksum") {
+            toLower(svalue);
+            m_checksum = (svalue == "yes");
+        }
+
+        if (sname == "coalesced") {
+            toLower(svalue);
+            m_coalesced = (svalue == "yes");
+        }
+
+        if (sname == "extentStore") {
+            m_extent_store = svalue;
+        }
+
+        if (sname == "trace") {
+            toLower(svalue);
+            m_trace = (svalue == "yes");
+        }
+        if (sname == "traceDir") {
+            m_trace_dir = svalue;
+        }
+        if (sname == "traceBufferMB") {
+            m_trace_mb = strtoul(svalue.c_str(), NULL, 0);
+        }
+
+        if (sname == "stopDrainMs") {
+            m_stop_drain_ns = strtoull(svalue.c_str(), NULL, 0)*1000000ULL;
+        }
+
+        if (sname == "perfCounters") {
+            toLower(svalue);
+            m_perf_enabled = (svalue == "yes");
+        }
+
+        if (sname == "tapEveryNBlocks") {
+            m_tap.set_every_n(strtoul(svalue.c_str(), NULL, 0));
+        }
+        if (sname == "tapIntervalMs") {
+            m_tap.set_interval_ms(strtoul(svalue.c_str(), NULL, 0));
+        }
+        if (sname == "tapShmName") {
+            m_tap_name = svalue;
+        }
+        if (sname == "tapSlots") {
+            m_tap_slots = strtoul(svalue.c_str(), NULL, 0);
+        }
+        if (sname == "tapSlotSizeKB") {
+            m_tap_slot_size = strtoul(svalue.c_str(), NULL, 0)*1024;
+        }
+
+        if (sname == "waitStrategy") {
+            toLower(svalue);
+            if (m_wait.set_mode(svalue) < 0) {
+                std::cerr << "### WARNING: unknown waitStrategy: " << svalue
+                          << ", use spin" << std::endl;
+                m_wait.set_mode("spin");
+            }
+            std::cerr << "wait strategy:" << m_wait.mode_name() << std::endl;
+        }
+        if (sname == "waitSpinCount") {
+            m_wait.set_spin_count(strtoul(svalue.c_str(), NULL, 0));
+        }
+        if (sname == "waitTimeoutUs") {
+            m_wait.set_timeout_us(strtoul(svalue.c_str(), NULL, 0));
+        }
+
+        if (sname == "latencyReportSec") {
+            m_lat_report_interval_ns =
+                strtoull(svalue.c_str(), NULL, 0)*1000000000ULL;
+            std::cerr << "latency report interval(sec):"
+                      << svalue << std::endl;
+        }
+        if (sname == "portStatsReportSec") {
+            m_port_report_ns =
+                strtoull(svalue.c_str(), NULL, 0)*1000000000ULL;
+        }
     }
 
     if (m_isDataLogging) {
         for (int i = 0; i < length ; i += 2) {
-            if (m_debug) {
-                std::cerr << "NVList[" << (*list)[i].name
-                          << "," << (*list)[i].value << "]" << std::endl;
-            }
             std::string sname  = (std::string)(*list)[i].value;
             std::string svalue = (std::string)(*list)[i + 1].value;
+            TPLOG_DEBUG("param %s: %s", sname.c_str(), svalue.c_str());
 
             if (sname == "dirName") {
                 isExistParamDirName = true;
@@ -179,36 +370,37 @@ int TPEtherLogger::parse_params(::NVList* list)
 
 int TPEtherLogger::daq_unconfigure()
 {
+    AsyncLog::flush();
     std::cerr << "*** TPEtherLogger::unconfigure" << std::endl;
     if (m_isDataLogging) {
         delete fileUtils;
-        if (m_debug) {
-            std::cerr << "fileUtils deleted\n";
-        }
+        TPLOG_DEBUG("fileUtils deleted");
         fileUtils = 0;
     }
+    m_tap.close();
     return 0;
 }
 
 int TPEtherLogger::daq_start()
 {
     std::cerr << "*** TPEtherLogger::start" << std::endl;
+    unsigned long long t_start = mono_now_ns();
 
     m_in_status = BUF_SUCCESS;
     m_filesOpened = false;
     unsigned int runNumber = m_daq_service0.getRunNo();
-    if (m_debug) {
-        std::cerr << "runNumber:" << runNumber << std::endl;
-    }
+    m_run_no = runNumber;
+    TPLOG_DEBUG("runNumber:%u", runNumber);
     if (m_isDataLogging) {
         int ret = 0;
         fileUtils->set_run_no(runNumber);
-        if (m_debug) {
-            std::cerr << "m_maxFileSizeInMByte:"
-                      << m_maxFileSizeInMByte << std::endl;
-        }
+        TPLOG_DEBUG("m_maxFileSizeInMByte:%u", m_maxFileSizeInMByte);
         fileUtils->set_max_size_in_megaBytes(m_maxFileSizeInMByte);
-        ret = fileUtils->open_file(m_dirName);
+        fileUtils->set_checksum(m_checksum);
+        ret = fileUtils->set_extent_store(m_extent_store);
+        if (ret == 0) {
+            ret = fileUtils->open_file(m_dirName);
+        }
         if (ret < 0) {
             std::cerr << "### ERROR: TPEtherLogger: open file failed\n";
             fatal_error_report(CANNOT_OPEN_FILE);
@@ -218,21 +410,64 @@ int TPEtherLogger::daq_start()
             m_filesOpened = true;
         }
     }
-    
+
+    m_framer.reset();
+    m_sub_seq    = 0;
+    m_sub_blocks = 0;
+    if (m_filesOpened && m_framer.configured() && m_ev_index) {
+        open_event_index(runNumber);
+    }
+
+    m_lat_transport.reset();
+    m_lat_write.reset();
+    m_lat_persist.reset();
+    m_lat_transport_run.reset();
+    m_lat_write_run.reset();
+    m_lat_persist_run.reset();
+    m_lat_last_report_ns = mono_now_ns();
+
+    m_in_stats.reset();
+    m_in_stats_run.reset();
+    m_in_empty_reads = 0;
+    m_in_empty_since = 0;
+    m_port_last_report_ns = mono_now_ns();
+
+    m_wait.reset_stats();
+    getrusage(RUSAGE_THREAD, &m_ru_thread_start);
+    getrusage(RUSAGE_SELF, &m_ru_self_start);
+
+    if (m_perf_enabled) {
+        m_perf.open();
+        m_perf.start();
+    }
+
     gettimeofday(&m_tv_start, NULL);
+    Trace::complete("start", t_start, mono_now_ns());
+    std::cerr << "start_latency: " << (mono_now_ns() - t_start)/1e6 << " ms"
+              << std::endl;
     return 0;
 }
 
 int TPEtherLogger::daq_stop()
 {
+    AsyncLog::flush();     // messages of the run before the report
     std::cerr << "*** TPEtherLogger::stop" << std::endl;
+    unsigned long long t_stop = mono_now_ns();
+
+    if (m_perf_enabled) {
+        m_perf.stop();
+    }
 
     if (m_isDataLogging && m_filesOpened) {
-        if (m_debug) {
-            std::cerr << "TPEtherLogger::stop: close files \n";
-        }
+        TPLOG_DEBUG("TPEtherLogger::stop: close files");
+        TraceScope trace("close file");
         fileUtils->close_file();
+        if (m_checksum) {
+            std::cerr << "checksum manifest (crc32c " << crc32c_impl() << "): "
+                      << fileUtils->get_manifest_path() << std::endl;
+        }
     }
+    close_event_index();
 
     reset_InPort();
 
@@ -243,38 +478,105 @@ int TPEtherLogger::daq_stop()
     unsigned long long total_byte_size = get_total_byte_size();
     double transfer_rate = total_byte_size / elapsed_sec / 1024.0 / 1024.0;
     std::cerr << "transfer_rate: " << transfer_rate << " MB/s" << std::endl;
+    if (m_perf_enabled) {
+        m_perf.print(std::cerr, get_sequence_num(), get_total_byte_size());
+        m_perf.close();
+    }
+
+    report_latency(true);
+    report_port_stats(true);
+    report_cpu_usage(total_byte_size);
+    if (m_tap.is_open()) {
+        std::cerr << "tap published: " << m_tap.published() << std::endl;
+    }
+    if (m_framer.configured()) {
+        m_framer.print_stats(std::cerr);
+    }
+    if (m_coalesced) {
+        std::cerr << "sub-blocks: " << m_sub_blocks;
+        if (get_sequence_num() > 0) {
+            std::cerr << " sub-blocks/block: "
+                      << (double)m_sub_blocks/get_sequence_num();
+        }
+        std::cerr << std::endl;
+    }
 
+    Trace::complete("stop", t_stop, mono_now_ns());
+    std::cerr << "stop_latency: " << (mono_now_ns() - t_stop)/1e6 << " ms"
+              << std::endl;
+
+    if (m_trace) {
+        export_trace(m_run_no);    // not part of the stop latency
+    }
     return 0;
 }
 
 int TPEtherLogger::daq_pause()
 {
+    AsyncLog::flush();
     std::cerr << "*** TPEtherLogger::pause" << std::endl;
+    Trace::instant("pause");
     return 0;
 }
 
 int TPEtherLogger::daq_resume()
 {
     std::cerr << "*** TPEtherLogger::resume" << std::endl;
+    Trace::instant("resume");
     return 0;
 }
 
 int TPEtherLogger::reset_InPort()
 {
-    bool ret = true;
-    while (ret) {
-        ret = m_InPort.read();
-        if (ret == true) {
-            std::cerr << "m_in_data.data.length(): "
-                      << m_in_data.data.length() << std::endl;
+    // Blocks still queued after stop are discarded.  Bounded in time,
+    // so that a source that keeps sending cannot hold up the stop.
+    TraceScope trace("InPort drain");
+    unsigned long long t_start = mono_now_ns();
+    unsigned long long blocks = 0;
+    unsigned long long bytes  = 0;
+    bool timed_out = false;
+    while (m_InPort.read()) {
+        blocks++;
+        bytes += m_in_data.data.length();
+        if ((blocks & 63) == 0 && mono_now_ns() - t_start >= m_stop_drain_ns) {
+            timed_out = true;
+            break;
         }
     }
-    if (m_debug) {
-        std::cerr << "*** TPEtherLogger::InPort flushed\n";
+    if (blocks > 0 || AsyncLog::enabled(AsyncLog::LEVEL_DEBUG)) {
+        std::cerr << "InPort flushed: " << blocks << " blocks "
+                  << bytes << " bytes in "
+                  << (mono_now_ns() - t_start)/1e6 << " ms" << std::endl;
     }
+    if (timed_out) {
+        std::cerr << "### WARNING: InPort not empty after stopDrainMs"
+                  << std::endl;
+    }
+
     return 0;
 }
 
+void TPEtherLogger::export_trace(unsigned int run_no)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "/TPEtherLogger_%06u_%d.json",
+             run_no, (int)getpid());
+    std::string path = m_trace_dir + name;
+
+    unsigned long long t_export = mono_now_ns();
+    long long events = Trace::export_json(path, "TPEtherLogger");
+    if (events < 0) {
+        std::cerr << "### WARNING: cannot write trace " << path << std::endl;
+    }
+    else {
+        std::cerr << "trace: " << events << " events ("
+                  << Trace::overwritten() << " overwritten) to " << path
+                  << " in " << (mono_now_ns() - t_export)/1e6 << " ms"
+                  << std::endl;
+    }
+    Trace::clear();
+}
+
 void TPEtherLogger::toLower(std::basic_string<char>& s)
 {
     for (std::basic_string<char>::iterator p = s.begin(); p != s.end(); ++p) {
@@ -282,60 +584,494 @@ void TPEtherLogger::toLower(std::basic_string<char>& s)
     }
 }
 
+void TPEtherLogger::report_port_stats(bool run_total)
+{
+    m_in_stats_run.merge(m_in_stats);
+    if (run_total) {
+        m_in_stats_run.print(std::cerr, "InPort");
+    }
+    else if (AsyncLog::enabled(AsyncLog::LEVEL_INFO)) {
+        std::ostringstream os;
+        os << "port stats (interval)" << std::endl;
+        m_in_stats.print(os, "InPort");
+        AsyncLog::log_lines(AsyncLog::LEVEL_INFO, os.str());
+    }
+    m_in_stats.reset();
+}
+
+void TPEtherLogger::report_latency(bool run_total)
+{
+    m_lat_transport_run.merge(m_lat_transport);
+    m_lat_write_run.merge(m_lat_write);
+    m_lat_persist_run.merge(m_lat_persist);
+
+    if (run_total) {
+        std::cerr << "latency (run total) block_byte_size: "
+                  << m_last_block_byte_size << std::endl;
+        m_lat_transport_run.print(std::cerr, "latency_transport");
+        if (m_isDataLogging) {
+            m_lat_write_run.print(std::cerr, "latency_write");
+            m_lat_persist_run.print(std::cerr, "latency_persist");
+        }
+    }
+    else if (AsyncLog::enabled(AsyncLog::LEVEL_INFO)) {
+        // called from daq_run(): formatted here, written by the flusher
+        std::ostringstream os;
+        os << "latency (interval) block_byte_size: "
+           << m_last_block_byte_size << std::endl;
+        m_lat_transport.print(os, "latency_transport");
+        if (m_isDataLogging) {
+            m_lat_write.print(os, "latency_write");
+            m_lat_persist.print(os, "latency_persist");
+        }
+        AsyncLog::log_lines(AsyncLog::LEVEL_INFO, os.str());
+    }
+
+    m_lat_transport.reset();
+    m_lat_write.reset();
+    m_lat_persist.reset();
+}
+
+bool TPEtherLogger::check_magic(unsigned int block_byte_size)
+{
+    unsigned char* header = &m_in_data.data[0];
+    unsigned char* footer = &m_in_data.data[block_byte_size - FOOTER_BYTE_SIZE];
+
+    if (header[0] != HEADER_MAGIC || header[1] != HEADER_MAGIC) {
+        TPLOG_ERROR("TPEtherLogger: bad header magic");
+        fatal_error_report(HEADER_DATA_MISMATCH);
+        return false;
+    }
+    if (footer[0] != FOOTER_MAGIC || footer[1] != FOOTER_MAGIC) {
+        TPLOG_ERROR("TPEtherLogger: bad footer magic");
+        fatal_error_report(FOOTER_DATA_MISMATCH);
+        return false;
+    }
+    return true;
+}
+
+bool TPEtherLogger::check_block(unsigned int block_byte_size)
+{
+    if (m_sequenceCheck) {
+        return check_header_footer(m_in_data, block_byte_size);
+    }
+    // Fan-out from TPEtherReader: this logger gets only a part of
+    // the sequence, so check the magic words only.
+    return check_magic(block_byte_size);
+}
+
+/// check_block() for blocks of N data bytes: header and footer are
+/// compared as one word each; anything else goes to check_block(),
+/// which also reports what is wrong
+template <unsigned int N>
+bool TPEtherLogger::check_block_fixed(unsigned int block_byte_size)
+{
+    if (FixedBlock<N>::check(&m_in_data.data[0], block_byte_size,
+                             m_sequenceCheck,
+                             (unsigned int)get_sequence_num())) {
+        return true;
+    }
+    return check_block(block_byte_size);
+}
+
+/// The sizes of coalesced blocks vary and are not size classes anyway.
+TPEtherLogger::CheckBlockFunc
+TPEtherLogger::select_check_block(unsigned int block_byte_size) const
+{
+    if (m_coalesced) {
+        return &TPEtherLogger::check_block;
+    }
+    switch (fixed_block_class(block_byte_size
+                              - HEADER_BYTE_SIZE - FOOTER_BYTE_SIZE)) {
+    case 0:  return &TPEtherLogger::check_block_fixed<1024U <<  0>;
+    case 1:  return &TPEtherLogger::check_block_fixed<1024U <<  1>;
+    case 2:  return &TPEtherLogger::check_block_fixed<1024U <<  2>;
+    case 3:  return &TPEtherLogger::check_block_fixed<1024U <<  3>;
+    case 4:  return &TPEtherLogger::check_block_fixed<1024U <<  4>;
+    case 5:  return &TPEtherLogger::check_block_fixed<1024U <<  5>;
+    case 6:  return &TPEtherLogger::check_block_fixed<1024U <<  6>;
+    case 7:  return &TPEtherLogger::check_block_fixed<1024U <<  7>;
+    case 8:  return &TPEtherLogger::check_block_fixed<1024U <<  8>;
+    case 9:  return &TPEtherLogger::check_block_fixed<1024U <<  9>;
+    case 10: return &TPEtherLogger::check_block_fixed<1024U << 10>;
+    case 11: return &TPEtherLogger::check_block_fixed<1024U << 11>;
+    case 12: return &TPEtherLogger::check_block_fixed<1024U << 12>;
+    default: return &TPEtherLogger::check_block;
+    }
+}
+
+static double cpu_sec_diff(const struct rusage& start, const struct rusage& stop)
+{
+    struct timeval utime;
+    struct timeval stime;
+    timersub(&stop.ru_utime, &start.ru_utime, &utime);
+    timersub(&stop.ru_stime, &start.ru_stime, &stime);
+    return utime.tv_sec + 0.000001*utime.tv_usec
+         + stime.tv_sec + 0.000001*stime.tv_usec;
+}
+
+void TPEtherLogger::report_cpu_usage(unsigned long long total_byte_size)
+{
+    struct rusage ru_thread;
+    struct rusage ru_self;
+    getrusage(RUSAGE_THREAD, &ru_thread);
+    getrusage(RUSAGE_SELF, &ru_self);
+
+    double cpu_thread = cpu_sec_diff(m_ru_thread_start, ru_thread);
+    double cpu_self   = cpu_sec_diff(m_ru_self_start, ru_self);
+    double mbytes     = total_byte_size / 1024.0 / 1024.0;
+
+    std::cerr << "cpu_thread: " << cpu_thread << " s"
+              << " cpu_process: " << cpu_self << " s" << std::endl;
+    if (mbytes > 0) {
+        std::cerr << "cpu_per_MB: thread " << cpu_thread*1000.0/mbytes
+                  << " ms/MB process " << cpu_self*1000.0/mbytes
+                  << " ms/MB" << std::endl;
+    }
+    m_wait.print_stats(std::cerr);
+}
+
+int TPEtherLogger::configure_framing()
+{
+    if (m_framing_mode == "none" || m_framing_mode == "no") {
+        return 0;
+    }
+
+    if (m_framer.set_magic(m_ev_magic, m_ev_magic_byte_size) < 0) {
+        std::cerr << "### ERROR: eventMagicByteSize must be 0..4" << std::endl;
+        return -1;
+    }
+    if (m_framing_mode == "fixed") {
+        if (m_event_byte_size == 0) {
+            std::cerr << "### ERROR: eventFraming fixed needs eventByteSize"
+                      << std::endl;
+            return -1;
+        }
+        m_framer.set_fixed(m_event_byte_size);
+    }
+    else if (m_framing_mode == "length") {
+        if (m_framer.set_length_field(m_ev_len_offset, m_ev_len_byte_size,
+                                      m_ev_len_big_endian,
+                                      m_ev_len_adjust) < 0) {
+            std::cerr << "### ERROR: bad eventLengthOffset/eventLengthByteSize"
+                      << std::endl;
+            return -1;
+        }
+    }
+    else {
+        std::cerr << "### ERROR: unknown eventFraming: " << m_framing_mode
+                  << std::endl;
+        return -1;
+    }
+    m_framer.set_max_event_size(m_ev_max_byte_size);
+    m_framer.set_indexing(m_isDataLogging && m_ev_index);
+    m_framer.set_block_framing(m_saveHeaderFooter);
+
+    std::cerr << "TPEtherLogger: event framing: " << m_framing_mode
+              << " index: " << ((m_isDataLogging && m_ev_index) ? "yes" : "no")
+              << std::endl;
+    return 0;
+}
+
+void TPEtherLogger::open_event_index(unsigned int run_no)
+{
+    std::string path = fileUtils->get_file_path() + ".idx";
+    m_index_file.open(path.c_str(), std::ios::out | std::ios::binary);
+    if (!m_index_file) {
+        std::cerr << "### WARNING: TPEtherLogger: cannot open event index "
+                  << path << std::endl;
+        return;
+    }
+
+    EventIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, EVENT_INDEX_MAGIC, sizeof(header.magic));
+    header.entry_size = sizeof(EventIndexEntry);
+    header.run_no     = run_no;
+    m_index_file.write((char*)&header, sizeof(header));
+    std::cerr << "TPEtherLogger: event index: " << path << std::endl;
+}
+
+void TPEtherLogger::close_event_index()
+{
+    if (m_index_file.is_open()) {
+        m_index_file.close();
+    }
+}
+
+void TPEtherLogger::frame_events(unsigned char* data, unsigned int size)
+{
+    // where this block's payload will be in the data file
+    unsigned long long offset = 0;
+    unsigned int branch_no = 0;
+    if (m_filesOpened) {
+        offset    = fileUtils->get_file_size();
+        branch_no = fileUtils->get_branch_no();
+        if (m_saveHeaderFooter) {
+            offset += HEADER_BYTE_SIZE;
+        }
+    }
+
+    unsigned int errors = m_framer.feed(data, size, offset, branch_no);
+    if (errors > 0) {
+        // a few per second are enough to locate the problem
+        TPLOG_RATE(AsyncLog::LEVEL_ERROR, 10,
+                   "TPEtherLogger: event framing error in block %llu"
+                   " (%u in this block)", get_sequence_num(), errors);
+        if (m_ev_fatal) {
+            fatal_error_report(USER_DEFINED_ERROR1, "EVENT FRAMING ERROR");
+        }
+    }
+
+    std::vector<EventIndexEntry>& entries = m_framer.entries();
+    if (!entries.empty()) {
+        if (m_index_file.is_open()) {
+            m_index_file.write((char*)&entries[0],
+                               entries.size()*sizeof(EventIndexEntry));
+        }
+        entries.clear();
+    }
+}
+
+const SubBlockTableHeader*
+TPEtherLogger::sub_block_table(unsigned int event_byte_size)
+{
+    const SubBlockTableHeader* table =
+        (const SubBlockTableHeader*)&m_in_data.data[HEADER_BYTE_SIZE];
+    const SubBlockEntry* entries = (const SubBlockEntry*)(table + 1);
+
+    bool ok = event_byte_size >= sizeof(SubBlockTableHeader) &&
+              table->magic == SUB_BLOCK_MAGIC &&
+              table->count <= table->capacity &&
+              table->capacity <= (event_byte_size - sizeof(SubBlockTableHeader))
+                                 / sizeof(SubBlockEntry) &&
+              sub_block_table_size(table->capacity) + table->data_byte_size
+                  == event_byte_size;
+    unsigned long long sum = 0;
+    for (unsigned int i = 0; ok && i < table->count; i++) {
+        sum += entries[i].byte_size;
+    }
+    if (!ok || sum != table->data_byte_size) {
+        TPLOG_ERROR("TPEtherLogger: bad sub-block table in block %llu",
+                    get_sequence_num());
+        fatal_error_report(HEADER_DATA_MISMATCH);
+        return 0;
+    }
+
+    for (unsigned int i = 0; i < table->count; i++) {
+        if (m_sequenceCheck && entries[i].seq_num != m_sub_seq) {
+            TPLOG_ERROR("TPEtherLogger: sub-block %u, expected %u",
+                        entries[i].seq_num, m_sub_seq);
+            fatal_error_report(SEQUENCE_NUM_MISMATCH);
+            return 0;
+        }
+        m_sub_seq = entries[i].seq_num + 1;
+    }
+    return table;
+}
+
+void TPEtherLogger::add_sub_block_latency(LatencyHistogram& hist,
+                                          const SubBlockTableHeader* table,
+                                          unsigned long long t)
+{
+    // from the receive time of each sub-block, not only the oldest
+    const SubBlockEntry* entries = (const SubBlockEntry*)(table + 1);
+    for (unsigned int i = 0; i < table->count; i++) {
+        if (entries[i].recv_ns > 0 && t >= entries[i].recv_ns) {
+            hist.add(t - entries[i].recv_ns);
+        }
+    }
+}
+
+int TPEtherLogger::write_sub_blocks(const SubBlockTableHeader* table,
+                                    unsigned char* data)
+{
+    // Each sub-block as the block an uncoalesced reader would have
+    // sent, with its own sequence number in the footer, so that
+    // tpether-merge reads the file as before.
+    const SubBlockEntry* entries = (const SubBlockEntry*)(table + 1);
+    for (unsigned int i = 0; i < table->count; i++) {
+        unsigned int size = entries[i].byte_size;
+        unsigned int seq  = entries[i].seq_num;
+        m_sub_buf.resize(HEADER_BYTE_SIZE + size + FOOTER_BYTE_SIZE);
+        unsigned char* block  = &m_sub_buf[0];
+        unsigned char* footer = &m_sub_buf[HEADER_BYTE_SIZE + size];
+        set_header(block, size);
+        memcpy(block + HEADER_BYTE_SIZE, data, size);
+        footer[0] = FOOTER_MAGIC;
+        footer[1] = FOOTER_MAGIC;
+        footer[2] = 0;
+        footer[3] = 0;
+        footer[4] = (seq >> 24) & 0xff;
+        footer[5] = (seq >> 16) & 0xff;
+        footer[6] = (seq >>  8) & 0xff;
+        footer[7] =  seq        & 0xff;
+
+        if (m_framer.configured()) {
+            frame_events(data, size);    // offsets in the file as written
+        }
+        if (fileUtils->write_data((char *)block, m_sub_buf.size()) < 0) {
+            return -1;
+        }
+        data += size;
+    }
+    return 0;
+}
+
 int TPEtherLogger::daq_run()
 {
 
     int event_byte_size = 0;
+    unsigned long long t_recv = 0; // reader receive time, 0 if not stamped
+    unsigned long long t_in   = 0;
+    unsigned long long gen    = m_wait.begin_poll();
+    unsigned long long t_read = mono_now_ns();
     bool ret = m_InPort.read();
 
     if (ret == true) {
+        m_wait.got_data();
         int block_byte_size = m_in_data.data.length();
+        m_last_block_byte_size = block_byte_size;
+        unsigned long long t_got = mono_now_ns();
+        if (Trace::enabled()) {  // empty polls are not recorded
+            Trace::complete("InPort read", t_read, t_got,
+                            "bytes", block_byte_size);
+        }
+
+        // blocks still queued behind this one
+        size_t fill, capacity;
+        if (connector_fill(m_InPort.connectors(), fill, capacity)) {
+            m_in_stats.sample_fill(fill, capacity);
+        }
+        m_in_stats.add_call(t_got - t_read);
+        m_in_stats.add_block(m_in_empty_reads,
+                             m_in_empty_reads > 0 ? t_read - m_in_empty_since : 0);
+        m_in_empty_reads = 0;
+        if (m_port_report_ns > 0 &&
+            t_got - m_port_last_report_ns >= m_port_report_ns) {
+            report_port_stats(false);
+            m_port_last_report_ns = t_got;
+        }
+
+        t_recv = get_block_time(m_in_data.tm);
+        if (t_recv > 0) {
+            t_in = mono_now_ns();
+            if (t_in >= t_recv) {
+                if (!m_coalesced) {   // per sub-block below
+                    m_lat_transport.add(t_in - t_recv);
+                }
+            }
+            else {  // not stamped on this host, ignore
+                t_recv = 0;
+            }
+        }
 
         event_byte_size =
             block_byte_size - HEADER_BYTE_SIZE - FOOTER_BYTE_SIZE;
-        if (m_debug) {
-            std::cerr << "m_in_data.data.length:"
-                      << m_in_data.data.length() << std::endl;
-            std::cerr << "event_byte_size w/ header, fooger = "
-                      << event_byte_size << std::endl;
-        }
+        TPLOG_DEBUG("m_in_data.data.length:%d event_byte_size:%d",
+                    block_byte_size, event_byte_size);
 
         if (event_byte_size == 0) {
             return 0;
         }
 
-        if (check_header_footer(m_in_data, block_byte_size)) {
-            //data header and footer were valid, do nothing
+        if ((unsigned int)block_byte_size != m_check_block_size) {
+            // once per run, unless the block size changes
+            m_check_block = select_check_block(block_byte_size);
+            m_check_block_size = block_byte_size;
         }
+        (this->*m_check_block)(block_byte_size);
     }
     else {
+        if (m_in_empty_reads++ == 0) {
+            m_in_empty_since = t_read;
+        }
         if (check_trans_lock()) {
-            if (m_debug) {
-                std::cerr << "**** trans unlock\n";
-            }
+            TPLOG_DEBUG("**** trans unlock");
             set_trans_unlock();
+            return 0;
         }
+        m_wait.idle(gen);
         return 0;
     }
 
+    // the data, without the sub-block table of a coalesced block
+    unsigned char* data = &m_in_data.data[HEADER_BYTE_SIZE];
+    unsigned int data_byte_size = event_byte_size;
+    const SubBlockTableHeader* table = 0;
+    if (m_coalesced) {
+        table = sub_block_table(event_byte_size);
+        if (table == 0) {
+            return 0;
+        }
+        data += sub_block_table_size(table->capacity);
+        data_byte_size = table->data_byte_size;
+        if (t_recv > 0) {
+            add_sub_block_latency(m_lat_transport, table, t_in);
+        }
+    }
+    // a header and footer around each sub-block in the file
+    bool per_sub_block = table && m_saveHeaderFooter && m_isDataLogging;
+
+    // one copy for online monitoring, readers never block us
+    if (m_tap.is_open() && m_tap.due()) {
+        m_tap.publish(data, data_byte_size, get_sequence_num(), t_recv);
+    }
+
+    if (m_framer.configured() && !per_sub_block) {
+        TraceScope trace("framing");
+        frame_events(data, data_byte_size);
+    }
+
     if (m_isDataLogging) {
-        int ret = fileUtils->write_data((char *)&m_in_data.data[HEADER_BYTE_SIZE],
-                                        event_byte_size);
+        TraceScope trace("file write");
+        trace.set_arg("bytes", data_byte_size);
+        int ret;
+        if (per_sub_block) {
+            ret = write_sub_blocks(table, data);
+        }
+        else if (m_saveHeaderFooter) {
+            // keep the sequence number in the footer for merging
+            ret = fileUtils->write_data((char *)&m_in_data.data[0],
+                                        m_in_data.data.length());
+        }
+        else {
+            ret = fileUtils->write_data((char *)data, data_byte_size);
+        }
 
         if (ret < 0) {
-            std::cerr << "### TPEtherLogger: ERROR occured at data saving\n";
+            TPLOG_ERROR("TPEtherLogger: error occured at data saving");
             fatal_error_report(CANNOT_WRITE_DATA);
         }
+
+        if (t_recv > 0) {
+            unsigned long long t_out = mono_now_ns();
+            m_lat_write.add(t_out - t_in);
+            if (table) {
+                add_sub_block_latency(m_lat_persist, table, t_out);
+            }
+            else {
+                m_lat_persist.add(t_out - t_recv);
+            }
+        }
     }
 
-    inc_total_data_size(event_byte_size);
+    if (t_recv > 0 && m_lat_report_interval_ns > 0 &&
+        t_in - m_lat_last_report_ns >= m_lat_report_interval_ns) {
+        report_latency(false);
+        m_lat_last_report_ns = t_in;
+    }
+
+    inc_total_data_size(data_byte_size);
     inc_sequence_num();
+    if (table) {
+        m_sub_blocks += table->count;
+    }
 
-    if (m_debug) {
+    if (AsyncLog::enabled(AsyncLog::LEVEL_DEBUG)) {
         unsigned long long seq_num = get_sequence_num();
         if (seq_num % m_update_rate == 0) {
-            std::cerr << "TPEtherLogger: loop = " << seq_num << std::endl;
-            std::cerr << "\033[A\r";
+            TPLOG_DEBUG("TPEtherLogger: loop = %llu", seq_num);
         }
     }
 
@@ -18,6 +18,21 @@
 
 #include "DaqComponentBase.h"
 #include "FileUtils.h"
+#include "AsyncLog.h"
+#include "BlockTime.h"
+#include "LatencyHistogram.h"
+#include "PerfCounters.h"
+#include "PortStats.h"
+#include "Trace.h"
+#include "WaitStrategy.h"
+#include "SampleTap.h"
+#include "EventFramer.h"
+#include "FixedBlock.h"
+#include "SubBlockTable.h"
+
+#include <fstream>
+#include <vector>
+#include <sys/resource.h>
 
 using namespace RTC;
 
@@ -52,6 +67,26 @@ private:
     int parse_params(::NVList* list);
     int reset_InPort();
     void toLower(std::basic_string<char>& s);
+    bool check_magic(unsigned int block_byte_size);
+    bool check_block(unsigned int block_byte_size);
+    template <unsigned int N>
+    bool check_block_fixed(unsigned int block_byte_size);
+    typedef bool (TPEtherLogger::*CheckBlockFunc)(unsigned int);
+    CheckBlockFunc select_check_block(unsigned int block_byte_size) const;
+    void report_latency(bool run_total);
+    void report_cpu_usage(unsigned long long total_byte_size);
+    void report_port_stats(bool run_total);
+    int  configure_framing();
+    void frame_events(unsigned char* data, unsigned int size);
+    void open_event_index(unsigned int run_no);
+    void close_event_index();
+    const SubBlockTableHeader* sub_block_table(unsigned int event_byte_size);
+    void add_sub_block_latency(LatencyHistogram& hist,
+                               const SubBlockTableHeader* table,
+                               unsigned long long t);
+    int  write_sub_blocks(const SubBlockTableHeader* table,
+                          unsigned char* data);
+    void export_trace(unsigned int run_no);
 
     FileUtils* fileUtils;
     bool m_isDataLogging;
@@ -60,10 +95,78 @@ private:
     unsigned int m_maxFileSizeInMByte;
     BufferStatus m_in_status;
     int m_update_rate;
+    bool m_sequenceCheck;                 /// no: input is a fan-out share
+    bool m_saveHeaderFooter;              /// yes: write whole blocks
     struct timeval m_tv_start;
     struct timeval m_tv_stop;
 
-    bool m_debug;
+    /// block latency, measured from the reader's receive time stamp
+    LatencyHistogram m_lat_transport;     /// reader recv -> InPort read
+    LatencyHistogram m_lat_write;         /// write_data() call
+    LatencyHistogram m_lat_persist;       /// reader recv -> write_data() return
+    LatencyHistogram m_lat_transport_run;
+    LatencyHistogram m_lat_write_run;
+    LatencyHistogram m_lat_persist_run;
+    unsigned long long m_lat_report_interval_ns; /// 0: report at stop only
+    unsigned long long m_lat_last_report_ns;
+
+    /// InPort occupancy and time without data, interval and run total
+    PortStats m_in_stats;
+    PortStats m_in_stats_run;
+    unsigned int m_in_empty_reads;        /// read() without data since the last block
+    unsigned long long m_in_empty_since;
+    unsigned long long m_port_report_ns;  /// interval report, 0: at stop only
+    unsigned long long m_port_last_report_ns;
+    unsigned int m_last_block_byte_size;
+    CheckBlockFunc m_check_block;         /// check_block or check_block_fixed<N>
+    unsigned int m_check_block_size;      /// block size m_check_block was chosen for
+
+    WaitStrategy m_wait;
+
+    /// sampled blocks for online monitoring
+    SampleTap m_tap;
+    std::string m_tap_name;
+    unsigned int m_tap_slots;
+    unsigned int m_tap_slot_size;
+    struct rusage m_ru_thread_start;      /// EC thread
+    struct rusage m_ru_self_start;        /// whole process, incl. ORB threads
+
+    PerfCounters m_perf;
+    bool m_perf_enabled;
+
+    /// event framing: none, fixed (eventByteSize) or length
+    EventFramer m_framer;
+    std::string m_framing_mode;
+    unsigned int m_event_byte_size;
+    unsigned int m_ev_len_offset;
+    unsigned int m_ev_len_byte_size;
+    bool m_ev_len_big_endian;
+    int m_ev_len_adjust;
+    unsigned int m_ev_magic;
+    unsigned int m_ev_magic_byte_size;
+    unsigned int m_ev_max_byte_size;
+    bool m_ev_index;
+    bool m_ev_fatal;                      /// framing error stops the run
+    std::ofstream m_index_file;
+
+    unsigned long long m_stop_drain_ns;   /// max. time to empty the InPort
+
+    /// coalesced "yes": blocks of several sub-blocks (TPEtherReader
+    /// coalesceMaxKB), logged, indexed and counted per sub-block
+    bool m_coalesced;
+    unsigned int m_sub_seq;               /// next sub-block sequence number
+    unsigned long long m_sub_blocks;
+    std::vector<unsigned char> m_sub_buf; /// header + sub-block + footer
+
+    bool m_checksum;                      /// CRC32C manifest of the files
+    /// data files as extents of this file or device, "": files in dirName
+    std::string m_extent_store;
+
+    /// trace "yes": timeline of the run, written at daq_stop()
+    bool m_trace;
+    std::string m_trace_dir;
+    unsigned int m_trace_mb;              /// ring size per thread
+    unsigned int m_run_no;
 };
 
 extern "C"
@@ -0,0 +1,630 @@
+// -*- C++ -*-
+/*!
+ * @file
+ * @brief
+ * @date
+ * @author
+ *
+ */
+
+#include "TPEtherMerger.h"
+
+using DAQMW::FatalType::DATAPATH_DISCONNECTED;
+using DAQMW::FatalType::OUTPORT_ERROR;
+using DAQMW::FatalType::HEADER_DATA_MISMATCH;
+using DAQMW::FatalType::USER_DEFINED_ERROR1;
+
+// Module specification
+// Change following items to suit your component's spec.
+static const char* tpethermerger_spec[] =
+{
+    "implementation_id", "TPEtherMerger",
+    "type_name",         "TPEtherMerger",
+    "description",       "TPEtherMerger component",
+    "version",           "1.0",
+    "vendor",            "Kazuo Nakayoshi, KEK",
+    "category",          "example",
+    "activity_type",     "DataFlowComponent",
+    "max_instance",      "1",
+    "language",          "C++",
+    "lang_type",         "compile",
+    ""
+};
+
+/*
+ * Merged block
+ *
+ * Blocks with the same key (DAQ-Middleware sequence number, or an event
+ * number in the payload) from every input are concatenated in input
+ * order.  The data part of the output block is:
+ *
+ *   for each input:
+ *     input number      (4 bytes, big endian)
+ *     payload byte size (4 bytes, big endian)
+ *     payload           (payload byte size bytes)
+ *
+ * Each input has its own receive thread which moves blocks from its
+ * InPort into its own lock-free queue, so a slow input backs up only
+ * its own queue and InPort buffer.  daq_run() takes the queue heads,
+ * drops heads which have no partner on the other inputs, and sends
+ * the merged block.
+ */
+
+static const unsigned int SUB_HEADER_BYTE_SIZE = 8;
+
+static void* receive_thread(void* arg)
+{
+    MergeInput* in = (MergeInput*)arg;
+    in->comp->receive_loop(in);
+    return 0;
+}
+
+static void put_be32(unsigned char* p, unsigned int v)
+{
+    p[0] = (v >> 24) & 0xff;
+    p[1] = (v >> 16) & 0xff;
+    p[2] = (v >>  8) & 0xff;
+    p[3] =  v        & 0xff;
+}
+
+TPEtherMerger::TPEtherMerger(RTC::Manager* manager)
+    : DAQMW::DaqComponentBase(manager),
+      m_OutPort("tpethermerger_out", m_out_data),
+      m_num_in_ports(2),
+      m_queue_depth(64),
+      m_key_source(KEY_SEQUENCE),
+      m_key_offset(0),
+      m_key_byte_size(4),
+      m_key_big_endian(true),
+      m_receiving(false),
+      m_receivers_started(false),
+      m_out_status(BUF_SUCCESS),
+      m_send_byte_size(0),
+      m_merged(0),
+
+      m_debug(false)
+{
+    // Registration: InPort/OutPort/Service
+
+    // Set InPort buffers
+    for (int i = 0; i < MAX_IN_PORTS; i++) {
+        std::ostringstream port_name;
+        port_name << "tpethermerger_in" << i;
+        MergeInput& in = m_inputs[i];
+        in.comp     = this;
+        in.index    = i;
+        in.in_data  = new TimedOctetSeq();
+        in.in_port  = new InPort<TimedOctetSeq>(port_name.str().c_str(),
+                                                *in.in_data);
+        in.notifier = new DataArrivalNotifier();
+        in.error    = 0;
+        registerInPort(port_name.str().c_str(), *in.in_port);
+        in.in_port->addConnectorDataListener(ON_BUFFER_WRITE, in.notifier);
+    }
+
+    // Set OutPort buffers
+    registerOutPort("tpethermerger_out", m_OutPort);
+
+    init_command_port();
+    init_state_table();
+    set_comp_name("TPETHERMERGER");
+}
+
+TPEtherMerger::~TPEtherMerger()
+{
+    stop_receivers();
+    for (int i = 0; i < MAX_IN_PORTS; i++) {
+        // notifier is deleted by the port
+        delete m_inputs[i].in_port;
+        delete m_inputs[i].in_data;
+    }
+}
+
+RTC::ReturnCode_t TPEtherMerger::onInitialize()
+{
+    if (m_debug) {
+        std::cerr << "TPEtherMerger::onInitialize()" << std::endl;
+    }
+
+    return RTC::RTC_OK;
+}
+
+RTC::ReturnCode_t TPEtherMerger::onExecute(RTC::UniqueId ec_id)
+{
+    daq_do();
+
+    return RTC::RTC_OK;
+}
+
+int TPEtherMerger::daq_dummy()
+{
+    return 0;
+}
+
+int TPEtherMerger::daq_configure()
+{
+    std::cerr << "*** TPEtherMerger::configure" << std::endl;
+
+    ::NVList* paramList;
+    paramList = m_daq_service0.getCompParams();
+    parse_params(paramList);
+
+    for (int i = 0; i < m_num_in_ports; i++) {
+        m_inputs[i].queue.resize(m_queue_depth);
+    }
+
+    return 0;
+}
+
+int TPEtherMerger::parse_params(::NVList* list)
+{
+    std::cerr << "param list length:" << (*list).length() << std::endl;
+
+    int len = (*list).length();
+    for (int i = 0; i < len; i+=2) {
+        std::string sname  = (std::string)(*list)[i].value;
+        std::string svalue = (std::string)(*list)[i+1].value;
+
+        std::cerr << "sname: " << sname << "  ";
+        std::cerr << "value: " << svalue << std::endl;
+
+        if ( sname == "numInPorts" ) {
+            char* offset;
+            m_num_in_ports = (int)strtol(svalue.c_str(), &offset, 10);
+            if (m_num_in_ports < 1 || m_num_in_ports > MAX_IN_PORTS) {
+                std::cerr << "### ERROR: numInPorts must be 1.."
+                          << MAX_IN_PORTS << std::endl;
+                fatal_error_report(USER_DEFINED_ERROR1, "BAD NUMINPORTS");
+            }
+        }
+        if ( sname == "queueDepth" ) {
+            char* offset;
+            m_queue_depth = (unsigned int)strtoul(svalue.c_str(), &offset, 10);
+            if (m_queue_depth == 0) {
+                m_queue_depth = 1;
+            }
+        }
+        if ( sname == "mergeKey" ) {
+            if (svalue == "sequence") {
+                m_key_source = KEY_SEQUENCE;
+            }
+            else if (svalue == "payload") {
+                m_key_source = KEY_PAYLOAD;
+            }
+            else {
+                std::cerr << "### ERROR: unknown mergeKey: "
+                          << svalue << std::endl;
+                fatal_error_report(USER_DEFINED_ERROR1, "BAD MERGEKEY");
+            }
+        }
+        if ( sname == "keyOffset" ) {
+            char* offset;
+            m_key_offset = (unsigned int)strtoul(svalue.c_str(), &offset, 0);
+        }
+        if ( sname == "keyByteSize" ) {
+            char* offset;
+            m_key_byte_size = (unsigned int)strtoul(svalue.c_str(), &offset, 10);
+            if (m_key_byte_size != 1 && m_key_byte_size != 2 &&
+                m_key_byte_size != 4 && m_key_byte_size != 8) {
+                std::cerr << "### ERROR: keyByteSize must be 1, 2, 4 or 8"
+                          << std::endl;
+                fatal_error_report(USER_DEFINED_ERROR1, "BAD KEYBYTESIZE");
+            }
+        }
+        if ( sname == "keyByteOrder" ) {
+            m_key_big_endian = (svalue != "little");
+        }
+    }
+
+    return 0;
+}
+
+int TPEtherMerger::daq_unconfigure()
+{
+    std::cerr << "*** TPEtherMerger::unconfigure" << std::endl;
+
+    return 0;
+}
+
+int TPEtherMerger::daq_start()
+{
+    std::cerr << "*** TPEtherMerger::start" << std::endl;
+
+    m_out_status = BUF_SUCCESS;
+    m_merged = 0;
+
+    // Check data port connections
+    for (int i = 0; i < m_num_in_ports; i++) {
+        bool inport_conn = check_dataPort_connections( *m_inputs[i].in_port );
+        if (!inport_conn) {
+            std::cerr << "### NO Connection: InPort " << i << std::endl;
+            fatal_error_report(DATAPATH_DISCONNECTED);
+        }
+    }
+    bool outport_conn = check_dataPort_connections( m_OutPort );
+    if (!outport_conn) {
+        std::cerr << "### NO Connection" << std::endl;
+        fatal_error_report(DATAPATH_DISCONNECTED);
+    }
+
+    for (int i = 0; i < m_num_in_ports; i++) {
+        MergeInput& in = m_inputs[i];
+        in.queue.clear();
+        in.error         = 0;
+        in.received      = 0;
+        in.dropped       = 0;
+        in.max_depth     = 0;
+        in.wait_since_ns = 0;
+        in.wait_total_ns = 0;
+        in.wait_time.reset();
+        in.skew.reset();
+    }
+
+    if (start_receivers() < 0) {
+        fatal_error_report(USER_DEFINED_ERROR1, "CANNOT START THREAD");
+    }
+
+    gettimeofday(&m_tv_start, NULL);
+    return 0;
+}
+
+int TPEtherMerger::daq_stop()
+{
+    std::cerr << "*** TPEtherMerger::stop" << std::endl;
+
+    stop_receivers();
+    reset_InPort();
+
+    gettimeofday(&m_tv_stop, NULL);
+    struct timeval tv_diff;
+    timersub(&m_tv_stop, &m_tv_start, &tv_diff);
+    double elapsed_sec = tv_diff.tv_sec + 0.000001*tv_diff.tv_usec;
+    unsigned long long total_bytes_size = get_total_byte_size();
+    double transfer_rate = total_bytes_size / elapsed_sec / 1024.0 / 1024.0;
+    std::cerr << "transfer_rate: " << transfer_rate << " MB/s" << std::endl;
+
+    report_stats();
+
+    return 0;
+}
+
+int TPEtherMerger::daq_pause()
+{
+    std::cerr << "*** TPEtherMerger::pause" << std::endl;
+
+    return 0;
+}
+
+int TPEtherMerger::daq_resume()
+{
+    std::cerr << "*** TPEtherMerger::resume" << std::endl;
+
+    return 0;
+}
+
+int TPEtherMerger::start_receivers()
+{
+    __atomic_store_n(&m_receiving, true, __ATOMIC_RELEASE);
+    for (int i = 0; i < m_num_in_ports; i++) {
+        if (pthread_create(&m_inputs[i].thread, NULL,
+                           receive_thread, &m_inputs[i]) != 0) {
+            std::cerr << "### ERROR: pthread_create: input " << i << std::endl;
+            // m_receivers_started is still false: stop the ones running here
+            __atomic_store_n(&m_receiving, false, __ATOMIC_RELEASE);
+            for (int j = 0; j < i; j++) {
+                pthread_join(m_inputs[j].thread, NULL);
+            }
+            return -1;
+        }
+    }
+    m_receivers_started = true;
+    return 0;
+}
+
+void TPEtherMerger::stop_receivers()
+{
+    if (!m_receivers_started) {
+        return;
+    }
+    __atomic_store_n(&m_receiving, false, __ATOMIC_RELEASE);
+    for (int i = 0; i < m_num_in_ports; i++) {
+        pthread_join(m_inputs[i].thread, NULL);
+    }
+    m_receivers_started = false;
+}
+
+bool TPEtherMerger::get_key(const TimedOctetSeq& in_data,
+                            unsigned long long& key)
+{
+    unsigned int block_byte_size = in_data.data.length();
+
+    if (m_key_source == KEY_SEQUENCE) {
+        const unsigned char* footer =
+            &in_data.data[block_byte_size - FOOTER_BYTE_SIZE];
+        key = ((unsigned int)footer[4] << 24) | (footer[5] << 16)
+            | (footer[6] << 8) | footer[7];
+        return true;
+    }
+
+    unsigned int data_byte_size =
+        block_byte_size - HEADER_BYTE_SIZE - FOOTER_BYTE_SIZE;
+    if (m_key_offset + m_key_byte_size > data_byte_size) {
+        return false;
+    }
+    const unsigned char* p = &in_data.data[HEADER_BYTE_SIZE + m_key_offset];
+    key = 0;
+    for (unsigned int i = 0; i < m_key_byte_size; i++) {
+        if (m_key_big_endian) {
+            key = (key << 8) | p[i];
+        }
+        else {
+            key |= (unsigned long long)p[i] << (8*i);
+        }
+    }
+    return true;
+}
+
+void TPEtherMerger::receive_loop(MergeInput* in)
+{
+    const unsigned long long wait_ns = 10000000ULL; // to see m_receiving
+
+    while (__atomic_load_n(&m_receiving, __ATOMIC_ACQUIRE)) {
+        MergeBlock* slot = in->queue.write_slot();
+        if (slot == 0) {
+            // merger is waiting for other inputs; only this queue backs up
+            usleep(100);
+            continue;
+        }
+
+        unsigned long long gen = in->notifier->generation();
+        if (!in->in_port->read()) {
+            in->notifier->wait(gen, wait_ns);
+            continue;
+        }
+
+        const TimedOctetSeq& in_data = *in->in_data;
+        unsigned int block_byte_size = in_data.data.length();
+        if (block_byte_size < HEADER_BYTE_SIZE + FOOTER_BYTE_SIZE ||
+            in_data.data[0] != HEADER_MAGIC ||
+            in_data.data[block_byte_size - FOOTER_BYTE_SIZE] != FOOTER_MAGIC ||
+            !get_key(in_data, slot->key)) {
+            // fatal_error_report() must be called from daq_run()
+            __atomic_store_n(&in->error, 1, __ATOMIC_RELEASE);
+            break;
+        }
+
+        unsigned int data_byte_size =
+            block_byte_size - HEADER_BYTE_SIZE - FOOTER_BYTE_SIZE;
+        slot->data.resize(data_byte_size);
+        if (data_byte_size > 0) {
+            memcpy(&slot->data[0], &in_data.data[HEADER_BYTE_SIZE],
+                   data_byte_size);
+        }
+        slot->recv_ns    = get_block_time(in_data.tm);
+        slot->arrival_ns = mono_now_ns();
+        in->queue.commit();
+
+        in->received++;
+        unsigned int depth = in->queue.count();
+        if (depth > in->max_depth) {
+            in->max_depth = depth;
+        }
+    }
+}
+
+void TPEtherMerger::update_wait_time(unsigned long long now)
+{
+    bool any_data = false;
+    for (int i = 0; i < m_num_in_ports; i++) {
+        if (!m_inputs[i].queue.empty()) {
+            any_data = true;
+            break;
+        }
+    }
+
+    for (int i = 0; i < m_num_in_ports; i++) {
+        MergeInput& in = m_inputs[i];
+        if (in.queue.empty()) {
+            if (any_data && in.wait_since_ns == 0) {
+                in.wait_since_ns = now;
+            }
+        }
+        else if (in.wait_since_ns > 0) {
+            unsigned long long waited = now - in.wait_since_ns;
+            in.wait_time.add(waited);
+            in.wait_total_ns += waited;
+            in.wait_since_ns = 0;
+        }
+    }
+}
+
+int TPEtherMerger::set_data(MergeBlock** heads)
+{
+    unsigned char header[8];
+    unsigned char footer[8];
+
+    unsigned int data_byte_size = 0;
+    unsigned long long first_arrival = ~0ULL;
+    unsigned long long first_recv    = ~0ULL;
+    for (int i = 0; i < m_num_in_ports; i++) {
+        data_byte_size += SUB_HEADER_BYTE_SIZE + heads[i]->data.size();
+        if (heads[i]->arrival_ns < first_arrival) {
+            first_arrival = heads[i]->arrival_ns;
+        }
+        if (heads[i]->recv_ns > 0 && heads[i]->recv_ns < first_recv) {
+            first_recv = heads[i]->recv_ns;
+        }
+    }
+
+    set_header(&header[0], data_byte_size);
+    set_footer(&footer[0]);
+
+    ///set OutPort buffer length
+    m_out_data.data.length(data_byte_size + HEADER_BYTE_SIZE + FOOTER_BYTE_SIZE);
+    memcpy(&(m_out_data.data[0]), &header[0], HEADER_BYTE_SIZE);
+    unsigned int pos = HEADER_BYTE_SIZE;
+    for (int i = 0; i < m_num_in_ports; i++) {
+        unsigned int size = heads[i]->data.size();
+        put_be32(&(m_out_data.data[pos]), i);
+        put_be32(&(m_out_data.data[pos + 4]), size);
+        pos += SUB_HEADER_BYTE_SIZE;
+        if (size > 0) {
+            memcpy(&(m_out_data.data[pos]), &heads[i]->data[0], size);
+        }
+        pos += size;
+
+        m_inputs[i].skew.add(heads[i]->arrival_ns - first_arrival);
+    }
+    memcpy(&(m_out_data.data[pos]), &footer[0], FOOTER_BYTE_SIZE);
+
+    /// keep the earliest reader receive time for latency measurement
+    set_block_time(m_out_data.tm, first_recv == ~0ULL ? 0 : first_recv);
+
+    return data_byte_size;
+}
+
+int TPEtherMerger::write_OutPort()
+{
+    ////////////////// send data from OutPort  //////////////////
+    bool ret = m_OutPort.write();
+
+    //////////////////// check write status /////////////////////
+    if (ret == false) {  // TIMEOUT or FATAL
+        m_out_status  = check_outPort_status(m_OutPort);
+        if (m_out_status == BUF_FATAL) {   // Fatal error
+            fatal_error_report(OUTPORT_ERROR);
+        }
+        if (m_out_status == BUF_TIMEOUT) { // Timeout
+            return -1;
+        }
+    }
+    else {
+        m_out_status = BUF_SUCCESS; // successfully done
+    }
+
+    return 0;
+}
+
+int TPEtherMerger::reset_InPort()
+{
+    unsigned long long flushed = 0;
+    for (int i = 0; i < m_num_in_ports; i++) {
+        while (m_inputs[i].in_port->read()) {
+            flushed++;
+        }
+    }
+    if (m_debug) {
+        std::cerr << "*** TPEtherMerger::InPort flushed: "
+                  << flushed << " blocks" << std::endl;
+    }
+    return 0;
+}
+
+void TPEtherMerger::report_stats()
+{
+    std::cerr << "merged blocks: " << m_merged << std::endl;
+    for (int i = 0; i < m_num_in_ports; i++) {
+        MergeInput& in = m_inputs[i];
+        std::ostringstream name;
+        name << "input" << i;
+        std::cerr << name.str()
+                  << " received: " << in.received
+                  << " dropped: "  << in.dropped
+                  << " max_queue_depth: " << in.max_depth
+                  << " wait_total: " << in.wait_total_ns/1000000.0 << " ms"
+                  << std::endl;
+        in.wait_time.print(std::cerr, name.str() + "_wait");
+        in.skew.print(std::cerr, name.str() + "_skew");
+    }
+}
+
+int TPEtherMerger::daq_run()
+{
+    if (m_debug) {
+        std::cerr << "*** TPEtherMerger::run" << std::endl;
+    }
+
+    if (check_trans_lock()) {  // check if stop command has come
+        set_trans_unlock();    // transit to CONFIGURED state
+        return 0;
+    }
+
+    for (int i = 0; i < m_num_in_ports; i++) {
+        if (__atomic_load_n(&m_inputs[i].error, __ATOMIC_ACQUIRE)) {
+            std::cerr << "### ERROR: TPEtherMerger: bad block on input "
+                      << i << std::endl;
+            fatal_error_report(HEADER_DATA_MISMATCH);
+        }
+    }
+
+    if (m_out_status != BUF_SUCCESS) {   // retry previous block
+        if (write_OutPort() == 0) {
+            inc_sequence_num();
+            inc_total_data_size(m_send_byte_size);
+            m_merged++;
+        }
+        return 0;
+    }
+
+    update_wait_time(mono_now_ns());
+
+    MergeBlock* heads[MAX_IN_PORTS];
+    for (int i = 0; i < m_num_in_ports; i++) {
+        heads[i] = m_inputs[i].queue.read_slot();
+        if (heads[i] == 0) {
+            return 0;          // wait for this input
+        }
+    }
+
+    // Drop heads older than the newest head: their partners are gone.
+    bool matched = false;
+    while (!matched) {
+        unsigned long long max_key = 0;
+        for (int i = 0; i < m_num_in_ports; i++) {
+            if (heads[i]->key > max_key) {
+                max_key = heads[i]->key;
+            }
+        }
+        matched = true;
+        for (int i = 0; i < m_num_in_ports; i++) {
+            while (heads[i]->key < max_key) {
+                m_inputs[i].dropped++;
+                m_inputs[i].queue.release();
+                heads[i] = m_inputs[i].queue.read_slot();
+                if (heads[i] == 0) {
+                    return 0;
+                }
+            }
+            if (heads[i]->key != max_key) {
+                matched = false;
+            }
+        }
+    }
+
+    m_send_byte_size = set_data(heads);
+    for (int i = 0; i < m_num_in_ports; i++) {
+        m_inputs[i].queue.release();
+    }
+
+    if (write_OutPort() < 0) {
+        ;     // Timeout. retry at next daq_run()
+    }
+    else {    // OutPort write successfully done
+        inc_sequence_num();                     // increase sequence num.
+        inc_total_data_size(m_send_byte_size);  // increase total data byte size
+        m_merged++;
+    }
+
+    return 0;
+}
+
+extern "C"
+{
+    void TPEtherMergerInit(RTC::Manager* manager)
+    {
+        RTC::Properties profile(tpethermerger_spec);
+        manager->registerFactory(profile,
+                    RTC::Create<TPEtherMerger>,
+                    RTC::Delete<TPEtherMerger>);
+    }
+};
@@ -0,0 +1,130 @@
+// -*- C++ -*-
+/*!
+ * @file
+ * @brief
+ * @date
+ * @author
+ *
+ */
+
+#ifndef TPETHERMERGER_H
+#define TPETHERMERGER_H
+
+#include "DaqComponentBase.h"
+
+#include <pthread.h>
+#include <unistd.h>
+#include <sstream>
+#include <vector>
+
+#include "BlockTime.h"
+#include "LatencyHistogram.h"
+#include "SpscQueue.h"
+#include "WaitStrategy.h"
+
+using namespace RTC;
+
+struct MergeBlock {
+    std::vector<unsigned char> data;      /// payload w/o header, footer
+    unsigned long long key;               /// sequence or event number
+    unsigned long long arrival_ns;        /// taken off the InPort
+    unsigned long long recv_ns;           /// reader's receive time stamp
+};
+
+class TPEtherMerger;
+
+struct MergeInput {
+    TPEtherMerger* comp;
+    int index;
+    TimedOctetSeq* in_data;
+    InPort<TimedOctetSeq>* in_port;
+    DataArrivalNotifier* notifier;
+    SpscQueue<MergeBlock> queue;
+    pthread_t thread;
+    int error;                            /// set by the receive thread
+
+    // statistics
+    unsigned long long received;
+    unsigned long long dropped;           /// no partner on other inputs
+    unsigned int max_depth;
+    unsigned long long wait_since_ns;     /// 0: merger is not waiting
+    unsigned long long wait_total_ns;
+    LatencyHistogram wait_time;           /// merger waiting for this input
+    LatencyHistogram skew;                /// arrival - earliest arrival
+};
+
+class TPEtherMerger
+    : public DAQMW::DaqComponentBase
+{
+public:
+    TPEtherMerger(RTC::Manager* manager);
+    ~TPEtherMerger();
+
+    // The initialize action (on CREATED->ALIVE transition)
+    // former rtc_init_entry()
+    virtual RTC::ReturnCode_t onInitialize();
+
+    // The execution action that is invoked periodically
+    // former rtc_active_do()
+    virtual RTC::ReturnCode_t onExecute(RTC::UniqueId ec_id);
+
+    /// body of the per-input receive thread
+    void receive_loop(MergeInput* in);
+
+private:
+    static const int MAX_IN_PORTS = 8;
+
+    MergeInput m_inputs[MAX_IN_PORTS];
+
+    TimedOctetSeq          m_out_data;
+    OutPort<TimedOctetSeq> m_OutPort;
+
+private:
+    int daq_dummy();
+    int daq_configure();
+    int daq_unconfigure();
+    int daq_start();
+    int daq_run();
+    int daq_stop();
+    int daq_pause();
+    int daq_resume();
+
+    int parse_params(::NVList* list);
+    bool get_key(const TimedOctetSeq& in_data, unsigned long long& key);
+    int start_receivers();
+    void stop_receivers();
+    void update_wait_time(unsigned long long now);
+    int set_data(MergeBlock** heads);
+    int write_OutPort();
+    int reset_InPort();
+    void report_stats();
+
+    enum KeySource { KEY_SEQUENCE, KEY_PAYLOAD };
+
+    int m_num_in_ports;
+    unsigned int m_queue_depth;
+    KeySource m_key_source;
+    unsigned int m_key_offset;            /// byte offset in the payload
+    unsigned int m_key_byte_size;         /// 1, 2, 4 or 8
+    bool m_key_big_endian;
+
+    bool m_receiving;                     /// receive threads keep running
+    bool m_receivers_started;
+
+    BufferStatus m_out_status;
+    unsigned int m_send_byte_size;
+    unsigned long long m_merged;
+
+    struct timeval m_tv_start;
+    struct timeval m_tv_stop;
+
+    bool m_debug;
+};
+
+
+extern "C"
+{
+    void TPEtherMergerInit(RTC::Manager* manager);
+};
+
+#endif // TPETHERMERGER_H
@@ -0,0 +1,621 @@
+// -*- C++ -*-
+/*!
+ * @file
+ * @brief
+ * @date
+ * @author
+ *
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+
+#include "TPEtherMonitor.h"
+
+using DAQMW::FatalType::DATAPATH_DISCONNECTED;
+using DAQMW::FatalType::HEADER_DATA_MISMATCH;
+using DAQMW::FatalType::FOOTER_DATA_MISMATCH;
+using DAQMW::FatalType::USER_DEFINED_ERROR1;
+
+// Module specification
+// Change following items to suit your component's spec.
+static const char* tpethermonitor_spec[] =
+{
+    "implementation_id", "TPEtherMonitor",
+    "type_name",         "TPEtherMonitor",
+    "description",       "TPEtherMonitor component",
+    "version",           "1.0",
+    "vendor",            "Kazuo Nakayoshi, KEK",
+    "category",          "example",
+    "activity_type",     "DataFlowComponent",
+    "max_instance",      "1",
+    "language",          "C++",
+    "lang_type",         "compile",
+    ""
+};
+
+/*
+ * Online histograms of 16 bit samples
+ *
+ * The payload of each block is a sequence of 16 bit samples with the
+ * channels interleaved (sample i belongs to channel i % histChannels),
+ * or, with inputFormat zs, the sparse output of the TPEtherReader zero
+ * suppression (TPEtherReader/ZeroSuppress.h).
+ *
+ * daq_run() only copies blocks off the InPort into the queue of one of
+ * numWorkers worker threads.  Every worker fills its own accumulator,
+ * so there is no lock or atomic operation per sample.  Every
+ * snapshotIntervalMs daq_run() asks each worker to switch to its
+ * second accumulator, adds the one just released to the run total and
+ * writes the total to snapshotFile (common/HistSnapshot.h).
+ */
+
+static void* work_thread(void* arg)
+{
+    MonitorWorker* w = (MonitorWorker*)arg;
+    w->comp->work_loop(w);
+    return 0;
+}
+
+static unsigned int get_le32(const unsigned char* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+TPEtherMonitor::TPEtherMonitor(RTC::Manager* manager)
+    : DAQMW::DaqComponentBase(manager),
+      m_InPort("tpethermonitor_in", m_in_data),
+      m_num_workers(2),
+      m_queue_depth(16),
+      m_next_worker(0),
+      m_running(false),
+      m_workers_started(false),
+      m_n_channels(1),
+      m_n_bins(1024),
+      m_bin_shift(6),
+      m_big_endian(false),
+      m_zs_input(false),
+      m_snapshot_file("/dev/shm/tpethermonitor.hist"),
+      m_snapshot_interval_ns(1000ULL*1000000ULL),
+      m_last_snapshot_ns(0),
+      m_snapshots(0),
+      m_run_no(0),
+      m_dispatch_stalls(0),
+
+      m_debug(false)
+{
+    // Registration: InPort/OutPort/Service
+
+    // Set InPort buffers
+    registerInPort("tpethermonitor_in", m_InPort);
+    m_InPort.addConnectorDataListener(ON_BUFFER_WRITE, m_wait.notifier());
+
+    for (int i = 0; i < MAX_WORKERS; i++) {
+        m_workers[i].comp  = this;
+        m_workers[i].index = i;
+    }
+
+    init_command_port();
+    init_state_table();
+    set_comp_name("TPETHERMONITOR");
+}
+
+TPEtherMonitor::~TPEtherMonitor()
+{
+    stop_workers();
+}
+
+RTC::ReturnCode_t TPEtherMonitor::onInitialize()
+{
+    if (m_debug) {
+        std::cerr << "TPEtherMonitor::onInitialize()" << std::endl;
+    }
+
+    return RTC::RTC_OK;
+}
+
+RTC::ReturnCode_t TPEtherMonitor::onExecute(RTC::UniqueId ec_id)
+{
+    daq_do();
+
+    return RTC::RTC_OK;
+}
+
+int TPEtherMonitor::daq_dummy()
+{
+    return 0;
+}
+
+int TPEtherMonitor::daq_configure()
+{
+    std::cerr << "*** TPEtherMonitor::configure" << std::endl;
+
+    ::NVList* paramList;
+    paramList = m_daq_service0.getCompParams();
+    parse_params(paramList);
+
+    unsigned int size = m_n_channels*m_n_bins;
+    for (int i = 0; i < m_num_workers; i++) {
+        m_workers[i].queue.resize(m_queue_depth);
+        m_workers[i].acc[0].assign(size, 0);
+        m_workers[i].acc[1].assign(size, 0);
+    }
+    m_total.assign(size, 0);
+
+    return 0;
+}
+
+int TPEtherMonitor::parse_params(::NVList* list)
+{
+    std::cerr << "param list length:" << (*list).length() << std::endl;
+
+    int len = (*list).length();
+    for (int i = 0; i < len; i+=2) {
+        std::string sname  = (std::string)(*list)[i].value;
+        std::string svalue = (std::string)(*list)[i+1].value;
+
+        std::cerr << "sname: " << sname << "  ";
+        std::cerr << "value: " << svalue << std::endl;
+
+        if ( sname == "numWorkers" ) {
+            char* offset;
+            m_num_workers = (int)strtol(svalue.c_str(), &offset, 10);
+            if (m_num_workers < 1 || m_num_workers > MAX_WORKERS) {
+                std::cerr << "### ERROR: numWorkers must be 1.."
+                          << MAX_WORKERS << std::endl;
+                fatal_error_report(USER_DEFINED_ERROR1, "BAD NUMWORKERS");
+            }
+        }
+        if ( sname == "queueDepth" ) {
+            char* offset;
+            m_queue_depth = (unsigned int)strtoul(svalue.c_str(), &offset, 10);
+            if (m_queue_depth == 0) {
+                m_queue_depth = 1;
+            }
+        }
+        if ( sname == "histChannels" ) {
+            char* offset;
+            m_n_channels = (unsigned int)strtoul(svalue.c_str(), &offset, 10);
+            if (m_n_channels == 0 || m_n_channels > 65536) {
+                std::cerr << "### ERROR: histChannels must be 1..65536"
+                          << std::endl;
+                fatal_error_report(USER_DEFINED_ERROR1, "BAD HISTCHANNELS");
+            }
+        }
+        if ( sname == "histBins" ) {
+            char* offset;
+            m_n_bins = (unsigned int)strtoul(svalue.c_str(), &offset, 10);
+            m_bin_shift = 16;
+            while (m_bin_shift > 0 && (1U << (16 - m_bin_shift)) < m_n_bins) {
+                m_bin_shift--;
+            }
+            if (m_n_bins != (1U << (16 - m_bin_shift))) {
+                std::cerr << "### ERROR: histBins must be a power of 2, "
+                          << "at most 65536" << std::endl;
+                fatal_error_report(USER_DEFINED_ERROR1, "BAD HISTBINS");
+            }
+        }
+        if ( sname == "sampleByteOrder" ) {
+            m_big_endian = (svalue == "big");
+        }
+        if ( sname == "inputFormat" ) {
+            if (svalue == "raw") {
+                m_zs_input = false;
+            }
+            else if (svalue == "zs") {
+                m_zs_input = true;
+            }
+            else {
+                std::cerr << "### ERROR: unknown inputFormat: "
+                          << svalue << std::endl;
+                fatal_error_report(USER_DEFINED_ERROR1, "BAD INPUTFORMAT");
+            }
+        }
+        if ( sname == "snapshotFile" ) {
+            m_snapshot_file = svalue;
+        }
+        if ( sname == "snapshotIntervalMs" ) {
+            char* offset;
+            m_snapshot_interval_ns =
+                strtoull(svalue.c_str(), &offset, 10)*1000000ULL;
+        }
+        if ( sname == "waitStrategy" ) {
+            if (m_wait.set_mode(svalue) < 0) {
+                std::cerr << "### WARNING: unknown waitStrategy: " << svalue
+                          << ", use spin" << std::endl;
+                m_wait.set_mode("spin");
+            }
+        }
+    }
+
+    return 0;
+}
+
+int TPEtherMonitor::daq_unconfigure()
+{
+    std::cerr << "*** TPEtherMonitor::unconfigure" << std::endl;
+
+    return 0;
+}
+
+int TPEtherMonitor::daq_start()
+{
+    std::cerr << "*** TPEtherMonitor::start" << std::endl;
+
+    bool inport_conn = check_dataPort_connections( m_InPort );
+    if (!inport_conn) {
+        std::cerr << "### NO Connection" << std::endl;
+        fatal_error_report(DATAPATH_DISCONNECTED);
+    }
+
+    for (int i = 0; i < m_num_workers; i++) {
+        MonitorWorker& w = m_workers[i];
+        w.queue.clear();
+        std::fill(w.acc[0].begin(), w.acc[0].end(), 0);
+        std::fill(w.acc[1].begin(), w.acc[1].end(), 0);
+        w.active    = 0;
+        w.swap_req  = 0;
+        w.swap_ack  = 0;
+        w.blocks    = 0;
+        w.samples   = 0;
+        w.busy_ns   = 0;
+        w.max_depth = 0;
+    }
+    std::fill(m_total.begin(), m_total.end(), 0);
+    m_next_worker     = 0;
+    m_snapshots       = 0;
+    m_dispatch_stalls = 0;
+    m_run_no          = m_daq_service0.getRunNo();
+    m_last_snapshot_ns = mono_now_ns();
+    m_wait.reset_stats();
+
+    if (start_workers() < 0) {
+        fatal_error_report(USER_DEFINED_ERROR1, "CANNOT START THREAD");
+    }
+
+    gettimeofday(&m_tv_start, NULL);
+    return 0;
+}
+
+int TPEtherMonitor::daq_stop()
+{
+    std::cerr << "*** TPEtherMonitor::stop" << std::endl;
+
+    // workers drain their queues before they exit
+    stop_workers();
+    reset_InPort();
+
+    collect(false);
+    write_snapshot();
+
+    gettimeofday(&m_tv_stop, NULL);
+    struct timeval tv_diff;
+    timersub(&m_tv_stop, &m_tv_start, &tv_diff);
+    double elapsed_sec = tv_diff.tv_sec + 0.000001*tv_diff.tv_usec;
+    unsigned long long total_bytes_size = get_total_byte_size();
+    double transfer_rate = total_bytes_size / elapsed_sec / 1024.0 / 1024.0;
+    std::cerr << "transfer_rate: " << transfer_rate << " MB/s" << std::endl;
+
+    report_stats();
+
+    return 0;
+}
+
+int TPEtherMonitor::daq_pause()
+{
+    std::cerr << "*** TPEtherMonitor::pause" << std::endl;
+
+    return 0;
+}
+
+int TPEtherMonitor::daq_resume()
+{
+    std::cerr << "*** TPEtherMonitor::resume" << std::endl;
+
+    return 0;
+}
+
+int TPEtherMonitor::start_workers()
+{
+    __atomic_store_n(&m_running, true, __ATOMIC_RELEASE);
+    for (int i = 0; i < m_num_workers; i++) {
+        if (pthread_create(&m_workers[i].thread, NULL,
+                           work_thread, &m_workers[i]) != 0) {
+            std::cerr << "### ERROR: pthread_create: worker " << i << std::endl;
+            // m_workers_started is still false: stop the ones running here
+            __atomic_store_n(&m_running, false, __ATOMIC_RELEASE);
+            for (int j = 0; j < i; j++) {
+                pthread_join(m_workers[j].thread, NULL);
+            }
+            return -1;
+        }
+    }
+    m_workers_started = true;
+    return 0;
+}
+
+void TPEtherMonitor::stop_workers()
+{
+    if (!m_workers_started) {
+        return;
+    }
+    __atomic_store_n(&m_running, false, __ATOMIC_RELEASE);
+    for (int i = 0; i < m_num_workers; i++) {
+        pthread_join(m_workers[i].thread, NULL);
+    }
+    m_workers_started = false;
+}
+
+void TPEtherMonitor::check_swap(MonitorWorker* w)
+{
+    unsigned long long req = __atomic_load_n(&w->swap_req, __ATOMIC_ACQUIRE);
+    if (req != w->swap_ack) {
+        w->active ^= 1;
+        __atomic_store_n(&w->swap_ack, req, __ATOMIC_RELEASE);
+    }
+}
+
+unsigned long long TPEtherMonitor::fill(unsigned int* acc,
+                                        const MonitorBlock& block)
+{
+    const unsigned char* p = block.data.empty() ? 0 : &block.data[0];
+    unsigned int size = block.data.size();
+    const unsigned int n_bins = m_n_bins;
+    const unsigned int shift  = m_bin_shift;
+
+    if (m_zs_input) {
+        // ZeroSuppress.h: 16 byte header, u32 indices, u16 values
+        if (size < 16 || p[0] != 0x5a || p[1] != 0x53) {
+            return 0;
+        }
+        unsigned int hits = get_le32(p + 12);
+        if (16 + (unsigned long long)hits*6 > size) {
+            return 0;
+        }
+        const unsigned char* idx = p + 16;
+        const unsigned char* val = idx + hits*4;
+        for (unsigned int i = 0; i < hits; i++) {
+            unsigned int ch = get_le32(idx + i*4) % m_n_channels;
+            unsigned int v  = val[i*2] | (val[i*2 + 1] << 8);
+            acc[ch*n_bins + (v >> shift)]++;
+        }
+        return hits;
+    }
+
+    unsigned int n = size/2;
+    unsigned int* row = acc;
+    unsigned int* last_row = acc + (m_n_channels - 1)*n_bins;
+    if (m_big_endian) {
+        for (unsigned int i = 0; i < n; i++, p += 2) {
+            unsigned int v = (p[0] << 8) | p[1];
+            row[v >> shift]++;
+            row = (row == last_row) ? acc : row + n_bins;
+        }
+    }
+    else {
+        for (unsigned int i = 0; i < n; i++, p += 2) {
+            unsigned int v = p[0] | (p[1] << 8);
+            row[v >> shift]++;
+            row = (row == last_row) ? acc : row + n_bins;
+        }
+    }
+    return n;
+}
+
+void TPEtherMonitor::work_loop(MonitorWorker* w)
+{
+    for (;;) {
+        check_swap(w);
+
+        MonitorBlock* block = w->queue.read_slot();
+        if (block == 0) {
+            if (!__atomic_load_n(&m_running, __ATOMIC_ACQUIRE)) {
+                break;
+            }
+            usleep(50);
+            continue;
+        }
+
+        unsigned long long t_start = mono_now_ns();
+        unsigned long long n = fill(&w->acc[w->active][0], *block);
+        w->queue.release();
+        w->busy_ns += mono_now_ns() - t_start;
+        // read by write_snapshot()
+        __atomic_store_n(&w->samples, w->samples + n, __ATOMIC_RELAXED);
+        __atomic_store_n(&w->blocks, w->blocks + 1, __ATOMIC_RELAXED);
+    }
+}
+
+int TPEtherMonitor::dispatch(const TimedOctetSeq& in_data)
+{
+    unsigned int block_byte_size = in_data.data.length();
+    unsigned int data_byte_size =
+        block_byte_size - HEADER_BYTE_SIZE - FOOTER_BYTE_SIZE;
+
+    // round robin, skip workers which are behind
+    MonitorBlock* slot = 0;
+    MonitorWorker* w = 0;
+    while (slot == 0) {
+        for (int i = 0; i < m_num_workers && slot == 0; i++) {
+            w = &m_workers[(m_next_worker + i) % m_num_workers];
+            slot = w->queue.write_slot();
+        }
+        if (slot == 0) {
+            m_dispatch_stalls++;
+            usleep(50);
+        }
+    }
+    m_next_worker = (w->index + 1) % m_num_workers;
+
+    slot->data.resize(data_byte_size);
+    if (data_byte_size > 0) {
+        memcpy(&slot->data[0], &in_data.data[HEADER_BYTE_SIZE], data_byte_size);
+    }
+    w->queue.commit();
+
+    unsigned int depth = w->queue.count();
+    if (depth > w->max_depth) {
+        w->max_depth = depth;
+    }
+
+    return data_byte_size;
+}
+
+void TPEtherMonitor::add_counts(std::vector<unsigned int>& acc)
+{
+    for (unsigned int i = 0; i < acc.size(); i++) {
+        m_total[i] += acc[i];
+    }
+    std::fill(acc.begin(), acc.end(), 0);
+}
+
+void TPEtherMonitor::collect(bool workers_running)
+{
+    if (!workers_running) {
+        for (int i = 0; i < m_num_workers; i++) {
+            add_counts(m_workers[i].acc[0]);
+            add_counts(m_workers[i].acc[1]);
+        }
+        return;
+    }
+
+    for (int i = 0; i < m_num_workers; i++) {
+        __atomic_add_fetch(&m_workers[i].swap_req, 1, __ATOMIC_RELEASE);
+    }
+    // a worker switches at the latest after the block it is filling
+    for (int i = 0; i < m_num_workers; i++) {
+        MonitorWorker& w = m_workers[i];
+        unsigned long long req = __atomic_load_n(&w.swap_req, __ATOMIC_RELAXED);
+        while (__atomic_load_n(&w.swap_ack, __ATOMIC_ACQUIRE) != req) {
+            usleep(10);
+        }
+        add_counts(w.acc[w.active ^ 1]);
+    }
+}
+
+int TPEtherMonitor::write_snapshot()
+{
+    HistSnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, HIST_SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.n_channels  = m_n_channels;
+    header.n_bins      = m_n_bins;
+    header.bin_shift   = m_bin_shift;
+    header.run_no      = m_run_no;
+    header.snapshot_no = m_snapshots;
+    header.time_sec    = time(NULL);
+    for (int i = 0; i < m_num_workers; i++) {
+        header.blocks  += __atomic_load_n(&m_workers[i].blocks, __ATOMIC_RELAXED);
+        header.samples += __atomic_load_n(&m_workers[i].samples, __ATOMIC_RELAXED);
+    }
+
+    std::string tmp = m_snapshot_file + ".tmp";
+    FILE* fp = fopen(tmp.c_str(), "wb");
+    if (fp == NULL) {
+        perror(tmp.c_str());
+        return -1;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+              fwrite(&m_total[0], sizeof(m_total[0]), m_total.size(), fp)
+                  == m_total.size();
+    if (fclose(fp) != 0 || !ok) {
+        perror(tmp.c_str());
+        return -1;
+    }
+    if (rename(tmp.c_str(), m_snapshot_file.c_str()) < 0) {
+        perror(m_snapshot_file.c_str());
+        return -1;
+    }
+    m_snapshots++;
+    return 0;
+}
+
+int TPEtherMonitor::reset_InPort()
+{
+    unsigned long long flushed = 0;
+    while (m_InPort.read()) {
+        flushed++;
+    }
+    if (m_debug) {
+        std::cerr << "*** TPEtherMonitor::InPort flushed: "
+                  << flushed << " blocks" << std::endl;
+    }
+    return 0;
+}
+
+void TPEtherMonitor::report_stats()
+{
+    std::cerr << "snapshots: " << m_snapshots << " file: " << m_snapshot_file
+              << " dispatch_stalls: " << m_dispatch_stalls << std::endl;
+    for (int i = 0; i < m_num_workers; i++) {
+        MonitorWorker& w = m_workers[i];
+        std::cerr << "worker" << i
+                  << " blocks: "  << w.blocks
+                  << " samples: " << w.samples
+                  << " max_queue_depth: " << w.max_depth;
+        if (w.busy_ns > 0) {
+            std::cerr << " fill_rate: "
+                      << w.samples*2/(w.busy_ns/1e9)/1024.0/1024.0 << " MB/s";
+        }
+        std::cerr << std::endl;
+    }
+    m_wait.print_stats(std::cerr);
+}
+
+int TPEtherMonitor::daq_run()
+{
+    if (m_debug) {
+        std::cerr << "*** TPEtherMonitor::run" << std::endl;
+    }
+
+    unsigned long long now = mono_now_ns();
+    if (m_snapshot_interval_ns > 0 &&
+        now - m_last_snapshot_ns >= m_snapshot_interval_ns) {
+        collect(true);
+        write_snapshot();
+        m_last_snapshot_ns = now;
+    }
+
+    unsigned long long gen = m_wait.begin_poll();
+    bool ret = m_InPort.read();
+    if (ret == false) {
+        if (check_trans_lock()) {  // check if stop command has come
+            set_trans_unlock();    // transit to CONFIGURED state
+            return 0;
+        }
+        m_wait.idle(gen);
+        return 0;
+    }
+    m_wait.got_data();
+
+    unsigned int block_byte_size = m_in_data.data.length();
+    if (block_byte_size < HEADER_BYTE_SIZE + FOOTER_BYTE_SIZE) {
+        std::cerr << "### ERROR: TPEtherMonitor: short block" << std::endl;
+        fatal_error_report(HEADER_DATA_MISMATCH);
+    }
+    if (m_in_data.data[0] != HEADER_MAGIC ||
+        m_in_data.data[block_byte_size - FOOTER_BYTE_SIZE] != FOOTER_MAGIC) {
+        std::cerr << "### ERROR: TPEtherMonitor: bad header/footer magic"
+                  << std::endl;
+        fatal_error_report(FOOTER_DATA_MISMATCH);
+    }
+
+    unsigned int data_byte_size = dispatch(m_in_data);
+
+    inc_sequence_num();
+    inc_total_data_size(data_byte_size);
+
+    return 0;
+}
+
+extern "C"
+{
+    void TPEtherMonitorInit(RTC::Manager* manager)
+    {
+        RTC::Properties profile(tpethermonitor_spec);
+        manager->registerFactory(profile,
+                    RTC::Create<TPEtherMonitor>,
+                    RTC::Delete<TPEtherMonitor>);
+    }
+};
@@ -0,0 +1,134 @@
+// -*- C++ -*-
+/*!
+ * @file
+ * @brief
+ * @date
+ * @author
+ *
+ */
+
+#ifndef TPETHERMONITOR_H
+#define TPETHERMONITOR_H
+
+#include "DaqComponentBase.h"
+
+#include <pthread.h>
+#include <unistd.h>
+#include <sstream>
+#include <vector>
+
+#include "BlockTime.h"
+#include "HistSnapshot.h"
+#include "SpscQueue.h"
+#include "WaitStrategy.h"
+
+using namespace RTC;
+
+struct MonitorBlock {
+    std::vector<unsigned char> data;      /// payload w/o header, footer
+};
+
+class TPEtherMonitor;
+
+struct MonitorWorker {
+    TPEtherMonitor* comp;
+    int index;
+    SpscQueue<MonitorBlock> queue;
+    pthread_t thread;
+
+    /// two accumulators: the worker fills acc[active], the other one
+    /// is handed to daq_run() for merging on request
+    std::vector<unsigned int> acc[2];
+    int active;
+    unsigned long long swap_req;          /// written by daq_run()
+    unsigned long long swap_ack;          /// written by the worker
+
+    // statistics
+    unsigned long long blocks;
+    unsigned long long samples;
+    unsigned long long busy_ns;
+    unsigned int max_depth;
+};
+
+class TPEtherMonitor
+    : public DAQMW::DaqComponentBase
+{
+public:
+    TPEtherMonitor(RTC::Manager* manager);
+    ~TPEtherMonitor();
+
+    // The initialize action (on CREATED->ALIVE transition)
+    // former rtc_init_entry()
+    virtual RTC::ReturnCode_t onInitialize();
+
+    // The execution action that is invoked periodically
+    // former rtc_active_do()
+    virtual RTC::ReturnCode_t onExecute(RTC::UniqueId ec_id);
+
+    /// body of the worker thread
+    void work_loop(MonitorWorker* w);
+
+private:
+    static const int MAX_WORKERS = 16;
+
+    TimedOctetSeq          m_in_data;
+    InPort<TimedOctetSeq>  m_InPort;
+
+private:
+    int daq_dummy();
+    int daq_configure();
+    int daq_unconfigure();
+    int daq_start();
+    int daq_run();
+    int daq_stop();
+    int daq_pause();
+    int daq_resume();
+
+    int parse_params(::NVList* list);
+    int start_workers();
+    void stop_workers();
+    int dispatch(const TimedOctetSeq& in_data);
+    unsigned long long fill(unsigned int* acc, const MonitorBlock& block);
+    void check_swap(MonitorWorker* w);
+    void collect(bool workers_running);
+    void add_counts(std::vector<unsigned int>& acc);
+    int write_snapshot();
+    int reset_InPort();
+    void report_stats();
+
+    MonitorWorker m_workers[MAX_WORKERS];
+    int m_num_workers;
+    unsigned int m_queue_depth;
+    int m_next_worker;
+    bool m_running;                       /// worker threads keep running
+    bool m_workers_started;
+
+    unsigned int m_n_channels;
+    unsigned int m_n_bins;
+    unsigned int m_bin_shift;
+    bool m_big_endian;                    /// byte order of the samples
+    bool m_zs_input;                      /// zero suppressed blocks
+
+    std::vector<unsigned long long> m_total;   /// [channel][bin]
+    std::string m_snapshot_file;
+    unsigned long long m_snapshot_interval_ns;
+    unsigned long long m_last_snapshot_ns;
+    unsigned long long m_snapshots;
+    unsigned int m_run_no;
+
+    WaitStrategy m_wait;
+    unsigned long long m_dispatch_stalls; /// all worker queues were full
+
+    struct timeval m_tv_start;
+    struct timeval m_tv_stop;
+
+    bool m_debug;
+};
+
+
+extern "C"
+{
+    void TPEtherMonitorInit(RTC::Manager* manager);
+};
+
+#endif // TPETHERMONITOR_H
@@ -0,0 +1,168 @@
+// -*- C++ -*-
+/*!
+ * @file EventPacker.cpp
+ * @brief Pack whole length-prefixed events from the stream into blocks.
+ * @date
+ * @author
+ *
+ */
+
+#include <cstring>
+
+#include "EventPacker.h"
+
+EventPacker::EventPacker()
+    : m_block_size(0), m_len_offset(0), m_len_bytes(0),
+      m_len_big_endian(true), m_len_adjust(0), m_max_event_size(0),
+      m_head(0), m_tail(0)
+{
+    reset_stats();
+}
+
+EventPacker::~EventPacker()
+{
+}
+
+int EventPacker::configure(unsigned int block_size, unsigned int offset,
+                           unsigned int field_byte_size, bool big_endian,
+                           int adjust, unsigned int max_event_size)
+{
+    if (field_byte_size != 1 && field_byte_size != 2 && field_byte_size != 4) {
+        return -1;
+    }
+    if (block_size == 0 || offset + field_byte_size > block_size) {
+        return -1;
+    }
+    if (max_event_size == 0 || max_event_size > block_size) {
+        max_event_size = block_size;  // an event must fit into one block
+    }
+
+    m_block_size     = block_size;
+    m_len_offset     = offset;
+    m_len_bytes      = field_byte_size;
+    m_len_big_endian = big_endian;
+    m_len_adjust     = adjust;
+    m_max_event_size = max_event_size;
+
+    m_buf.resize(4*(size_t)block_size);
+    reset();
+    return 0;
+}
+
+void EventPacker::reset()
+{
+    m_head = 0;
+    m_tail = 0;
+}
+
+unsigned char* EventPacker::recv_space(unsigned int& space)
+{
+    // A partial event is shorter than a block, so after the move there
+    // are at least three blocks free.
+    if (m_buf.size() - m_tail < m_block_size) {
+        unsigned int left = m_tail - m_head;
+        if (left > 0) {
+            memmove(&m_buf[0], &m_buf[m_head], left);
+            m_moved_bytes += left;
+        }
+        m_head = 0;
+        m_tail = left;
+    }
+    space = m_buf.size() - m_tail;
+    return &m_buf[m_tail];
+}
+
+void EventPacker::commit(unsigned int byte_size)
+{
+    m_tail += byte_size;
+    m_recvs++;
+    m_recv_bytes += byte_size;
+}
+
+long long EventPacker::event_size(const unsigned char* p,
+                                  unsigned int avail) const
+{
+    if (avail < m_len_offset + m_len_bytes) {
+        return 0;
+    }
+    const unsigned char* f = p + m_len_offset;
+    unsigned long long len = 0;
+    for (unsigned int i = 0; i < m_len_bytes; i++) {
+        unsigned int k = m_len_big_endian ? i : m_len_bytes - 1 - i;
+        len = (len << 8) | f[k];
+    }
+    long long size = (long long)len + m_len_adjust;
+    if (size < (long long)(m_len_offset + m_len_bytes) ||
+        size > (long long)m_max_event_size) {
+        return -1;
+    }
+    return size;
+}
+
+int EventPacker::next_block(const unsigned char*& data)
+{
+    unsigned int pos = m_head;
+    unsigned int events = 0;
+
+    while (pos < m_tail) {
+        long long size = event_size(&m_buf[pos], m_tail - pos);
+        if (size < 0) {
+            return -1;
+        }
+        if (size == 0 || pos + size > m_tail) {
+            break;             // rest of the event not received yet
+        }
+        if (pos - m_head + size > m_block_size) {
+            break;             // block full
+        }
+        pos += size;
+        events++;
+    }
+
+    if (events == 0) {
+        return 0;
+    }
+    data = &m_buf[m_head];
+    int block_size = pos - m_head;
+    m_head = pos;
+    m_blocks++;
+    m_events += events;
+    return block_size;
+}
+
+bool EventPacker::has_event() const
+{
+    if (m_tail == m_head) {
+        return false;
+    }
+    long long size = event_size(&m_buf[m_head], m_tail - m_head);
+    // a bad length is reported by next_block()
+    return size < 0 || (size > 0 && m_head + size <= m_tail);
+}
+
+void EventPacker::reset_stats()
+{
+    m_recvs       = 0;
+    m_recv_bytes  = 0;
+    m_blocks      = 0;
+    m_events      = 0;
+    m_moved_bytes = 0;
+}
+
+void EventPacker::print_stats(std::ostream& os) const
+{
+    os << "framed receive: events: " << m_events
+       << " blocks: " << m_blocks;
+    if (m_blocks > 0) {
+        os << " events/block: " << (double)m_events/m_blocks;
+    }
+    os << " recv calls: " << m_recvs;
+    if (m_recvs > 0) {
+        os << " bytes/recv: " << m_recv_bytes/m_recvs;
+    }
+    os << " moved: " << m_moved_bytes << " bytes" << std::endl;
+    if (m_tail > m_head) {
+        os << "partial event carried over: " << m_tail - m_head
+           << " bytes" << std::endl;
+    }
+}
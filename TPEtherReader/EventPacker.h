@@ -0,0 +1,85 @@
+// -*- C++ -*-
+/*!
+ * @file EventPacker.h
+ * @brief Pack whole length-prefixed events from the stream into blocks.
+ * @date
+ * @author
+ *
+ */
+
+#ifndef EVENTPACKER_H
+#define EVENTPACKER_H
+
+#include <iostream>
+#include <vector>
+
+/*
+ * @class EventPacker
+ * @brief Staging buffer between the socket and the OutPort for
+ *        recvFraming "length".
+ *
+ * The caller receives into recv_space() with one large recv() and
+ * commit()s what arrived.  next_block() then walks the event headers
+ *
+ *   event size = length field + length adjust
+ *
+ * and returns as many whole events as fit into one block, as a pointer
+ * into the staging buffer (no copy).  The rest of a partial event stays
+ * in the buffer and is moved to its start before the next recv(), so
+ * a block never splits an event and no syscall is made per event.
+ *
+ * The staging buffer holds several blocks, so that one recv() usually
+ * brings in more than one block worth of events.
+ */
+class EventPacker
+{
+public:
+    EventPacker();
+    virtual ~EventPacker();
+
+    /// field_byte_size: 1, 2 or 4.  max_event_size 0: block_size.
+    int  configure(unsigned int block_size, unsigned int offset,
+                   unsigned int field_byte_size, bool big_endian,
+                   int adjust, unsigned int max_event_size);
+
+    /// forget buffered data (new connection)
+    void reset();
+
+    /// where to recv() next and how much fits there
+    unsigned char* recv_space(unsigned int& space);
+    void commit(unsigned int byte_size);
+
+    /// returns the block byte size, 0 if no whole event is buffered yet,
+    /// -1 on a bad length field.  data is valid until the next
+    /// recv_space().
+    int  next_block(const unsigned char*& data);
+    /// a whole event is buffered, next_block() returns it without recv()
+    bool has_event() const;
+
+    void reset_stats();
+    void print_stats(std::ostream& os) const;
+
+private:
+    /// 0: header not complete, -1: bad length
+    long long event_size(const unsigned char* p, unsigned int avail) const;
+
+    unsigned int m_block_size;
+    unsigned int m_len_offset;
+    unsigned int m_len_bytes;
+    bool m_len_big_endian;
+    int m_len_adjust;
+    unsigned int m_max_event_size;
+
+    std::vector<unsigned char> m_buf;
+    unsigned int m_head;                  /// first unsent byte
+    unsigned int m_tail;                  /// end of received data
+
+    // statistics
+    unsigned long long m_recvs;
+    unsigned long long m_recv_bytes;
+    unsigned long long m_blocks;
+    unsigned long long m_events;
+    unsigned long long m_moved_bytes;     /// partial events moved to front
+};
+
+#endif
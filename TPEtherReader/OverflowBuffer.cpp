@@ -0,0 +1,211 @@
+// -*- C++ -*-
+/*!
+ * @file OverflowBuffer.cpp
+ * @brief FIFO of received blocks while the OutPort is back-pressured.
+ * @date
+ * @author
+ *
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "OverflowBuffer.h"
+#include "BlockTime.h"
+
+OverflowBuffer::OverflowBuffer()
+    : m_slot_size(0), m_ring_head(0), m_ring_count(0),
+      m_spill_fd(-1), m_spill_max(0), m_spill_read(0), m_spill_write(0),
+      m_spill_blocks(0), m_blocks(0)
+{
+    reset_stats();
+}
+
+OverflowBuffer::~OverflowBuffer()
+{
+    close();
+}
+
+int OverflowBuffer::open(unsigned int ram_slots, unsigned int slot_size,
+                         const std::string& spill_dir,
+                         unsigned long long spill_max)
+{
+    close();
+
+    m_ring.resize(ram_slots);
+    for (unsigned int i = 0; i < ram_slots; i++) {
+        m_ring[i].data.reserve(slot_size);
+    }
+    m_slot_size  = slot_size;
+    m_ring_head  = 0;
+    m_ring_count = 0;
+    m_replay.resize(slot_size);
+
+    m_spill_max = spill_max;
+    if (spill_max > 0) {
+        std::string path = spill_dir + "/tpetherreader_spill.XXXXXX";
+        std::vector<char> name(path.begin(), path.end());
+        name.push_back('\0');
+        m_spill_fd = mkstemp(&name[0]);
+        if (m_spill_fd < 0) {
+            perror(&name[0]);
+            m_spill_max = 0;
+            return -1;
+        }
+        unlink(&name[0]);
+    }
+    return 0;
+}
+
+void OverflowBuffer::close()
+{
+    if (m_spill_fd >= 0) {
+        ::close(m_spill_fd);
+        m_spill_fd = -1;
+    }
+    m_ring_count   = 0;
+    m_spill_read   = 0;
+    m_spill_write  = 0;
+    m_spill_blocks = 0;
+    m_blocks       = 0;
+}
+
+bool OverflowBuffer::has_room() const
+{
+    if (m_spill_blocks == 0 && m_ring_count < m_ring.size()) {
+        return true;
+    }
+    return m_spill_fd >= 0 &&
+           m_spill_write - m_spill_read + sizeof(SpillRecord) + m_slot_size
+               <= m_spill_max;
+}
+
+int OverflowBuffer::push(const unsigned char* data, unsigned int size,
+                         unsigned long long recv_ns)
+{
+    if (size > m_slot_size || !has_room()) {
+        return -1;
+    }
+
+    if (m_spill_blocks == 0 && m_ring_count < m_ring.size()) {
+        Slot& slot = m_ring[(m_ring_head + m_ring_count) % m_ring.size()];
+        slot.data.assign(data, data + size);
+        slot.recv_ns = recv_ns;
+        m_ring_count++;
+    }
+    else {
+        SpillRecord rec;
+        rec.size    = size;
+        rec.pad     = 0;
+        rec.recv_ns = recv_ns;
+        struct iovec iov[2];
+        iov[0].iov_base = &rec;
+        iov[0].iov_len  = sizeof(rec);
+        iov[1].iov_base = (void*)data;
+        iov[1].iov_len  = size;
+        ssize_t n = pwritev(m_spill_fd, iov, 2, m_spill_write);
+        if (n != (ssize_t)(sizeof(rec) + size)) {
+            perror("OverflowBuffer: pwritev");
+            return -1;
+        }
+        m_spill_write += n;
+        m_spill_blocks++;
+        m_spilled_bytes += size;
+        if (m_spill_write - m_spill_read > m_max_spill_bytes) {
+            m_max_spill_bytes = m_spill_write - m_spill_read;
+        }
+    }
+
+    if (m_blocks == 0) {
+        m_episodes++;
+        m_episode_start_ns = mono_now_ns();
+    }
+    m_blocks++;
+    m_pushed++;
+    if (m_blocks > m_max_blocks) {
+        m_max_blocks = m_blocks;
+    }
+    return 0;
+}
+
+int OverflowBuffer::pop(const unsigned char*& data, unsigned long long& recv_ns)
+{
+    if (m_blocks == 0) {
+        return 0;
+    }
+
+    int size;
+    if (m_ring_count > 0) {
+        Slot& slot = m_ring[m_ring_head];
+        // swap, so that the slot keeps a buffer of the same capacity
+        m_replay.swap(slot.data);
+        size    = m_replay.size();
+        recv_ns = slot.recv_ns;
+        m_ring_head = (m_ring_head + 1) % m_ring.size();
+        m_ring_count--;
+    }
+    else {
+        SpillRecord rec;
+        if (pread(m_spill_fd, &rec, sizeof(rec), m_spill_read) != sizeof(rec) ||
+            rec.size > m_slot_size) {
+            perror("OverflowBuffer: pread");
+            return -1;
+        }
+        m_replay.resize(rec.size);
+        if (rec.size > 0 &&
+            pread(m_spill_fd, &m_replay[0], rec.size,
+                  m_spill_read + sizeof(rec)) != (ssize_t)rec.size) {
+            perror("OverflowBuffer: pread");
+            return -1;
+        }
+        size    = rec.size;
+        recv_ns = rec.recv_ns;
+        m_spill_read += sizeof(rec) + rec.size;
+        m_spill_blocks--;
+        if (m_spill_blocks == 0) {
+            // start over at the beginning of the file
+            m_spill_read  = 0;
+            m_spill_write = 0;
+            if (ftruncate(m_spill_fd, 0) < 0) {
+                perror("OverflowBuffer: ftruncate");
+            }
+        }
+    }
+
+    m_blocks--;
+    if (m_blocks == 0) {
+        m_recovery.add(mono_now_ns() - m_episode_start_ns);
+    }
+    data = m_replay.empty() ? 0 : &m_replay[0];
+    return size;
+}
+
+void OverflowBuffer::reset_stats()
+{
+    m_episodes         = 0;
+    m_episode_start_ns = 0;
+    m_pushed           = 0;
+    m_max_blocks       = 0;
+    m_spilled_bytes    = 0;
+    m_max_spill_bytes  = 0;
+    m_recovery.reset();
+}
+
+void OverflowBuffer::print_stats(std::ostream& os) const
+{
+    os << "overflow episodes: " << m_episodes
+       << " blocks: " << m_pushed
+       << " max_depth: " << m_max_blocks << " blocks"
+       << " spilled: " << m_spilled_bytes << " bytes"
+       << " max_spill: " << m_max_spill_bytes << " bytes" << std::endl;
+    if (m_recovery.count() > 0) {
+        m_recovery.print(os, "overflow_recovery");
+    }
+    if (m_blocks > 0) {
+        os << "### WARNING: overflow blocks not sent: " << m_blocks << std::endl;
+    }
+}
@@ -0,0 +1,96 @@
+// -*- C++ -*-
+/*!
+ * @file OverflowBuffer.h
+ * @brief FIFO of received blocks while the OutPort is back-pressured.
+ * @date
+ * @author
+ *
+ */
+
+#ifndef OVERFLOWBUFFER_H
+#define OVERFLOWBUFFER_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "LatencyHistogram.h"
+
+/*
+ * @class OverflowBuffer
+ * @brief Bounded RAM ring of blocks backed by a spill file.
+ *
+ * Blocks go to the RAM ring while it has a free slot and nothing is in
+ * the spill file, otherwise they are appended to the spill file.  All
+ * blocks in RAM are therefore older than those in the file, and pop()
+ * takes RAM first, then the file: the order is kept.  When the spill
+ * file becomes empty it is truncated, so its size is bounded by the
+ * longest backlog, not by the run.
+ *
+ * The spill file is unlinked right after it is created, so nothing is
+ * left on the scratch disk if the component dies.
+ *
+ * Used from the reader's daq_run() thread only.
+ */
+class OverflowBuffer
+{
+public:
+    OverflowBuffer();
+    virtual ~OverflowBuffer();
+
+    /// ram_slots: blocks kept in RAM, slot_size: max. block byte size,
+    /// spill_max: max. spill file bytes (0: no spill file)
+    int  open(unsigned int ram_slots, unsigned int slot_size,
+              const std::string& spill_dir, unsigned long long spill_max);
+    void close();
+
+    bool empty() const { return m_blocks == 0; }
+    unsigned long long blocks() const { return m_blocks; }
+    /// room for one more block of max. size
+    bool has_room() const;
+
+    int  push(const unsigned char* data, unsigned int size,
+              unsigned long long recv_ns);
+    /// data points into an internal buffer valid until the next pop().
+    /// returns the block byte size, -1 on spill file read error.
+    int  pop(const unsigned char*& data, unsigned long long& recv_ns);
+
+    void reset_stats();
+    void print_stats(std::ostream& os) const;
+
+private:
+    struct Slot {
+        std::vector<unsigned char> data;
+        unsigned long long recv_ns;
+    };
+    struct SpillRecord {
+        unsigned int size;
+        unsigned int pad;
+        unsigned long long recv_ns;
+    };
+
+    std::vector<Slot> m_ring;
+    unsigned int m_slot_size;
+    unsigned int m_ring_head;
+    unsigned int m_ring_count;
+
+    int m_spill_fd;
+    unsigned long long m_spill_max;
+    unsigned long long m_spill_read;      /// file offset of the oldest record
+    unsigned long long m_spill_write;     /// file offset to append at
+    unsigned long long m_spill_blocks;
+
+    std::vector<unsigned char> m_replay;  /// block read back from the file
+    unsigned long long m_blocks;          /// RAM + file
+
+    // statistics
+    unsigned long long m_episodes;        /// empty -> non-empty transitions
+    unsigned long long m_episode_start_ns;
+    unsigned long long m_pushed;
+    unsigned long long m_max_blocks;
+    unsigned long long m_spilled_bytes;
+    unsigned long long m_max_spill_bytes;
+    LatencyHistogram m_recovery;          /// first overflow -> empty again
+};
+
+#endif
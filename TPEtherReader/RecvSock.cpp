@@ -0,0 +1,348 @@
+// -*- C++ -*-
+/*!
+ * @file RecvSock.cpp
+ * @brief TCP receive socket with kernel receive time stamps.
+ * @date
+ * @author
+ *
+ */
+
+#include <iostream>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <ctime>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
+
+#include "RecvSock.h"
+#include "AsyncLog.h"
+
+RecvSock::RecvSock()
+    : m_fd(-1), m_connecting(false), m_timeout_sec(2.0), m_ts(false), m_hw_ts(false), m_no_ts(0)
+{
+}
+
+RecvSock::~RecvSock()
+{
+    disconnect();
+}
+
+int RecvSock::connect(const std::string& host, int port)
+{
+    if (open_socket(host, port, false) < 0) {
+        return ERROR_FATAL;
+    }
+    connected();
+    return 0;
+}
+
+/// For reconnecting in daq_run(): a blocking connect() to a host that
+/// does not answer takes the kernel's SYN retries, minutes, during
+/// which the stop command would not be handled.
+int RecvSock::connect_start(const std::string& host, int port)
+{
+    int ret = open_socket(host, port, true);
+    if (ret < 0) {
+        return ERROR_FATAL;
+    }
+    if (ret == CONNECT_PENDING) {
+        m_connecting = true;
+        return CONNECT_PENDING;
+    }
+    connected();
+    return 0;
+}
+
+int RecvSock::connect_wait(int timeout_ms)
+{
+    if (!m_connecting) {
+        return m_fd >= 0 ? 0 : ERROR_FATAL;
+    }
+    struct pollfd pfd;
+    pfd.fd      = m_fd;
+    pfd.events  = POLLOUT;
+    pfd.revents = 0;
+    int ret = poll(&pfd, 1, timeout_ms);
+    if (ret < 0 && errno != EINTR) {
+        perror("poll");
+        disconnect();
+        return ERROR_FATAL;
+    }
+    if (ret <= 0) {
+        return CONNECT_PENDING;
+    }
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(m_fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) {
+        err = errno;
+    }
+    if (err != 0) {
+        TPLOG_DEBUG("connect: %s", strerror(err));
+        disconnect();
+        return ERROR_FATAL;
+    }
+    connected();
+    return 0;
+}
+
+/// 0: connected, CONNECT_PENDING (nonblock only), -1: error
+int RecvSock::open_socket(const std::string& host, int port, bool nonblock)
+{
+    disconnect();
+
+    struct addrinfo hints;
+    struct addrinfo* res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    std::ostringstream service;
+    service << port;
+    int ret = getaddrinfo(host.c_str(), service.str().c_str(), &hints, &res);
+    if (ret != 0) {
+        std::cerr << "### ERROR: getaddrinfo: " << gai_strerror(ret)
+                  << std::endl;
+        return ERROR_FATAL;
+    }
+
+    m_fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (m_fd < 0) {
+        perror("socket");
+        freeaddrinfo(res);
+        return ERROR_FATAL;
+    }
+    if (nonblock) {
+        fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) | O_NONBLOCK);
+    }
+    if (::connect(m_fd, res->ai_addr, res->ai_addrlen) < 0) {
+        if (nonblock && errno == EINPROGRESS) {
+            freeaddrinfo(res);
+            return CONNECT_PENDING;
+        }
+        if (nonblock) {         // retried with backoff, not worth a line each
+            TPLOG_DEBUG("connect: %s", strerror(errno));
+        }
+        else {
+            perror("connect");
+        }
+        freeaddrinfo(res);
+        disconnect();
+        return ERROR_FATAL;
+    }
+    freeaddrinfo(res);
+    return 0;
+}
+
+/// blocking reads with the receive timeout from here on
+void RecvSock::connected()
+{
+    m_connecting = false;
+    fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) & ~O_NONBLOCK);
+    set_recv_timeout(m_timeout_sec);
+}
+
+int RecvSock::disconnect()
+{
+    if (m_fd >= 0) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+    m_connecting = false;
+    return 0;
+}
+
+void RecvSock::set_recv_timeout(double sec)
+{
+    m_timeout_sec = sec;
+    if (m_fd < 0) {
+        return;
+    }
+    struct timeval tv;
+    tv.tv_sec  = (time_t)sec;
+    tv.tv_usec = (suseconds_t)((sec - tv.tv_sec)*1000000);
+    setsockopt(m_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+int RecvSock::enable_timestamping(const std::string& hw_if)
+{
+    if (m_fd < 0) {
+        return -1;
+    }
+
+    int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+
+    m_hw_ts = false;
+    if (!hw_if.empty()) {
+        // ask the driver to stamp every received packet
+        struct hwtstamp_config hwconfig;
+        memset(&hwconfig, 0, sizeof(hwconfig));
+        hwconfig.tx_type   = HWTSTAMP_TX_OFF;
+        hwconfig.rx_filter = HWTSTAMP_FILTER_ALL;
+
+        struct ifreq ifr;
+        memset(&ifr, 0, sizeof(ifr));
+        strncpy(ifr.ifr_name, hw_if.c_str(), sizeof(ifr.ifr_name) - 1);
+        ifr.ifr_data = (char*)&hwconfig;
+        if (ioctl(m_fd, SIOCSHWTSTAMP, &ifr) == 0 &&
+            hwconfig.rx_filter != HWTSTAMP_FILTER_NONE) {
+            flags |= SOF_TIMESTAMPING_RX_HARDWARE |
+                     SOF_TIMESTAMPING_RAW_HARDWARE;
+            m_hw_ts = true;
+        }
+        else {
+            std::cerr << "### WARNING: hardware time stamp not available on "
+                      << hw_if << ": " << strerror(errno)
+                      << ", software only" << std::endl;
+        }
+    }
+
+    if (setsockopt(m_fd, SOL_SOCKET, SO_TIMESTAMPING,
+                   &flags, sizeof(flags)) < 0) {
+        perror("setsockopt SO_TIMESTAMPING");
+        m_ts = false;
+        m_hw_ts = false;
+        return -1;
+    }
+    m_ts = true;
+    return 0;
+}
+
+static unsigned long long timespec_ns(const struct timespec& ts)
+{
+    return (unsigned long long)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+int RecvSock::recv_ts(unsigned char* buf, int size)
+{
+    struct iovec iov;
+    iov.iov_base = buf;
+    iov.iov_len  = size;
+
+    char control[256];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control;
+    msg.msg_controllen = sizeof(control);
+
+    int n = recvmsg(m_fd, &msg, 0);
+    if (n <= 0) {
+        return n;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    unsigned long long now_ns = timespec_ns(now);
+
+    bool stamped = false;
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET ||
+            cmsg->cmsg_type != SCM_TIMESTAMPING) {
+            continue;
+        }
+        // ts[0]: software, ts[1]: deprecated, ts[2]: raw hardware
+        struct timespec ts[3];
+        memcpy(ts, CMSG_DATA(cmsg), sizeof(ts));
+        unsigned long long sw_ns = timespec_ns(ts[0]);
+        unsigned long long hw_ns = timespec_ns(ts[2]);
+        if (sw_ns > 0 && now_ns >= sw_ns) {
+            m_sw_gap.add(now_ns - sw_ns);
+            stamped = true;
+        }
+        if (m_hw_ts && hw_ns > 0 && now_ns >= hw_ns) {
+            m_hw_gap.add(now_ns - hw_ns);
+        }
+    }
+    if (!stamped) {
+        m_no_ts++;
+    }
+
+    return n;
+}
+
+int RecvSock::readAll(unsigned char* buf, int size)
+{
+    int received = 0;
+
+    while (received < size) {
+        int n = readSome(buf + received, size - received);
+        if (n < 0) {
+            return n;
+        }
+        received += n;
+    }
+
+    return received;
+}
+
+int RecvSock::readSome(unsigned char* buf, int size)
+{
+    for (;;) {
+        int n;
+        if (m_ts) {
+            n = recv_ts(buf, size);
+        }
+        else {
+            n = recv(m_fd, buf, size, 0);
+        }
+
+        if (n > 0) {
+            return n;
+        }
+        if (n == 0) {
+            TPLOG_WARNING("RecvSock: connection closed by peer");
+            return ERROR_FATAL;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return ERROR_TIMEOUT;
+        }
+        TPLOG_ERROR("recv: %s", strerror(errno));
+        return ERROR_FATAL;
+    }
+}
+
+bool RecvSock::readable(int timeout_ms)
+{
+    struct pollfd pfd;
+    pfd.fd      = m_fd;
+    pfd.events  = POLLIN;
+    pfd.revents = 0;
+    return poll(&pfd, 1, timeout_ms) > 0 && (pfd.revents & POLLIN);
+}
+
+void RecvSock::reset_stats()
+{
+    m_sw_gap.reset();
+    m_hw_gap.reset();
+    m_no_ts = 0;
+}
+
+void RecvSock::print_stats(std::ostream& os) const
+{
+    if (!m_ts) {
+        return;
+    }
+    m_sw_gap.print(os, "kernel_to_user");
+    if (m_hw_ts) {
+        m_hw_gap.print(os, "nic_to_user");
+    }
+    if (m_no_ts > 0) {
+        os << "recvmsg without time stamp: " << m_no_ts << std::endl;
+    }
+}
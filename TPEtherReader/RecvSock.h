@@ -0,0 +1,83 @@
+// -*- C++ -*-
+/*!
+ * @file RecvSock.h
+ * @brief TCP receive socket with kernel receive time stamps.
+ * @date
+ * @author
+ *
+ */
+
+#ifndef RECVSOCK_H
+#define RECVSOCK_H
+
+#include <string>
+
+#include "LatencyHistogram.h"
+
+/*
+ * @class RecvSock
+ * @brief Replacement of DAQMW::Sock for the TPEtherReader receive path
+ *        when the socket descriptor itself is needed.
+ *
+ * Return values of readAll() are the same as DAQMW::Sock.
+ *
+ * With enable_timestamping() the socket gets SO_TIMESTAMPING and
+ * readAll() uses recvmsg() to take the kernel receive time stamp of
+ * the newest segment of every recvmsg().  The difference to the time
+ * recvmsg() returned is how long the data waited in the socket buffer.
+ * Hardware time stamps are in the NIC clock; the hardware gap is
+ * meaningful only if the NIC clock is synchronized to the system clock
+ * (e.g. phc2sys).
+ */
+class RecvSock
+{
+public:
+    static const int ERROR_FATAL   = -1;
+    static const int ERROR_TIMEOUT = -2;
+    static const int CONNECT_PENDING = 1;
+
+    RecvSock();
+    virtual ~RecvSock();
+
+    int  connect(const std::string& host, int port);
+    /// connect without blocking: 0 connected, CONNECT_PENDING (finish
+    /// with connect_wait()), ERROR_FATAL
+    int  connect_start(const std::string& host, int port);
+    /// waits at most timeout_ms: 0 connected, CONNECT_PENDING, ERROR_FATAL
+    int  connect_wait(int timeout_ms);
+    bool connecting() const { return m_connecting; }
+    int  disconnect();
+    int  fd() const { return m_fd; }
+    void set_recv_timeout(double sec);
+
+    /// hw_if: interface for hardware time stamps, "" for software only.
+    /// returns -1 if time stamping could not be enabled at all.
+    int  enable_timestamping(const std::string& hw_if);
+    bool hw_timestamping() const { return m_hw_ts; }
+
+    int  readAll(unsigned char* buf, int size);
+    /// one recv(): returns 1..size bytes, or ERROR_FATAL/ERROR_TIMEOUT
+    int  readSome(unsigned char* buf, int size);
+    /// data waiting in the socket buffer (waits at most timeout_ms)
+    bool readable(int timeout_ms);
+
+    void reset_stats();
+    void print_stats(std::ostream& os) const;
+
+private:
+    int  recv_ts(unsigned char* buf, int size);
+    int  open_socket(const std::string& host, int port, bool nonblock);
+    void connected();
+
+    int m_fd;
+    bool m_connecting;                   /// connect_start() in progress
+    double m_timeout_sec;
+    bool m_ts;
+    bool m_hw_ts;
+
+    LatencyHistogram m_sw_gap;           /// kernel (software) -> user
+    LatencyHistogram m_hw_gap;           /// NIC (hardware) -> user
+    unsigned long long m_no_ts;          /// recvmsg() without time stamp
+};
+
+#endif
@@ -7,6 +7,8 @@
  *
  */
 
+#include <fcntl.h>
+
 #include "TPEtherReader.h"
 
 using DAQMW::FatalType::DATAPATH_DISCONNECTED;
@@ -35,19 +37,95 @@ TPEtherReader::TPEtherReader(RTC::Manager* manager)
     : DAQMW::DaqComponentBase(manager),
       m_OutPort("tpetherreader_out", m_out_data),
       m_sock(0),
+      m_rsock(0),
+      m_kernel_ts(false),
       m_data(0),
       m_bufsize_kb(0),
       m_bufsize(0),
+      m_set_data(&TPEtherReader::set_data),
       m_recv_byte_size(0),
+      m_recv_time_ns(0),
       m_out_status(BUF_SUCCESS),
-
-      m_debug(false)
+      m_num_out_ports(1),
+      m_fanout_policy(FANOUT_ROUND_ROBIN),
+      m_out_index(0),
+      m_hash_index(0),
+      m_out_attempts(0),
+      m_out_first_try_ns(0),
+      m_port_report_ns(0),
+      m_port_last_report_ns(0),
+      m_blocks_per_run(1),
+      m_run_slice_ns(0),
+      m_last_exit_ns(0),
+      m_run_calls(0),
+      m_run_blocks(0),
+      m_run_busy_ns(0),
+      m_perf_enabled(false),
+      m_udp_mode(false),
+      m_udp_batch(64),
+      m_udp_max_datagram(9000),
+      m_udp_rcvbuf_mb(0),
+      m_udp_seq_offset(0),
+      m_udp_seq_byte_size(0),
+      m_udp_seq_big_endian(true),
+      m_udp_report_ns(10ULL*1000000000ULL),
+      m_udp_last_report_ns(0),
+      m_capture(false),
+      m_capture_max_mb(0),
+      m_capture_header_footer(false),
+      m_pipe_size(0),
+      m_splice_calls(0),
+      m_framed(false),
+      m_ev_len_offset(0),
+      m_ev_len_byte_size(4),
+      m_ev_len_big_endian(true),
+      m_ev_len_adjust(0),
+      m_ev_max_byte_size(0),
+      m_zs_enabled(false),
+      m_zs_channels(1),
+      m_zs_thresholds("0"),
+      m_zs_scalar(false),
+      m_overflow_enabled(false),
+      m_overflow_ram_mb(64),
+      m_spill_dir("/tmp"),
+      m_spill_mb(1024),
+      m_overflow_full(0),
+      m_persistent(false),
+      m_reconnect_backoff_ms(RECONNECT_MIN_MS),
+      m_reconnect_at_ns(0),
+      m_connect_start_ns(0),
+      m_reconnects(0),
+      m_coalesce_bytes(0),
+      m_coalesce_max_blocks(0),
+      m_coalesce_age_ns(1000000ULL),
+      m_sub_seq(0),
+      m_pending_sub_blocks(0),
+      m_sub_blocks(0),
+      m_flush_size(0),
+      m_flush_age(0),
+      m_trace(false),
+      m_trace_dir("/tmp"),
+      m_trace_mb(64)
 {
+    m_pipe[0] = -1;
+    m_pipe[1] = -1;
+
     // Registration: InPort/OutPort/Service
 
     // Set OutPort buffers
     registerOutPort("tpetherreader_out", m_OutPort);
 
+    m_out_datas[0] = &m_out_data;
+    m_out_ports[0] = &m_OutPort;
+    for (int i = 1; i < MAX_OUT_PORTS; i++) {
+        std::ostringstream port_name;
+        port_name << "tpetherreader_out" << i;
+        m_out_datas[i] = new TimedOctetSeq();
+        m_out_ports[i] = new OutPort<TimedOctetSeq>(port_name.str().c_str(),
+                                                    *m_out_datas[i]);
+        registerOutPort(port_name.str().c_str(), *m_out_ports[i]);
+    }
+
     init_command_port();
     init_state_table();
     set_comp_name("TPETHERREADER");
@@ -55,13 +133,16 @@ TPEtherReader::TPEtherReader(RTC::Manager* manager)
 
 TPEtherReader::~TPEtherReader()
 {
+    delete m_rsock;
+    for (int i = 1; i < MAX_OUT_PORTS; i++) {
+        delete m_out_ports[i];
+        delete m_out_datas[i];
+    }
 }
 
 RTC::ReturnCode_t TPEtherReader::onInitialize()
 {
-    if (m_debug) {
-        std::cerr << "TPEtherReader::onInitialize()" << std::endl;
-    }
+    TPLOG_DEBUG("TPEtherReader::onInitialize()");
 
     return RTC::RTC_OK;
 }
@@ -81,12 +162,27 @@ int TPEtherReader::daq_dummy()
 int TPEtherReader::daq_configure()
 {
     std::cerr << "*** TPEtherReader::configure" << std::endl;
+    unsigned long long t_configure = mono_now_ns();
 
     ::NVList* paramList;
     paramList = m_daq_service0.getCompParams();
     parse_params(paramList);
 
     m_data = new unsigned char[m_bufsize];
+
+    m_set_data = select_set_data();
+    std::cerr << "set_data: "
+              << (m_set_data == &TPEtherReader::set_data ? "generic" : "fixed")
+              << " for " << m_bufsize << " byte blocks" << std::endl;
+
+    if (m_trace) {
+        Trace::enable(m_trace_mb*1024ULL*1024ULL);
+        Trace::set_thread_name("TPEtherReader");
+        Trace::complete("configure", t_configure, mono_now_ns());
+    }
+    else {
+        Trace::enable(0);
+    }
     return 0;
 }
 
@@ -107,31 +203,254 @@ int TPEtherReader::parse_params(::NVList* list)
 
         if ( sname == "srcAddr" ) {
             srcAddrSpecified = true;
-            if (m_debug) {
-                std::cerr << "source addr: " << svalue << std::endl;
-            }
+            TPLOG_DEBUG("source addr: %s", svalue.c_str());
             m_srcAddr = svalue;
         }
         if ( sname == "srcPort" ) {
             srcPortSpecified = true;
-            if (m_debug) {
-                std::cerr << "source port: " << svalue << std::endl;
-            }
+            TPLOG_DEBUG("source port: %s", svalue.c_str());
             char* offset;
             m_srcPort = (int)strtol(svalue.c_str(), &offset, 10);
         }
 
         if ( sname == "bufsize_kb" ) {
-            if (m_debug) {
-                std::cerr << "bufsize_kb " << svalue << std::endl;
-            }
+            TPLOG_DEBUG("bufsize_kb %s", svalue.c_str());
             char* offset;
             m_bufsize_kb = (int)strtol(svalue.c_str(), &offset, 10);
             m_bufsize = m_bufsize_kb*1024;
         }
 
+        if ( sname == "logLevel" ) {
+            if (AsyncLog::set_level(svalue) < 0) {
+                std::cerr << "### ERROR: unknown logLevel: "
+                          << svalue << std::endl;
+                fatal_error_report(USER_DEFINED_ERROR1, "BAD LOGLEVEL");
+            }
+        }
+
+        if ( sname == "numOutPorts" ) {
+            char* offset;
+            m_num_out_ports = (int)strtol(svalue.c_str(), &offset, 10);
+            if (m_num_out_ports < 1 || m_num_out_ports > MAX_OUT_PORTS) {
+                std::cerr << "### ERROR: numOutPorts must be 1.."
+                          << MAX_OUT_PORTS << std::endl;
+                fatal_error_report(USER_DEFINED_ERROR1, "BAD NUMOUTPORTS");
+            }
+        }
+        if ( sname == "fanOutPolicy" ) {
+            if (svalue == "roundrobin") {
+                m_fanout_policy = FANOUT_ROUND_ROBIN;
+            }
+            else if (svalue == "leastbacklog") {
+                m_fanout_policy = FANOUT_LEAST_BACKLOG;
+            }
+            else if (svalue == "hash") {
+                m_fanout_policy = FANOUT_HASH;
+            }
+            else {
+                std::cerr << "### ERROR: unknown fanOutPolicy: "
+                          << svalue << std::endl;
+                fatal_error_report(USER_DEFINED_ERROR1, "BAD FANOUTPOLICY");
+            }
+        }
+
+        if ( sname == "kernelTimestamps" ) {
+            m_kernel_ts = (svalue == "yes");
+        }
+        if ( sname == "hwTimestampIf" ) {
+            m_hw_ts_if = svalue;
+        }
+
+        if ( sname == "perfCounters" ) {
+            m_perf_enabled = (svalue == "yes");
+        }
+
+        if ( sname == "zeroSuppress" ) {
+            m_zs_enabled = (svalue == "yes");
+        }
+        if ( sname == "zsChannels" ) {
+            char* offset;
+            m_zs_channels = (unsigned int)strtoul(svalue.c_str(), &offset, 10);
+        }
+        if ( sname == "zsThresholds" ) {
+            m_zs_thresholds = svalue;
+        }
+        if ( sname == "zsKernel" ) {
+            m_zs_scalar = (svalue == "scalar");
+        }
+
+        if ( sname == "overflowPolicy" ) {
+            if (svalue == "spill") {
+                m_overflow_enabled = true;
+            }
+            else if (svalue == "block") {
+                m_overflow_enabled = false;
+            }
+            else {
+                std::cerr << "### ERROR: unknown overflowPolicy: "
+                          << svalue << std::endl;
+                fatal_error_report(USER_DEFINED_ERROR1, "BAD OVERFLOWPOLICY");
+            }
+        }
+        if ( sname == "overflowRamMB" ) {
+            char* offset;
+            m_overflow_ram_mb = (unsigned int)strtoul(svalue.c_str(), &offset, 10);
+        }
+        if ( sname == "overflowSpillDir" ) {
+            m_spill_dir = svalue;
+        }
+        if ( sname == "overflowSpillMB" ) {
+            char* offset;
+            m_spill_mb = (unsigned int)strtoul(svalue.c_str(), &offset, 10);
+        }
+
+        if ( sname == "protocol" ) {
+            if (svalue == "udp") {
+                m_udp_mode = true;
+            }
+            else if (svalue == "tcp") {
+                m_udp_mode = false;
+            }
+            else {
+                std::cerr << "### ERROR: unknown protocol: "
+                          << svalue << std::endl;
+                fatal_error_report(USER_DEFINED_ERROR1, "BAD PROTOCOL");
+            }
+        }
+        if ( sname == "udpBindAddr" ) {
+            m_udp_bind_addr = svalue;
+        }
+        if ( sname == "udpBatch" ) {
+            char* offset;
+            m_udp_batch = (unsigned int)strtoul(svalue.c_str(), &offset, 10);
+        }
+        if ( sname == "udpMaxDatagram" ) {
+            char* offset;
+            m_udp_max_datagram = (unsigned int)strtoul(svalue.c_str(), &offset, 10);
+        }
+        if ( sname == "udpRcvBufMB" ) {
+            char* offset;
+            m_udp_rcvbuf_mb = (unsigned int)strtoul(svalue.c_str(), &offset, 10);
+        }
+        if ( sname == "udpSeqOffset" ) {
+            char* offset;
+            m_udp_seq_offset = (unsigned int)strtoul(svalue.c_str(), &offset, 0);
+        }
+        if ( sname == "udpSeqByteSize" ) {
+            char* offset;
+            m_udp_seq_byte_size = (unsigned int)strtoul(svalue.c_str(), &offset, 0);
+        }
+        if ( sname == "udpSeqByteOrder" ) {
+            m_udp_seq_big_endian = (svalue != "little");
+        }
+        if ( sname == "udpLossReportSec" ) {
+            char* offset;
+            m_udp_report_ns = strtoull(svalue.c_str(), &offset, 10)*1000000000ULL;
+        }
+        if ( sname == "portStatsReportSec" ) {
+            char* offset;
+            m_port_report_ns = strtoull(svalue.c_str(), &offset, 10)*1000000000ULL;
+        }
+
+        if ( sname == "captureMode" ) {
+            if (svalue == "splice") {
+                m_capture = true;
+            }
+            else if (svalue == "none") {
+                m_capture = false;
+            }
+            else {
+                std::cerr << "### ERROR: unknown captureMode: "
+                          << svalue << std::endl;
+                fatal_error_report(USER_DEFINED_ERROR1, "BAD CAPTUREMODE");
+            }
+        }
+        if ( sname == "captureDir" ) {
+            m_capture_dir = svalue;
+        }
+        if ( sname == "captureMaxFileSizeInMegaByte" ) {
+            char* offset;
+            m_capture_max_mb = (unsigned int)strtoul(svalue.c_str(), &offset, 10);
+        }
+        if ( sname == "captureHeaderFooter" ) {
+            m_capture_header_footer = (svalue == "yes");
+        }
+
+        if ( sname == "recvFraming" ) {
+            if (svalue == "length") {
+                m_framed = true;
+            }
+            else if (svalue == "fixed") {
+                m_framed = false;
+            }
+            else {
+                std::cerr << "### ERROR: unknown recvFraming: "
+                          << svalue << std::endl;
+                fatal_error_report(USER_DEFINED_ERROR1, "BAD RECVFRAMING");
+            }
+        }
+        if ( sname == "eventLengthOffset" ) {
+            char* offset;
+            m_ev_len_offset = (unsigned int)strtoul(svalue.c_str(), &offset, 0);
+        }
+        if ( sname == "eventLengthByteSize" ) {
+            char* offset;
+            m_ev_len_byte_size = (unsigned int)strtoul(svalue.c_str(), &offset, 0);
+        }
+        if ( sname == "eventLengthByteOrder" ) {
+            m_ev_len_big_endian = (svalue != "little");
+        }
+        if ( sname == "eventLengthAdjust" ) {
+            char* offset;
+            m_ev_len_adjust = (int)strtol(svalue.c_str(), &offset, 0);
+        }
+        if ( sname == "eventMaxByteSize" ) {
+            char* offset;
+            m_ev_max_byte_size = (unsigned int)strtoul(svalue.c_str(), &offset, 0);
+        }
+
+        if ( sname == "coalesceMaxKB" ) {
+            char* offset;
+            m_coalesce_bytes = (unsigned int)strtoul(svalue.c_str(), &offset, 10)*1024;
+        }
+        if ( sname == "coalesceMaxBlocks" ) {
+            char* offset;
+            m_coalesce_max_blocks = (unsigned int)strtoul(svalue.c_str(), &offset, 10);
+        }
+        if ( sname == "coalesceMaxAgeUs" ) {
+            char* offset;
+            m_coalesce_age_ns = strtoull(svalue.c_str(), &offset, 10)*1000ULL;
+        }
+
+        if ( sname == "persistentConnection" ) {
+            m_persistent = (svalue == "yes");
+        }
+
+        if ( sname == "trace" ) {
+            m_trace = (svalue == "yes");
+        }
+        if ( sname == "traceDir" ) {
+            m_trace_dir = svalue;
+        }
+        if ( sname == "traceBufferMB" ) {
+            char* offset;
+            m_trace_mb = (unsigned int)strtoul(svalue.c_str(), &offset, 10);
+        }
+
+        if ( sname == "blocksPerRun" ) {
+            char* offset;
+            m_blocks_per_run = (unsigned int)strtoul(svalue.c_str(), &offset, 10);
+            if (m_blocks_per_run == 0) {
+                m_blocks_per_run = 1;
+            }
+        }
+        if ( sname == "runTimeSliceUs" ) {
+            char* offset;
+            m_run_slice_ns = strtoull(svalue.c_str(), &offset, 10)*1000ULL;
+        }
+
     }
-    if (!srcAddrSpecified) {
+    if (!srcAddrSpecified && !m_udp_mode) {
         std::cerr << "### ERROR:data source address not specified\n";
         fatal_error_report(USER_DEFINED_ERROR1, "NO SRC ADDRESS");
     }
@@ -140,13 +459,114 @@ int TPEtherReader::parse_params(::NVList* list)
         fatal_error_report(USER_DEFINED_ERROR2, "NO SRC PORT");
     }
 
+    // FNV-1a of "addr:port", so that every reader of the same source
+    // sends to the same logger
+    std::ostringstream source;
+    source << m_srcAddr << ":" << m_srcPort;
+    std::string src = source.str();
+    unsigned int hash = 2166136261U;
+    for (unsigned int i = 0; i < src.size(); i++) {
+        hash ^= (unsigned char)src[i];
+        hash *= 16777619U;
+    }
+    m_hash_index = hash % m_num_out_ports;
+
+    if (m_capture) {
+        if (m_udp_mode || m_framed || m_zs_enabled || m_overflow_enabled) {
+            std::cerr << "### ERROR: captureMode splice takes the raw TCP"
+                      << " stream only" << std::endl;
+            fatal_error_report(USER_DEFINED_ERROR1, "BAD CAPTUREMODE");
+        }
+        if (!m_capture_files.check_dir(m_capture_dir)) {
+            std::cerr << "Can not open directory:" << m_capture_dir << std::endl;
+            fatal_error_report(USER_DEFINED_ERROR1, "BAD CAPTURE DIR");
+        }
+    }
+
+    if (m_udp_mode) {
+        if (m_framed || m_zs_enabled || m_overflow_enabled) {
+            std::cerr << "### ERROR: protocol udp does not work with"
+                      << " recvFraming, zeroSuppress or overflowPolicy"
+                      << std::endl;
+            fatal_error_report(USER_DEFINED_ERROR1, "BAD PROTOCOL");
+        }
+        if (m_udp_max_datagram == 0 || m_udp_max_datagram > (unsigned int)m_bufsize) {
+            std::cerr << "### ERROR: udpMaxDatagram must be 1 .. bufsize_kb*1024"
+                      << std::endl;
+            fatal_error_report(USER_DEFINED_ERROR1, "BAD PROTOCOL");
+        }
+        if (m_udp.set_seq_field(m_udp_seq_offset, m_udp_seq_byte_size,
+                                m_udp_seq_big_endian) < 0) {
+            std::cerr << "### ERROR: udpSeqByteSize must be 0, 1, 2, 4 or 8"
+                      << std::endl;
+            fatal_error_report(USER_DEFINED_ERROR1, "BAD PROTOCOL");
+        }
+    }
+
+    if (m_framed) {
+        if (m_zs_enabled) {
+            std::cerr << "### ERROR: zeroSuppress works on fixed size blocks,"
+                      << " not with recvFraming length" << std::endl;
+            fatal_error_report(USER_DEFINED_ERROR1, "BAD RECVFRAMING");
+        }
+        if (m_packer.configure(m_bufsize, m_ev_len_offset, m_ev_len_byte_size,
+                               m_ev_len_big_endian, m_ev_len_adjust,
+                               m_ev_max_byte_size) < 0) {
+            std::cerr << "### ERROR: bad eventLengthOffset/eventLengthByteSize"
+                      << std::endl;
+            fatal_error_report(USER_DEFINED_ERROR1, "BAD RECVFRAMING");
+        }
+    }
+
+    if (m_zs_enabled) {
+        std::vector<unsigned int> thresholds;
+        if (ZeroSuppressor::parse_thresholds(m_zs_thresholds, thresholds) < 0 ||
+            m_zs.configure(m_zs_channels, thresholds) < 0) {
+            std::cerr << "### ERROR: bad zsChannels/zsThresholds: "
+                      << m_zs_channels << " / " << m_zs_thresholds << std::endl;
+            fatal_error_report(USER_DEFINED_ERROR1, "BAD ZERO SUPPRESSION");
+        }
+        m_zs.force_scalar(m_zs_scalar);
+        std::cerr << "zero suppression: " << m_zs_channels << " channels, kernel "
+                  << m_zs.kernel_name() << std::endl;
+    }
+
+    if (m_coalesce_bytes > 0) {
+        if (m_capture) {
+            std::cerr << "### ERROR: captureMode splice sends nothing to"
+                      << " coalesce" << std::endl;
+            fatal_error_report(USER_DEFINED_ERROR1, "BAD COALESCE");
+        }
+        if (m_coalesce_bytes < max_block_size()) {
+            // with zeroSuppress a sub-block can be larger than bufsize_kb
+            std::cerr << "### ERROR: coalesceMaxKB must hold a whole block of "
+                      << max_block_size() << " bytes" << std::endl;
+            fatal_error_report(USER_DEFINED_ERROR1, "BAD COALESCE");
+        }
+        if (m_coalesce_max_blocks == 0) {
+            m_coalesce_max_blocks = m_bufsize > 0 ? m_coalesce_bytes/m_bufsize : 1;
+        }
+        std::cerr << "coalesce: " << m_coalesce_bytes/1024 << " kB, "
+                  << m_coalesce_max_blocks << " blocks, "
+                  << m_coalesce_age_ns/1000 << " us" << std::endl;
+    }
+
     return 0;
 }
 
 int TPEtherReader::daq_unconfigure()
 {
+    AsyncLog::flush();
     std::cerr << "*** TPEtherReader::unconfigure" << std::endl;
     delete [] m_data;
+    m_data = 0;
+
+    m_udp.close();
+    if (m_rsock) {          // persistent connection ends here
+        m_rsock->disconnect();
+        delete m_rsock;
+        m_rsock = 0;
+    }
 
     return 0;
 }
@@ -154,41 +574,132 @@ int TPEtherReader::daq_unconfigure()
 int TPEtherReader::daq_start()
 {
     std::cerr << "*** TPEtherReader::start" << std::endl;
+    unsigned long long t_start = mono_now_ns();
 
     m_out_status = BUF_SUCCESS;
 
-    try {
-        // Create socket and connect to data server.
-        m_sock = new DAQMW::Sock();
-        m_sock->connect(m_srcAddr, m_srcPort);
-    } catch (DAQMW::SockException& e) {
-        std::cerr << "Sock Fatal Error : " << e.what() << std::endl;
-        fatal_error_report(USER_DEFINED_ERROR1, "SOCKET FATAL ERROR");
-    } catch (...) {
-        std::cerr << "Sock Fatal Error : Unknown" << std::endl;
-        fatal_error_report(USER_DEFINED_ERROR1, "SOCKET FATAL ERROR");
+    // exactly one source per run: UDP, RecvSock (kernelTimestamps,
+    // overflowPolicy, ...: see use_rsock()) or DAQMW::Sock.  The overflow
+    // buffer below is opened on top of RecvSock, not instead of a socket.
+    if (m_udp_mode) {
+        if (!m_udp.is_open() &&
+            m_udp.open(m_udp_bind_addr, m_srcPort, m_udp_batch,
+                       m_udp_max_datagram, m_udp_rcvbuf_mb*1024*1024) < 0) {
+            std::cerr << "UdpRecv Fatal Error : bind" << std::endl;
+            fatal_error_report(USER_DEFINED_ERROR1, "SOCKET FATAL ERROR");
+        }
+        m_udp.reset_stats();
+        m_udp_last_report_ns = mono_now_ns();
+    }
+    else if (use_rsock()) {
+        // DAQMW::Sock does not give us the descriptor for recvmsg()
+        // and poll()
+        if (m_rsock == 0) {
+            m_rsock = new RecvSock();
+        }
+        if (m_rsock->fd() >= 0 && !m_rsock->connecting()) {
+            std::cerr << "TPEtherReader: keep connection to "
+                      << m_srcAddr << ":" << m_srcPort << std::endl;
+        }
+        else if (open_connection() < 0) {
+            std::cerr << "RecvSock Fatal Error : connect" << std::endl;
+            fatal_error_report(USER_DEFINED_ERROR1, "SOCKET FATAL ERROR");
+        }
+        m_rsock->reset_stats();
+        m_reconnect_backoff_ms = RECONNECT_MIN_MS;
+        m_reconnects = 0;
+    }
+    else {
+        try {
+            // Create socket and connect to data server.
+            m_sock = new DAQMW::Sock();
+            m_sock->connect(m_srcAddr, m_srcPort);
+        } catch (DAQMW::SockException& e) {
+            std::cerr << "Sock Fatal Error : " << e.what() << std::endl;
+            fatal_error_report(USER_DEFINED_ERROR1, "SOCKET FATAL ERROR");
+        } catch (...) {
+            std::cerr << "Sock Fatal Error : Unknown" << std::endl;
+            fatal_error_report(USER_DEFINED_ERROR1, "SOCKET FATAL ERROR");
+        }
     }
 
-    // Check data port connections
-    bool outport_conn = check_dataPort_connections( m_OutPort );
-    if (!outport_conn) {
-        std::cerr << "### NO Connection" << std::endl;
-        fatal_error_report(DATAPATH_DISCONNECTED);
+    if (m_overflow_enabled) {
+        unsigned int slots = (unsigned long long)m_overflow_ram_mb*1024*1024
+                           / max_block_size();
+        if (slots == 0) {
+            slots = 1;
+        }
+        if (m_overflow.open(slots, max_block_size(), m_spill_dir,
+                            (unsigned long long)m_spill_mb*1024*1024) < 0) {
+            std::cerr << "### WARNING: cannot create spill file in "
+                      << m_spill_dir << ", RAM only" << std::endl;
+        }
+        m_overflow.reset_stats();
+        m_overflow_full = 0;
+    }
+
+    if (m_capture && open_capture() < 0) {
+        fatal_error_report(USER_DEFINED_ERROR1, "CAPTURE FILE ERROR");
+    }
+
+    // Check data port connections (not used in capture mode)
+    for (int i = 0; i < m_num_out_ports; i++) {
+        bool outport_conn = check_dataPort_connections( *m_out_ports[i] );
+        if (!outport_conn && !m_capture) {
+            std::cerr << "### NO Connection: OutPort " << i << std::endl;
+            fatal_error_report(DATAPATH_DISCONNECTED);
+        }
+        m_out_blocks[i] = 0;
+        m_out_cost_ns[i] = 0;
+        m_out_stats[i].reset();
+        m_out_stats_run[i].reset();
+    }
+    m_out_index = 0;
+    m_out_attempts = 0;
+    m_port_last_report_ns = mono_now_ns();
+
+    m_last_exit_ns = 0;
+    m_run_calls    = 0;
+    m_run_blocks   = 0;
+    m_run_busy_ns  = 0;
+    m_framework_gap.reset();
+    m_zs.reset_stats();
+    m_packer.reset_stats();
+    m_sub_seq     = 0;
+    m_sub_blocks  = 0;
+    m_flush_size  = 0;
+    m_flush_age   = 0;
+
+    if (m_perf_enabled) {
+        m_perf.open();
+        m_perf.start();
     }
 
     gettimeofday(&m_tv_start, NULL);
+    Trace::complete("start", t_start, mono_now_ns());
+    std::cerr << "start_latency: " << (mono_now_ns() - t_start)/1e6 << " ms"
+              << std::endl;
     return 0;
 }
 
 int TPEtherReader::daq_stop()
 {
+    AsyncLog::flush();     // messages of the run before the report
     std::cerr << "*** TPEtherReader::stop" << std::endl;
+    unsigned long long t_stop = mono_now_ns();
+
+    if (m_perf_enabled) {
+        m_perf.stop();
+    }
 
     if (m_sock) {
         m_sock->disconnect();
         delete m_sock;
         m_sock = 0;
     }
+    if (m_rsock && !m_persistent) {
+        m_rsock->disconnect();
+    }
 
     gettimeofday(&m_tv_stop, NULL);
     struct timeval tv_diff;
@@ -197,13 +708,235 @@ int TPEtherReader::daq_stop()
     unsigned long long total_bytes_size = get_total_byte_size();
     double transfer_rate = total_bytes_size / elapsed_sec / 1024.0 / 1024.0;
     std::cerr << "transfer_rate: " << transfer_rate << " MB/s" << std::endl;
+    if (m_perf_enabled) {
+        m_perf.print(std::cerr, get_sequence_num(), get_total_byte_size());
+        m_perf.close();
+    }
+
+    report_loop_overhead();
+    if (m_coalesce_bytes > 0) {
+        std::cerr << "coalesce: sub-blocks: " << m_sub_blocks;
+        if (get_sequence_num() > 0) {
+            std::cerr << " sub-blocks/block: "
+                      << (double)m_sub_blocks/get_sequence_num();
+        }
+        std::cerr << " ended by size: " << m_flush_size
+                  << " by age: " << m_flush_age << std::endl;
+    }
+    if (m_zs_enabled) {
+        m_zs.print_stats(std::cerr);
+    }
+    if (m_framed) {
+        m_packer.print_stats(std::cerr);
+    }
+    if (m_capture) {
+        close_capture();
+    }
+    if (m_udp_mode) {
+        m_udp.print_stats(std::cerr);
+        if (!m_persistent) {
+            m_udp.close();
+        }
+    }
+    if (m_overflow_enabled) {
+        m_overflow.print_stats(std::cerr);
+        if (m_overflow_full > 0) {
+            std::cerr << "overflow full, socket not read: "
+                      << m_overflow_full << " times" << std::endl;
+        }
+        m_overflow.close();
+    }
+
+    if (m_rsock) {
+        m_rsock->print_stats(std::cerr);
+        if (m_reconnects > 0) {
+            std::cerr << "reconnects: " << m_reconnects << std::endl;
+        }
+        if (!m_persistent) {
+            delete m_rsock;
+            m_rsock = 0;
+        }
+    }
+
+    if (m_num_out_ports > 1) {
+        for (int i = 0; i < m_num_out_ports; i++) {
+            std::cerr << "OutPort " << i << " blocks: "
+                      << m_out_blocks[i] << std::endl;
+        }
+    }
+    if (!m_capture) {
+        report_port_stats(true);
+    }
+
+    Trace::complete("stop", t_stop, mono_now_ns());
+    std::cerr << "stop_latency: " << (mono_now_ns() - t_stop)/1e6 << " ms"
+              << std::endl;
+
+    if (m_trace) {
+        export_trace();    // not part of the stop latency
+    }
+    return 0;
+}
+
+bool TPEtherReader::use_rsock() const
+{
+    if (m_udp_mode) {
+        return false;
+    }
+    return m_kernel_ts || m_overflow_enabled || m_persistent || m_framed ||
+           m_capture || m_coalesce_bytes > 0;
+}
 
+/// blocking, for daq_start(); check_connection() reconnects without
+int TPEtherReader::open_connection()
+{
+    if (m_rsock->connect(m_srcAddr, m_srcPort) < 0) {
+        return -1;
+    }
+    connection_opened();
     return 0;
 }
 
+void TPEtherReader::connection_opened()
+{
+    m_packer.reset();      // a partial event of the old stream is lost
+    if (m_kernel_ts && m_rsock->enable_timestamping(m_hw_ts_if) < 0) {
+        TPLOG_WARNING("kernel time stamp not available");
+    }
+}
+
+void TPEtherReader::connection_lost()
+{
+    TPLOG_WARNING("connection to %s:%d lost, reconnecting",
+                  m_srcAddr.c_str(), m_srcPort);
+    Trace::instant("connection lost");
+    m_rsock->disconnect();
+    m_reconnect_backoff_ms = RECONNECT_MIN_MS;
+    m_reconnect_at_ns = mono_now_ns();
+}
+
+int TPEtherReader::check_connection()
+{
+    if (m_rsock == 0 || (m_rsock->fd() >= 0 && !m_rsock->connecting())) {
+        return 0;
+    }
+
+    // Never block here for longer than a few ms: the stop command is
+    // handled only between daq_run() calls.
+    unsigned long long now = mono_now_ns();
+    int ret;
+    if (m_rsock->connecting()) {
+        ret = m_rsock->connect_wait(CONNECT_POLL_MS);
+        if (ret == RecvSock::CONNECT_PENDING &&
+            now - m_connect_start_ns >= RECONNECT_MAX_MS*1000000ULL) {
+            m_rsock->disconnect();    // no answer, try again later
+            ret = RecvSock::ERROR_FATAL;
+        }
+    }
+    else {
+        if (now < m_reconnect_at_ns) {
+            // do not spin in the execution context, but come back for
+            // the stop command soon
+            unsigned long long wait_us = (m_reconnect_at_ns - now)/1000;
+            usleep(wait_us < 10000 ? wait_us : 10000);
+            return -1;
+        }
+        m_connect_start_ns = now;
+        ret = m_rsock->connect_start(m_srcAddr, m_srcPort);
+        if (ret == RecvSock::CONNECT_PENDING) {
+            ret = m_rsock->connect_wait(CONNECT_POLL_MS);
+        }
+    }
+    if (ret == RecvSock::CONNECT_PENDING) {
+        return -1;
+    }
+
+    now = mono_now_ns();
+    if (ret == 0) {
+        connection_opened();
+        m_reconnects++;
+        TPLOG_INFO("TPEtherReader: reconnected to %s:%d",
+                   m_srcAddr.c_str(), m_srcPort);
+        Trace::instant("reconnect");
+        m_reconnect_backoff_ms = RECONNECT_MIN_MS;
+        return 0;
+    }
+    m_reconnect_at_ns = now + m_reconnect_backoff_ms*1000000ULL;
+    m_reconnect_backoff_ms *= 2;
+    if (m_reconnect_backoff_ms > RECONNECT_MAX_MS) {
+        m_reconnect_backoff_ms = RECONNECT_MAX_MS;
+    }
+    return -1;
+}
+
+void TPEtherReader::export_trace()
+{
+    char name[64];
+    snprintf(name, sizeof(name), "/TPEtherReader_%06u_%d.json",
+             (unsigned int)m_daq_service0.getRunNo(), (int)getpid());
+    std::string path = m_trace_dir + name;
+
+    unsigned long long t_export = mono_now_ns();
+    long long events = Trace::export_json(path, "TPEtherReader");
+    if (events < 0) {
+        std::cerr << "### WARNING: cannot write trace " << path << std::endl;
+    }
+    else {
+        std::cerr << "trace: " << events << " events ("
+                  << Trace::overwritten() << " overwritten) to " << path
+                  << " in " << (mono_now_ns() - t_export)/1e6 << " ms"
+                  << std::endl;
+    }
+    Trace::clear();
+}
+
+void TPEtherReader::report_loop_overhead()
+{
+    if (m_run_calls == 0) {
+        return;
+    }
+    std::cerr << "daq_run calls: " << m_run_calls
+              << " blocks: " << m_run_blocks
+              << " blocks/call: " << (double)m_run_blocks/m_run_calls
+              << " busy/call: " << m_run_busy_ns/1000.0/m_run_calls << " us"
+              << std::endl;
+    if (m_run_blocks > 0) {
+        std::cerr << "busy/block: "
+                  << m_run_busy_ns/1000.0/m_run_blocks << " us" << std::endl;
+    }
+    m_framework_gap.print(std::cerr, "framework_overhead");
+}
+
+void TPEtherReader::report_port_stats(bool run_total)
+{
+    std::ostringstream os;
+    os << "port stats (interval)" << std::endl;
+    for (int i = 0; i < m_num_out_ports; i++) {
+        m_out_stats_run[i].merge(m_out_stats[i]);
+        std::ostringstream name;
+        name << "OutPort";
+        if (m_num_out_ports > 1) {
+            name << i;
+        }
+        if (run_total) {
+            m_out_stats_run[i].print(std::cerr, name.str());
+        }
+        else {
+            m_out_stats[i].print(os, name.str());
+        }
+        m_out_stats[i].reset();
+    }
+    if (!run_total && AsyncLog::enabled(AsyncLog::LEVEL_INFO)) {
+        // called from daq_run(): formatted here, written by the flusher
+        AsyncLog::log_lines(AsyncLog::LEVEL_INFO, os.str());
+    }
+}
+
 int TPEtherReader::daq_pause()
 {
+    AsyncLog::flush();
     std::cerr << "*** TPEtherReader::pause" << std::endl;
+    Trace::instant("pause");
 
     return 0;
 }
@@ -211,33 +944,122 @@ int TPEtherReader::daq_pause()
 int TPEtherReader::daq_resume()
 {
     std::cerr << "*** TPEtherReader::resume" << std::endl;
+    Trace::instant("resume");
 
     return 0;
 }
 
 int TPEtherReader::read_data_from_detectors()
 {
-    int received_data_size = 0;
-
     /// write your logic here
     /// read 1024 byte data from data server
-    int status = m_sock->readAll(m_data, m_bufsize);
-    if (status == DAQMW::Sock::ERROR_FATAL) {
-        std::cerr << "### ERROR: m_sock->readAll" << std::endl;
+    int status;
+    if (m_rsock) {
+        status = m_rsock->readAll(m_data, m_bufsize);
+    }
+    else {
+        status = m_sock->readAll(m_data, m_bufsize);
+    }
+    if (check_recv_status(status) < 0) {
+        return 0;
+    }
+    m_recv_time_ns = mono_now_ns();
+
+    return m_bufsize;
+}
+
+int TPEtherReader::read_framed_block(const unsigned char*& data)
+{
+    for (;;) {
+        int ret = m_packer.next_block(data);
+        if (ret > 0) {
+            return ret;
+        }
+        if (ret < 0) {
+            TPLOG_ERROR("bad event length in the stream");
+            fatal_error_report(USER_DEFINED_ERROR1, "BAD EVENT LENGTH");
+        }
+
+        // no whole event buffered: one recv() of all that is there
+        unsigned int space;
+        unsigned char* p = m_packer.recv_space(space);
+        int status = m_rsock->readSome(p, space);
+        if (check_recv_status(status) < 0) {
+            return 0;
+        }
+        m_recv_time_ns = mono_now_ns();
+        m_packer.commit(status);
+    }
+}
+
+int TPEtherReader::read_udp_block(const unsigned char*& data)
+{
+    // Whole datagrams are packed into the block.  The first batch is
+    // waited for (up to the receive timeout), further ones are taken
+    // only if already queued, so a block is not held back at low rate.
+    unsigned int filled = 0;
+    for (;;) {
+        if (!m_udp.pending()) {
+            int status = m_udp.recv_batch(filled > 0);
+            if (status == UdpRecv::ERROR_TIMEOUT) {
+                break;
+            }
+            if (status < 0) {
+                TPLOG_ERROR("m_udp.recv_batch");
+                fatal_error_report(USER_DEFINED_ERROR1, "SOCKET FATAL ERROR");
+            }
+            if (filled == 0) {
+                m_recv_time_ns = mono_now_ns();
+            }
+            continue;
+        }
+        if (filled + m_udp.peek_size() > (unsigned int)m_bufsize) {
+            break;             // rest goes into the next block
+        }
+        const unsigned char* p = 0;
+        unsigned int size = m_udp.next(p);
+        memcpy(m_data + filled, p, size);
+        filled += size;
+    }
+
+    unsigned long long now = mono_now_ns();
+    if (now - m_udp_last_report_ns >= m_udp_report_ns) {
+        m_udp.report_interval((now - m_udp_last_report_ns)/1e9);
+        m_udp_last_report_ns = now;
+    }
+
+    data = m_data;
+    return filled;
+}
+
+bool TPEtherReader::source_readable(int timeout_ms)
+{
+    if (m_udp_mode) {
+        return m_udp.readable(timeout_ms);
+    }
+    return m_rsock->readable(timeout_ms);
+}
+
+int TPEtherReader::check_recv_status(int status)
+{
+    if (status == DAQMW::Sock::ERROR_FATAL && m_rsock && m_persistent) {
+        connection_lost();         // no data, the run goes on
+        return -1;
+    }
+    else if (status == DAQMW::Sock::ERROR_FATAL) {
+        TPLOG_ERROR("m_sock->readAll");
         fatal_error_report(USER_DEFINED_ERROR1, "SOCKET FATAL ERROR");
     }
     else if (status == DAQMW::Sock::ERROR_TIMEOUT) {
-        std::cerr << "### Timeout: m_sock->readAll" << std::endl;
+        TPLOG_ERROR("timeout: m_sock->readAll");
         fatal_error_report(USER_DEFINED_ERROR2, "SOCKET TIMEOUT");
     }
-    else {
-        received_data_size = m_bufsize;
-    }
 
-    return received_data_size;
+    return 0;
 }
 
-int TPEtherReader::set_data(unsigned int data_byte_size)
+int TPEtherReader::set_data(const unsigned char* data,
+                            unsigned int data_byte_size)
 {
     unsigned char header[8];
     unsigned char footer[8];
@@ -246,62 +1068,524 @@ int TPEtherReader::set_data(unsigned int data_byte_size)
     set_footer(&footer[0]);
 
     ///set OutPort buffer length
-    m_out_data.data.length(data_byte_size + HEADER_BYTE_SIZE + FOOTER_BYTE_SIZE);
-    memcpy(&(m_out_data.data[0]), &header[0], HEADER_BYTE_SIZE);
-    memcpy(&(m_out_data.data[HEADER_BYTE_SIZE]), &m_data[0], data_byte_size);
-    memcpy(&(m_out_data.data[HEADER_BYTE_SIZE + data_byte_size]), &footer[0],
+    TimedOctetSeq& out_data = *m_out_datas[m_out_index];
+    out_data.data.length(data_byte_size + HEADER_BYTE_SIZE + FOOTER_BYTE_SIZE);
+    memcpy(&(out_data.data[0]), &header[0], HEADER_BYTE_SIZE);
+    memcpy(&(out_data.data[HEADER_BYTE_SIZE]), data, data_byte_size);
+    memcpy(&(out_data.data[HEADER_BYTE_SIZE + data_byte_size]), &footer[0],
            FOOTER_BYTE_SIZE);
 
+    /// receive time stamp, used by TPEtherLogger for latency measurement
+    set_block_time(out_data.tm, m_recv_time_ns);
+
+    return 0;
+}
+
+/// set_data() for blocks of exactly N bytes: header and footer are
+/// single stores, the copy is the one FixedBlock<N> chose for the size
+template <unsigned int N>
+int TPEtherReader::set_data_fixed(const unsigned char* data,
+                                  unsigned int data_byte_size)
+{
+    if (data_byte_size != N) {        // short read at the end of a stream
+        return set_data(data, data_byte_size);
+    }
+
+    TimedOctetSeq& out_data = *m_out_datas[m_out_index];
+    out_data.data.length(FixedBlock<N>::BLOCK_BYTE_SIZE);
+    FixedBlock<N>::fill(&(out_data.data[0]), data, get_sequence_num());
+
+    set_block_time(out_data.tm, m_recv_time_ns);
+
     return 0;
 }
 
+/// Only plain TCP blocks are always bufsize_kb*1024 bytes; zeroSuppress,
+/// recvFraming and udp make a size per block and use set_data().
+TPEtherReader::SetDataFunc TPEtherReader::select_set_data() const
+{
+    if (m_zs_enabled || m_framed || m_udp_mode) {
+        return &TPEtherReader::set_data;
+    }
+    switch (fixed_block_class(m_bufsize)) {
+    case 0:  return &TPEtherReader::set_data_fixed<1024U <<  0>;
+    case 1:  return &TPEtherReader::set_data_fixed<1024U <<  1>;
+    case 2:  return &TPEtherReader::set_data_fixed<1024U <<  2>;
+    case 3:  return &TPEtherReader::set_data_fixed<1024U <<  3>;
+    case 4:  return &TPEtherReader::set_data_fixed<1024U <<  4>;
+    case 5:  return &TPEtherReader::set_data_fixed<1024U <<  5>;
+    case 6:  return &TPEtherReader::set_data_fixed<1024U <<  6>;
+    case 7:  return &TPEtherReader::set_data_fixed<1024U <<  7>;
+    case 8:  return &TPEtherReader::set_data_fixed<1024U <<  8>;
+    case 9:  return &TPEtherReader::set_data_fixed<1024U <<  9>;
+    case 10: return &TPEtherReader::set_data_fixed<1024U << 10>;
+    case 11: return &TPEtherReader::set_data_fixed<1024U << 11>;
+    case 12: return &TPEtherReader::set_data_fixed<1024U << 12>;
+    default: return &TPEtherReader::set_data;
+    }
+}
+
+int TPEtherReader::coalesce_block()
+{
+    // The sub-blocks are copied straight to their place in the OutPort
+    // buffer, behind a table with room for m_coalesce_max_blocks.
+    m_out_index = select_OutPort();
+    TimedOctetSeq& out_data = *m_out_datas[m_out_index];
+    unsigned int table_size = sub_block_table_size(m_coalesce_max_blocks);
+    out_data.data.length(HEADER_BYTE_SIZE + table_size + m_coalesce_bytes
+                         + FOOTER_BYTE_SIZE);
+    unsigned char* block = &(out_data.data[0]);
+    SubBlockTableHeader* table = (SubBlockTableHeader*)&block[HEADER_BYTE_SIZE];
+    SubBlockEntry* entries = (SubBlockEntry*)(table + 1);
+    unsigned char* payload = &block[HEADER_BYTE_SIZE + table_size];
+
+    unsigned int count  = 0;
+    unsigned int filled = 0;
+    unsigned long long first_ns = 0;
+    for (;;) {
+        if (count > 0 && !sub_block_ready(first_ns)) {
+            m_flush_age++;
+            break;
+        }
+        const unsigned char* data = 0;
+        int ret;
+        if (m_overflow_enabled && !m_overflow.empty()) {
+            TraceScope trace("overflow pop");
+            ret = m_overflow.pop(data, m_recv_time_ns);  // oldest first
+            if (ret < 0) {
+                fatal_error_report(USER_DEFINED_ERROR1, "SPILL FILE ERROR");
+            }
+        }
+        else {
+            if (check_connection() < 0) {
+                break;         // not connected yet
+            }
+            TraceScope trace("read");
+            ret = receive_block(data);
+            trace.set_arg("bytes", ret > 0 ? ret : 0);
+        }
+        if (ret <= 0) {
+            break;             // connection lost, send what we have
+        }
+
+        memcpy(payload + filled, data, ret);
+        entries[count].byte_size = ret;
+        entries[count].seq_num   = m_sub_seq++;
+        entries[count].recv_ns   = m_recv_time_ns;
+        if (count == 0) {
+            first_ns = m_recv_time_ns;
+        }
+        count++;
+        filled += ret;
+        if (count == m_coalesce_max_blocks ||
+            filled + max_block_size() > m_coalesce_bytes) {
+            m_flush_size++;
+            break;
+        }
+    }
+    if (count == 0) {
+        return -1;
+    }
+
+    memset(&entries[count], 0,
+           (m_coalesce_max_blocks - count)*sizeof(SubBlockEntry));
+    table->magic          = SUB_BLOCK_MAGIC;
+    table->count          = count;
+    table->capacity       = m_coalesce_max_blocks;
+    table->data_byte_size = filled;
+
+    unsigned int data_byte_size = table_size + filled;
+    set_header(&block[0], data_byte_size);
+    set_footer(&block[HEADER_BYTE_SIZE + data_byte_size]);
+    out_data.data.length(HEADER_BYTE_SIZE + data_byte_size + FOOTER_BYTE_SIZE);
+
+    /// the oldest sub-block, so that the logger sees the worst latency
+    set_block_time(out_data.tm, first_ns);
+
+    m_pending_sub_blocks = count;
+    return filled;
+}
+
+bool TPEtherReader::sub_block_ready(unsigned long long first_ns)
+{
+    // already received, no wait
+    if (m_overflow_enabled && !m_overflow.empty()) {
+        return true;
+    }
+    if (m_framed && m_packer.has_event()) {
+        return true;
+    }
+    if (m_udp_mode && m_udp.pending()) {
+        return true;
+    }
+
+    // wait for the source until the first sub-block is max. age old
+    unsigned long long age = mono_now_ns() - first_ns;
+    if (age >= m_coalesce_age_ns) {
+        return false;
+    }
+    return source_readable((m_coalesce_age_ns - age)/1000000);
+}
+
+int TPEtherReader::select_OutPort()
+{
+    if (m_num_out_ports == 1) {
+        return 0;
+    }
+
+    switch (m_fanout_policy) {
+    case FANOUT_HASH:
+        return m_hash_index;
+    case FANOUT_LEAST_BACKLOG: {
+        // The port whose consumer took the last blocks fastest: with the
+        // flush publisher write() returns when the logger has the block,
+        // so a busy logger shows as long writes and timeouts.  Equal
+        // costs go round robin.  The costs of all ports age, so that a
+        // port skipped for being slow is tried again later.
+        int best = m_out_index;
+        unsigned long long best_cost = ~0ULL;
+        for (int i = 0; i < m_num_out_ports; i++) {
+            int port = (m_out_index + 1 + i) % m_num_out_ports;
+            m_out_cost_ns[port] -= m_out_cost_ns[port] >> 4;
+            if (m_out_cost_ns[port] < best_cost) {
+                best_cost = m_out_cost_ns[port];
+                best = port;
+            }
+        }
+        return best;
+    }
+    default:
+        return (m_out_index + 1) % m_num_out_ports;
+    }
+}
+
 int TPEtherReader::write_OutPort()
 {
+    OutPort<TimedOctetSeq>& out_port = *m_out_ports[m_out_index];
+    // No fill level here: with the flush publisher the OutPort
+    // connector buffer is empty again when write() returns; the back
+    // pressure shows as write() time, timeouts and wait per block.
+    PortStats& stats = m_out_stats[m_out_index];
+
     ////////////////// send data from OutPort  //////////////////
-    bool ret = m_OutPort.write();
+    TraceScope trace("OutPort write");
+    trace.set_arg("port", m_out_index);
+    unsigned long long t_write = mono_now_ns();
+    if (m_out_attempts++ == 0) {
+        m_out_first_try_ns = t_write;
+    }
+    bool ret = out_port.write();
+    unsigned long long t_done = mono_now_ns();
+    stats.add_call(t_done - t_write);
 
     //////////////////// check write status /////////////////////
     if (ret == false) {  // TIMEOUT or FATAL
-        m_out_status  = check_outPort_status(m_OutPort);
+        m_out_status  = check_outPort_status(out_port);
         if (m_out_status == BUF_FATAL) {   // Fatal error
             fatal_error_report(OUTPORT_ERROR);
         }
         if (m_out_status == BUF_TIMEOUT) { // Timeout
+            // blocked now: at least as bad as the wait so far
+            unsigned long long waited = t_done - m_out_first_try_ns;
+            if (m_out_cost_ns[m_out_index] < waited) {
+                m_out_cost_ns[m_out_index] = waited;
+            }
+            Trace::instant("OutPort timeout", "port", m_out_index);
             return -1;
         }
     }
     else {
         m_out_status = BUF_SUCCESS; // successfully done
+        m_out_blocks[m_out_index]++;
+        stats.add_block(m_out_attempts - 1, t_done - m_out_first_try_ns);
+        unsigned long long& cost = m_out_cost_ns[m_out_index];
+        cost = cost - (cost >> 3) + ((t_done - m_out_first_try_ns) >> 3);
+        m_out_attempts = 0;
     }
 
     return 0;
 }
 
-int TPEtherReader::daq_run()
+int TPEtherReader::receive_block(const unsigned char*& data)
 {
-    if (m_debug) {
-        std::cerr << "*** TPEtherReader::run" << std::endl;
+    if (m_udp_mode) {
+        return read_udp_block(data);
+    }
+    if (m_framed) {
+        return read_framed_block(data);
     }
+    int ret = read_data_from_detectors();
+    if (ret <= 0) {
+        return ret;
+    }
+    data = m_data;
+    if (m_zs_enabled) {
+        // sparse block replaces the raw one
+        TraceScope trace("zero suppress");
+        ret = m_zs.reduce(m_data, ret, data);
+        trace.set_arg("bytes", ret);
+    }
+    return ret;
+}
 
-    if (check_trans_lock()) {  // check if stop command has come
-        set_trans_unlock();    // transit to CONFIGURED state
-        return 0;
+unsigned int TPEtherReader::max_block_size() const
+{
+    if (m_zs_enabled) {
+        // every sample a hit: 4 byte index + 2 byte value
+        return ZeroSuppressor::HEADER_BYTE_SIZE + (m_bufsize/2)*6;
     }
+    return m_bufsize;
+}
 
-    if (m_out_status == BUF_SUCCESS) {   // previous OutPort.write() successfully done
-        int ret = read_data_from_detectors();
-        if (ret > 0) {
-            m_recv_byte_size = ret;
-            set_data(m_recv_byte_size); // set data to OutPort Buffer
+void TPEtherReader::drain_to_overflow()
+{
+    // bounded, so that the pending OutPort write is retried regularly
+    const int max_blocks = 16;
+
+    for (int i = 0; i < max_blocks; i++) {
+        if (!source_readable()) {
+            return;
+        }
+        if (!m_overflow.has_room()) {
+            m_overflow_full++;     // the front-end has to wait, as before
+            return;
+        }
+        const unsigned char* data = 0;
+        int ret = receive_block(data);
+        if (ret <= 0) {
+            return;
         }
+        m_overflow.push(data, ret, m_recv_time_ns);
+    }
+}
+
+int TPEtherReader::open_capture()
+{
+    if (pipe(m_pipe) < 0) {
+        perror("pipe");
+        return -1;
+    }
+    // one block in flight; the kernel rounds up to pages and caps the
+    // size at /proc/sys/fs/pipe-max-size
+    fcntl(m_pipe[1], F_SETPIPE_SZ, m_bufsize);
+    int size = fcntl(m_pipe[1], F_GETPIPE_SZ);
+    m_pipe_size = size > 0 ? size : 65536;
+    m_splice_calls = 0;
+
+    m_capture_files.set_run_no(m_daq_service0.getRunNo());
+    if (m_capture_files.set_max_size_in_megaBytes(m_capture_max_mb) < 0) {
+        std::cerr << "### ERROR: bad captureMaxFileSizeInMegaByte" << std::endl;
+        return -1;
+    }
+    if (m_capture_files.open_raw_file(m_capture_dir) < 0) {
+        return -1;
+    }
+    std::cerr << "capture to " << m_capture_files.get_file_path()
+              << " pipe size " << m_pipe_size << std::endl;
+    return 0;
+}
+
+void TPEtherReader::close_capture()
+{
+    int files = m_capture_files.get_branch_no() + 1;
+    m_capture_files.close_file();
+    for (int i = 0; i < 2; i++) {
+        if (m_pipe[i] >= 0) {
+            close(m_pipe[i]);
+            m_pipe[i] = -1;
+        }
+    }
+    std::cerr << "capture files: " << files
+              << " splice calls: " << m_splice_calls;
+    if (m_splice_calls > 0) {
+        std::cerr << " bytes/splice: " << get_total_byte_size()/m_splice_calls;
+    }
+    std::cerr << std::endl;
+}
+
+int TPEtherReader::capture_one_block()
+{
+    if (check_connection() < 0) {
+        return -1;
+    }
+
+    unsigned char header[8];
+    unsigned long long header_offset = m_capture_files.get_file_size();
+    if (m_capture_header_footer) {
+        set_header(&header[0], m_bufsize);
+        if (m_capture_files.write_raw((char*)&header[0], HEADER_BYTE_SIZE) < 0) {
+            fatal_error_report(USER_DEFINED_ERROR1, "CAPTURE FILE ERROR");
+        }
+    }
+
+    // socket -> pipe -> file: the data stays in kernel pages
+    unsigned int remaining = m_bufsize;
+    while (remaining > 0) {
+        unsigned int len = remaining < m_pipe_size ? remaining : m_pipe_size;
+        ssize_t n = splice(m_rsock->fd(), NULL, m_pipe[1], NULL, len,
+                           SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (n <= 0) {
+            int status = DAQMW::Sock::ERROR_FATAL;
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                status = DAQMW::Sock::ERROR_TIMEOUT;
+            }
+            else if (n < 0) {
+                TPLOG_ERROR("splice: %s", strerror(errno));
+            }
+            TPLOG_WARNING("capture block cut at %u bytes",
+                          m_bufsize - remaining);
+            // the header is in the file already: end the block with
+            // what came, so that the file stays a sequence of blocks
+            if (m_capture_header_footer || remaining < (unsigned int)m_bufsize) {
+                end_capture_block(header_offset, m_bufsize - remaining);
+            }
+            check_recv_status(status);
+            return -1;
+        }
+        m_splice_calls++;
+        if (m_capture_files.splice_from(m_pipe[0], n) < 0) {
+            fatal_error_report(USER_DEFINED_ERROR1, "CAPTURE FILE ERROR");
+        }
+        remaining -= n;
+    }
+
+    return end_capture_block(header_offset, m_bufsize);
+}
+
+/// footer and accounting of a captured block; a block cut short gets
+/// the size it has in its header
+int TPEtherReader::end_capture_block(unsigned long long header_offset,
+                                     unsigned int data_byte_size)
+{
+    if (m_capture_header_footer) {
+        unsigned char header[8];
+        unsigned char footer[8];
+        if (data_byte_size != (unsigned int)m_bufsize) {
+            set_header(&header[0], data_byte_size);
+            if (m_capture_files.rewrite_raw(header_offset, (char*)&header[0],
+                                            HEADER_BYTE_SIZE) < 0) {
+                fatal_error_report(USER_DEFINED_ERROR1, "CAPTURE FILE ERROR");
+            }
+        }
+        set_footer(&footer[0]);
+        if (m_capture_files.write_raw((char*)&footer[0], FOOTER_BYTE_SIZE) < 0) {
+            fatal_error_report(USER_DEFINED_ERROR1, "CAPTURE FILE ERROR");
+        }
+    }
+    inc_sequence_num();
+    inc_total_data_size(data_byte_size);
+
+    if (m_capture_files.end_block() < 0) {
+        fatal_error_report(USER_DEFINED_ERROR1, "CAPTURE FILE ERROR");
+    }
+    return 0;
+}
+
+int TPEtherReader::process_one_block()
+{
+    if (m_capture) {
+        TraceScope trace("splice");
+        return capture_one_block();
+    }
+
+    if (m_overflow_enabled &&
+        (m_out_status != BUF_SUCCESS || !m_overflow.empty())) {
+        // downstream is behind: keep the socket buffer empty
+        TraceScope trace("overflow drain");
+        drain_to_overflow();
+    }
+
+    if (m_out_status == BUF_SUCCESS && m_coalesce_bytes > 0) {
+        TraceScope trace("coalesce");
+        int ret = coalesce_block();
+        if (ret < 0) {
+            return -1;         // nothing received
+        }
+        trace.set_arg("sub-blocks", m_pending_sub_blocks);
+        m_recv_byte_size = ret;
+    }
+    else if (m_out_status == BUF_SUCCESS) {   // previous OutPort.write() successfully done
+        const unsigned char* data = 0;
+        int ret;
+        if (m_overflow_enabled && !m_overflow.empty()) {
+            TraceScope trace("overflow pop");
+            ret = m_overflow.pop(data, m_recv_time_ns);  // oldest first
+            if (ret < 0) {
+                fatal_error_report(USER_DEFINED_ERROR1, "SPILL FILE ERROR");
+            }
+            trace.set_arg("bytes", ret);
+        }
+        else {
+            if (check_connection() < 0) {
+                return -1;     // not connected yet
+            }
+            TraceScope trace("read");
+            ret = receive_block(data);
+            trace.set_arg("bytes", ret > 0 ? ret : 0);
+        }
+        if (ret <= 0) {
+            return -1;         // connection lost, nothing to send
+        }
+        m_recv_byte_size = ret;
+        m_out_index = select_OutPort();
+        (this->*m_set_data)(data, m_recv_byte_size); // set data to OutPort Buffer
     }
 
     if (write_OutPort() < 0) {
-        ;     // Timeout. do nothing.
+        return -1;     // Timeout. do nothing.
     }
     else {    // OutPort write successfully done
         inc_sequence_num();                     // increase sequence num.
         inc_total_data_size(m_recv_byte_size);  // increase total data byte size
+        m_sub_blocks += m_pending_sub_blocks;
+    }
+
+    return 0;
+}
+
+int TPEtherReader::daq_run()
+{
+    TPLOG_DEBUG("*** TPEtherReader::run");
+
+    if (check_trans_lock()) {  // check if stop command has come
+        set_trans_unlock();    // transit to CONFIGURED state
+        return 0;
+    }
+
+    unsigned long long t_enter = mono_now_ns();
+    if (m_last_exit_ns > 0) {
+        m_framework_gap.add(t_enter - m_last_exit_ns);
+    }
+    m_run_calls++;
+
+    // Free-running: handle up to m_blocks_per_run blocks or up to
+    // m_run_slice_ns before returning to the execution context.  The
+    // stop command is checked between blocks so that stop latency stays
+    // bounded by the time to handle one block.
+    for (unsigned int i = 0; i < m_blocks_per_run; i++) {
+        if (i > 0 && check_trans_lock()) {
+            break;             // handled at next daq_run()
+        }
+        if (process_one_block() < 0) {
+            break;             // OutPort timeout, back off
+        }
+        m_run_blocks++;
+        if (m_run_slice_ns > 0 && mono_now_ns() - t_enter >= m_run_slice_ns) {
+            break;
+        }
+    }
+
+    unsigned long long t_now = mono_now_ns();
+    m_run_busy_ns += t_now - t_enter;
+    m_last_exit_ns = t_now;
+
+    if (m_port_report_ns > 0 && !m_capture &&
+        t_now - m_port_last_report_ns >= m_port_report_ns) {
+        report_port_stats(false);
+        m_port_last_report_ns = t_now;
     }
 
     return 0;
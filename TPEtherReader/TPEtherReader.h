@@ -13,6 +13,23 @@
 #include "DaqComponentBase.h"
 
 #include <daqmw/Sock.h>
+#include <unistd.h>
+#include <sstream>
+
+#include "AsyncLog.h"
+#include "BlockTime.h"
+#include "LatencyHistogram.h"
+#include "EventPacker.h"
+#include "FixedBlock.h"
+#include "FileUtils.h"
+#include "OverflowBuffer.h"
+#include "PerfCounters.h"
+#include "PortStats.h"
+#include "Trace.h"
+#include "RecvSock.h"
+#include "SubBlockTable.h"
+#include "UdpRecv.h"
+#include "ZeroSuppress.h"
 
 using namespace RTC;
 
@@ -35,6 +52,13 @@ private:
     TimedOctetSeq          m_out_data;
     OutPort<TimedOctetSeq> m_OutPort;
 
+    /// fan-out to several loggers: port 0 is m_OutPort, others are
+    /// tpetherreader_out1, tpetherreader_out2, ...
+    static const int MAX_OUT_PORTS = 4;
+    enum FanOutPolicy { FANOUT_ROUND_ROBIN, FANOUT_LEAST_BACKLOG, FANOUT_HASH };
+    TimedOctetSeq*          m_out_datas[MAX_OUT_PORTS];
+    OutPort<TimedOctetSeq>* m_out_ports[MAX_OUT_PORTS];
+
 private:
     int daq_dummy();
     int daq_configure();
@@ -47,10 +71,42 @@ private:
 
     int parse_params(::NVList* list);
     int read_data_from_detectors();
-    int set_data(unsigned int data_byte_size);
+    int read_framed_block(const unsigned char*& data);
+    int read_udp_block(const unsigned char*& data);
+    int open_capture();
+    void close_capture();
+    int capture_one_block();
+    int end_capture_block(unsigned long long header_offset,
+                          unsigned int data_byte_size);
+    bool source_readable(int timeout_ms = 0);
+    int check_recv_status(int status);
+    int receive_block(const unsigned char*& data);
+    unsigned int max_block_size() const;
+    void drain_to_overflow();
+    int set_data(const unsigned char* data, unsigned int data_byte_size);
+    template <unsigned int N>
+    int set_data_fixed(const unsigned char* data, unsigned int data_byte_size);
+    typedef int (TPEtherReader::*SetDataFunc)(const unsigned char*, unsigned int);
+    SetDataFunc select_set_data() const;
+    int coalesce_block();
+    bool sub_block_ready(unsigned long long first_ns);
     int write_OutPort();
+    int select_OutPort();
+    int process_one_block();
+    void report_loop_overhead();
+    void report_port_stats(bool run_total);
+    bool use_rsock() const;
+    int open_connection();
+    void connection_opened();
+    void connection_lost();
+    int check_connection();
+    void export_trace();
 
     DAQMW::Sock* m_sock;               /// socket for data server
+    RecvSock* m_rsock;                 /// used instead of m_sock for
+                                       /// kernel receive time stamps
+    bool m_kernel_ts;
+    std::string m_hw_ts_if;            /// NIC for hardware time stamps
 
     //static const int EVENT_BYTE_SIZE  = 8;    // event byte size
     //static const int SEND_BUFFER_SIZE = 1024; //
@@ -58,16 +114,122 @@ private:
     unsigned char *m_data;
     int m_bufsize_kb;
     int m_bufsize;
+    SetDataFunc m_set_data;             /// set_data or set_data_fixed<m_bufsize>
     struct timeval m_tv_start;
     struct timeval m_tv_stop;
     unsigned int  m_recv_byte_size;
+    unsigned long long m_recv_time_ns;  /// CLOCK_MONOTONIC at readAll() return
 
     BufferStatus m_out_status;
 
+    int m_num_out_ports;
+    FanOutPolicy m_fanout_policy;
+    int m_out_index;                      /// port the current block goes to
+    int m_hash_index;                     /// port chosen by FANOUT_HASH
+    unsigned long long m_out_blocks[MAX_OUT_PORTS];
+    /// FANOUT_LEAST_BACKLOG: smoothed time from the first write() of a
+    /// block to its success, per port; the connector buffer is always
+    /// empty with the flush publisher, so its fill says nothing
+    unsigned long long m_out_cost_ns[MAX_OUT_PORTS];
+
+    /// back pressure seen by each OutPort, interval and run total
+    PortStats m_out_stats[MAX_OUT_PORTS];
+    PortStats m_out_stats_run[MAX_OUT_PORTS];
+    unsigned int m_out_attempts;          /// write() calls for the pending block
+    unsigned long long m_out_first_try_ns;
+    unsigned long long m_port_report_ns;  /// interval report, 0: at stop only
+    unsigned long long m_port_last_report_ns;
+
+    /// free-running mode: blocks handled per daq_run() invocation
+    unsigned int m_blocks_per_run;        /// max. blocks, 1: former behavior
+    unsigned long long m_run_slice_ns;    /// max. time, 0: no limit
+    unsigned long long m_last_exit_ns;    /// daq_run() return time
+    unsigned long long m_run_calls;
+    unsigned long long m_run_blocks;
+    unsigned long long m_run_busy_ns;     /// time spent inside daq_run()
+    LatencyHistogram m_framework_gap;     /// daq_run() return -> next call
+
     int m_srcPort;                        /// Port No. of data server
     std::string m_srcAddr;                /// IP addr. of data server
 
-    bool m_debug;
+    PerfCounters m_perf;
+    bool m_perf_enabled;
+
+    /// protocol "udp": srcPort is the local port to bind
+    UdpRecv m_udp;
+    bool m_udp_mode;
+    std::string m_udp_bind_addr;          /// "": any address
+    unsigned int m_udp_batch;             /// datagrams per recvmmsg()
+    unsigned int m_udp_max_datagram;
+    unsigned int m_udp_rcvbuf_mb;         /// 0: system default
+    unsigned int m_udp_seq_offset;
+    unsigned int m_udp_seq_byte_size;     /// 0: no loss accounting
+    bool m_udp_seq_big_endian;
+    unsigned long long m_udp_report_ns;   /// loss report interval
+    unsigned long long m_udp_last_report_ns;
+
+    /// captureMode "splice": socket -> pipe -> file in this process,
+    /// nothing is sent on the OutPort
+    bool m_capture;
+    std::string m_capture_dir;
+    unsigned int m_capture_max_mb;        /// file split size, 0: no split
+    bool m_capture_header_footer;
+    FileUtils m_capture_files;
+    int m_pipe[2];
+    unsigned int m_pipe_size;
+    unsigned long long m_splice_calls;
+
+    /// recvFraming "length": blocks of whole length-prefixed events
+    EventPacker m_packer;
+    bool m_framed;
+    unsigned int m_ev_len_offset;
+    unsigned int m_ev_len_byte_size;
+    bool m_ev_len_big_endian;
+    int m_ev_len_adjust;
+    unsigned int m_ev_max_byte_size;
+
+    /// data reduction before the block is sent
+    ZeroSuppressor m_zs;
+    bool m_zs_enabled;
+    unsigned int m_zs_channels;
+    std::string m_zs_thresholds;
+    bool m_zs_scalar;
+
+    /// overflow policy "spill": keep reading the socket while the
+    /// OutPort is back-pressured, replay in order when it recovers
+    OverflowBuffer m_overflow;
+    bool m_overflow_enabled;
+    unsigned int m_overflow_ram_mb;
+    std::string m_spill_dir;
+    unsigned int m_spill_mb;
+    unsigned long long m_overflow_full;   /// socket left unread: no room
+
+    /// persistent connection: kept from daq_start() of the first run to
+    /// daq_unconfigure(), reconnected with backoff if it drops
+    static const unsigned int RECONNECT_MIN_MS = 100;
+    static const unsigned int RECONNECT_MAX_MS = 5000;
+    static const int CONNECT_POLL_MS = 10;    /// per daq_run() call
+    bool m_persistent;
+    unsigned int m_reconnect_backoff_ms;
+    unsigned long long m_reconnect_at_ns; /// next connect attempt
+    unsigned long long m_connect_start_ns; /// of the pending connect
+    unsigned long long m_reconnects;
+
+    /// coalesceMaxKB > 0: several received blocks (sub-blocks) in one
+    /// OutPort block, behind a SubBlockTable
+    unsigned int m_coalesce_bytes;        /// data per block, 0: off
+    unsigned int m_coalesce_max_blocks;   /// table entries, 0: auto
+    unsigned long long m_coalesce_age_ns; /// max. age of the first sub-block
+    unsigned int m_sub_seq;               /// next sub-block sequence number
+    unsigned int m_pending_sub_blocks;    /// in the block being written
+    unsigned long long m_sub_blocks;      /// sent
+    unsigned long long m_flush_size;      /// blocks ended by size or table
+    unsigned long long m_flush_age;       /// blocks ended by the age limit
+
+    /// trace "yes": timeline of the run, written at daq_stop()
+    bool m_trace;
+    std::string m_trace_dir;
+    unsigned int m_trace_mb;              /// ring size per thread
 };
 
 
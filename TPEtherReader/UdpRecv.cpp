@@ -0,0 +1,325 @@
+// -*- C++ -*-
+/*!
+ * @file UdpRecv.cpp
+ * @brief Batched UDP receive with sequence gap accounting.
+ * @date
+ * @author
+ *
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <unistd.h>
+#include <netdb.h>
+#include <poll.h>
+#include <netinet/in.h>
+
+#include "UdpRecv.h"
+#include "AsyncLog.h"
+
+UdpRecv::UdpRecv()
+    : m_fd(-1), m_batch(0), m_max_datagram(0), m_count(0), m_next(0),
+      m_seq_offset(0), m_seq_bytes(0), m_seq_big_endian(true), m_seq_mask(0),
+      m_expected(0), m_seq_started(false), m_window(SEQ_WINDOW)
+{
+    reset_stats();
+}
+
+UdpRecv::~UdpRecv()
+{
+    close();
+}
+
+int UdpRecv::open(const std::string& addr, int port, unsigned int batch,
+                  unsigned int max_datagram, unsigned int rcvbuf)
+{
+    close();
+
+    struct addrinfo hints;
+    struct addrinfo* res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags    = AI_PASSIVE;
+
+    std::ostringstream service;
+    service << port;
+    int ret = getaddrinfo(addr.empty() ? NULL : addr.c_str(),
+                          service.str().c_str(), &hints, &res);
+    if (ret != 0) {
+        std::cerr << "### ERROR: getaddrinfo: " << gai_strerror(ret)
+                  << std::endl;
+        return ERROR_FATAL;
+    }
+
+    m_fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (m_fd < 0) {
+        perror("socket");
+        freeaddrinfo(res);
+        return ERROR_FATAL;
+    }
+    int on = 1;
+    setsockopt(m_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (rcvbuf > 0) {
+        // usually capped by net.core.rmem_max, see the printed value
+        int size = rcvbuf;
+        socklen_t len = sizeof(size);
+        setsockopt(m_fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+        getsockopt(m_fd, SOL_SOCKET, SO_RCVBUF, &size, &len);
+        std::cerr << "UdpRecv: SO_RCVBUF " << size << " bytes" << std::endl;
+    }
+    if (bind(m_fd, res->ai_addr, res->ai_addrlen) < 0) {
+        perror("bind");
+        freeaddrinfo(res);
+        close();
+        return ERROR_FATAL;
+    }
+    freeaddrinfo(res);
+
+    m_batch        = batch > 0 ? batch : 1;
+    m_max_datagram = max_datagram;
+    m_slots.resize((size_t)m_batch*m_max_datagram);
+    m_msgs.resize(m_batch);
+    m_iovs.resize(m_batch);
+    for (unsigned int i = 0; i < m_batch; i++) {
+        m_iovs[i].iov_base = &m_slots[(size_t)i*m_max_datagram];
+        m_iovs[i].iov_len  = m_max_datagram;
+        memset(&m_msgs[i], 0, sizeof(m_msgs[i]));
+        m_msgs[i].msg_hdr.msg_iov    = &m_iovs[i];
+        m_msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    m_count = 0;
+    m_next  = 0;
+    m_seq_started = false;
+
+    set_recv_timeout(0.1);
+    return 0;
+}
+
+void UdpRecv::close()
+{
+    if (m_fd >= 0) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+    m_count = 0;
+    m_next  = 0;
+}
+
+void UdpRecv::set_recv_timeout(double sec)
+{
+    struct timeval tv;
+    tv.tv_sec  = (time_t)sec;
+    tv.tv_usec = (suseconds_t)((sec - tv.tv_sec)*1000000.0);
+    setsockopt(m_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+int UdpRecv::set_seq_field(unsigned int offset, unsigned int seq_byte_size,
+                           bool big_endian)
+{
+    if (seq_byte_size != 0 && seq_byte_size != 1 && seq_byte_size != 2 &&
+        seq_byte_size != 4 && seq_byte_size != 8) {
+        return -1;
+    }
+    m_seq_offset     = offset;
+    m_seq_bytes      = seq_byte_size;
+    m_seq_big_endian = big_endian;
+    m_seq_mask       = seq_byte_size == 8 ? ~0ULL
+                                          : (1ULL << (8*seq_byte_size)) - 1;
+    m_seq_started    = false;
+    // a step back must stay within half of the sequence range
+    m_window = SEQ_WINDOW;
+    while (m_window > 1 && m_window > m_seq_mask/2) {
+        m_window /= 2;
+    }
+    return 0;
+}
+
+int UdpRecv::recv_batch(bool dont_wait)
+{
+    int flags = MSG_WAITFORONE;
+    if (dont_wait) {
+        flags |= MSG_DONTWAIT;
+    }
+
+    int n;
+    for (;;) {
+        n = recvmmsg(m_fd, &m_msgs[0], m_batch, flags, NULL);
+        if (n >= 0) {
+            break;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return ERROR_TIMEOUT;
+        }
+        TPLOG_ERROR("recvmmsg: %s", strerror(errno));
+        return ERROR_FATAL;
+    }
+
+    m_count = n;
+    m_next  = 0;
+    m_batches++;
+    for (int i = 0; i < n; i++) {
+        unsigned int len = m_msgs[i].msg_len;
+        if (m_msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+            m_truncated++;
+        }
+        check_seq(&m_slots[(size_t)i*m_max_datagram], len);
+        m_datagrams++;
+        m_int_datagrams++;
+        m_bytes += len;
+    }
+    return n;
+}
+
+unsigned int UdpRecv::peek_size() const
+{
+    if (m_next >= m_count) {
+        return 0;
+    }
+    return m_msgs[m_next].msg_len;
+}
+
+unsigned int UdpRecv::next(const unsigned char*& data)
+{
+    if (m_next >= m_count) {
+        return 0;
+    }
+    data = &m_slots[(size_t)m_next*m_max_datagram];
+    return m_msgs[m_next++].msg_len;
+}
+
+bool UdpRecv::readable(int timeout_ms)
+{
+    if (pending()) {
+        return true;
+    }
+    struct pollfd pfd;
+    pfd.fd      = m_fd;
+    pfd.events  = POLLIN;
+    pfd.revents = 0;
+    return poll(&pfd, 1, timeout_ms) > 0 && (pfd.revents & POLLIN);
+}
+
+void UdpRecv::check_seq(const unsigned char* data, unsigned int size)
+{
+    if (m_seq_bytes == 0) {
+        return;
+    }
+    if (size < m_seq_offset + m_seq_bytes) {
+        m_short++;
+        return;
+    }
+
+    const unsigned char* f = data + m_seq_offset;
+    unsigned long long seq = 0;
+    for (unsigned int i = 0; i < m_seq_bytes; i++) {
+        unsigned int k = m_seq_big_endian ? i : m_seq_bytes - 1 - i;
+        seq = (seq << 8) | f[k];
+    }
+
+    if (!m_seq_started) {
+        clear_missing();
+    }
+    else {
+        unsigned long long diff = (seq - m_expected) & m_seq_mask;
+        if (diff > m_seq_mask/2) {
+            unsigned long long back = (m_expected - seq) & m_seq_mask;
+            unsigned int bit = seq & (m_window - 1);
+            if (back <= m_window &&
+                (m_missing[bit/64] & (1ULL << (bit % 64)))) {
+                // late: counted as lost when its gap was seen.  The gap
+                // may be in an earlier report interval; the interval
+                // count then goes down here.
+                m_missing[bit/64] &= ~(1ULL << (bit % 64));
+                m_reordered++;
+                if (m_lost > 0) {
+                    m_lost--;
+                }
+                if (m_int_lost > 0) {
+                    m_int_lost--;
+                }
+            }
+            else {
+                m_duplicates++;
+            }
+            return;
+        }
+        m_lost     += diff;
+        m_int_lost += diff;
+
+        // the numbers up to seq take the places of those m_window
+        // older: the skipped ones missing, seq itself arrived
+        unsigned long long first = diff + 1 > m_window ? diff + 1 - m_window : 0;
+        for (unsigned long long k = first; k <= diff; k++) {
+            unsigned int bit = (m_expected + k) & (m_window - 1);
+            if (k < diff) {
+                m_missing[bit/64] |= 1ULL << (bit % 64);
+            }
+            else {
+                m_missing[bit/64] &= ~(1ULL << (bit % 64));
+            }
+        }
+    }
+    m_seq_started = true;
+    m_expected = (seq + 1) & m_seq_mask;
+}
+
+void UdpRecv::clear_missing()
+{
+    for (unsigned int i = 0; i < SEQ_WINDOW/64; i++) {
+        m_missing[i] = 0;
+    }
+}
+
+void UdpRecv::reset_stats()
+{
+    m_datagrams     = 0;
+    m_bytes         = 0;
+    m_batches       = 0;
+    m_lost          = 0;
+    m_reordered     = 0;
+    m_duplicates    = 0;
+    clear_missing();                      // losses before this are not taken back
+    m_truncated     = 0;
+    m_short         = 0;
+    m_int_datagrams = 0;
+    m_int_lost      = 0;
+}
+
+void UdpRecv::report_interval(double interval_sec)
+{
+    if (m_seq_bytes > 0) {
+        unsigned long long sent = m_int_datagrams + m_int_lost;
+        TPLOG_INFO("udp datagrams: %llu lost: %llu (%.3g %%) in last %.3g s",
+                   m_int_datagrams, m_int_lost,
+                   sent > 0 ? 100.0*m_int_lost/sent : 0.0, interval_sec);
+    }
+    m_int_datagrams = 0;
+    m_int_lost      = 0;
+}
+
+void UdpRecv::print_stats(std::ostream& os) const
+{
+    os << "udp datagrams: " << m_datagrams
+       << " bytes: " << m_bytes
+       << " recvmmsg calls: " << m_batches;
+    if (m_batches > 0) {
+        os << " datagrams/call: " << (double)m_datagrams/m_batches;
+    }
+    os << std::endl;
+    if (m_seq_bytes > 0) {
+        os << "udp lost: " << m_lost
+           << " reordered: " << m_reordered
+           << " duplicates: " << m_duplicates
+           << " too short for seq: " << m_short << std::endl;
+    }
+    if (m_truncated > 0) {
+        os << "### WARNING: udp datagrams truncated (> udpMaxDatagram): "
+           << m_truncated << std::endl;
+    }
+}
@@ -0,0 +1,114 @@
+// -*- C++ -*-
+/*!
+ * @file UdpRecv.h
+ * @brief Batched UDP receive with sequence gap accounting.
+ * @date
+ * @author
+ *
+ */
+
+#ifndef UDPRECV_H
+#define UDPRECV_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+/*
+ * @class UdpRecv
+ * @brief Receive side of protocol "udp" of TPEtherReader.
+ *
+ * The socket is bound to a local address/port.  recv_batch() fills up
+ * to batch pre-allocated slots with one recvmmsg() call; the datagrams
+ * are then taken one by one with next() without further syscalls.
+ *
+ * If the datagrams carry a sequence number (seq_byte_size 1, 2, 4 or 8
+ * bytes at seq_offset) every datagram is checked against the previous
+ * one.  A forward jump counts the skipped numbers as lost.  A step back
+ * (within half of the sequence range) to a number counted as lost in
+ * the last SEQ_WINDOW numbers counts as reordered and is taken off the
+ * lost counts again; any other step back is a duplicate (or too late
+ * to tell) and changes nothing.  The number wraps at the field width.
+ * Lost counts are kept for the whole run and for the current report
+ * interval.
+ */
+class UdpRecv
+{
+public:
+    static const int ERROR_FATAL   = -1;
+    static const int ERROR_TIMEOUT = -2;
+
+    UdpRecv();
+    virtual ~UdpRecv();
+
+    /// rcvbuf 0: leave SO_RCVBUF alone
+    int  open(const std::string& addr, int port, unsigned int batch,
+              unsigned int max_datagram, unsigned int rcvbuf);
+    void close();
+    bool is_open() const { return m_fd >= 0; }
+    void set_recv_timeout(double sec);
+
+    /// seq_byte_size 0: no sequence check
+    int  set_seq_field(unsigned int offset, unsigned int seq_byte_size,
+                       bool big_endian);
+
+    /// datagrams left from the last recv_batch()
+    bool pending() const { return m_next < m_count; }
+    /// dont_wait: return ERROR_TIMEOUT at once if nothing is queued.
+    /// returns the number of datagrams received.
+    int  recv_batch(bool dont_wait);
+    /// size of the next pending datagram (0: none)
+    unsigned int peek_size() const;
+    /// returns the datagram size, data valid until the next recv_batch()
+    unsigned int next(const unsigned char*& data);
+
+    bool readable(int timeout_ms);
+
+    void reset_stats();
+    /// log the loss in the interval since the last call, reset the interval
+    void report_interval(double interval_sec);
+    void print_stats(std::ostream& os) const;
+
+private:
+    void check_seq(const unsigned char* data, unsigned int size);
+    void clear_missing();
+
+    /// numbers behind the expected one whose loss can be taken back
+    static const unsigned int SEQ_WINDOW = 1024;
+
+    int m_fd;
+    unsigned int m_batch;
+    unsigned int m_max_datagram;
+
+    std::vector<unsigned char> m_slots;   /// batch x max_datagram
+    std::vector<struct mmsghdr> m_msgs;
+    std::vector<struct iovec> m_iovs;
+    unsigned int m_count;                 /// datagrams in the slots
+    unsigned int m_next;                  /// next one to hand out
+
+    unsigned int m_seq_offset;
+    unsigned int m_seq_bytes;
+    bool m_seq_big_endian;
+    unsigned long long m_seq_mask;
+    unsigned long long m_expected;
+    bool m_seq_started;
+    unsigned int m_window;                /// SEQ_WINDOW, less for 1 byte
+    /// bit (seq & (m_window - 1)): seq counted as lost, not arrived yet
+    unsigned long long m_missing[SEQ_WINDOW/64];
+
+    // statistics
+    unsigned long long m_datagrams;
+    unsigned long long m_bytes;
+    unsigned long long m_batches;
+    unsigned long long m_lost;
+    unsigned long long m_reordered;
+    unsigned long long m_duplicates;      /// behind, not a counted loss
+    unsigned long long m_truncated;       /// longer than max_datagram
+    unsigned long long m_short;           /// too short for the seq field
+    unsigned long long m_int_datagrams;   /// current report interval
+    unsigned long long m_int_lost;
+};
+
+#endif
@@ -0,0 +1,242 @@
+// -*- C++ -*-
+/*!
+ * @file ZeroSuppress.cpp
+ * @brief Per-channel threshold suppression of 16 bit samples.
+ * @date
+ * @author
+ *
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ZS_HAVE_X86 1
+#endif
+
+#include "ZeroSuppress.h"
+#include "BlockTime.h"
+
+static unsigned int gcd(unsigned int a, unsigned int b)
+{
+    while (b != 0) {
+        unsigned int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+static void put_le32(unsigned char* p, unsigned int v)
+{
+    p[0] =  v        & 0xff;
+    p[1] = (v >>  8) & 0xff;
+    p[2] = (v >> 16) & 0xff;
+    p[3] = (v >> 24) & 0xff;
+}
+
+ZeroSuppressor::ZeroSuppressor()
+    : m_n_channels(1), m_has_avx2(false), m_use_avx2(false)
+{
+#ifdef ZS_HAVE_X86
+    __builtin_cpu_init();
+    m_has_avx2 = __builtin_cpu_supports("avx2");
+#endif
+    m_use_avx2 = m_has_avx2;
+    reset_stats();
+}
+
+ZeroSuppressor::~ZeroSuppressor()
+{
+}
+
+int ZeroSuppressor::parse_thresholds(const std::string& s,
+                                     std::vector<unsigned int>& thresholds)
+{
+    thresholds.clear();
+    std::istringstream is(s);
+    std::string item;
+    while (std::getline(is, item, ',')) {
+        char* end;
+        unsigned long v = strtoul(item.c_str(), &end, 0);
+        if (end == item.c_str() || v > 0xffff) {
+            return -1;
+        }
+        thresholds.push_back(v);
+    }
+    return thresholds.empty() ? -1 : 0;
+}
+
+int ZeroSuppressor::configure(unsigned int n_channels,
+                              const std::vector<unsigned int>& thresholds)
+{
+    if (n_channels == 0 || n_channels > 65536 || thresholds.empty()) {
+        return -1;
+    }
+    if (thresholds.size() != 1 && thresholds.size() != n_channels) {
+        return -1;
+    }
+    m_n_channels = n_channels;
+
+    unsigned int period = n_channels / gcd(n_channels, 16) * 16;
+    m_pattern.resize(period);
+    for (unsigned int i = 0; i < period; i++) {
+        unsigned int ch  = i % n_channels;
+        unsigned int thr = thresholds.size() == 1 ? thresholds[0] : thresholds[ch];
+        if (thr > 0xfffe) {
+            thr = 0xfffe;       // keep thr + 1 in 16 bits
+        }
+        m_pattern[i] = thr + 1; // keep if sample >= thr + 1
+    }
+    return 0;
+}
+
+unsigned int ZeroSuppressor::reduce_scalar(const unsigned short* in,
+                                           unsigned int n,
+                                           unsigned int* idx,
+                                           unsigned short* val)
+{
+    const unsigned int period = m_pattern.size();
+    const unsigned short* pattern = &m_pattern[0];
+    unsigned int hits = 0;
+    unsigned int pos = 0;
+
+    for (unsigned int i = 0; i < n; i++) {
+        unsigned short x = in[i];
+        if (x >= pattern[pos]) {
+            idx[hits] = i;
+            val[hits] = x;
+            hits++;
+        }
+        if (++pos == period) {
+            pos = 0;
+        }
+    }
+    return hits;
+}
+
+#ifdef ZS_HAVE_X86
+__attribute__((target("avx2")))
+unsigned int ZeroSuppressor::reduce_avx2(const unsigned short* in,
+                                         unsigned int n,
+                                         unsigned int* idx,
+                                         unsigned short* val)
+{
+    const unsigned int period = m_pattern.size(); // multiple of 16
+    const unsigned short* pattern = &m_pattern[0];
+    unsigned int hits = 0;
+    unsigned int pos = 0;
+    unsigned int i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m256i x   = _mm256_loadu_si256((const __m256i*)(in + i));
+        __m256i thr = _mm256_loadu_si256((const __m256i*)(pattern + pos));
+        // x >= thr  <=>  max(x, thr) == x   (unsigned)
+        __m256i ge  = _mm256_cmpeq_epi16(_mm256_max_epu16(x, thr), x);
+        unsigned int mask = _mm256_movemask_epi8(ge);
+        // two mask bits per sample
+        while (mask != 0) {
+            unsigned int bit = __builtin_ctz(mask);
+            unsigned int k = i + bit/2;
+            idx[hits] = k;
+            val[hits] = in[k];
+            hits++;
+            mask &= ~(3U << bit);
+        }
+        pos += 16;
+        if (pos == period) {
+            pos = 0;
+        }
+    }
+
+    // tail
+    for (; i < n; i++) {
+        if (in[i] >= pattern[pos + (i & 15)]) {
+            idx[hits] = i;
+            val[hits] = in[i];
+            hits++;
+        }
+    }
+    return hits;
+}
+#else
+unsigned int ZeroSuppressor::reduce_avx2(const unsigned short* in,
+                                         unsigned int n,
+                                         unsigned int* idx,
+                                         unsigned short* val)
+{
+    return reduce_scalar(in, n, idx, val);
+}
+#endif
+
+unsigned int ZeroSuppressor::reduce(const unsigned char* in,
+                                    unsigned int byte_size,
+                                    const unsigned char*& out)
+{
+    unsigned long long t_start = mono_now_ns();
+
+    unsigned int n = byte_size / 2;
+    if (m_idx.size() < n) {
+        m_idx.resize(n);
+        m_val.resize(n);
+    }
+
+    unsigned int hits = 0;
+    if (n > 0) {
+        if (m_use_avx2) {
+            hits = reduce_avx2((const unsigned short*)in, n, &m_idx[0], &m_val[0]);
+        }
+        else {
+            hits = reduce_scalar((const unsigned short*)in, n, &m_idx[0], &m_val[0]);
+        }
+    }
+
+    unsigned int out_size = HEADER_BYTE_SIZE + hits*(4 + 2);
+    if (m_out.size() < out_size) {
+        m_out.resize(out_size);
+    }
+    unsigned char* p = &m_out[0];
+    p[0] = 0x5a;
+    p[1] = 0x53;
+    p[2] = 1;
+    p[3] = 2;
+    put_le32(p +  4, m_n_channels);
+    put_le32(p +  8, n);
+    put_le32(p + 12, hits);
+    if (hits > 0) {
+        // host order is little endian on the DAQ nodes (x86)
+        memcpy(p + HEADER_BYTE_SIZE, &m_idx[0], hits*4);
+        memcpy(p + HEADER_BYTE_SIZE + hits*4, &m_val[0], hits*2);
+    }
+    out = p;
+
+    m_in_bytes  += byte_size;
+    m_out_bytes += out_size;
+    m_hits      += hits;
+    m_ns        += mono_now_ns() - t_start;
+
+    return out_size;
+}
+
+void ZeroSuppressor::reset_stats()
+{
+    m_in_bytes  = 0;
+    m_out_bytes = 0;
+    m_hits      = 0;
+    m_ns        = 0;
+}
+
+void ZeroSuppressor::print_stats(std::ostream& os) const
+{
+    os << "zero_suppress kernel: " << kernel_name()
+       << " in: " << m_in_bytes << " bytes"
+       << " out: " << m_out_bytes << " bytes"
+       << " hits: " << m_hits << std::endl;
+    if (m_in_bytes > 0) {
+        os << "zero_suppress reduction_ratio: "
+           << (m_out_bytes > 0 ? (double)m_in_bytes/m_out_bytes : 0.0)
+           << " ns/byte: " << (double)m_ns/m_in_bytes << std::endl;
+    }
+}
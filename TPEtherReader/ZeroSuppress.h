@@ -0,0 +1,89 @@
+// -*- C++ -*-
+/*!
+ * @file ZeroSuppress.h
+ * @brief Per-channel threshold suppression of 16 bit samples.
+ * @date
+ * @author
+ *
+ */
+
+#ifndef ZEROSUPPRESS_H
+#define ZEROSUPPRESS_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+/*
+ * Input: a block of 16 bit samples (host byte order), channels
+ * interleaved, i.e. sample i belongs to channel i % n_channels.
+ * A sample is kept if it is greater than the threshold of its channel.
+ *
+ * Output (sparse) layout, all fields little endian:
+ *
+ *   offset  size
+ *    0      2     magic 0x5a 0x53 ("ZS")
+ *    2      1     version (1)
+ *    3      1     sample byte size (2)
+ *    4      4     n_channels
+ *    8      4     n_samples in the original block
+ *   12      4     n_hits
+ *   16      4*n_hits  sample index of each hit (channel = index % n_channels)
+ *   ..      2*n_hits  sample value of each hit
+ *
+ * Indices and values are separate arrays so that both stay aligned
+ * for vectorized decoding.  A trailing odd byte of the input (not a
+ * whole sample) is dropped.
+ *
+ * The AVX2 kernel compares 16 samples per instruction and skips the
+ * (common) case of no hit with one test; it is selected at run time
+ * if the CPU supports AVX2, otherwise the scalar kernel is used.
+ */
+class ZeroSuppressor
+{
+public:
+    static const unsigned int HEADER_BYTE_SIZE = 16;
+
+    ZeroSuppressor();
+    virtual ~ZeroSuppressor();
+
+    /// thresholds: one value for all channels, or one per channel
+    int  configure(unsigned int n_channels,
+                   const std::vector<unsigned int>& thresholds);
+    /// "100" or "100,120,95" -> thresholds. returns -1 on parse error
+    static int parse_thresholds(const std::string& s,
+                                std::vector<unsigned int>& thresholds);
+    void force_scalar(bool scalar) { m_use_avx2 = !scalar && m_has_avx2; }
+    const char* kernel_name() const { return m_use_avx2 ? "avx2" : "scalar"; }
+
+    /// returns the output byte size, out points into an internal buffer
+    unsigned int reduce(const unsigned char* in, unsigned int byte_size,
+                        const unsigned char*& out);
+
+    void reset_stats();
+    void print_stats(std::ostream& os) const;
+
+private:
+    unsigned int reduce_scalar(const unsigned short* in, unsigned int n,
+                               unsigned int* idx, unsigned short* val);
+    unsigned int reduce_avx2(const unsigned short* in, unsigned int n,
+                             unsigned int* idx, unsigned short* val);
+
+    unsigned int m_n_channels;
+    /// threshold + 1 per sample position, repeated over one period
+    /// which is a multiple of both n_channels and 16 samples
+    std::vector<unsigned short> m_pattern;
+    bool m_has_avx2;
+    bool m_use_avx2;
+
+    std::vector<unsigned int> m_idx;
+    std::vector<unsigned short> m_val;
+    std::vector<unsigned char> m_out;
+
+    unsigned long long m_in_bytes;
+    unsigned long long m_out_bytes;
+    unsigned long long m_hits;
+    unsigned long long m_ns;
+};
+
+#endif
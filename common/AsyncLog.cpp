@@ -0,0 +1,292 @@
+// -*- C++ -*-
+/*!
+ * @file AsyncLog.cpp
+ * @brief Leveled, rate limited logging off the data path.
+ * @date
+ * @author
+ *
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <vector>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "AsyncLog.h"
+#include "BlockTime.h"
+#include "SpscQueue.h"
+
+struct LogRecord {
+    unsigned long long ns;                /// CLOCK_REALTIME
+    int level;
+    unsigned int len;
+    char text[240];
+};
+
+struct LogRing {
+    SpscQueue<LogRecord> queue;
+    int in_use;                           /// a live thread owns it
+    unsigned long long dropped;
+};
+
+static const unsigned int RING_SIZE = 1024;
+static const useconds_t FLUSH_INTERVAL_US = 10000;
+
+int AsyncLog::s_level = AsyncLog::LEVEL_INFO;
+
+// Nothing here has a destructor: the flusher thread may still run
+// while static objects are destroyed at exit.
+static pthread_mutex_t s_rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<LogRing*>* s_rings = 0; /// never shrinks
+static pthread_mutex_t s_drain_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long long s_dropped_reported = 0;
+static bool s_flusher_started = false;
+static pthread_key_t s_ring_key;
+static __thread LogRing* t_ring = 0;
+
+static const char* level_prefix(int level)
+{
+    switch (level) {
+    case AsyncLog::LEVEL_ERROR:
+        return "### ERROR: ";
+    case AsyncLog::LEVEL_WARNING:
+        return "### WARNING: ";
+    case AsyncLog::LEVEL_DEBUG:
+        return "debug: ";
+    default:
+        return "";
+    }
+}
+
+static void release_ring(void* ring)
+{
+    // the consumer still drains what the thread left behind
+    __atomic_store_n(&static_cast<LogRing*>(ring)->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void* flusher_loop(void*)
+{
+    for (;;) {
+        usleep(FLUSH_INTERVAL_US);
+        AsyncLog::flush();
+    }
+    return 0;
+}
+
+static void flush_at_exit()
+{
+    AsyncLog::flush();
+}
+
+static LogRing* thread_ring()
+{
+    if (t_ring != 0) {
+        return t_ring;
+    }
+
+    pthread_mutex_lock(&s_rings_mutex);
+    if (!s_flusher_started) {
+        s_rings = new std::vector<LogRing*>();
+        pthread_key_create(&s_ring_key, release_ring);
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, flusher_loop, NULL) == 0) {
+            pthread_detach(thread);
+        }
+        atexit(flush_at_exit);
+        s_flusher_started = true;
+    }
+    LogRing* ring = 0;
+    for (unsigned int i = 0; i < s_rings->size(); i++) {
+        if (__atomic_load_n(&(*s_rings)[i]->in_use, __ATOMIC_ACQUIRE) == 0) {
+            ring = (*s_rings)[i];
+            break;
+        }
+    }
+    if (ring == 0) {
+        ring = new LogRing();
+        ring->queue.resize(RING_SIZE);
+        ring->dropped = 0;
+        s_rings->push_back(ring);
+    }
+    ring->in_use = 1;
+    pthread_mutex_unlock(&s_rings_mutex);
+
+    pthread_setspecific(s_ring_key, ring);
+    t_ring = ring;
+    return ring;
+}
+
+void AsyncLog::set_level(Level level)
+{
+    __atomic_store_n(&s_level, (int)level, __ATOMIC_RELAXED);
+}
+
+int AsyncLog::set_level(const std::string& name)
+{
+    if (name == "error") {
+        set_level(LEVEL_ERROR);
+    }
+    else if (name == "warning") {
+        set_level(LEVEL_WARNING);
+    }
+    else if (name == "info") {
+        set_level(LEVEL_INFO);
+    }
+    else if (name == "debug") {
+        set_level(LEVEL_DEBUG);
+    }
+    else {
+        return -1;
+    }
+    return 0;
+}
+
+void AsyncLog::log(Level level, const char* fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    vlog(level, fmt, ap);
+    va_end(ap);
+}
+
+void AsyncLog::vlog(Level level, const char* fmt, va_list ap)
+{
+    LogRing* ring = thread_ring();
+    LogRecord* rec = ring->queue.write_slot();
+    if (rec == 0) {
+        __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    rec->ns    = (unsigned long long)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+    rec->level = level;
+    int n = vsnprintf(rec->text, sizeof(rec->text), fmt, ap);
+    if (n < 0) {
+        n = 0;
+    }
+    rec->len = (unsigned int)n < sizeof(rec->text) ? n : sizeof(rec->text) - 1;
+    ring->queue.commit();
+}
+
+void AsyncLog::log_lines(Level level, const std::string& text)
+{
+    std::string::size_type begin = 0;
+    while (begin < text.size()) {
+        std::string::size_type end = text.find('\n', begin);
+        if (end == std::string::npos) {
+            end = text.size();
+        }
+        log(level, "%s", text.substr(begin, end - begin).c_str());
+        begin = end + 1;
+    }
+}
+
+static bool earlier(const LogRecord& a, const LogRecord& b)
+{
+    return a.ns < b.ns;
+}
+
+void AsyncLog::flush()
+{
+    pthread_mutex_lock(&s_drain_mutex);
+
+    std::vector<LogRing*> rings;
+    pthread_mutex_lock(&s_rings_mutex);
+    if (s_rings != 0) {
+        rings = *s_rings;
+    }
+    pthread_mutex_unlock(&s_rings_mutex);
+
+    std::vector<LogRecord> batch;
+    unsigned long long dropped = 0;
+    for (unsigned int i = 0; i < rings.size(); i++) {
+        LogRecord* rec;
+        while ((rec = rings[i]->queue.read_slot()) != 0) {
+            batch.push_back(*rec);
+            rings[i]->queue.release();
+        }
+        dropped += __atomic_load_n(&rings[i]->dropped, __ATOMIC_RELAXED);
+    }
+    std::stable_sort(batch.begin(), batch.end(), earlier);
+
+    std::string out;
+    for (unsigned int i = 0; i < batch.size(); i++) {
+        const LogRecord& rec = batch[i];
+        time_t sec = rec.ns / 1000000000ULL;
+        struct tm tm;
+        localtime_r(&sec, &tm);
+        char stamp[32];
+        snprintf(stamp, sizeof(stamp), "%02d:%02d:%02d.%06llu ",
+                 tm.tm_hour, tm.tm_min, tm.tm_sec,
+                 (rec.ns % 1000000000ULL)/1000);
+        out += stamp;
+        out += level_prefix(rec.level);
+        out.append(rec.text, rec.len);
+        out += '\n';
+    }
+    if (dropped > s_dropped_reported) {
+        char msg[96];
+        snprintf(msg, sizeof(msg),
+                 "### WARNING: %llu log messages dropped, queue full\n",
+                 dropped - s_dropped_reported);
+        out += msg;
+        s_dropped_reported = dropped;
+    }
+
+    const char* p = out.data();
+    size_t left = out.size();
+    while (left > 0) {
+        ssize_t n = write(STDERR_FILENO, p, left);
+        if (n <= 0) {
+            break;
+        }
+        p    += n;
+        left -= n;
+    }
+
+    pthread_mutex_unlock(&s_drain_mutex);
+}
+
+unsigned long long AsyncLog::dropped()
+{
+    pthread_mutex_lock(&s_drain_mutex);
+    unsigned long long n = s_dropped_reported;
+    pthread_mutex_unlock(&s_drain_mutex);
+    return n;
+}
+
+LogRateLimit::LogRateLimit(unsigned int per_sec, const char* file, int line)
+    : m_per_sec(per_sec), m_file(file), m_line(line),
+      m_window(0), m_count(0), m_suppressed(0)
+{
+}
+
+bool LogRateLimit::allow()
+{
+    // Counters are updated without a lock; with several threads on one
+    // call site the limit is approximate, which is fine for a log.
+    unsigned long long window = mono_now_ns() / 1000000000ULL;
+    if (window != __atomic_load_n(&m_window, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&m_window, window, __ATOMIC_RELAXED);
+        __atomic_store_n(&m_count, 0, __ATOMIC_RELAXED);
+        unsigned long long suppressed =
+            __atomic_exchange_n(&m_suppressed, 0, __ATOMIC_RELAXED);
+        if (suppressed > 0) {
+            AsyncLog::log(AsyncLog::LEVEL_WARNING,
+                          "%llu messages suppressed at %s:%d",
+                          suppressed, m_file, m_line);
+        }
+    }
+    if (__atomic_add_fetch(&m_count, 1, __ATOMIC_RELAXED) <= m_per_sec) {
+        return true;
+    }
+    __atomic_add_fetch(&m_suppressed, 1, __ATOMIC_RELAXED);
+    return false;
+}
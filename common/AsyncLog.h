@@ -0,0 +1,114 @@
+// -*- C++ -*-
+/*!
+ * @file AsyncLog.h
+ * @brief Leveled, rate limited logging off the data path.
+ * @date
+ * @author
+ *
+ */
+
+#ifndef ASYNCLOG_H
+#define ASYNCLOG_H
+
+#include <cstdarg>
+#include <string>
+
+/*
+ * @class AsyncLog
+ * @brief printf-style messages queued per thread, written by a
+ *        background thread.
+ *
+ * Every thread that logs gets its own SpscQueue of fixed size records
+ * (reused after the thread exits).  A message costs a level check, a
+ * clock read and a vsnprintf() into the queue slot; there is no lock
+ * and no syscall.  If the queue is full the message is dropped and
+ * counted, the caller never waits.
+ *
+ * A flusher thread wakes up every 10 ms, takes the records of all
+ * queues, orders them by time and writes them to stderr with one
+ * write().  flush() does the same in the calling thread; call it
+ * before writing to std::cerr directly so that the order is kept.
+ *
+ * Lines look like
+ *     12:34:56.789012 ### WARNING: connection to ... lost
+ * ERROR and WARNING keep the "### ERROR:" style of the components.
+ *
+ * Use the macros, which skip the formatting when the level is off:
+ *     TPLOG_DEBUG("block %u: %d bytes", seq, size);
+ *     TPLOG_RATE(AsyncLog::LEVEL_ERROR, 10, "bad header in block %u", seq);
+ * TPLOG_RATE passes at most N messages per second of that call site
+ * and reports how many were suppressed.
+ */
+class AsyncLog
+{
+public:
+    enum Level {
+        LEVEL_ERROR = 0,
+        LEVEL_WARNING,
+        LEVEL_INFO,
+        LEVEL_DEBUG
+    };
+
+    static void set_level(Level level);
+    /// "error", "warning", "info" or "debug"; returns -1 if unknown
+    static int  set_level(const std::string& name);
+    static bool enabled(Level level)
+    {
+        return (int)level <= __atomic_load_n(&s_level, __ATOMIC_RELAXED);
+    }
+
+    static void log(Level level, const char* fmt, ...)
+        __attribute__((format(printf, 2, 3)));
+    static void vlog(Level level, const char* fmt, va_list ap);
+    /// one record per line, for multi-line reports
+    static void log_lines(Level level, const std::string& text);
+
+    /// write out all queued messages now
+    static void flush();
+    /// messages lost because a queue was full
+    static unsigned long long dropped();
+
+private:
+    static int s_level;
+};
+
+/*
+ * @class LogRateLimit
+ * @brief Per call site state of TPLOG_RATE, shared by all threads.
+ */
+class LogRateLimit
+{
+public:
+    LogRateLimit(unsigned int per_sec, const char* file, int line);
+    bool allow();
+
+private:
+    unsigned int m_per_sec;
+    const char* m_file;
+    int m_line;
+    unsigned long long m_window;          /// current second
+    unsigned int m_count;                 /// messages in this second
+    unsigned long long m_suppressed;
+};
+
+#define TPLOG_AT(level, ...)                                        \
+    do {                                                            \
+        if (AsyncLog::enabled(level)) {                             \
+            AsyncLog::log(level, __VA_ARGS__);                      \
+        }                                                           \
+    } while (0)
+
+#define TPLOG_ERROR(...)   TPLOG_AT(AsyncLog::LEVEL_ERROR, __VA_ARGS__)
+#define TPLOG_WARNING(...) TPLOG_AT(AsyncLog::LEVEL_WARNING, __VA_ARGS__)
+#define TPLOG_INFO(...)    TPLOG_AT(AsyncLog::LEVEL_INFO, __VA_ARGS__)
+#define TPLOG_DEBUG(...)   TPLOG_AT(AsyncLog::LEVEL_DEBUG, __VA_ARGS__)
+
+#define TPLOG_RATE(level, per_sec, ...)                             \
+    do {                                                            \
+        static LogRateLimit tplog_limit_(per_sec, __FILE__, __LINE__); \
+        if (AsyncLog::enabled(level) && tplog_limit_.allow()) {     \
+            AsyncLog::log(level, __VA_ARGS__);                      \
+        }                                                           \
+    } while (0)
+
+#endif
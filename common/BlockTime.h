@@ -0,0 +1,41 @@
+// -*- C++ -*-
+/*!
+ * @file BlockTime.h
+ * @brief Monotonic time stamp carried in TimedOctetSeq::tm.
+ * @date
+ * @author
+ *
+ * TPEtherReader stamps each block with CLOCK_MONOTONIC at the time
+ * the socket read completed.  The clock is per host, so latencies
+ * computed from this stamp are meaningful only when the reader and
+ * the consumer run on the same node.
+ *
+ */
+
+#ifndef BLOCKTIME_H
+#define BLOCKTIME_H
+
+#include <time.h>
+
+static inline unsigned long long mono_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+template <class T>
+static inline void set_block_time(T& tm, unsigned long long ns)
+{
+    tm.sec  = ns / 1000000000ULL;
+    tm.nsec = ns % 1000000000ULL;
+}
+
+/// returns 0 if the block was not stamped
+template <class T>
+static inline unsigned long long get_block_time(const T& tm)
+{
+    return (unsigned long long)tm.sec*1000000000ULL + tm.nsec;
+}
+
+#endif
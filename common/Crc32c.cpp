@@ -0,0 +1,212 @@
+// -*- C++ -*-
+/*!
+ * @file Crc32c.cpp
+ * @brief CRC32C (Castagnoli) with the SSE4.2 crc32 instruction.
+ * @date
+ * @author
+ *
+ */
+
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#define CRC32C_HAVE_X86 1
+#endif
+
+#include "Crc32c.h"
+
+/*
+ * All internal functions work on the raw shift register; the public
+ * ones invert it on the way in and out.  Bit 31 of a register value is
+ * the coefficient of x^0 (reflected).
+ */
+
+static const unsigned int POLY = 0x82f63b78;
+
+static unsigned int s_table[8][256];
+static unsigned int s_x2n[32];           /// x^(2^n) mod P
+static bool s_use_hw = false;
+
+/// a*b mod P
+static unsigned int multmodp(unsigned int a, unsigned int b)
+{
+    unsigned int m = 1U << 31;
+    unsigned int p = 0;
+    for (;;) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m - 1)) == 0) {
+                break;
+            }
+        }
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ POLY : b >> 1;
+    }
+    return p;
+}
+
+/// x^(n*2^k) mod P
+static unsigned int x2nmodp(unsigned long long n, unsigned int k)
+{
+    unsigned int p = 1U << 31;           // x^0
+    while (n) {
+        if (n & 1) {
+            p = multmodp(s_x2n[k & 31], p);
+        }
+        n >>= 1;
+        k++;
+    }
+    return p;
+}
+
+static unsigned int crc_table(unsigned int crc, const unsigned char* p,
+                              size_t len)
+{
+    while (len > 0 && ((size_t)p & 7) != 0) {
+        crc = s_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+        len--;
+    }
+    while (len >= 8) {
+        unsigned int lo;
+        unsigned int hi;
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + 4, 4);
+        lo ^= crc;
+        crc = s_table[7][ lo        & 0xff] ^ s_table[6][(lo >>  8) & 0xff] ^
+              s_table[5][(lo >> 16) & 0xff] ^ s_table[4][ lo >> 24        ] ^
+              s_table[3][ hi        & 0xff] ^ s_table[2][(hi >>  8) & 0xff] ^
+              s_table[1][(hi >> 16) & 0xff] ^ s_table[0][ hi >> 24        ];
+        p   += 8;
+        len -= 8;
+    }
+    while (len > 0) {
+        crc = s_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+        len--;
+    }
+    return crc;
+}
+
+#ifdef CRC32C_HAVE_X86
+/// bytes per stream of the 3-way loop, long and short
+static const size_t LONG_CHUNK  = 32768;
+static const size_t SHORT_CHUNK = 1024;
+static unsigned int s_long_shift;        /// x^(8*LONG_CHUNK) mod P
+static unsigned int s_short_shift;
+
+__attribute__((target("sse4.2")))
+static unsigned int crc_hw(unsigned int crc, const unsigned char* p,
+                           size_t len)
+{
+    while (len > 0 && ((size_t)p & 7) != 0) {
+        crc = _mm_crc32_u8(crc, *p++);
+        len--;
+    }
+
+    // three independent streams keep the crc32 unit busy; the register
+    // of a stream is moved over the following ones by multmodp()
+    size_t chunk = LONG_CHUNK;
+    unsigned int shift = s_long_shift;
+    for (;;) {
+        while (len >= 3*chunk) {
+            unsigned long long a = crc;
+            unsigned long long b = 0;
+            unsigned long long c = 0;
+            const unsigned char* end = p + chunk;
+            while (p < end) {
+                unsigned long long va;
+                unsigned long long vb;
+                unsigned long long vc;
+                memcpy(&va, p, 8);
+                memcpy(&vb, p + chunk, 8);
+                memcpy(&vc, p + 2*chunk, 8);
+                a = _mm_crc32_u64(a, va);
+                b = _mm_crc32_u64(b, vb);
+                c = _mm_crc32_u64(c, vc);
+                p += 8;
+            }
+            crc = multmodp(shift, (unsigned int)a) ^ (unsigned int)b;
+            crc = multmodp(shift, crc) ^ (unsigned int)c;
+            p   += 2*chunk;
+            len -= 3*chunk;
+        }
+        if (chunk == SHORT_CHUNK) {
+            break;
+        }
+        chunk = SHORT_CHUNK;
+        shift = s_short_shift;
+    }
+
+    unsigned long long c64 = crc;
+    while (len >= 8) {
+        unsigned long long v;
+        memcpy(&v, p, 8);
+        c64 = _mm_crc32_u64(c64, v);
+        p   += 8;
+        len -= 8;
+    }
+    crc = (unsigned int)c64;
+    while (len > 0) {
+        crc = _mm_crc32_u8(crc, *p++);
+        len--;
+    }
+    return crc;
+}
+#endif
+
+/// tables and CPU check, before main() so that threads need no lock
+static struct Crc32cInit {
+    Crc32cInit()
+    {
+        for (unsigned int n = 0; n < 256; n++) {
+            unsigned int c = n;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? (c >> 1) ^ POLY : c >> 1;
+            }
+            s_table[0][n] = c;
+        }
+        for (unsigned int n = 0; n < 256; n++) {
+            unsigned int c = s_table[0][n];
+            for (int k = 1; k < 8; k++) {
+                c = s_table[0][c & 0xff] ^ (c >> 8);
+                s_table[k][n] = c;
+            }
+        }
+
+        unsigned int p = 1U << 30;       // x^1
+        s_x2n[0] = p;
+        for (int n = 1; n < 32; n++) {
+            s_x2n[n] = p = multmodp(p, p);
+        }
+
+#ifdef CRC32C_HAVE_X86
+        s_long_shift  = x2nmodp(LONG_CHUNK, 3);
+        s_short_shift = x2nmodp(SHORT_CHUNK, 3);
+        __builtin_cpu_init();
+        s_use_hw = __builtin_cpu_supports("sse4.2");
+#endif
+    }
+} s_crc32c_init;
+
+unsigned int crc32c(unsigned int crc, const void* data, size_t len)
+{
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    crc = ~crc;
+#ifdef CRC32C_HAVE_X86
+    if (s_use_hw) {
+        return ~crc_hw(crc, p, len);
+    }
+#endif
+    return ~crc_table(crc, p, len);
+}
+
+unsigned int crc32c_combine(unsigned int crc_a, unsigned int crc_b,
+                            unsigned long long len_b)
+{
+    return multmodp(x2nmodp(len_b, 3), crc_a) ^ crc_b;
+}
+
+const char* crc32c_impl()
+{
+    return s_use_hw ? "sse4.2" : "table";
+}
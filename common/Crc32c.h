@@ -0,0 +1,32 @@
+// -*- C++ -*-
+/*!
+ * @file Crc32c.h
+ * @brief CRC32C (Castagnoli) with the SSE4.2 crc32 instruction.
+ * @date
+ * @author
+ *
+ * Same result as the iSCSI/ext4/btrfs checksum:
+ * crc32c(0, "123456789", 9) == 0xe3069283.
+ *
+ * The SSE4.2 instruction has a latency of 3 cycles and a throughput of
+ * 1, so large buffers are cut into three streams which are checksummed
+ * in parallel and merged with crc32c_combine().  Without SSE4.2 a
+ * slicing-by-8 table is used.  The choice is made once at load time.
+ */
+
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <cstddef>
+
+/// crc: result of the previous call, 0 for the first piece
+unsigned int crc32c(unsigned int crc, const void* data, size_t len);
+
+/// CRC of the concatenation A+B from crc(A), crc(B) and the length of B
+unsigned int crc32c_combine(unsigned int crc_a, unsigned int crc_b,
+                            unsigned long long len_b);
+
+/// "sse4.2" or "table"
+const char* crc32c_impl();
+
+#endif
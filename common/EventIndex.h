@@ -0,0 +1,56 @@
+// -*- C++ -*-
+/*!
+ * @file EventIndex.h
+ * @brief Event index file written by TPEtherLogger.
+ * @date
+ * @author
+ *
+ */
+
+#ifndef EVENTINDEX_H
+#define EVENTINDEX_H
+
+/*
+ * The index file is written next to the first data file of a run,
+ * with ".idx" appended to its name:
+ *
+ *   EventIndexHeader
+ *   EventIndexEntry for event 0
+ *   EventIndexEntry for event 1
+ *   ...
+ *
+ * Fields are in host byte order (little endian on the DAQ nodes).
+ * Entry N is at sizeof(EventIndexHeader) + N*sizeof(EventIndexEntry),
+ * so event N is found with one seek.  branch_no is the file branch
+ * (the BBB in the data file name) in which the event starts; an event
+ * which starts at the end of a branch continues at the beginning of
+ * the next one.
+ *
+ * With saveHeaderFooter the file keeps the 8 byte header and footer of
+ * every block, so an event across a block boundary is not contiguous:
+ * block_bytes is then the number of bytes from offset to the end of
+ * the block's data, and the event continues after the footer and the
+ * header of the next block (which gives that block's size).  0: the
+ * data of the blocks is contiguous in the file.
+ *
+ * Index files of entry_size 16 are from before block_bytes and have
+ * contiguous data.
+ */
+
+static const char EVENT_INDEX_MAGIC[8] = { 'T', 'P', 'E', 'I', 'D', 'X', '0', '1' };
+
+struct EventIndexHeader {
+    char magic[8];
+    unsigned int entry_size;             /// sizeof(EventIndexEntry)
+    unsigned int run_no;
+};
+
+struct EventIndexEntry {
+    unsigned long long offset;           /// byte offset in the data file
+    unsigned int branch_no;
+    unsigned int byte_size;              /// event length
+    unsigned int block_bytes;            /// to the end of the block, 0: no framing
+    unsigned int reserved;
+};
+
+#endif
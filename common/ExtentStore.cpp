@@ -0,0 +1,484 @@
+// -*- C++ -*-
+/*!
+ * @file ExtentStore.cpp
+ * @brief Data files as extents of one preallocated file or block device.
+ * @date
+ * @author
+ *
+ */
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+
+#include "ExtentStore.h"
+#include "Crc32c.h"
+
+// the on-disk layout must not depend on the compiler
+typedef char extent_entry_size_check[sizeof(ExtentEntry) == 128 ? 1 : -1];
+
+static const unsigned int STORE_VERSION = 1;
+static const unsigned long long DATA_ALIGN = 1024*1024;  /// data area start
+
+static unsigned long long round_up(unsigned long long n, unsigned long long a)
+{
+    return (n + a - 1)/a*a;
+}
+
+static unsigned int entry_crc(const ExtentEntry& e)
+{
+    return crc32c(0, &e, offsetof(ExtentEntry, entry_crc));
+}
+
+static unsigned int sb_crc(const ExtentSuperblock& sb)
+{
+    return crc32c(0, &sb, offsetof(ExtentSuperblock, sb_crc));
+}
+
+static void* aligned_alloc_zero(size_t size)
+{
+    void* p = 0;
+    if (posix_memalign(&p, ExtentStore::ALIGN, size) != 0) {
+        return 0;
+    }
+    memset(p, 0, size);
+    return p;
+}
+
+static int pwrite_all(int fd, const void* buf, size_t size,
+                      unsigned long long offset)
+{
+    const char* p = static_cast<const char*>(buf);
+    while (size > 0) {
+        ssize_t n = pwrite(fd, p, size, offset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p      += n;
+        size   -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+static int write_all(int fd, const char* p, size_t size)
+{
+    while (size > 0) {
+        ssize_t n = ::write(fd, p, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p    += n;
+        size -= n;
+    }
+    return 0;
+}
+
+static int pread_all(int fd, void* buf, size_t size, unsigned long long offset)
+{
+    char* p = static_cast<char*>(buf);
+    while (size > 0) {
+        ssize_t n = pread(fd, p, size, offset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (n == 0) {
+            errno = EIO;       // store shorter than its superblock says
+            return -1;
+        }
+        p      += n;
+        size   -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+ExtentStore::ExtentStore()
+    : m_fd(-1), m_direct(false), m_for_write(false), m_table(0),
+      m_table_bytes(0), m_used(0), m_cur(-1), m_next_offset(0),
+      m_buf(0), m_buf_fill(0), m_buf_offset(0), m_last_update(0),
+      m_lost(false)
+{
+    memset(&m_sb, 0, sizeof(m_sb));
+}
+
+ExtentStore::~ExtentStore()
+{
+    close();
+}
+
+int ExtentStore::fail(const std::string& what)
+{
+    m_error = m_path + ": " + what;
+    if (errno != 0) {
+        m_error += std::string(": ") + strerror(errno);
+    }
+    return -1;
+}
+
+int ExtentStore::format(const std::string& path, unsigned long long size,
+                        unsigned int max_extents, bool preallocate,
+                        std::string& error)
+{
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        error = path + ": " + strerror(errno);
+        return -1;
+    }
+
+    struct stat st;
+    fstat(fd, &st);
+    if (S_ISBLK(st.st_mode)) {
+        unsigned long long dev_size = 0;
+        ioctl(fd, BLKGETSIZE64, &dev_size);
+        if (size == 0 || size > dev_size) {
+            size = dev_size;
+        }
+    }
+    else {
+        if (size == 0) {
+            size = st.st_size;
+        }
+        int ret = preallocate ? fallocate(fd, 0, 0, size) : ftruncate(fd, size);
+        if (ret < 0) {
+            error = path + ": cannot set size: " + strerror(errno);
+            ::close(fd);
+            return -1;
+        }
+    }
+    size = size/ALIGN*ALIGN;
+
+    ExtentSuperblock sb;
+    memset(&sb, 0, sizeof(sb));
+    memcpy(sb.magic, EXTENT_STORE_MAGIC, sizeof(sb.magic));
+    sb.version       = STORE_VERSION;
+    sb.align         = ALIGN;
+    sb.store_size    = size;
+    sb.table_offset  = ALIGN;
+    sb.table_entries = max_extents;
+    sb.entry_size    = sizeof(ExtentEntry);
+    unsigned long long table_bytes =
+        round_up((unsigned long long)max_extents*sizeof(ExtentEntry), ALIGN);
+    sb.data_offset   = round_up(sb.table_offset + table_bytes, DATA_ALIGN);
+    sb.format_time   = time(NULL);
+    sb.sb_crc        = sb_crc(sb);
+    if (max_extents == 0 || sb.data_offset + ALIGN > size) {
+        error = path + ": too small for the extent table";
+        ::close(fd);
+        return -1;
+    }
+
+    // an empty table, then the superblock which makes it valid
+    std::vector<char> zero(1024*1024, 0);
+    for (unsigned long long off = 0; off < table_bytes; off += zero.size()) {
+        size_t n = table_bytes - off < zero.size() ? table_bytes - off
+                                                   : zero.size();
+        if (pwrite_all(fd, &zero[0], n, sb.table_offset + off) < 0) {
+            error = path + ": " + strerror(errno);
+            ::close(fd);
+            return -1;
+        }
+    }
+    std::vector<char> unit(ALIGN, 0);
+    memcpy(&unit[0], &sb, sizeof(sb));
+    if (pwrite_all(fd, &unit[0], ALIGN, 0) < 0 || fdatasync(fd) < 0) {
+        error = path + ": " + strerror(errno);
+        ::close(fd);
+        return -1;
+    }
+    return ::close(fd);
+}
+
+int ExtentStore::open(const std::string& path, bool for_write)
+{
+    close();
+    m_path      = path;
+    m_for_write = for_write;
+    m_direct    = false;
+    errno = 0;
+
+    if (for_write) {
+        m_fd = ::open(path.c_str(), O_RDWR | O_DIRECT);
+        if (m_fd >= 0) {
+            m_direct = true;
+        }
+        else if (errno == EINVAL) {
+            // the file system does not do direct I/O
+            m_fd = ::open(path.c_str(), O_RDWR);
+        }
+    }
+    else {
+        m_fd = ::open(path.c_str(), O_RDONLY);
+    }
+    if (m_fd < 0) {
+        return fail("open");
+    }
+
+    if (read_metadata() < 0) {
+        ::close(m_fd);
+        m_fd = -1;
+        return -1;
+    }
+    if (for_write) {
+        m_buf = static_cast<char*>(aligned_alloc_zero(BUFFER_SIZE));
+        if (m_buf == 0) {
+            errno = ENOMEM;
+            return fail("buffer");
+        }
+    }
+    return 0;
+}
+
+int ExtentStore::read_metadata()
+{
+    char* unit = static_cast<char*>(aligned_alloc_zero(ALIGN));
+    if (unit == 0) {
+        errno = ENOMEM;
+        return fail("superblock");
+    }
+    int ret = pread_all(m_fd, unit, ALIGN, 0);
+    memcpy(&m_sb, unit, sizeof(m_sb));
+    free(unit);
+    if (ret < 0) {
+        return fail("read superblock");
+    }
+    errno = 0;
+    if (memcmp(m_sb.magic, EXTENT_STORE_MAGIC, sizeof(m_sb.magic)) != 0 ||
+        m_sb.sb_crc != sb_crc(m_sb)) {
+        return fail("not an extent store (format it first)");
+    }
+    if (m_sb.version != STORE_VERSION || m_sb.align != ALIGN ||
+        m_sb.entry_size != sizeof(ExtentEntry)) {
+        return fail("unsupported extent store version");
+    }
+
+    m_table_bytes = round_up((unsigned long long)m_sb.table_entries*
+                             sizeof(ExtentEntry), ALIGN);
+    m_table = static_cast<ExtentEntry*>(aligned_alloc_zero(m_table_bytes));
+    if (m_table == 0) {
+        errno = ENOMEM;
+        return fail("extent table");
+    }
+    if (pread_all(m_fd, m_table, m_table_bytes, m_sb.table_offset) < 0) {
+        return fail("read extent table");
+    }
+
+    // entries are used in order, the first free one ends the table
+    m_used = 0;
+    m_next_offset = m_sb.data_offset;
+    while (m_used < m_sb.table_entries &&
+           m_table[m_used].state != EXTENT_FREE) {
+        const ExtentEntry& e = m_table[m_used];
+        if (e.entry_crc != entry_crc(e)) {
+            errno = 0;
+            return fail("extent table entry corrupted");
+        }
+        m_next_offset = round_up(e.offset + e.length, ALIGN);
+        m_used++;
+    }
+    return 0;
+}
+
+int ExtentStore::close()
+{
+    int ret = 0;
+    if (m_fd >= 0) {
+        if (m_cur >= 0 && end_extent(false, 0) < 0) {
+            ret = -1;
+        }
+        if (::close(m_fd) < 0 && ret == 0) {
+            ret = fail("close");
+        }
+        m_fd = -1;
+    }
+    free(m_table);
+    free(m_buf);
+    m_table = 0;
+    m_buf   = 0;
+    m_used  = 0;
+    m_cur   = -1;
+    return ret;
+}
+
+unsigned long long ExtentStore::free_bytes() const
+{
+    unsigned long long end = m_cur >= 0 ? m_buf_offset + m_buf_fill
+                                        : m_next_offset;
+    return m_sb.store_size > end ? m_sb.store_size - end : 0;
+}
+
+int ExtentStore::write_entry(unsigned int index)
+{
+    m_table[index].entry_crc = entry_crc(m_table[index]);
+    // the whole unit holding the entry, for O_DIRECT
+    unsigned long long unit = (unsigned long long)index*sizeof(ExtentEntry)/ALIGN;
+    if (pwrite_all(m_fd, (char*)m_table + unit*ALIGN, ALIGN,
+                   m_sb.table_offset + unit*ALIGN) < 0) {
+        return fail("write extent table");
+    }
+    return 0;
+}
+
+int ExtentStore::begin_extent(unsigned int run_no, unsigned int branch_no,
+                              const std::string& name)
+{
+    if (m_fd < 0 || !m_for_write) {
+        errno = EBADF;
+        return fail("not open for writing");
+    }
+    if (m_cur >= 0 && end_extent(false, 0) < 0) {
+        return -1;
+    }
+    errno = 0;
+    if (m_used >= m_sb.table_entries) {
+        return fail("extent table full");
+    }
+    if (m_next_offset + ALIGN > m_sb.store_size) {
+        return fail("store full");
+    }
+
+    ExtentEntry& e = m_table[m_used];
+    memset(&e, 0, sizeof(e));
+    e.state     = EXTENT_OPEN;
+    e.run_no    = run_no;
+    e.branch_no = branch_no;
+    e.offset    = m_next_offset;
+    e.time      = time(NULL);
+    strncpy(e.name, name.c_str(), sizeof(e.name) - 1);
+    m_cur = m_used++;
+    m_buf_offset  = m_next_offset;
+    m_buf_fill    = 0;
+    m_last_update = 0;
+    m_lost        = false;
+    return write_entry(m_cur);
+}
+
+int ExtentStore::flush_buffer(bool last)
+{
+    if (m_buf_fill == 0) {
+        return 0;
+    }
+    unsigned int size = m_buf_fill;
+    if (last) {
+        // O_DIRECT writes whole units
+        size = round_up(m_buf_fill, ALIGN);
+        memset(m_buf + m_buf_fill, 0, size - m_buf_fill);
+    }
+    if (m_buf_offset + size > m_sb.store_size) {
+        errno = ENOSPC;
+        return fail("store full");
+    }
+    if (pwrite_all(m_fd, m_buf, size, m_buf_offset) < 0) {
+        return fail("write");
+    }
+    m_buf_offset += m_buf_fill;
+    m_buf_fill = 0;
+    return 0;
+}
+
+int ExtentStore::write(const char* data, unsigned long size)
+{
+    if (m_cur < 0) {        // begin_extent() failed, e.g. table full
+        errno = 0;
+        return fail("no open extent");
+    }
+    ExtentEntry& e = m_table[m_cur];
+    while (size > 0) {
+        unsigned long n = BUFFER_SIZE - m_buf_fill;
+        if (n > size) {
+            n = size;
+        }
+        memcpy(m_buf + m_buf_fill, data, n);
+        m_buf_fill += n;
+        data += n;
+        size -= n;
+        e.length += n;
+        if (m_buf_fill == BUFFER_SIZE) {
+            if (flush_buffer(false) < 0) {
+                e.length -= m_buf_fill;    // did not reach the store
+                m_buf_fill = 0;
+                m_lost = true;
+                return -1;
+            }
+            if (e.length - m_last_update >= TABLE_UPDATE_BYTES) {
+                // all of it is written, for after a crash
+                m_last_update = e.length;
+                if (write_entry(m_cur) < 0) {
+                    return -1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+int ExtentStore::end_extent(bool has_crc, unsigned int data_crc)
+{
+    if (m_cur < 0) {
+        return 0;
+    }
+    unsigned int index = m_cur;
+    m_cur = -1;
+    ExtentEntry& e = m_table[index];
+    int ret = flush_buffer(true);
+    if (ret < 0) {
+        e.length -= m_buf_fill;
+        m_buf_fill = 0;
+    }
+    if (m_lost) {
+        ret = -1;                          // m_error tells the first failure
+    }
+    e.state    = EXTENT_CLOSED;
+    e.has_crc  = has_crc && ret == 0;
+    e.data_crc = e.has_crc ? data_crc : 0;
+    m_next_offset = round_up(e.offset + e.length, ALIGN);
+    if (write_entry(index) < 0 || ret < 0) {
+        return -1;
+    }
+    if (fdatasync(m_fd) < 0) {
+        return fail("fdatasync");
+    }
+    return 0;
+}
+
+std::vector<ExtentEntry> ExtentStore::list() const
+{
+    return std::vector<ExtentEntry>(m_table, m_table + m_used);
+}
+
+int ExtentStore::extract(const ExtentEntry& entry, int out_fd,
+                         unsigned int& crc)
+{
+    crc = 0;
+    std::vector<char> buf(BUFFER_SIZE);
+    unsigned long long done = 0;
+    while (done < entry.length) {
+        size_t n = entry.length - done < buf.size() ? entry.length - done
+                                                    : buf.size();
+        if (pread_all(m_fd, &buf[0], n, entry.offset + done) < 0) {
+            return fail("read");
+        }
+        crc = crc32c(crc, &buf[0], n);
+        if (out_fd >= 0 && write_all(out_fd, &buf[0], n) < 0) {
+            return fail("write output");
+        }
+        done += n;
+    }
+    return 0;
+}
@@ -0,0 +1,150 @@
+// -*- C++ -*-
+/*!
+ * @file ExtentStore.h
+ * @brief Data files as extents of one preallocated file or block device.
+ * @date
+ * @author
+ *
+ */
+
+#ifndef EXTENTSTORE_H
+#define EXTENTSTORE_H
+
+#include <string>
+#include <vector>
+
+/*
+ * Layout, every offset and size a multiple of ALIGN:
+ *
+ *   0             ExtentSuperblock (one ALIGN unit)
+ *   table_offset  ExtentEntry[table_entries]
+ *   data_offset   extent 0, extent 1, ...
+ *
+ * Each extent is the content of one data file (one run and branch) as
+ * FileUtils would have written it, stored contiguously and in the
+ * order of writing; an extent starts at the ALIGN boundary after the
+ * previous one.  Nothing is ever moved or reused: the store is full
+ * when the data area or the table is, and is emptied by formatting it
+ * again (tools/tpether-extent).
+ *
+ * An entry is written when its extent begins (state open), every
+ * TABLE_UPDATE_BYTES of data and when it ends (state closed, with the
+ * data CRC32C if FileUtils computed one).  After a crash the extent
+ * being written stays open with the length of its last table update.
+ *
+ * Fields are in host byte order (little endian on the DAQ nodes).
+ */
+
+static const char EXTENT_STORE_MAGIC[8] = { 'T', 'P', 'E', 'X', 'T', 'S', '0', '1' };
+
+struct ExtentSuperblock {
+    char magic[8];
+    unsigned int version;
+    unsigned int align;
+    unsigned long long store_size;       /// bytes, superblock and table included
+    unsigned long long table_offset;
+    unsigned int table_entries;
+    unsigned int entry_size;             /// sizeof(ExtentEntry)
+    unsigned long long data_offset;
+    unsigned long long format_time;      /// seconds since the epoch
+    unsigned int sb_crc;                 /// CRC32C of the fields above
+};
+
+enum ExtentState {
+    EXTENT_FREE   = 0,
+    EXTENT_OPEN   = 1,
+    EXTENT_CLOSED = 2
+};
+
+struct ExtentEntry {
+    unsigned int state;                  /// ExtentState
+    unsigned int run_no;
+    unsigned int branch_no;
+    unsigned int data_crc;               /// CRC32C of the data, 0: none
+    unsigned long long offset;           /// in the store
+    unsigned long long length;           /// bytes of data, without padding
+    unsigned long long time;             /// seconds since the epoch, at begin
+    char name[80];                       /// file name, e.g. 20110202T143748_000100_000.dat
+    unsigned int has_crc;
+    unsigned int entry_crc;              /// CRC32C of the fields above
+};
+
+/*
+ * @class ExtentStore
+ * @brief Sequential writer and reader of an extent store.
+ *
+ * The writer opens the store with O_DIRECT (plain I/O where the file
+ * system refuses it, e.g. tmpfs) and collects the data in an aligned
+ * buffer of BUFFER_SIZE bytes, written with one pwrite() when full;
+ * the last unit of an extent is padded with zeros.  No file is created
+ * and no file system metadata changes while data is written.
+ *
+ * Functions return -1 on error, error() tells why.
+ */
+class ExtentStore
+{
+public:
+    static const unsigned int ALIGN = 4096;
+    static const unsigned int BUFFER_SIZE = 4*1024*1024;
+    static const unsigned long long TABLE_UPDATE_BYTES = 256ULL*1024*1024;
+
+    ExtentStore();
+    virtual ~ExtentStore();
+
+    /// new, empty store; size 0: size of the existing file or device.
+    /// preallocate reserves the blocks of a regular file (fallocate),
+    /// otherwise a new file stays sparse
+    static int format(const std::string& path, unsigned long long size,
+                      unsigned int max_extents, bool preallocate,
+                      std::string& error);
+
+    int  open(const std::string& path, bool for_write);
+    int  close();
+    bool is_open() const { return m_fd >= 0; }
+    bool direct() const { return m_direct; }
+    const std::string& path() const { return m_path; }
+    const std::string& error() const { return m_error; }
+
+    // writer
+    int begin_extent(unsigned int run_no, unsigned int branch_no,
+                     const std::string& name);
+    int write(const char* data, unsigned long size);
+    /// has_crc: data_crc is the CRC32C of all data of the extent;
+    /// -1 also if a write() of the extent failed (no CRC is recorded)
+    int end_extent(bool has_crc, unsigned int data_crc);
+    bool in_extent() const { return m_cur >= 0; }
+    unsigned long long free_bytes() const;
+
+    // reader
+    const ExtentSuperblock& superblock() const { return m_sb; }
+    /// entries in use, in the order of writing
+    std::vector<ExtentEntry> list() const;
+    /// copy the data of an extent to out_fd, crc: CRC32C of the data
+    int extract(const ExtentEntry& entry, int out_fd, unsigned int& crc);
+
+private:
+    int  read_metadata();
+    int  write_entry(unsigned int index);
+    int  flush_buffer(bool last);
+    int  fail(const std::string& what);
+
+    int m_fd;
+    std::string m_path;
+    bool m_direct;
+    bool m_for_write;
+    ExtentSuperblock m_sb;
+    ExtentEntry* m_table;                /// ALIGN aligned, whole table
+    unsigned long long m_table_bytes;
+    unsigned int m_used;                 /// entries in use
+    int m_cur;                           /// entry being written, -1: none
+    unsigned long long m_next_offset;    /// where the next extent begins
+
+    char* m_buf;                         /// ALIGN aligned
+    unsigned int m_buf_fill;
+    unsigned long long m_buf_offset;     /// store offset of m_buf[0]
+    unsigned long long m_last_update;    /// length at the last table update
+    bool m_lost;                         /// a write of the extent failed
+    std::string m_error;
+};
+
+#endif
@@ -0,0 +1,600 @@
+// -*- C++ -*-
+/*!
+ * @file FileUtils.cpp
+ * @brief File operation utilities for Logger Comp
+ * @date
+ * @author Kazuo Nakayoshi <kazuo.nakayoshi@kek.jp>
+ *
+ * Copyright (C) 2011
+ *     Kazuo Nakayoshi
+ *     Electronics System Group,
+ *     KEK, Japan.
+ *     All rights reserved.
+ *
+ */
+
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "FileUtils.h"
+#include "Crc32c.h"
+#include "ExtentStore.h"
+#include "AsyncLog.h"
+#include "Trace.h"
+
+/*
+ * @class FileUtils
+ * @brief File operation utilites for data logging
+ *
+ * Function: Genarate files and names using run no, date and time(ISO string).
+ *           File splitting by specified size, with branch no.
+ *           External buffer can be used for iostream as default one.
+ *
+ * Data file name:
+ *  case: run no <= 0
+ *   YYYYMMDD T HHMMSS _ 000000 _ BBB . (file extension)
+ *                             e.g. 20110202T143748_000000_000.dat
+ *
+ *  case: run no > 0 and run no < 999999
+ *   YYYYMMDD T HHMMSS _ NNNNNN _ BBB . (file extension)
+ *                             e.g. 20110202T143748_000100_000.dat
+ *
+ *   YYYY: year, MM: moth, DD: day, HH: hour, MM: minute, SS: second
+ *   NNNNNN: run no, BBB: file branch no
+ *
+ * This class provides public interface as follows.
+ *  - check_dir():     Check on whether specified directory exists.
+ *  - set_extension(): Set file extension.
+ *  - set_max_size_in_megaBytes(): Set max file size for file splitting
+ *  - set_run_no(): Set run no for file name.
+ *  - open_file(dir_name): Open file with specified directory
+ *  - open_file(dir_name, stream_buf, buf_size): Open file with specified
+ *    directory and specified external buffer for file stream.
+ *  - close(): Close file
+ *  - get_file_path(), get_file_size(), get_branch_no(): Current file,
+ *    bytes written to it and its branch no.
+ *  - open_raw_file(), write_raw(), splice_from(), end_block(): Same file
+ *    names and splitting, written through the file descriptor.
+ *  - set_checksum(): CRC32C of each file, computed in write_data() while
+ *    the block is in cache.  close_file() appends
+ *        crc32c size file_name
+ *    to the manifest of the run, YYYYMMDDTHHMMSS_NNNNNN.crc32c
+ *    (tools/tpether-verify checks it).  Not for the raw mode, whose
+ *    data does not pass through user space.
+ *  - set_extent_store(): open_file() and write_data() write each file
+ *    as an extent of a preallocated store (common/ExtentStore.h) under
+ *    the same name; the directory keeps the manifest and the event
+ *    index.  tools/tpether-extent extracts the files.
+ */
+
+FileUtils::FileUtils()
+    : m_max_size(0), m_ext_name("dat"), m_dir_name(""),
+      m_auto_fname(false), m_checksum(false), m_extent(0)
+{
+    TPLOG_DEBUG("FileUtils create");
+    m_file_info.file = 0;
+    m_file_info.fd = -1;
+    m_file_info.name_main = "";
+    m_file_info.size = 0;
+    m_file_info.branch_no = 0;
+    m_file_info.run_no = 0;
+    m_file_info.crc = 0;
+}
+
+FileUtils::FileUtils(const std::string ext_name)
+    : m_max_size(0), m_ext_name(ext_name), m_dir_name(""),
+      m_auto_fname(false), m_checksum(false), m_extent(0)
+{
+    TPLOG_DEBUG("FileUtils create");
+    m_file_info.file = 0;
+    m_file_info.fd = -1;
+    m_file_info.name_main = "";
+    m_file_info.size = 0;
+    m_file_info.branch_no = 0;
+    m_file_info.run_no = 0;
+    m_file_info.crc = 0;
+}
+
+FileUtils::~FileUtils()
+{
+    delete m_extent;
+    TPLOG_DEBUG("FileUtils deleted");
+}
+
+bool FileUtils::check_dir(std::string dir_name)
+{
+    boost::filesystem::path mydir(dir_name);
+    if (boost::filesystem::exists(mydir)) {
+        if (boost::filesystem::is_directory(mydir)) {
+            if (access(dir_name.c_str(), W_OK) == 0) {
+                return true;
+            }
+            else {
+                std::cerr << "### ERROR: directory is not writable"
+                          << std::endl;
+            }
+        }
+    }
+    return false;
+}
+
+void FileUtils::set_extension(std::string ext_name)
+{
+    m_ext_name = ext_name;
+}
+
+void FileUtils::set_max_size(unsigned long long size)
+{
+    m_max_size = size;
+}
+
+int FileUtils::set_max_size_in_megaBytes(unsigned int size)
+{
+    if (size < 0 || size > 1024) {
+        return -1;
+    }
+    unsigned long long msize = size * 1024 * 1024;
+    set_max_size(msize);
+    TPLOG_INFO("set max size in bytes:%llu", m_max_size);
+    return 0;
+}
+
+int FileUtils::set_run_no(unsigned int run_no)
+{
+    if (run_no > MAX_RUN_NO) {
+        return -1;
+    }
+    m_file_info.run_no = run_no;
+    if (run_no <= 0) {
+        m_auto_fname = true;
+    }
+    else {
+        m_auto_fname = false;
+    }
+    return 0;
+}
+
+int FileUtils::write_data(char* data, unsigned long size)
+{
+    if (m_extent) {
+        if (m_extent->write(data, size) < 0) {
+            TPLOG_ERROR("write_data: %s", m_extent->error().c_str());
+            close_file();
+            return -1;
+        }
+    }
+    else if (!m_file_info.file->write(data, size)) {
+        TPLOG_ERROR("write_data: %s", strerror(errno));
+        close_file();
+        return -1;
+    }
+    m_file_info.size += size;
+    if (m_checksum) {
+        m_file_info.crc = crc32c(m_file_info.crc, data, size);
+    }
+
+    if ((m_max_size > 0) && (m_max_size <= m_file_info.size)) {
+        TraceScope trace("rotate");
+        close_file();
+        int ret;
+        if (m_extent) {
+            ret = open_extent(m_dir_name, true);
+        }
+        else {
+            ret = open_file_incr_branch(m_dir_name);
+        }
+        trace.set_arg("branch", m_file_info.branch_no);
+        if (ret < 0) {
+            TPLOG_ERROR("write_data: cannot open the next file %s",
+                        m_file_info.file_path.c_str());
+            return -1;
+        }
+    }
+    return 0;
+}
+
+std::string FileUtils::get_date_time()
+{
+    boost::posix_time::ptime now =
+        boost::posix_time::second_clock::local_time();
+    return boost::posix_time::to_iso_string(now);
+}
+
+void FileUtils::incr_branch_no()
+{
+    m_file_info.branch_no += 1;
+}
+
+void FileUtils::reset_branch_no()
+{
+    m_file_info.branch_no = 0;
+}
+
+void FileUtils::reset_file_size()
+{
+    m_file_info.size = 0;
+    m_file_info.crc  = 0;
+}
+
+int FileUtils::open_file(std::string dir_name)
+{
+    if (m_extent) {
+        return open_extent(dir_name, false);
+    }
+    if (check_dir(dir_name) == false) {
+        return -1;
+    }
+
+    m_dir_name = dir_name;
+
+    reset_branch_no();
+    reset_file_size();
+    std::string fileName = gen_file_name();
+    //m_file_info.name = dir_name + "/" + fileName;
+    m_file_info.file_path = dir_name + "/" + fileName;
+    // ..._000.dat -> ....crc32c
+    m_manifest_path = m_file_info.file_path.substr(
+        0, m_file_info.file_path.rfind('_')) + ".crc32c";
+
+    std::ofstream* outFile = new std::ofstream();
+    //outFile->open(m_file_info.name.c_str());
+    outFile->open(m_file_info.file_path.c_str());
+    m_file_info.file = outFile;
+
+    if (!m_file_info.file) {
+        std::cerr << "### ERROR: open file: error occured\n";
+        return -1;
+    }
+    return 0;
+}
+
+int FileUtils::open_file(std::string dir_name, char* stream_buf,
+                         unsigned int buf_size)
+{
+    if (m_extent) {
+        return open_extent(dir_name, false);
+    }
+    if (check_dir(dir_name) == false) {
+        return -1;
+    }
+
+    m_dir_name = dir_name;
+
+    reset_branch_no();
+    reset_file_size();
+    std::string fileName = gen_file_name();
+    m_file_info.file_path = dir_name + "/" + fileName;
+    m_manifest_path = m_file_info.file_path.substr(
+        0, m_file_info.file_path.rfind('_')) + ".crc32c";
+
+    std::ofstream* outFile = new std::ofstream();
+    outFile->rdbuf()->pubsetbuf(stream_buf, buf_size);
+    outFile->open(m_file_info.file_path.c_str());
+    m_file_info.file = outFile;
+
+    if (!m_file_info.file) {
+        std::cerr << "### ERROR: open file: error occured\n";
+        return -1;
+    }
+    return 0;
+}
+
+int FileUtils::close_file()
+{
+    if (m_extent) {
+        if (!m_extent->in_extent()) {
+            return 0;
+        }
+        // no manifest line for a file whose data did not all reach the store
+        if (m_extent->end_extent(m_checksum, m_file_info.crc) < 0) {
+            std::cerr << "### ERROR: close file: " << m_extent->error()
+                      << std::endl;
+            return -1;
+        }
+        if (m_checksum && append_manifest() < 0) {
+            return -1;
+        }
+        return 0;
+    }
+
+    if (m_file_info.fd >= 0) {
+        int ret = ::close(m_file_info.fd);
+        m_file_info.fd = -1;
+        if (ret < 0) {
+            perror("close_file");
+            return -1;
+        }
+        return 0;
+    }
+
+    if (m_file_info.file == 0) {   // raw mode, or nothing was opened
+        return 0;
+    }
+    bool was_open = m_file_info.file->is_open();
+    m_file_info.file->close();
+    if (m_checksum && was_open && append_manifest() < 0) {
+        return -1;
+    }
+    if (m_file_info.file) {
+        return 0;
+    }
+    else {
+        std::cerr << "### ERROR: close file: error occured\n";
+        return -1;
+    }
+}
+
+int FileUtils::open_raw_file(std::string dir_name)
+{
+    if (check_dir(dir_name) == false) {
+        return -1;
+    }
+
+    m_dir_name = dir_name;
+
+    reset_branch_no();
+    reset_file_size();
+    m_file_info.file_path = dir_name + "/" + gen_file_name();
+    return open_raw_path();
+}
+
+int FileUtils::open_raw_file_incr_branch()
+{
+    reset_file_size();
+    m_file_info.file_path = m_dir_name + "/" + gen_file_name(true);
+    return open_raw_path();
+}
+
+int FileUtils::open_raw_path()
+{
+    m_file_info.fd = ::open(m_file_info.file_path.c_str(),
+                            O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (m_file_info.fd < 0) {
+        perror(m_file_info.file_path.c_str());
+        std::cerr << "### ERROR: open file: error occured\n";
+        return -1;
+    }
+    return 0;
+}
+
+int FileUtils::write_raw(const char* data, unsigned long size)
+{
+    while (size > 0) {
+        ssize_t n = ::write(m_file_info.fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            TPLOG_ERROR("write_raw: %s", strerror(errno));
+            return -1;
+        }
+        data += n;
+        size -= n;
+        m_file_info.size += n;
+    }
+    return 0;
+}
+
+int FileUtils::rewrite_raw(unsigned long long offset, const char* data,
+                           unsigned long size)
+{
+    while (size > 0) {
+        ssize_t n = ::pwrite(m_file_info.fd, data, size, offset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            TPLOG_ERROR("rewrite_raw: %s", strerror(errno));
+            return -1;
+        }
+        data += n;
+        size -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+int FileUtils::splice_from(int pipe_fd, unsigned long size)
+{
+    while (size > 0) {
+        ssize_t n = splice(pipe_fd, NULL, m_file_info.fd, NULL, size,
+                           SPLICE_F_MOVE);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            TPLOG_ERROR("splice_from: %s", strerror(errno));
+            return -1;
+        }
+        size -= n;
+        m_file_info.size += n;
+    }
+    return 0;
+}
+
+int FileUtils::end_block()
+{
+    if ((m_max_size > 0) && (m_max_size <= m_file_info.size)) {
+        TraceScope trace("rotate");
+        close_file();
+        trace.set_arg("branch", m_file_info.branch_no + 1);
+        return open_raw_file_incr_branch();
+    }
+    return 0;
+}
+
+int FileUtils::append_manifest()
+{
+    std::string name = m_file_info.file_path.substr(
+        m_file_info.file_path.rfind('/') + 1);
+    std::ofstream manifest(m_manifest_path.c_str(), std::ios::app);
+    char crc[16];
+    snprintf(crc, sizeof(crc), "%08x", m_file_info.crc);
+    manifest << crc << " " << m_file_info.size << " " << name << std::endl;
+    if (!manifest) {
+        std::cerr << "### ERROR: cannot write " << m_manifest_path << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+int FileUtils::set_extent_store(const std::string& path)
+{
+    if (path != m_extent_path) {
+        delete m_extent;
+        m_extent = 0;
+    }
+    m_extent_path = path;
+    if (path.empty() || m_extent) {
+        return 0;
+    }
+    m_extent = new ExtentStore();
+    if (m_extent->open(path, true) < 0) {
+        std::cerr << "### ERROR: " << m_extent->error() << std::endl;
+        delete m_extent;
+        m_extent = 0;
+        m_extent_path = "";
+        return -1;
+    }
+    if (!m_extent->direct()) {
+        std::cerr << "### WARNING: " << path
+                  << ": no O_DIRECT, writing through the page cache"
+                  << std::endl;
+    }
+    TPLOG_INFO("extent store %s: %llu MB free", path.c_str(),
+               m_extent->free_bytes()/1024/1024);
+    return 0;
+}
+
+int FileUtils::open_extent(std::string dir_name, bool incr_branch)
+{
+    if (!incr_branch) {
+        // the manifest and the event index stay in the directory
+        if (check_dir(dir_name) == false) {
+            return -1;
+        }
+        m_dir_name = dir_name;
+        reset_branch_no();
+    }
+    reset_file_size();
+    std::string fileName = gen_file_name(incr_branch);
+    m_file_info.file_path = dir_name + "/" + fileName;
+    if (!incr_branch) {
+        m_manifest_path = m_file_info.file_path.substr(
+            0, m_file_info.file_path.rfind('_')) + ".crc32c";
+    }
+
+    if (m_extent->begin_extent(m_file_info.run_no, m_file_info.branch_no,
+                               fileName) < 0) {
+        std::cerr << "### ERROR: open file: " << m_extent->error()
+                  << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+std::string FileUtils::get_file_path() const
+{
+    return m_file_info.file_path;
+}
+
+unsigned long long FileUtils::get_file_size() const
+{
+    return m_file_info.size;
+}
+
+int FileUtils::get_branch_no() const
+{
+    return m_file_info.branch_no;
+}
+
+int FileUtils::open_file_incr_branch(std::string dir_name)
+{
+    m_dir_name = dir_name;
+    reset_file_size();
+
+    std::string fileName = gen_file_name(true);
+    m_file_info.file_path = dir_name + "/" + fileName;
+
+    std::ofstream* outFile = new std::ofstream();
+    outFile->open(m_file_info.file_path.c_str());
+    m_file_info.file = outFile;
+
+    if (!m_file_info.file) {
+        std::cerr << "### ERROR: open file: error occured\n";
+        return -1;
+    }
+    return 0;
+}
+
+int FileUtils::open_file_incr_branch(std::string dir_name, char* stream_buf,
+                                     unsigned int buf_size)
+{
+    m_dir_name = dir_name;
+    reset_file_size();
+
+    std::string fileName = gen_file_name(true);
+    m_file_info.file_path = dir_name + "/" + fileName;
+
+    std::ofstream* outFile = new std::ofstream();
+    outFile->rdbuf()->pubsetbuf(stream_buf, buf_size);
+    outFile->open(m_file_info.file_path.c_str());
+
+    m_file_info.file = outFile;
+
+    if (!m_file_info.file) {
+        std::cerr << "### ERROR: open file: error occured\n";
+        return -1;
+    }
+    return 0;
+}
+
+std::string FileUtils::gen_file_name(bool incr_branch)
+{
+    std::stringstream run_no;
+    std::stringstream file_br_no;
+    std::string date_time = "";
+    std::string myconnector = "_";
+    std::string mydot = ".";
+
+    std::string fileName = "";
+
+    if (incr_branch) { //Open a file for same run, increment branch no.
+        incr_branch_no();
+    }
+    else {             //Open a file for new run, no increment branch no.
+        date_time = get_date_time();
+        m_file_info.name_main = date_time;
+    }
+
+    file_br_no << std::setw(3)
+               << std::setfill('0')
+               << m_file_info.branch_no;
+
+    if (!m_auto_fname) {
+        run_no << std::setw(6)
+               << std::setfill('0')
+               << m_file_info.run_no;
+
+        fileName = m_file_info.name_main
+                   + myconnector
+                   + run_no.str()
+                   + myconnector
+                   + file_br_no.str()
+                   + mydot
+                   + m_ext_name;
+    }
+    else {
+        fileName = m_file_info.name_main
+                   + myconnector
+                   + file_br_no.str()
+                   + mydot
+                   + m_ext_name;
+    }
+
+    TPLOG_DEBUG("branch_no: %d run_no: %u file name: %s",
+                m_file_info.branch_no, m_file_info.run_no, fileName.c_str());
+    return fileName;
+}
+
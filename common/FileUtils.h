@@ -29,13 +29,17 @@
 
 struct FileInfo {
     std::ofstream* file;
+    int fd;                              /// raw mode, -1: stream mode
     std::string name_main;
     std::string file_path;
     unsigned long long size;
     int branch_no;
     unsigned int run_no;
+    unsigned int crc;                    /// CRC32C of the bytes written
 };
 
+class ExtentStore;
+
 class FileUtils
 {
 public:
@@ -53,16 +57,41 @@ public:
                    unsigned int buf_size);
     int  close_file();
 
+    /// raw mode: the file is written through its descriptor, e.g. with
+    /// splice(), and switched to the next branch only by end_block()
+    int  open_raw_file(std::string dir_name);
+    int  write_raw(const char* data, unsigned long size);
+    /// overwrite bytes already written at offset of the current file
+    int  rewrite_raw(unsigned long long offset, const char* data,
+                     unsigned long size);
+    /// move size bytes from pipe_fd into the file without a user copy
+    int  splice_from(int pipe_fd, unsigned long size);
+    /// next branch if the file is full, so that a block is never split
+    int  end_block();
+    std::string get_file_path() const;
+    /// CRC32C of every file, written to <name>_<run>.crc32c at close
+    void set_checksum(bool on) { m_checksum = on; }
+    std::string get_manifest_path() const { return m_manifest_path; }
+    unsigned long long get_file_size() const;
+    int  get_branch_no() const;
+    /// data files as extents of a store made by tools/tpether-extent
+    /// instead of files in dir_name; call before open_file()
+    int  set_extent_store(const std::string& path);
+
 private:
     void set_max_size(unsigned long long size);
     int  open_file_incr_branch(std::string dir_name);
     int  open_file_incr_branch(std::string dir_name, char* stream_buf,
                                unsigned int buf_size);
+    int  open_raw_file_incr_branch();
+    int  open_raw_path();
+    int  open_extent(std::string dir_name, bool incr_branch);
     void incr_branch_no();
     void reset_branch_no();
     void reset_file_size();
     std::string get_date_time();
     std::string gen_file_name(bool incr_branch = false);
+    int  append_manifest();
 
     static const unsigned int MAX_RUN_NO = 999999;
     unsigned long long m_max_size;
@@ -70,7 +99,10 @@ private:
     std::string m_ext_name;
     std::string m_dir_name;
     bool m_auto_fname;
-    bool m_debug;
+    bool m_checksum;
+    std::string m_manifest_path;
+    ExtentStore* m_extent;               /// 0: files in m_dir_name
+    std::string m_extent_path;
 };
 
 #endif
@@ -0,0 +1,199 @@
+// -*- C++ -*-
+/*!
+ * @file FixedBlock.h
+ * @brief DAQ-Middleware block layout and copy for a block size fixed
+ *        at compile time.
+ * @date
+ * @author
+ *
+ */
+
+#ifndef FIXEDBLOCK_H
+#define FIXEDBLOCK_H
+
+#include <cstring>
+#include <stdint.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*
+ * A block is
+ *
+ *   header (8 bytes): 0xe7 0xe7 0x00 0x00 data_byte_size (big endian)
+ *   data   (data_byte_size bytes)
+ *   footer (8 bytes): 0xcc 0xcc 0x00 0x00 sequence number (big endian)
+ *
+ * FixedBlock<N> knows N, so the whole header is one constant word, the
+ * footer is at a constant offset and the copy kernel is fixed per size.
+ * The block sizes we run (bufsize_kb 1 ... 4096, the
+ * tp-ether-reader-logger-*kB.xml configurations) are instantiated;
+ * fixed_block_class() tells whether a size is one of them, so that the
+ * components choose the instance once at configure and fall back to
+ * the generic code for any other size.
+ *
+ * Copy, chosen per size class at compile time:
+ *  - below BLOCK_STREAM_MIN_BYTES: the library memcpy().  The block
+ *    stays in cache for OutPort::write(), which reads it next; the
+ *    library's vector copy was faster than a kernel of ours for these
+ *    sizes, and faster than the "rep movsq" GCC inlines for a memcpy()
+ *    of constant size (tools/tpether-blockbench).
+ *  - from BLOCK_STREAM_MIN_BYTES (the L2 size of the DAQ nodes): an
+ *    unrolled loop of non-temporal stores.  A block that large does not
+ *    stay in L2 anyway; the stores do not read the destination lines
+ *    first and do not evict the data of the next receive.
+ * tools/tpether-blockbench measures both copies for every size class,
+ * to check the threshold on a new CPU.
+ */
+
+static const unsigned char FIXED_HEADER_MAGIC = 0xe7;
+static const unsigned char FIXED_FOOTER_MAGIC = 0xcc;
+static const unsigned int  FIXED_HEADER_BYTE_SIZE = 8;
+static const unsigned int  FIXED_FOOTER_BYTE_SIZE = 8;
+
+static const unsigned int BLOCK_STREAM_MIN_BYTES = 2048*1024;
+
+/// size classes: 1 kB << class, class 0 ... FIXED_BLOCK_CLASSES - 1
+static const int FIXED_BLOCK_CLASSES = 13;
+
+/// class of a data byte size, -1 if it has no specialization
+static inline int fixed_block_class(unsigned int data_byte_size)
+{
+    for (int c = 0; c < FIXED_BLOCK_CLASSES; c++) {
+        if (data_byte_size == 1024U << c) {
+            return c;
+        }
+    }
+    return -1;
+}
+
+/// the 8 bytes b0 ... b7 as they are in memory, as one word
+static inline uint64_t block_word(unsigned int b0, unsigned int b1,
+                                  unsigned int b2, unsigned int b3,
+                                  unsigned int b4, unsigned int b5,
+                                  unsigned int b6, unsigned int b7)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return ((uint64_t)b0 << 56) | ((uint64_t)b1 << 48) | ((uint64_t)b2 << 40) |
+           ((uint64_t)b3 << 32) | ((uint64_t)b4 << 24) | ((uint64_t)b5 << 16) |
+           ((uint64_t)b6 <<  8) |  (uint64_t)b7;
+#else
+    return  (uint64_t)b0        | ((uint64_t)b1 <<  8) | ((uint64_t)b2 << 16) |
+           ((uint64_t)b3 << 24) | ((uint64_t)b4 << 32) | ((uint64_t)b5 << 40) |
+           ((uint64_t)b6 << 48) | ((uint64_t)b7 << 56);
+#endif
+}
+
+static inline uint64_t load_word(const unsigned char* p)
+{
+    uint64_t w;
+    memcpy(&w, p, sizeof(w));            // one unaligned load
+    return w;
+}
+
+static inline void store_word(unsigned char* p, uint64_t w)
+{
+    memcpy(p, &w, sizeof(w));
+}
+
+/// the library copy, called with the size as a variable on purpose
+static void copy_cached(unsigned char* dst, const unsigned char* src,
+                        unsigned int n) __attribute__((noinline, unused));
+static void copy_cached(unsigned char* dst, const unsigned char* src,
+                        unsigned int n)
+{
+    memcpy(dst, src, n);
+}
+
+/// n bytes, n >= 16, non-temporal stores
+static inline void copy_stream(unsigned char* dst, const unsigned char* src,
+                               unsigned int n)
+{
+#ifdef __SSE2__
+    // streaming stores need 16 byte alignment; the data of an OutPort
+    // block starts 8 bytes into the buffer
+    unsigned int head = (16 - ((uintptr_t)dst & 15)) & 15;
+    if (head > 0) {
+        _mm_storeu_si128((__m128i*)dst, _mm_loadu_si128((const __m128i*)src));
+    }
+    unsigned int i = head;
+    for (; i + 64 <= n; i += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(src + i + 16));
+        __m128i c = _mm_loadu_si128((const __m128i*)(src + i + 32));
+        __m128i d = _mm_loadu_si128((const __m128i*)(src + i + 48));
+        _mm_stream_si128((__m128i*)(dst + i),      a);
+        _mm_stream_si128((__m128i*)(dst + i + 16), b);
+        _mm_stream_si128((__m128i*)(dst + i + 32), c);
+        _mm_stream_si128((__m128i*)(dst + i + 48), d);
+    }
+    memcpy(dst + i, src + i, n - i);     // exactly the rest: not past src + n
+    _mm_sfence();          // ordered before the block is handed on
+#else
+    memcpy(dst, src, n);
+#endif
+}
+
+template <unsigned int N>
+struct FixedBlock
+{
+    static const unsigned int DATA_BYTE_SIZE  = N;
+    static const unsigned int FOOTER_OFFSET   = FIXED_HEADER_BYTE_SIZE + N;
+    static const unsigned int BLOCK_BYTE_SIZE = FOOTER_OFFSET
+                                              + FIXED_FOOTER_BYTE_SIZE;
+
+    static uint64_t header_word()
+    {
+        return block_word(FIXED_HEADER_MAGIC, FIXED_HEADER_MAGIC, 0, 0,
+                          (N >> 24) & 0xff, (N >> 16) & 0xff,
+                          (N >> 8) & 0xff, N & 0xff);
+    }
+
+    static uint64_t footer_word(unsigned int seq_num)
+    {
+        return block_word(FIXED_FOOTER_MAGIC, FIXED_FOOTER_MAGIC, 0, 0,
+                          (seq_num >> 24) & 0xff, (seq_num >> 16) & 0xff,
+                          (seq_num >> 8) & 0xff, seq_num & 0xff);
+    }
+
+    /// header, data and footer of a whole block
+    static void fill(unsigned char* block, const unsigned char* data,
+                     unsigned int seq_num)
+    {
+        store_word(block, header_word());
+        copy(block + FIXED_HEADER_BYTE_SIZE, data);
+        store_word(block + FOOTER_OFFSET, footer_word(seq_num));
+    }
+
+    static void copy(unsigned char* dst, const unsigned char* src)
+    {
+        if (N >= BLOCK_STREAM_MIN_BYTES) {
+            copy_stream(dst, src, N);
+        }
+        else {
+            copy_cached(dst, src, N);
+        }
+    }
+
+    /// header and footer magic and size, and the sequence number if
+    /// check_seq.  False only means "not sure": the caller then runs
+    /// the generic check, which also reports what is wrong.
+    static bool check(const unsigned char* block, unsigned int block_byte_size,
+                      bool check_seq, unsigned int seq_num)
+    {
+        if (block_byte_size != BLOCK_BYTE_SIZE ||
+            load_word(block) != header_word()) {
+            return false;
+        }
+        uint64_t footer = load_word(block + FOOTER_OFFSET);
+        if (check_seq) {
+            return footer == footer_word(seq_num);
+        }
+        // magic words only
+        return (footer & block_word(0xff, 0xff, 0, 0, 0, 0, 0, 0))
+            == block_word(FIXED_FOOTER_MAGIC, FIXED_FOOTER_MAGIC, 0, 0, 0, 0, 0, 0);
+    }
+};
+
+#endif
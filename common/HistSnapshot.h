@@ -0,0 +1,39 @@
+// -*- C++ -*-
+/*!
+ * @file HistSnapshot.h
+ * @brief Histogram snapshot file written by TPEtherMonitor.
+ * @date
+ * @author
+ *
+ */
+
+#ifndef HISTSNAPSHOT_H
+#define HISTSNAPSHOT_H
+
+/*
+ * The snapshot file is replaced as a whole (write to name.tmp, then
+ * rename), so a reader always sees a complete snapshot.  With the
+ * default path in /dev/shm it never touches a disk.
+ *
+ *   HistSnapshotHeader
+ *   unsigned long long counts[n_channels][n_bins]
+ *
+ * Fields are in host byte order.  Bin b of a channel counts samples
+ * with (sample >> bin_shift) == b.  Counts are for the whole run.
+ */
+
+static const char HIST_SNAPSHOT_MAGIC[8] = { 'T', 'P', 'E', 'H', 'I', 'S', 'T', '1' };
+
+struct HistSnapshotHeader {
+    char magic[8];
+    unsigned int n_channels;
+    unsigned int n_bins;
+    unsigned int bin_shift;
+    unsigned int run_no;
+    unsigned long long snapshot_no;
+    unsigned long long blocks;
+    unsigned long long samples;
+    unsigned long long time_sec;          /// time(NULL) when written
+};
+
+#endif
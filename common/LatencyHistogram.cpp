@@ -0,0 +1,135 @@
+// -*- C++ -*-
+/*!
+ * @file LatencyHistogram.cpp
+ * @brief Log-linear histogram for latency percentiles.
+ * @date
+ * @author
+ *
+ */
+
+#include <cstring>
+#include <iomanip>
+#include "LatencyHistogram.h"
+
+LatencyHistogram::LatencyHistogram()
+{
+    reset();
+}
+
+LatencyHistogram::~LatencyHistogram()
+{
+}
+
+void LatencyHistogram::reset()
+{
+    memset(m_bucket, 0, sizeof(m_bucket));
+    m_count = 0;
+    m_sum   = 0;
+    m_min   = ~0ULL;
+    m_max   = 0;
+}
+
+int LatencyHistogram::bucket_index(unsigned long long ns)
+{
+    if (ns < (unsigned long long)SUB_BUCKETS) {
+        return (int)ns;
+    }
+    int msb = 63 - __builtin_clzll(ns);
+    int sub = (int)(ns >> (msb - SUB_BITS)) - SUB_BUCKETS;
+    return (msb - SUB_BITS + 1)*SUB_BUCKETS + sub;
+}
+
+unsigned long long LatencyHistogram::bucket_value(int index)
+{
+    if (index < SUB_BUCKETS) {
+        return index;
+    }
+    int msb = index / SUB_BUCKETS + SUB_BITS - 1;
+    int sub = index % SUB_BUCKETS;
+    unsigned long long low   = (unsigned long long)(SUB_BUCKETS + sub) << (msb - SUB_BITS);
+    unsigned long long width = 1ULL << (msb - SUB_BITS);
+    return low + width/2;   // middle of the bucket
+}
+
+void LatencyHistogram::add(unsigned long long ns)
+{
+    m_bucket[bucket_index(ns)]++;
+    m_count++;
+    m_sum += ns;
+    if (ns < m_min) {
+        m_min = ns;
+    }
+    if (ns > m_max) {
+        m_max = ns;
+    }
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other)
+{
+    for (int i = 0; i < N_BUCKETS; i++) {
+        m_bucket[i] += other.m_bucket[i];
+    }
+    m_count += other.m_count;
+    m_sum   += other.m_sum;
+    if (other.m_count > 0 && other.m_min < m_min) {
+        m_min = other.m_min;
+    }
+    if (other.m_max > m_max) {
+        m_max = other.m_max;
+    }
+}
+
+double LatencyHistogram::mean() const
+{
+    if (m_count == 0) {
+        return 0.0;
+    }
+    return (double)m_sum / m_count;
+}
+
+unsigned long long LatencyHistogram::percentile(double p) const
+{
+    if (m_count == 0) {
+        return 0;
+    }
+    unsigned long long rank = (unsigned long long)(p / 100.0 * m_count + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+    unsigned long long seen = 0;
+    for (int i = 0; i < N_BUCKETS; i++) {
+        seen += m_bucket[i];
+        if (seen >= rank) {
+            unsigned long long v = bucket_value(i);
+            // never report outside of the observed range
+            if (v > m_max) {
+                v = m_max;
+            }
+            if (v < m_min) {
+                v = m_min;
+            }
+            return v;
+        }
+    }
+    return m_max;
+}
+
+void LatencyHistogram::print(std::ostream& os, const std::string& name) const
+{
+    std::ios::fmtflags flags = os.flags();
+    std::streamsize prec = os.precision();
+
+    os << std::fixed << std::setprecision(1)
+       << name << ": n=" << m_count
+       << " min="   << min()/1000.0
+       << " mean="  << mean()/1000.0
+       << " p50="   << percentile(50.0)/1000.0
+       << " p90="   << percentile(90.0)/1000.0
+       << " p99="   << percentile(99.0)/1000.0
+       << " p99.9=" << percentile(99.9)/1000.0
+       << " max="   << max()/1000.0
+       << " us" << std::endl;
+
+    os.flags(flags);
+    os.precision(prec);
+}
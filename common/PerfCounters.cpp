@@ -0,0 +1,173 @@
+// -*- C++ -*-
+/*!
+ * @file PerfCounters.cpp
+ * @brief perf_event_open counters for the data path thread.
+ * @date
+ * @author
+ *
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "PerfCounters.h"
+
+static const char* counter_name[] = {
+    "cycles", "instructions", "llc_misses", "dtlb_misses", "context_switches"
+};
+
+static int perf_event_open(struct perf_event_attr* attr, pid_t pid,
+                           int cpu, int group_fd, unsigned long flags)
+{
+    return syscall(__NR_perf_event_open, attr, pid, cpu, group_fd, flags);
+}
+
+PerfCounters::PerfCounters()
+{
+    for (int i = 0; i < N_COUNTERS; i++) {
+        m_fd[i] = -1;
+        m_user_only[i] = false;
+        m_value[i] = 0;
+        m_valid[i] = false;
+    }
+}
+
+PerfCounters::~PerfCounters()
+{
+    close();
+}
+
+int PerfCounters::open_counter(unsigned int type, unsigned long long config,
+                               bool& user_only)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size        = sizeof(attr);
+    attr.type        = type;
+    attr.config      = config;
+    attr.disabled    = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    user_only = false;
+    // this thread only (pid 0), any cpu
+    int fd = perf_event_open(&attr, 0, -1, -1, 0);
+    if (fd < 0 && (errno == EACCES || errno == EPERM)) {
+        attr.exclude_kernel = 1;
+        attr.exclude_hv     = 1;
+        user_only = true;
+        fd = perf_event_open(&attr, 0, -1, -1, 0);
+    }
+    return fd;
+}
+
+int PerfCounters::open()
+{
+    close();
+
+    static const unsigned long long dtlb_read_miss =
+        PERF_COUNT_HW_CACHE_DTLB |
+        (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+
+    m_fd[CYCLES] = open_counter(PERF_TYPE_HARDWARE,
+                                PERF_COUNT_HW_CPU_CYCLES,
+                                m_user_only[CYCLES]);
+    m_fd[INSTRUCTIONS] = open_counter(PERF_TYPE_HARDWARE,
+                                      PERF_COUNT_HW_INSTRUCTIONS,
+                                      m_user_only[INSTRUCTIONS]);
+    m_fd[LLC_MISSES] = open_counter(PERF_TYPE_HARDWARE,
+                                    PERF_COUNT_HW_CACHE_MISSES,
+                                    m_user_only[LLC_MISSES]);
+    m_fd[DTLB_MISSES] = open_counter(PERF_TYPE_HW_CACHE, dtlb_read_miss,
+                                     m_user_only[DTLB_MISSES]);
+    m_fd[CONTEXT_SWITCHES] = open_counter(PERF_TYPE_SOFTWARE,
+                                          PERF_COUNT_SW_CONTEXT_SWITCHES,
+                                          m_user_only[CONTEXT_SWITCHES]);
+
+    int n_opened = 0;
+    for (int i = 0; i < N_COUNTERS; i++) {
+        if (m_fd[i] >= 0) {
+            n_opened++;
+        }
+    }
+    if (n_opened < N_COUNTERS) {
+        std::cerr << "### WARNING: perf counters: " << n_opened << " of "
+                  << N_COUNTERS << " available" << std::endl;
+    }
+    return n_opened;
+}
+
+void PerfCounters::close()
+{
+    for (int i = 0; i < N_COUNTERS; i++) {
+        if (m_fd[i] >= 0) {
+            ::close(m_fd[i]);
+            m_fd[i] = -1;
+        }
+        m_valid[i] = false;
+    }
+}
+
+void PerfCounters::start()
+{
+    for (int i = 0; i < N_COUNTERS; i++) {
+        m_valid[i] = false;
+        if (m_fd[i] >= 0) {
+            ioctl(m_fd[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(m_fd[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+void PerfCounters::stop()
+{
+    for (int i = 0; i < N_COUNTERS; i++) {
+        m_valid[i] = false;
+        if (m_fd[i] < 0) {
+            continue;
+        }
+        ioctl(m_fd[i], PERF_EVENT_IOC_DISABLE, 0);
+
+        unsigned long long buf[3]; // value, time enabled, time running
+        if (read(m_fd[i], buf, sizeof(buf)) != sizeof(buf) || buf[2] == 0) {
+            continue;
+        }
+        // scale if the PMU was multiplexed with other users
+        m_value[i] = (unsigned long long)((double)buf[0] * buf[1] / buf[2]);
+        m_valid[i] = true;
+    }
+}
+
+void PerfCounters::print(std::ostream& os, unsigned long long blocks,
+                         unsigned long long bytes) const
+{
+    double mbytes = bytes / 1024.0 / 1024.0;
+
+    for (int i = 0; i < N_COUNTERS; i++) {
+        os << "perf " << counter_name[i] << ": ";
+        if (!m_valid[i]) {
+            os << "n/a" << std::endl;
+            continue;
+        }
+        os << m_value[i];
+        if (blocks > 0) {
+            os << " per_block: " << (double)m_value[i]/blocks;
+        }
+        if (mbytes > 0) {
+            os << " per_MB: " << m_value[i]/mbytes;
+        }
+        if (m_user_only[i]) {
+            os << " (user only)";
+        }
+        os << std::endl;
+    }
+    if (m_valid[CYCLES] && m_valid[INSTRUCTIONS] && m_value[CYCLES] > 0) {
+        os << "perf IPC: "
+           << (double)m_value[INSTRUCTIONS]/m_value[CYCLES] << std::endl;
+    }
+}
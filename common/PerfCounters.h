@@ -0,0 +1,55 @@
+// -*- C++ -*-
+/*!
+ * @file PerfCounters.h
+ * @brief perf_event_open counters for the data path thread.
+ * @date
+ * @author
+ *
+ */
+
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+
+#include <iostream>
+
+/*
+ * @class PerfCounters
+ * @brief Counts cycles, instructions, LLC misses, dTLB misses and
+ *        context switches of the calling thread.
+ *
+ * open() and start() are called in daq_start(), stop() and print() in
+ * daq_stop(); both run in the execution context thread which also runs
+ * daq_run(), so the counts cover the component's hot loop with no cost
+ * per block.  Counters which cannot be opened (no PMU in a VM,
+ * perf_event_paranoid, ...) are reported as n/a.  If kernel counting
+ * is not permitted, user space only counting is tried.
+ */
+class PerfCounters
+{
+public:
+    PerfCounters();
+    virtual ~PerfCounters();
+
+    /// returns the number of counters opened
+    int  open();
+    void close();
+    void start();
+    void stop();
+
+    void print(std::ostream& os, unsigned long long blocks,
+               unsigned long long bytes) const;
+
+private:
+    enum { CYCLES, INSTRUCTIONS, LLC_MISSES, DTLB_MISSES, CONTEXT_SWITCHES,
+           N_COUNTERS };
+
+    int open_counter(unsigned int type, unsigned long long config,
+                     bool& user_only);
+
+    int  m_fd[N_COUNTERS];
+    bool m_user_only[N_COUNTERS];
+    unsigned long long m_value[N_COUNTERS];
+    bool m_valid[N_COUNTERS];
+};
+
+#endif
@@ -0,0 +1,121 @@
+// -*- C++ -*-
+/*!
+ * @file PortStats.cpp
+ * @brief Buffer occupancy and back pressure of one data port.
+ * @date
+ * @author
+ *
+ */
+
+#include <iomanip>
+
+#include "PortStats.h"
+
+PortStats::PortStats()
+{
+    reset();
+}
+
+PortStats::~PortStats()
+{
+}
+
+void PortStats::reset()
+{
+    m_blocks         = 0;
+    m_retries        = 0;
+    m_retried_blocks = 0;
+    m_max_retries    = 0;
+    m_fill_samples   = 0;
+    m_fill_sum       = 0;
+    m_fill_max       = 0;
+    m_capacity       = 0;
+    for (int i = 0; i < FILL_BINS; i++) {
+        m_fill_bin[i] = 0;
+    }
+    m_call.reset();
+    m_wait.reset();
+}
+
+void PortStats::merge(const PortStats& other)
+{
+    m_blocks         += other.m_blocks;
+    m_retries        += other.m_retries;
+    m_retried_blocks += other.m_retried_blocks;
+    if (other.m_max_retries > m_max_retries) {
+        m_max_retries = other.m_max_retries;
+    }
+    m_fill_samples += other.m_fill_samples;
+    m_fill_sum     += other.m_fill_sum;
+    if (other.m_fill_max > m_fill_max) {
+        m_fill_max = other.m_fill_max;
+    }
+    if (other.m_capacity > 0) {
+        m_capacity = other.m_capacity;
+    }
+    for (int i = 0; i < FILL_BINS; i++) {
+        m_fill_bin[i] += other.m_fill_bin[i];
+    }
+    m_call.merge(other.m_call);
+    m_wait.merge(other.m_wait);
+}
+
+void PortStats::sample_fill(size_t fill, size_t capacity)
+{
+    m_fill_samples++;
+    m_fill_sum += fill;
+    if (fill > m_fill_max) {
+        m_fill_max = fill;
+    }
+    m_capacity = capacity;
+    if (capacity > 0) {
+        int bin = fill >= capacity ? FILL_BINS - 1 : fill*10/capacity;
+        m_fill_bin[bin]++;
+    }
+}
+
+void PortStats::add_block(unsigned int retries, unsigned long long wait_ns)
+{
+    m_blocks++;
+    if (retries > 0) {
+        m_retries += retries;
+        m_retried_blocks++;
+        if (retries > m_max_retries) {
+            m_max_retries = retries;
+        }
+    }
+    m_wait.add(wait_ns);
+}
+
+void PortStats::print(std::ostream& os, const std::string& name) const
+{
+    std::ios::fmtflags flags = os.flags();
+    std::streamsize prec = os.precision();
+
+    os << name << ": blocks: " << m_blocks
+       << " retries: " << m_retries
+       << " blocks_retried: " << m_retried_blocks
+       << " max_retries/block: " << m_max_retries << std::endl;
+
+    if (m_fill_samples > 0) {
+        os << std::fixed << std::setprecision(1)
+           << name << ": buffer capacity: " << m_capacity
+           << " fill mean: " << (double)m_fill_sum/m_fill_samples
+           << " max: " << m_fill_max << std::endl;
+        if (m_capacity > 0) {
+            os << name << ": fill(% of samples)";
+            for (int i = 0; i < FILL_BINS - 1; i++) {
+                os << " " << i*10 << "-" << i*10 + 9 << "%:"
+                   << 100.0*m_fill_bin[i]/m_fill_samples;
+            }
+            os << " full:" << 100.0*m_fill_bin[FILL_BINS - 1]/m_fill_samples
+               << std::endl;
+        }
+    }
+
+    os.flags(flags);
+    os.precision(prec);
+
+    m_call.print(os, name + "_call");
+    m_wait.print(os, name + "_wait");
+}
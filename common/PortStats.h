@@ -0,0 +1,100 @@
+// -*- C++ -*-
+/*!
+ * @file PortStats.h
+ * @brief Buffer occupancy and back pressure of one data port.
+ * @date
+ * @author
+ *
+ */
+
+#ifndef PORTSTATS_H
+#define PORTSTATS_H
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+
+#include "LatencyHistogram.h"
+
+/*
+ * @class PortStats
+ * @brief Fill level of the connector buffer, calls and waits per block.
+ *
+ * The same counters describe both ends of a connection:
+ *
+ *  - OutPort: a call is one write(), a retry a write() that timed out,
+ *    the wait of a block the time from its first write() to the one
+ *    that succeeded.
+ *  - InPort: a call is one read() that returned data, a retry a read()
+ *    without data, the wait of a block the time the port was empty
+ *    before it.
+ *
+ * Fill levels are sampled only where blocks queue: the InPort buffer.
+ * With the flush publisher the OutPort buffer is empty whenever write()
+ * returns, and write() itself takes as long as the consumer needs.
+ * Long OutPort calls, retries and waits mean the hop downstream is the
+ * bottleneck; an InPort that is mostly empty means the one upstream.
+ * The InPort fill levels also show whether the buffer.length in
+ * rtc.conf is too short to cover the bursts.
+ */
+class PortStats
+{
+public:
+    PortStats();
+    virtual ~PortStats();
+
+    void reset();
+    void merge(const PortStats& other);
+
+    /// blocks in the connector buffer(s), capacity 0 if unknown
+    void sample_fill(size_t fill, size_t capacity);
+    /// one write() or read() call that took ns
+    void add_call(unsigned long long ns) { m_call.add(ns); }
+    /// a block went through after retries failed calls and wait_ns
+    void add_block(unsigned int retries, unsigned long long wait_ns);
+
+    unsigned long long blocks() const { return m_blocks; }
+    unsigned long long retries() const { return m_retries; }
+
+    /// "<name>: ..." lines, histograms as <name>_call and <name>_wait
+    void print(std::ostream& os, const std::string& name) const;
+
+private:
+    static const int FILL_BINS = 11;      /// 0-9% ... 90-99%, full
+
+    unsigned long long m_blocks;
+    unsigned long long m_retries;
+    unsigned long long m_retried_blocks;  /// blocks with at least one retry
+    unsigned int m_max_retries;
+
+    unsigned long long m_fill_samples;
+    unsigned long long m_fill_sum;
+    size_t m_fill_max;
+    size_t m_capacity;
+    unsigned long long m_fill_bin[FILL_BINS];
+
+    LatencyHistogram m_call;
+    LatencyHistogram m_wait;
+};
+
+/// summed fill and capacity of the buffers of a port's connectors
+/// (OutPortBase::connectors() or InPortBase::connectors());
+/// false if the port has no connector with a buffer
+template<class Connectors>
+bool connector_fill(Connectors& cons, size_t& fill, size_t& capacity)
+{
+    fill     = 0;
+    capacity = 0;
+    bool found = false;
+    for (size_t i = 0; i < cons.size(); i++) {
+        if (cons[i]->getBuffer() == 0) {
+            continue;
+        }
+        fill     += cons[i]->getBuffer()->readable();
+        capacity += cons[i]->getBuffer()->length();
+        found = true;
+    }
+    return found;
+}
+
+#endif
@@ -0,0 +1,240 @@
+// -*- C++ -*-
+/*!
+ * @file SampleTap.cpp
+ * @brief Shared memory ring of sampled blocks for online monitoring.
+ * @date
+ * @author
+ *
+ */
+
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "SampleTap.h"
+#include "BlockTime.h"
+
+static size_t slot_stride(unsigned int slot_size)
+{
+    // keep every slot header on a cache line boundary
+    return (sizeof(TapSlotHeader) + slot_size + 63) & ~(size_t)63;
+}
+
+static TapSlotHeader* slot_at(TapHeader* header, unsigned int index)
+{
+    char* base = (char*)header + sizeof(TapHeader);
+    return (TapSlotHeader*)(base + index*slot_stride(header->slot_size));
+}
+
+SampleTap::SampleTap()
+    : m_header(0), m_map_size(0), m_every_n(0), m_interval_ns(0),
+      m_count(0), m_last_ns(0), m_published(0)
+{
+}
+
+SampleTap::~SampleTap()
+{
+    close();
+}
+
+int SampleTap::open(const std::string& name, unsigned int slot_count,
+                    unsigned int slot_size)
+{
+    close();
+
+    if (slot_count == 0 || slot_size == 0) {
+        return -1;
+    }
+
+    int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+    if (fd < 0) {
+        perror("shm_open");
+        return -1;
+    }
+    size_t map_size = sizeof(TapHeader) + slot_count*slot_stride(slot_size);
+    if (ftruncate(fd, map_size) < 0) {
+        perror("ftruncate");
+        ::close(fd);
+        return -1;
+    }
+    void* p = mmap(0, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+
+    m_name     = name;
+    m_map_size = map_size;
+    m_header   = (TapHeader*)p;
+    memset(m_header, 0, map_size);
+    m_header->slot_count = slot_count;
+    m_header->slot_size  = slot_size;
+    // magic last, readers check it before using the sizes
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(m_header->magic, TAP_MAGIC, sizeof(TAP_MAGIC));
+
+    m_count     = 0;
+    m_last_ns   = 0;
+    m_published = 0;
+
+    return 0;
+}
+
+void SampleTap::close()
+{
+    if (m_header) {
+        munmap(m_header, m_map_size);
+        shm_unlink(m_name.c_str());
+        m_header = 0;
+    }
+}
+
+bool SampleTap::due()
+{
+    bool sample = false;
+
+    if (m_every_n > 0) {
+        if (++m_count >= m_every_n) {
+            m_count = 0;
+            sample = true;
+        }
+    }
+    if (m_interval_ns > 0) {
+        unsigned long long now = mono_now_ns();
+        if (now - m_last_ns >= m_interval_ns) {
+            m_last_ns = now;
+            sample = true;
+        }
+    }
+
+    return sample;
+}
+
+void SampleTap::publish(const unsigned char* data, unsigned int byte_size,
+                        unsigned long long block_seq,
+                        unsigned long long recv_ns)
+{
+    if (m_header == 0) {
+        return;
+    }
+
+    unsigned long long n = m_published;
+    TapSlotHeader* slot = slot_at(m_header, n % m_header->slot_count);
+    unsigned int copied = byte_size;
+    if (copied > m_header->slot_size) {
+        copied = m_header->slot_size;
+    }
+
+    __atomic_store_n(&slot->lock, 2*n + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->sample_no   = n;
+    slot->block_seq   = block_seq;
+    slot->recv_ns     = recv_ns;
+    slot->byte_size   = byte_size;
+    slot->copied_size = copied;
+    memcpy((char*)slot + sizeof(TapSlotHeader), data, copied);
+    __atomic_store_n(&slot->lock, 2*n + 2, __ATOMIC_RELEASE);
+
+    m_published = n + 1;
+    __atomic_store_n(&m_header->published, m_published, __ATOMIC_RELEASE);
+}
+
+SampleTapReader::SampleTapReader()
+    : m_header(0), m_map_size(0), m_next(0), m_lost(0)
+{
+}
+
+SampleTapReader::~SampleTapReader()
+{
+    close();
+}
+
+int SampleTapReader::open(const std::string& name)
+{
+    close();
+
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        perror("shm_open");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(TapHeader)) {
+        std::cerr << "### ERROR: " << name << ": not a sample tap" << std::endl;
+        ::close(fd);
+        return -1;
+    }
+    void* p = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+
+    TapHeader* header = (TapHeader*)p;
+    if (memcmp(header->magic, TAP_MAGIC, sizeof(TAP_MAGIC)) != 0) {
+        std::cerr << "### ERROR: " << name << ": bad magic" << std::endl;
+        munmap(p, st.st_size);
+        return -1;
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    m_header   = header;
+    m_map_size = st.st_size;
+    // start from the newest sample
+    m_next = __atomic_load_n(&m_header->published, __ATOMIC_ACQUIRE);
+    m_lost = 0;
+    return 0;
+}
+
+void SampleTapReader::close()
+{
+    if (m_header) {
+        munmap(m_header, m_map_size);
+        m_header = 0;
+    }
+}
+
+int SampleTapReader::read(TapSlotHeader& info, std::vector<unsigned char>& data)
+{
+    unsigned long long published =
+        __atomic_load_n(&m_header->published, __ATOMIC_ACQUIRE);
+    if (m_next >= published) {
+        return 0;
+    }
+    if (published - m_next > m_header->slot_count) {
+        // overwritten before we got here
+        m_lost += published - m_header->slot_count - m_next;
+        m_next = published - m_header->slot_count;
+    }
+
+    unsigned long long n = m_next++;
+    TapSlotHeader* slot = slot_at(m_header, n % m_header->slot_count);
+
+    unsigned long long lock = __atomic_load_n(&slot->lock, __ATOMIC_ACQUIRE);
+    if (lock != 2*n + 2) {
+        m_lost++;
+        return -1;
+    }
+    memcpy(&info, slot, sizeof(TapSlotHeader));
+    unsigned int copied = info.copied_size;
+    if (copied > m_header->slot_size) {
+        copied = m_header->slot_size;
+    }
+    data.resize(copied);
+    if (copied > 0) {
+        memcpy(&data[0], (char*)slot + sizeof(TapSlotHeader), copied);
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&slot->lock, __ATOMIC_RELAXED) != lock) {
+        m_lost++;
+        return -1;
+    }
+    return 1;
+}
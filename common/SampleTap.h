@@ -0,0 +1,116 @@
+// -*- C++ -*-
+/*!
+ * @file SampleTap.h
+ * @brief Shared memory ring of sampled blocks for online monitoring.
+ * @date
+ * @author
+ *
+ */
+
+#ifndef SAMPLETAP_H
+#define SAMPLETAP_H
+
+#include <string>
+#include <vector>
+
+/*
+ * Shared memory layout (POSIX shm, name given by tapShmName):
+ *
+ *   TapHeader
+ *   slot 0: TapSlotHeader, slot_size bytes of data
+ *   slot 1: ...
+ *
+ * There is one writer (TPEtherLogger) and any number of readers.
+ * The writer never waits for readers: it overwrites the oldest slot.
+ * Each slot has a sequence lock; a reader copies the slot and then
+ * checks that the lock did not change, otherwise the sample has been
+ * overwritten while copying and is skipped.
+ */
+
+static const char TAP_MAGIC[8] = { 'T', 'P', 'E', 'T', 'A', 'P', '0', '1' };
+
+struct TapHeader {
+    char magic[8];
+    unsigned int slot_count;
+    unsigned int slot_size;              /// max. data bytes per slot
+    unsigned long long published;        /// number of samples written
+    char pad[40];
+};
+
+struct TapSlotHeader {
+    unsigned long long lock;             /// odd while being written
+    unsigned long long sample_no;        /// published count of this sample
+    unsigned long long block_seq;        /// logger sequence number
+    unsigned long long recv_ns;          /// reader receive time stamp
+    unsigned int byte_size;              /// original block data size
+    unsigned int copied_size;            /// <= slot_size
+    char pad[24];
+};
+
+/*
+ * @class SampleTap
+ * @brief Writer side, used in TPEtherLogger::daq_run().
+ *
+ * A block is sampled every every_n blocks and/or once per interval_ms.
+ * due() is a counter compare (and a clock read if interval_ms is set);
+ * only a sampled block costs one copy into shared memory.
+ */
+class SampleTap
+{
+public:
+    SampleTap();
+    virtual ~SampleTap();
+
+    void set_every_n(unsigned int n) { m_every_n = n; }
+    void set_interval_ms(unsigned int ms) { m_interval_ns = ms*1000000ULL; }
+    bool enabled() const { return m_every_n > 0 || m_interval_ns > 0; }
+
+    int  open(const std::string& name, unsigned int slot_count,
+              unsigned int slot_size);
+    void close();
+    bool is_open() const { return m_header != 0; }
+
+    bool due();
+    void publish(const unsigned char* data, unsigned int byte_size,
+                 unsigned long long block_seq, unsigned long long recv_ns);
+
+    unsigned long long published() const { return m_published; }
+
+private:
+    std::string m_name;
+    TapHeader* m_header;
+    size_t m_map_size;
+    unsigned int m_every_n;
+    unsigned long long m_interval_ns;
+    unsigned int m_count;
+    unsigned long long m_last_ns;
+    unsigned long long m_published;
+};
+
+/*
+ * @class SampleTapReader
+ * @brief Reader side, for monitoring processes. Never blocks the writer.
+ */
+class SampleTapReader
+{
+public:
+    SampleTapReader();
+    virtual ~SampleTapReader();
+
+    int  open(const std::string& name);
+    void close();
+
+    /// copy the next sample into data. returns 1 if a sample was read,
+    /// 0 if no new sample, -1 if the sample was overwritten (skipped).
+    int  read(TapSlotHeader& info, std::vector<unsigned char>& data);
+    /// samples lost because the reader was too slow
+    unsigned long long lost() const { return m_lost; }
+
+private:
+    TapHeader* m_header;
+    size_t m_map_size;
+    unsigned long long m_next;
+    unsigned long long m_lost;
+};
+
+#endif
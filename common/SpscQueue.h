@@ -0,0 +1,113 @@
+// -*- C++ -*-
+/*!
+ * @file SpscQueue.h
+ * @brief Bounded lock-free single producer / single consumer queue.
+ * @date
+ * @author
+ *
+ */
+
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <vector>
+
+/*
+ * @class SpscQueue
+ * @brief Ring of preallocated slots shared by exactly two threads.
+ *
+ * Slots are filled and consumed in place and are never freed, so a
+ * slot holding e.g. a std::vector keeps its capacity and the steady
+ * state does not allocate.
+ *
+ * Producer:                        Consumer:
+ *    T* slot = q.write_slot();        T* slot = q.read_slot();
+ *    if (slot) {                      if (slot) {
+ *        ... fill *slot ...               ... use *slot ...
+ *        q.commit();                      q.release();
+ *    }                                }
+ *
+ * Head and tail are on separate cache lines so the two threads do not
+ * invalidate each other's line on every operation.
+ */
+template <class T>
+class SpscQueue
+{
+public:
+    SpscQueue()
+        : m_size(0), m_head(0), m_tail(0)
+    {
+    }
+
+    /// not thread safe, call before the threads start
+    void resize(unsigned int size)
+    {
+        m_slots.resize(size);
+        m_size = size;
+        m_head = 0;
+        m_tail = 0;
+    }
+
+    /// not thread safe, call while the threads are stopped
+    void clear()
+    {
+        m_head = 0;
+        m_tail = 0;
+    }
+
+    unsigned int capacity() const { return m_size; }
+
+    unsigned int count() const
+    {
+        unsigned long long tail = __atomic_load_n(&m_tail, __ATOMIC_ACQUIRE);
+        unsigned long long head = __atomic_load_n(&m_head, __ATOMIC_ACQUIRE);
+        return (unsigned int)(tail - head);
+    }
+
+    bool empty() const { return count() == 0; }
+
+    /// producer: free slot to fill, 0 if the queue is full
+    T* write_slot()
+    {
+        unsigned long long tail = __atomic_load_n(&m_tail, __ATOMIC_RELAXED);
+        unsigned long long head = __atomic_load_n(&m_head, __ATOMIC_ACQUIRE);
+        if (tail - head >= m_size) {
+            return 0;
+        }
+        return &m_slots[tail % m_size];
+    }
+
+    /// producer: publish the slot returned by write_slot()
+    void commit()
+    {
+        __atomic_add_fetch(&m_tail, 1, __ATOMIC_RELEASE);
+    }
+
+    /// consumer: oldest filled slot, 0 if the queue is empty
+    T* read_slot()
+    {
+        unsigned long long head = __atomic_load_n(&m_head, __ATOMIC_RELAXED);
+        unsigned long long tail = __atomic_load_n(&m_tail, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            return 0;
+        }
+        return &m_slots[head % m_size];
+    }
+
+    /// consumer: give the slot returned by read_slot() back
+    void release()
+    {
+        __atomic_add_fetch(&m_head, 1, __ATOMIC_RELEASE);
+    }
+
+private:
+    std::vector<T> m_slots;
+    unsigned long long m_size;
+    char m_pad0[64];
+    unsigned long long m_head;            /// consumer position
+    char m_pad1[64];
+    unsigned long long m_tail;            /// producer position
+    char m_pad2[64];
+};
+
+#endif
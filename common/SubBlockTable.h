@@ -0,0 +1,52 @@
+// -*- C++ -*-
+/*!
+ * @file SubBlockTable.h
+ * @brief Table of the sub-blocks in a coalesced block.
+ * @date
+ * @author
+ *
+ */
+
+#ifndef SUBBLOCKTABLE_H
+#define SUBBLOCKTABLE_H
+
+/*
+ * TPEtherReader with coalesceMaxKB > 0 sends several received blocks
+ * (sub-blocks) in one OutPort block.  The data between the
+ * DAQ-Middleware header and footer is then
+ *
+ *   SubBlockTableHeader
+ *   SubBlockEntry[capacity]      the first count are used
+ *   data of sub-block 0, 1, ..., count - 1, back to back
+ *
+ * capacity is fixed for the run (coalesceMaxBlocks), so that the
+ * reader can copy each sub-block to its final place as it arrives.
+ * The data of the sub-blocks, without the table, is the byte stream
+ * an uncoalesced reader would have sent.
+ *
+ * seq_num counts the sub-blocks of the run from 0, like the sequence
+ * number in the footer counts the blocks.  Fields are in host byte
+ * order (little endian on the DAQ nodes).
+ */
+
+static const unsigned int SUB_BLOCK_MAGIC = 0x42535054;  /// "TPSB"
+
+struct SubBlockTableHeader {
+    unsigned int magic;
+    unsigned int count;
+    unsigned int capacity;
+    unsigned int data_byte_size;         /// sum of the sub-block sizes
+};
+
+struct SubBlockEntry {
+    unsigned int byte_size;
+    unsigned int seq_num;
+    unsigned long long recv_ns;          /// CLOCK_MONOTONIC at receive, 0: none
+};
+
+static inline unsigned int sub_block_table_size(unsigned int capacity)
+{
+    return sizeof(SubBlockTableHeader) + capacity*sizeof(SubBlockEntry);
+}
+
+#endif
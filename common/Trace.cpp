@@ -0,0 +1,276 @@
+// -*- C++ -*-
+/*!
+ * @file Trace.cpp
+ * @brief Timeline of per-block events, exported as Chrome trace JSON.
+ * @date
+ * @author
+ *
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "Trace.h"
+
+struct TraceEvent {
+    unsigned long long ts;
+    unsigned long long dur;               /// INSTANT for an instant event
+    const char* name;
+    const char* arg_name;                 /// 0: no argument
+    unsigned long long arg;
+};
+
+struct TraceRing {
+    std::vector<TraceEvent> events;       /// power of two
+    unsigned long long written;           /// since the ring was cleared
+    unsigned int generation;
+    int in_use;                           /// a live thread owns it
+    int tid;
+    const char* name;
+};
+
+static const unsigned long long INSTANT = ~0ULL;
+
+bool Trace::s_enabled = false;
+
+// like AsyncLog: nothing with a destructor, rings are never freed
+static pthread_mutex_t s_rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<TraceRing*>* s_rings = 0;
+static unsigned long long s_capacity = 0;    /// events per ring
+static unsigned int s_generation = 1;        /// changed by enable/clear
+static pthread_key_t s_ring_key;
+static __thread TraceRing* t_ring = 0;
+static __thread const char* t_name = 0;
+
+static void release_ring(void* ring)
+{
+    __atomic_store_n(&static_cast<TraceRing*>(ring)->in_use, 0,
+                     __ATOMIC_RELEASE);
+}
+
+/// the ring of the calling thread, emptied if a clear() came since
+static TraceRing* thread_ring()
+{
+    TraceRing* ring = t_ring;
+    if (ring != 0 &&
+        ring->generation == __atomic_load_n(&s_generation, __ATOMIC_ACQUIRE)) {
+        return ring;
+    }
+
+    pthread_mutex_lock(&s_rings_mutex);
+    if (ring == 0) {
+        if (s_rings == 0) {
+            s_rings = new std::vector<TraceRing*>();
+            pthread_key_create(&s_ring_key, release_ring);
+        }
+        // a ring left by an exited thread, unless it has events not
+        // yet cleared
+        for (unsigned int i = 0; i < s_rings->size(); i++) {
+            TraceRing* old = (*s_rings)[i];
+            if (__atomic_load_n(&old->in_use, __ATOMIC_ACQUIRE) == 0 &&
+                old->generation != s_generation) {
+                ring = old;
+                break;
+            }
+        }
+        if (ring == 0) {
+            ring = new TraceRing();
+            s_rings->push_back(ring);
+        }
+        ring->in_use = 1;
+        ring->tid    = syscall(SYS_gettid);
+        ring->name   = t_name;
+        ring->generation = 0;
+        pthread_setspecific(s_ring_key, ring);
+        t_ring = ring;
+    }
+    if (ring->events.size() != s_capacity) {
+        // zero filled, so the pages are not faulted in during the run
+        std::vector<TraceEvent>(s_capacity).swap(ring->events);
+    }
+    ring->written    = 0;
+    ring->generation = s_generation;
+    pthread_mutex_unlock(&s_rings_mutex);
+    return ring;
+}
+
+static void record(const char* name, unsigned long long ts,
+                   unsigned long long dur, const char* arg_name,
+                   unsigned long long arg)
+{
+    TraceRing* ring = thread_ring();
+    if (ring->events.empty()) {
+        return;
+    }
+    unsigned long long n = ring->written;
+    TraceEvent& ev = ring->events[n & (ring->events.size() - 1)];
+    ev.ts       = ts;
+    ev.dur      = dur;
+    ev.name     = name;
+    ev.arg_name = arg_name;
+    ev.arg      = arg;
+    __atomic_store_n(&ring->written, n + 1, __ATOMIC_RELEASE);
+}
+
+void Trace::enable(unsigned long long bytes_per_thread)
+{
+    if (bytes_per_thread == 0) {
+        __atomic_store_n(&s_enabled, false, __ATOMIC_RELAXED);
+        return;
+    }
+
+    unsigned long long capacity = 1;
+    while (capacity*2*sizeof(TraceEvent) <= bytes_per_thread) {
+        capacity *= 2;
+    }
+    pthread_mutex_lock(&s_rings_mutex);
+    s_capacity = capacity;
+    __atomic_add_fetch(&s_generation, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&s_rings_mutex);
+
+    thread_ring();         // allocate the caller's ring now, not in the run
+    __atomic_store_n(&s_enabled, true, __ATOMIC_RELAXED);
+}
+
+void Trace::set_thread_name(const char* name)
+{
+    t_name = name;
+    if (t_ring != 0) {
+        t_ring->name = name;
+    }
+}
+
+void Trace::complete(const char* name,
+                     unsigned long long t_begin, unsigned long long t_end,
+                     const char* arg_name, unsigned long long arg)
+{
+    if (!enabled()) {
+        return;
+    }
+    record(name, t_begin, t_end - t_begin, arg_name, arg);
+}
+
+void Trace::instant(const char* name,
+                    const char* arg_name, unsigned long long arg)
+{
+    if (!enabled()) {
+        return;
+    }
+    record(name, mono_now_ns(), INSTANT, arg_name, arg);
+}
+
+void Trace::clear()
+{
+    pthread_mutex_lock(&s_rings_mutex);
+    __atomic_add_fetch(&s_generation, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&s_rings_mutex);
+}
+
+/// rings holding events of the current generation
+static std::vector<TraceRing*> current_rings()
+{
+    std::vector<TraceRing*> rings;
+    pthread_mutex_lock(&s_rings_mutex);
+    if (s_rings != 0) {
+        for (unsigned int i = 0; i < s_rings->size(); i++) {
+            TraceRing* ring = (*s_rings)[i];
+            if (ring->generation == s_generation && !ring->events.empty()) {
+                rings.push_back(ring);
+            }
+        }
+    }
+    pthread_mutex_unlock(&s_rings_mutex);
+    return rings;
+}
+
+unsigned long long Trace::overwritten()
+{
+    std::vector<TraceRing*> rings = current_rings();
+    unsigned long long n = 0;
+    for (unsigned int i = 0; i < rings.size(); i++) {
+        unsigned long long written =
+            __atomic_load_n(&rings[i]->written, __ATOMIC_ACQUIRE);
+        if (written > rings[i]->events.size()) {
+            n += written - rings[i]->events.size();
+        }
+    }
+    return n;
+}
+
+/// JSON string without the quotes
+static std::string escape(const std::string& s)
+{
+    std::string out;
+    for (unsigned int i = 0; i < s.size(); i++) {
+        if (s[i] == '"' || s[i] == '\\') {
+            out += '\\';
+        }
+        if ((unsigned char)s[i] >= 0x20) {
+            out += s[i];
+        }
+    }
+    return out;
+}
+
+long long Trace::export_json(const std::string& path,
+                             const std::string& process_name)
+{
+    FILE* fp = fopen(path.c_str(), "w");
+    if (fp == 0) {
+        return -1;
+    }
+    std::vector<char> buf(1024*1024);
+    setvbuf(fp, &buf[0], _IOFBF, buf.size());
+
+    int pid = getpid();
+    fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+            "\"args\":{\"name\":\"%s\"}}", pid, escape(process_name).c_str());
+
+    long long count = 0;
+    std::vector<TraceRing*> rings = current_rings();
+    for (unsigned int r = 0; r < rings.size(); r++) {
+        const TraceRing* ring = rings[r];
+        char name[32];
+        if (ring->name == 0) {
+            snprintf(name, sizeof(name), "thread %d", ring->tid);
+        }
+        fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+                "\"tid\":%d,\"args\":{\"name\":\"%s\"}}", pid, ring->tid,
+                ring->name ? escape(ring->name).c_str() : name);
+
+        unsigned long long end = __atomic_load_n(&ring->written,
+                                                 __ATOMIC_ACQUIRE);
+        unsigned long long size = ring->events.size();
+        unsigned long long begin = end > size ? end - size : 0;
+        for (unsigned long long i = begin; i < end; i++) {
+            const TraceEvent& ev = ring->events[i & (size - 1)];
+            // times in us with ns resolution
+            fprintf(fp, ",\n{\"name\":\"%s\",\"pid\":%d,\"tid\":%d,"
+                    "\"ts\":%llu.%03llu", ev.name, pid, ring->tid,
+                    ev.ts/1000, ev.ts%1000);
+            if (ev.dur == INSTANT) {
+                fprintf(fp, ",\"ph\":\"i\",\"s\":\"t\"");
+            }
+            else {
+                fprintf(fp, ",\"ph\":\"X\",\"dur\":%llu.%03llu",
+                        ev.dur/1000, ev.dur%1000);
+            }
+            if (ev.arg_name != 0) {
+                fprintf(fp, ",\"args\":{\"%s\":%llu}", ev.arg_name, ev.arg);
+            }
+            fputc('}', fp);
+            count++;
+        }
+    }
+    fprintf(fp, "\n]}\n");
+
+    if (fclose(fp) != 0) {
+        return -1;
+    }
+    return count;
+}
@@ -0,0 +1,102 @@
+// -*- C++ -*-
+/*!
+ * @file Trace.h
+ * @brief Timeline of per-block events, exported as Chrome trace JSON.
+ * @date
+ * @author
+ *
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <string>
+
+#include "BlockTime.h"
+
+/*
+ * @class Trace
+ * @brief Per thread ring buffers of timed events.
+ *
+ * An event is a name, a begin time and a duration (CLOCK_MONOTONIC, the
+ * clock of BlockTime.h) and one optional numeric argument.  Recording
+ * is two clock reads and a 40 byte store into the ring of the calling
+ * thread, without lock; when a ring is full the oldest events are
+ * overwritten.  While tracing is disabled a TraceScope costs one load.
+ *
+ * export_json() writes the events of all threads in the Chrome trace
+ * event format, which chrome://tracing and ui.perfetto.dev open.  Call
+ * it when the recording threads are idle (at stop).  All processes on
+ * a host share the clock, so the files of the reader and the logger can
+ * be merged into one timeline.
+ *
+ *     {
+ *         TraceScope trace("read");
+ *         ret = receive_block(data);
+ *         trace.set_arg("bytes", ret);
+ *     }
+ *     Trace::instant("rotate", "branch", branch_no);
+ */
+class Trace
+{
+public:
+    /// start recording with rings of this size; 0 stops recording
+    static void enable(unsigned long long bytes_per_thread);
+    static bool enabled()
+    {
+        return __atomic_load_n(&s_enabled, __ATOMIC_RELAXED);
+    }
+    /// thread name in the timeline, default "thread <tid>"
+    static void set_thread_name(const char* name);
+
+    /// names and arg_names must be string literals (kept as pointers)
+    static void complete(const char* name,
+                         unsigned long long t_begin, unsigned long long t_end,
+                         const char* arg_name = 0, unsigned long long arg = 0);
+    static void instant(const char* name,
+                        const char* arg_name = 0, unsigned long long arg = 0);
+
+    /// returns the number of events written, -1 on error
+    static long long export_json(const std::string& path,
+                                 const std::string& process_name);
+    /// events overwritten because a ring was full, since the last clear()
+    static unsigned long long overwritten();
+    /// drop the events of all threads
+    static void clear();
+
+private:
+    static bool s_enabled;
+};
+
+/*
+ * @class TraceScope
+ * @brief Records a complete event from construction to destruction.
+ */
+class TraceScope
+{
+public:
+    explicit TraceScope(const char* name)
+        : m_name(name), m_arg_name(0), m_arg(0),
+          m_begin(Trace::enabled() ? mono_now_ns() : 0)
+    {
+    }
+    ~TraceScope()
+    {
+        if (m_begin > 0) {
+            Trace::complete(m_name, m_begin, mono_now_ns(), m_arg_name, m_arg);
+        }
+    }
+    void set_arg(const char* arg_name, unsigned long long arg)
+    {
+        m_arg_name = arg_name;
+        m_arg      = arg;
+    }
+
+private:
+    const char* m_name;
+    const char* m_arg_name;
+    unsigned long long m_arg;
+    unsigned long long m_begin;
+};
+
+#endif
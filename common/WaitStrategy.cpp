@@ -0,0 +1,220 @@
+// -*- C++ -*-
+/*!
+ * @file WaitStrategy.cpp
+ * @brief What a component does when its InPort has no data.
+ * @date
+ * @author
+ *
+ */
+
+#include <cerrno>
+#include <sched.h>
+#include <time.h>
+
+#include "WaitStrategy.h"
+#include "BlockTime.h"
+
+static inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+DataArrivalNotifier::DataArrivalNotifier()
+    : m_generation(0), m_first_arrival_ns(0), m_waiting(0)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&m_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&m_mutex, NULL);
+}
+
+DataArrivalNotifier::~DataArrivalNotifier()
+{
+    pthread_cond_destroy(&m_cond);
+    pthread_mutex_destroy(&m_mutex);
+}
+
+void DataArrivalNotifier::operator()(const RTC::ConnectorInfo& info,
+                                     const cdrMemoryStream& data)
+{
+    unsigned long long zero = 0;
+    unsigned long long now  = mono_now_ns();
+    __atomic_compare_exchange_n(&m_first_arrival_ns, &zero, now, false,
+                                __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&m_generation, 1, __ATOMIC_SEQ_CST);
+
+    // The waiter sets m_waiting before it re-checks the generation
+    // under the mutex, so either it sees the new generation or we see
+    // m_waiting here.
+    if (__atomic_load_n(&m_waiting, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&m_mutex);
+        pthread_cond_signal(&m_cond);
+        pthread_mutex_unlock(&m_mutex);
+    }
+}
+
+unsigned long long DataArrivalNotifier::generation() const
+{
+    return __atomic_load_n(&m_generation, __ATOMIC_SEQ_CST);
+}
+
+bool DataArrivalNotifier::wait(unsigned long long gen,
+                               unsigned long long timeout_ns)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec  += timeout_ns / 1000000000ULL;
+    deadline.tv_nsec += timeout_ns % 1000000000ULL;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec  += 1;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    bool arrived = true;
+    pthread_mutex_lock(&m_mutex);
+    __atomic_store_n(&m_waiting, 1, __ATOMIC_SEQ_CST);
+    while (generation() == gen) {
+        int ret = pthread_cond_timedwait(&m_cond, &m_mutex, &deadline);
+        if (ret == ETIMEDOUT) {
+            arrived = (generation() != gen);
+            break;
+        }
+    }
+    __atomic_store_n(&m_waiting, 0, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&m_mutex);
+
+    return arrived;
+}
+
+void DataArrivalNotifier::clear_first_arrival()
+{
+    __atomic_store_n(&m_first_arrival_ns, 0, __ATOMIC_RELAXED);
+}
+
+unsigned long long DataArrivalNotifier::first_arrival() const
+{
+    return __atomic_load_n(&m_first_arrival_ns, __ATOMIC_RELAXED);
+}
+
+WaitStrategy::WaitStrategy()
+    : m_mode(SPIN), m_spin_count(1000), m_timeout_ns(10000000ULL),
+      m_notifier(new DataArrivalNotifier())
+{
+    reset_stats();
+}
+
+WaitStrategy::~WaitStrategy()
+{
+    // m_notifier is deleted by the InPort it is registered to
+}
+
+int WaitStrategy::set_mode(const std::string& name)
+{
+    if (name == "spin") {
+        m_mode = SPIN;
+    }
+    else if (name == "yield") {
+        m_mode = YIELD;
+    }
+    else if (name == "block") {
+        m_mode = BLOCK;
+    }
+    else {
+        return -1;
+    }
+    return 0;
+}
+
+void WaitStrategy::set_spin_count(unsigned int count)
+{
+    m_spin_count = count;
+}
+
+void WaitStrategy::set_timeout_us(unsigned int usec)
+{
+    m_timeout_ns = usec * 1000ULL;
+}
+
+std::string WaitStrategy::mode_name() const
+{
+    switch (m_mode) {
+    case YIELD:
+        return "yield";
+    case BLOCK:
+        return "block";
+    default:
+        return "spin";
+    }
+}
+
+void WaitStrategy::reset_stats()
+{
+    m_idle       = false;
+    m_idle_polls = 0;
+    m_wakeups    = 0;
+    m_timeouts   = 0;
+    m_wakeup_latency.reset();
+}
+
+unsigned long long WaitStrategy::begin_poll() const
+{
+    return m_notifier->generation();
+}
+
+void WaitStrategy::idle(unsigned long long gen)
+{
+    m_idle_polls++;
+    if (!m_idle) {
+        m_idle = true;
+        m_notifier->clear_first_arrival();
+    }
+
+    switch (m_mode) {
+    case SPIN:
+        break;
+    case YIELD:
+        for (unsigned int i = 0; i < m_spin_count; i++) {
+            if (m_notifier->generation() != gen) {
+                return;
+            }
+            cpu_relax();
+        }
+        sched_yield();
+        break;
+    case BLOCK:
+        if (!m_notifier->wait(gen, m_timeout_ns)) {
+            m_timeouts++;
+        }
+        break;
+    }
+}
+
+void WaitStrategy::got_data()
+{
+    if (!m_idle) {
+        return;
+    }
+    m_idle = false;
+    m_wakeups++;
+
+    unsigned long long arrival = m_notifier->first_arrival();
+    if (arrival > 0) {
+        unsigned long long now = mono_now_ns();
+        if (now >= arrival) {
+            m_wakeup_latency.add(now - arrival);
+        }
+    }
+}
+
+void WaitStrategy::print_stats(std::ostream& os) const
+{
+    os << "wait_strategy: " << mode_name()
+       << " idle_polls: " << m_idle_polls
+       << " wakeups: "    << m_wakeups
+       << " wait_timeouts: " << m_timeouts << std::endl;
+    m_wakeup_latency.print(os, "idle_wakeup_latency");
+}
@@ -0,0 +1,110 @@
+// -*- C++ -*-
+/*!
+ * @file WaitStrategy.h
+ * @brief What a component does when its InPort has no data.
+ * @date
+ * @author
+ *
+ */
+
+#ifndef WAITSTRATEGY_H
+#define WAITSTRATEGY_H
+
+#include <string>
+#include <pthread.h>
+#include <rtm/ConnectorListener.h>
+
+#include "LatencyHistogram.h"
+
+/*
+ * @class DataArrivalNotifier
+ * @brief InPort ON_BUFFER_WRITE listener.
+ *
+ * Called in the ORB thread after a block has been stored in the InPort
+ * buffer.  It bumps a generation counter, remembers the arrival time of
+ * the first block after an idle period, and wakes up a waiter only when
+ * there is one, so the spin strategies pay no lock on the data path.
+ * The untyped listener is used so that the block is not unmarshalled
+ * a second time.
+ */
+class DataArrivalNotifier
+    : public RTC::ConnectorDataListener
+{
+public:
+    DataArrivalNotifier();
+    virtual ~DataArrivalNotifier();
+
+    virtual void operator()(const RTC::ConnectorInfo& info,
+                            const cdrMemoryStream& data);
+
+    unsigned long long generation() const;
+    /// wait until generation() != gen or timeout_ns passed.
+    /// returns true if woken up by data arrival.
+    bool wait(unsigned long long gen, unsigned long long timeout_ns);
+    /// forget the arrival time, called when the reader goes idle
+    void clear_first_arrival();
+    /// arrival time of the first block after clear_first_arrival(), 0 if none
+    unsigned long long first_arrival() const;
+
+private:
+    pthread_mutex_t m_mutex;
+    pthread_cond_t  m_cond;
+    unsigned long long m_generation;
+    unsigned long long m_first_arrival_ns;
+    int m_waiting;
+};
+
+/*
+ * @class WaitStrategy
+ * @brief Idle action of the logger's InPort polling loop.
+ *
+ *  - spin:  return to the execution context at once (former behavior).
+ *  - yield: check for data arrival spin_count times, then sched_yield().
+ *  - block: sleep on the data arrival notification, at most timeout_us
+ *           so that check_trans_lock() is still polled regularly.
+ *
+ * Usage in daq_run():
+ *    gen = ws.begin_poll();
+ *    if (!m_InPort.read()) { ...; ws.idle(gen); return 0; }
+ *    ws.got_data();
+ */
+class WaitStrategy
+{
+public:
+    enum Mode { SPIN, YIELD, BLOCK };
+
+    WaitStrategy();
+    virtual ~WaitStrategy();
+
+    /// "spin", "yield" or "block". returns -1 for an unknown name.
+    int  set_mode(const std::string& name);
+    void set_spin_count(unsigned int count);
+    void set_timeout_us(unsigned int usec);
+    Mode mode() const { return m_mode; }
+    std::string mode_name() const;
+
+    /// listener to be registered to InPort ON_BUFFER_WRITE.
+    /// ownership goes to the port (autoclean).
+    DataArrivalNotifier* notifier() { return m_notifier; }
+
+    void reset_stats();
+    unsigned long long begin_poll() const;
+    void idle(unsigned long long gen);
+    void got_data();
+
+    void print_stats(std::ostream& os) const;
+
+private:
+    Mode m_mode;
+    unsigned int m_spin_count;
+    unsigned long long m_timeout_ns;
+    DataArrivalNotifier* m_notifier;
+
+    bool m_idle;
+    unsigned long long m_idle_polls;
+    unsigned long long m_wakeups;
+    unsigned long long m_timeouts;
+    LatencyHistogram m_wakeup_latency;
+};
+
+#endif
@@ -0,0 +1,327 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""Block size sweep for TPEtherReader -> TPEtherLogger.
+
+For each bufsize_kb the config.xml is generated from
+tp-ether-reader-logger.xml.in, the components are started with run.py
+and runs are taken with daqcom:
+
+  - warm-up runs (not used for statistics), then
+  - measurement runs until the 95% confidence interval of the mean
+    transfer_rate is within --ci-percent of the mean (or --max-runs).
+
+transfer_rate of each run is taken from the TPEtherLogger log
+(/tmp/daqmw/log.TPEtherLoggerComp).  The result with mean, stddev,
+confidence interval and percentiles per size, and the output of
+./runenv, is written as JSON and CSV.  With --baseline the result is
+compared against a previous JSON report and regressions are flagged
+(exit status 2).
+
+--local-source starts a stand-in data source (TCP server sending a
+fixed pattern) on this host and points srcAddr/srcPort at it.
+"""
+
+import argparse
+import csv
+import json
+import math
+import os
+import re
+import shutil
+import socket
+import subprocess
+import sys
+import threading
+import time
+
+DAQCOM_URL = 'http://localhost/daqmw/scripts/'
+LOGGER_LOG = '/tmp/daqmw/log.TPEtherLoggerComp'
+TEMPLATE = 'tp-ether-reader-logger.xml.in'
+
+# two sided 95% t values for df = 1 .. 30
+T95 = [12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262,
+       2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101,
+       2.093, 2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052,
+       2.048, 2.045, 2.042]
+
+
+def t95(df):
+    if df < 1:
+        return float('inf')
+    if df <= len(T95):
+        return T95[df - 1]
+    return 1.960
+
+
+def mean_stddev(values):
+    n = len(values)
+    mean = sum(values) / n
+    if n < 2:
+        return mean, 0.0
+    var = sum((v - mean) ** 2 for v in values) / (n - 1)
+    return mean, math.sqrt(var)
+
+
+def ci_half_width(values):
+    n = len(values)
+    if n < 2:
+        return float('inf')
+    _, sd = mean_stddev(values)
+    return t95(n - 1) * sd / math.sqrt(n)
+
+
+def percentile(values, p):
+    s = sorted(values)
+    if not s:
+        return 0.0
+    k = (len(s) - 1) * p / 100.0
+    lo = int(math.floor(k))
+    hi = int(math.ceil(k))
+    return s[lo] + (s[hi] - s[lo]) * (k - lo)
+
+
+class LocalSource(object):
+    """Stand-in for the front-end: sends a pattern to each connection."""
+
+    def __init__(self, port, chunk=1024 * 1024):
+        self.port = port
+        self.buf = bytes(bytearray(i & 0xff for i in range(chunk)))
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        self.sock.bind(('127.0.0.1', port))
+        self.sock.listen(4)
+        t = threading.Thread(target=self.accept_loop)
+        t.daemon = True
+        t.start()
+
+    def accept_loop(self):
+        while True:
+            conn, _ = self.sock.accept()
+            t = threading.Thread(target=self.send_loop, args=(conn,))
+            t.daemon = True
+            t.start()
+
+    def send_loop(self, conn):
+        try:
+            while True:
+                conn.sendall(self.buf)
+        except (OSError, socket.error):
+            pass
+        finally:
+            conn.close()
+
+
+def generate_config(size_kb, src_addr, src_port, path):
+    with open(TEMPLATE) as f:
+        text = f.read()
+    text = text.replace('%data_size%', str(size_kb))
+    if src_addr:
+        text = re.sub(r'(<param pid="srcAddr">)[^<]*(</param>)',
+                      r'\g<1>%s\g<2>' % src_addr, text)
+    if src_port:
+        text = re.sub(r'(<param pid="srcPort">)[^<]*(</param>)',
+                      r'\g<1>%d\g<2>' % src_port, text)
+    with open(path, 'w') as f:
+        f.write(text)
+
+
+def daqcom(*args):
+    subprocess.check_call(['daqcom', DAQCOM_URL] + list(args))
+
+
+def read_rates():
+    """All transfer_rate values printed so far by TPEtherLogger."""
+    try:
+        with open(LOGGER_LOG) as f:
+            text = f.read()
+    except IOError:
+        return []
+    return [float(m) for m in re.findall(r'transfer_rate: ([0-9.eE+-]+) MB/s',
+                                         text)]
+
+
+def one_run(run_no, duration):
+    before = len(read_rates())
+    daqcom('-b', str(run_no))
+    time.sleep(duration)
+    daqcom('-e')
+    # wait for the stop report
+    for _ in range(50):
+        rates = read_rates()
+        if len(rates) > before:
+            return rates[before]
+        time.sleep(0.2)
+    raise RuntimeError('no transfer_rate in %s after run %d'
+                       % (LOGGER_LOG, run_no))
+
+
+def sweep_size(size_kb, args):
+    config = '/tmp/tp-ether-reader-logger-%dkB.xml' % size_kb
+    generate_config(size_kb, args.src_addr, args.src_port, config)
+
+    for f in os.listdir('/tmp'):
+        if f.endswith('.dat'):
+            os.remove(os.path.join('/tmp', f))
+
+    subprocess.check_call(['run.py', '-l', config])
+    time.sleep(args.settle)
+    daqcom('-c')
+
+    run_no = 1
+    try:
+        for _ in range(args.warmup):
+            time.sleep(args.gap)
+            r = one_run(run_no, args.warmup_sec)
+            print('  warm-up run %d: %.1f MB/s' % (run_no, r))
+            run_no += 1
+
+        rates = []
+        while len(rates) < args.max_runs:
+            time.sleep(args.gap)
+            r = one_run(run_no, args.duration)
+            rates.append(r)
+            run_no += 1
+            mean, _ = mean_stddev(rates)
+            hw = ci_half_width(rates)
+            print('  run %d: %.1f MB/s  mean %.1f +- %.1f'
+                  % (run_no - 1, r, mean, hw if hw != float('inf') else 0))
+            if len(rates) >= args.min_runs and hw <= mean * args.ci_percent / 100:
+                break
+    finally:
+        if os.path.exists(LOGGER_LOG):
+            shutil.copy(LOGGER_LOG, 'log/run.%d' % size_kb)
+        subprocess.call(['pkill', '-f', 'Comp'])
+        time.sleep(args.gap)
+
+    mean, sd = mean_stddev(rates)
+    hw = ci_half_width(rates)
+    return {
+        'size_kb': size_kb,
+        'runs': len(rates),
+        'rates': rates,
+        'mean': mean,
+        'stddev': sd,
+        'ci95': hw if hw != float('inf') else None,
+        'converged': hw <= mean * args.ci_percent / 100,
+        'min': min(rates),
+        'p50': percentile(rates, 50),
+        'p90': percentile(rates, 90),
+        'max': max(rates),
+    }
+
+
+def compare(results, baseline_path, tolerance):
+    with open(baseline_path) as f:
+        baseline = json.load(f)
+    base = dict((r['size_kb'], r) for r in baseline['results'])
+    regressions = []
+    for r in results:
+        b = base.get(r['size_kb'])
+        if b is None:
+            continue
+        # a drop larger than both the tolerance and the combined
+        # confidence intervals is a regression
+        noise = (b.get('ci95') or 0) + (r.get('ci95') or 0)
+        limit = max(b['mean'] * tolerance / 100.0, noise)
+        r['baseline_mean'] = b['mean']
+        r['change_percent'] = (r['mean'] - b['mean']) / b['mean'] * 100.0
+        r['regression'] = b['mean'] - r['mean'] > limit
+        if r['regression']:
+            regressions.append(r)
+    return regressions
+
+
+def write_csv(results, path):
+    keys = ['size_kb', 'runs', 'mean', 'stddev', 'ci95', 'converged',
+            'min', 'p50', 'p90', 'max', 'baseline_mean', 'change_percent',
+            'regression']
+    with open(path, 'w') as f:
+        w = csv.writer(f)
+        w.writerow(keys)
+        for r in results:
+            w.writerow([r.get(k, '') for k in keys])
+
+
+def main():
+    p = argparse.ArgumentParser(description=__doc__,
+                                formatter_class=argparse.RawDescriptionHelpFormatter)
+    p.add_argument('--sizes', default=','.join(str(2 ** i) for i in range(13)),
+                   help='bufsize_kb list (default 1,2,4,...,4096)')
+    p.add_argument('--duration', type=float, default=30,
+                   help='measurement run length in sec (default 30)')
+    p.add_argument('--warmup', type=int, default=1,
+                   help='warm-up runs per size (default 1)')
+    p.add_argument('--warmup-sec', type=float, default=10)
+    p.add_argument('--min-runs', type=int, default=3)
+    p.add_argument('--max-runs', type=int, default=10)
+    p.add_argument('--ci-percent', type=float, default=2.0,
+                   help='stop when 95%% CI half width < this %% of mean')
+    p.add_argument('--settle', type=float, default=5,
+                   help='wait after run.py in sec')
+    p.add_argument('--gap', type=float, default=2,
+                   help='wait between runs in sec')
+    p.add_argument('--src-addr', help='override srcAddr')
+    p.add_argument('--src-port', type=int, help='override srcPort')
+    p.add_argument('--local-source', action='store_true',
+                   help='start a stand-in data source on 127.0.0.1')
+    p.add_argument('--baseline', help='previous JSON report to compare')
+    p.add_argument('--tolerance', type=float, default=3.0,
+                   help='regression threshold in %% (default 3)')
+    p.add_argument('-o', '--output', default='log/sweep',
+                   help='report path without extension (default log/sweep)')
+    args = p.parse_args()
+
+    if args.local_source:
+        port = args.src_port or 24240
+        LocalSource(port)
+        args.src_addr = '127.0.0.1'
+        args.src_port = port
+
+    sizes = [int(s) for s in args.sizes.split(',')]
+
+    try:
+        runenv = subprocess.check_output(['./runenv'],
+                                         stderr=subprocess.STDOUT)
+        runenv = runenv.decode('utf-8', 'replace')
+    except (OSError, subprocess.CalledProcessError) as e:
+        runenv = 'runenv failed: %s' % e
+
+    results = []
+    for size in sizes:
+        print('---> %d kB' % size)
+        results.append(sweep_size(size, args))
+
+    regressions = []
+    if args.baseline:
+        regressions = compare(results, args.baseline, args.tolerance)
+
+    report = {
+        'date': time.strftime('%Y-%m-%dT%H:%M:%S'),
+        'duration_sec': args.duration,
+        'ci_percent': args.ci_percent,
+        'local_source': args.local_source,
+        'runenv': runenv,
+        'results': results,
+    }
+    with open(args.output + '.json', 'w') as f:
+        json.dump(report, f, indent=2)
+    write_csv(results, args.output + '.csv')
+
+    print('%8s %5s %10s %8s %8s %s' % ('size_kB', 'runs', 'MB/s', 'stddev',
+                                       'ci95', ''))
+    for r in results:
+        flag = ''
+        if not r['converged']:
+            flag += ' (not converged)'
+        if r.get('regression'):
+            flag += ' REGRESSION %.1f%%' % r['change_percent']
+        print('%8d %5d %10.1f %8.1f %8.1f%s'
+              % (r['size_kb'], r['runs'], r['mean'], r['stddev'],
+                 r['ci95'] or 0, flag))
+
+    if regressions:
+        sys.exit(2)
+
+
+if __name__ == '__main__':
+    main()
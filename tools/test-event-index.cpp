@@ -0,0 +1,180 @@
+// -*- C++ -*-
+/*!
+ * @file test-event-index.cpp
+ * @brief Event index of TPEtherLogger read back with tpether-event,
+ *        for events across block and branch boundaries.
+ * @date
+ * @author
+ *
+ * Writes a run as TPEtherLogger does, with and without the header and
+ * footer of each block in the file (saveHeaderFooter): 100 byte events
+ * in 256 byte blocks, two blocks per branch, indexed by EventFramer
+ * with the offsets frame_events() gives it.  Then every event is
+ * extracted with tpether-event -o and compared with what was sent.
+ *
+ * Usage: test-event-index   (make check, in tools/; exit status 0: passed)
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "EventFramer.h"
+
+static const unsigned int EVENT_SIZE  = 100;
+static const unsigned int EVENTS      = 20;
+static const unsigned int BLOCK_DATA  = 256;
+static const unsigned int BLOCKS_PER_BRANCH = 2;
+
+static int s_failed = 0;
+
+static void expect(bool ok, const std::string& what)
+{
+    if (!ok) {
+        std::cerr << "FAILED " << what << std::endl;
+        s_failed++;
+    }
+}
+
+static std::string branch_path(const std::string& dir, unsigned int branch)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "/20110202T143748_000100_%03u.dat", branch);
+    return dir + name;
+}
+
+static void put_block_word(unsigned char* p, unsigned char magic,
+                           unsigned int value)
+{
+    p[0] = magic;
+    p[1] = magic;
+    p[2] = 0;
+    p[3] = 0;
+    p[4] = (value >> 24) & 0xff;
+    p[5] = (value >> 16) & 0xff;
+    p[6] = (value >>  8) & 0xff;
+    p[7] =  value        & 0xff;
+}
+
+static void run(const std::string& dir, bool header_footer)
+{
+    std::string mode = header_footer ? "saveHeaderFooter yes" : "saveHeaderFooter no";
+
+    std::vector<unsigned char> stream(EVENTS*EVENT_SIZE);
+    for (unsigned int i = 0; i < stream.size(); i++) {
+        stream[i] = (i/EVENT_SIZE)*13 + i%EVENT_SIZE;
+    }
+
+    EventFramer framer;
+    framer.set_fixed(EVENT_SIZE);
+    framer.set_indexing(true);
+    framer.set_block_framing(header_footer);
+
+    std::vector<EventIndexEntry> index;
+    std::ofstream file;
+    unsigned int branch = 0;
+    unsigned long long file_size = 0;
+    for (unsigned int b = 0; b*BLOCK_DATA < stream.size(); b++) {
+        if (b % BLOCKS_PER_BRANCH == 0) {
+            if (file.is_open()) {
+                file.close();
+                branch++;
+            }
+            file.open(branch_path(dir, branch).c_str(),
+                      std::ios::out | std::ios::binary | std::ios::trunc);
+            file_size = 0;
+        }
+        unsigned int size = stream.size() - b*BLOCK_DATA;
+        if (size > BLOCK_DATA) {
+            size = BLOCK_DATA;
+        }
+        const unsigned char* data = &stream[b*BLOCK_DATA];
+
+        // as TPEtherLogger::frame_events()
+        unsigned long long offset = file_size;
+        if (header_footer) {
+            offset += 8;
+        }
+        framer.feed(data, size, offset, branch);
+        index.insert(index.end(), framer.entries().begin(),
+                     framer.entries().end());
+        framer.entries().clear();
+
+        unsigned char word[8];
+        if (header_footer) {
+            put_block_word(word, 0xe7, size);
+            file.write((char*)word, sizeof(word));
+            file_size += sizeof(word);
+        }
+        file.write((const char*)data, size);
+        file_size += size;
+        if (header_footer) {
+            put_block_word(word, 0xcc, b);
+            file.write((char*)word, sizeof(word));
+            file_size += sizeof(word);
+        }
+    }
+    file.close();
+    expect(index.size() == EVENTS, mode + ": all events indexed");
+
+    std::string idx = branch_path(dir, 0) + ".idx";
+    std::ofstream out(idx.c_str(), std::ios::out | std::ios::binary);
+    EventIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, EVENT_INDEX_MAGIC, sizeof(header.magic));
+    header.entry_size = sizeof(EventIndexEntry);
+    header.run_no     = 100;
+    out.write((char*)&header, sizeof(header));
+    out.write((char*)&index[0], index.size()*sizeof(EventIndexEntry));
+    out.close();
+
+    for (unsigned int i = 0; i < index.size(); i++) {
+        std::string event_path = dir + "/event";
+        std::ostringstream cmd;
+        cmd << "./tpether-event -i " << idx << " -n " << i
+            << " -o " << event_path << " > /dev/null";
+        std::ostringstream what;
+        what << mode << ": event " << i;
+        if (system(cmd.str().c_str()) != 0) {
+            expect(false, what.str() + " extracted");
+            continue;
+        }
+        std::vector<char> got(EVENT_SIZE + 1);
+        std::ifstream in(event_path.c_str(), std::ios::binary);
+        in.read(&got[0], got.size());
+        expect(in.gcount() == (std::streamsize)EVENT_SIZE &&
+               memcmp(&got[0], &stream[i*EVENT_SIZE], EVENT_SIZE) == 0,
+               what.str() + " data");
+    }
+    std::cerr << mode << ": " << index.size() << " events checked" << std::endl;
+}
+
+int main()
+{
+    char dir[] = "/tmp/test-event-index.XXXXXX";
+    if (mkdtemp(dir) == 0) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    run(dir, false);
+    run(dir, true);
+
+    std::string cmd = std::string("rm -rf ") + dir;
+    if (system(cmd.c_str()) != 0) {
+        std::cerr << "cannot remove " << dir << std::endl;
+    }
+
+    if (s_failed > 0) {
+        std::cerr << s_failed << " checks FAILED" << std::endl;
+        return 1;
+    }
+    std::cerr << "all checks passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,100 @@
+// -*- C++ -*-
+/*!
+ * @file test-extent-rotate.cpp
+ * @brief FileUtils with an extent store: rotation with the extent
+ *        table full must fail the write, not run past the table.
+ * @date
+ * @author
+ *
+ * Formats a store of two extents in a temporary directory, writes
+ * blocks until the first file is rotated into the second extent and
+ * once more, and checks that write_data() then returns -1 (every time)
+ * and that the two files in the store are closed and complete.
+ *
+ * Usage: test-extent-rotate   (make check; exit status 0: passed)
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "FileUtils.h"
+#include "ExtentStore.h"
+
+static int s_failed = 0;
+
+static void expect(bool ok, const char* what)
+{
+    std::cerr << (ok ? "ok     " : "FAILED ") << what << std::endl;
+    if (!ok) {
+        s_failed++;
+    }
+}
+
+int main()
+{
+    char dir[] = "/tmp/test-extent-rotate.XXXXXX";
+    if (mkdtemp(dir) == 0) {
+        perror("mkdtemp");
+        return 1;
+    }
+    std::string store_path = std::string(dir) + "/store";
+
+    std::string error;
+    if (ExtentStore::format(store_path, 16ULL*1024*1024, 2, false, error) < 0) {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+
+    static const unsigned long BLOCK = 256*1024;
+    std::vector<char> block(BLOCK, 0x5a);
+
+    FileUtils* fu = new FileUtils();
+    fu->set_run_no(1);
+    fu->set_max_size_in_megaBytes(1);
+    expect(fu->set_extent_store(store_path) == 0, "set_extent_store");
+    expect(fu->open_file(dir) == 0, "open_file");
+
+    // 1 MB fills branch 0 and rotates into the second, last extent
+    int ret = 0;
+    for (int i = 0; i < 4 && ret == 0; i++) {
+        ret = fu->write_data(&block[0], BLOCK);
+    }
+    expect(ret == 0, "first rotation");
+    expect(fu->get_branch_no() == 1, "branch 1 open");
+
+    // the next rotation finds the table full
+    for (int i = 0; i < 4 && ret == 0; i++) {
+        ret = fu->write_data(&block[0], BLOCK);
+    }
+    expect(ret < 0, "rotation with the table full fails");
+    expect(fu->write_data(&block[0], BLOCK) < 0, "later writes fail too");
+    fu->close_file();
+    delete fu;
+
+    ExtentStore store;
+    expect(store.open(store_path, false) == 0, "store opens again");
+    std::vector<ExtentEntry> entries = store.list();
+    expect(entries.size() == 2, "two extents");
+    for (unsigned int i = 0; i < entries.size(); i++) {
+        expect(entries[i].state == EXTENT_CLOSED &&
+               entries[i].length == 4*BLOCK, "extent closed, 1 MB");
+    }
+    store.close();
+
+    std::string cmd = std::string("rm -rf ") + dir;
+    if (system(cmd.c_str()) != 0) {
+        std::cerr << "cannot remove " << dir << std::endl;
+    }
+
+    if (s_failed > 0) {
+        std::cerr << s_failed << " checks FAILED" << std::endl;
+        return 1;
+    }
+    std::cerr << "all checks passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,254 @@
+// -*- C++ -*-
+/*!
+ * @file tpether-blockbench.cpp
+ * @brief Microbenchmark of the fixed block size paths (FixedBlock.h).
+ * @date
+ * @author
+ *
+ * For every size class (1 kB ... 4096 kB) compares, per block:
+ *
+ *   copy:   memcpy() with the size known at run time and the
+ *           non-temporal kernel of FixedBlock.h
+ *   build:  TPEtherReader::set_data(), i.e. header, copy and footer,
+ *           generic and FixedBlock<N>::fill() (with the copy the size
+ *           class uses)
+ *   check:  the header/footer check of TPEtherLogger, byte by byte
+ *           like DaqComponentBase::check_header_footer() and
+ *           FixedBlock<N>::check()
+ *
+ * The destination is one block buffer used again and again, with the
+ * data 8 bytes into it, like the OutPort buffer; the source is exactly
+ * N bytes, like the receive buffer, and ends at an inaccessible page, so
+ * that a copy reading past its end crashes here.
+ *
+ * Usage: tpether-blockbench [-m MB per measurement] [-c class]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "FixedBlock.h"
+
+static unsigned long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned long long s_bytes_per_test = 2048ULL*1024*1024;
+static volatile unsigned int s_sink;
+
+// generic versions, as in the components: sizes at run time
+
+static void generic_set_header(unsigned char* header, unsigned int size)
+{
+    header[0] = FIXED_HEADER_MAGIC;
+    header[1] = FIXED_HEADER_MAGIC;
+    header[2] = 0;
+    header[3] = 0;
+    header[4] = (size >> 24) & 0xff;
+    header[5] = (size >> 16) & 0xff;
+    header[6] = (size >>  8) & 0xff;
+    header[7] =  size        & 0xff;
+}
+
+static void generic_set_footer(unsigned char* footer, unsigned int seq)
+{
+    footer[0] = FIXED_FOOTER_MAGIC;
+    footer[1] = FIXED_FOOTER_MAGIC;
+    footer[2] = 0;
+    footer[3] = 0;
+    footer[4] = (seq >> 24) & 0xff;
+    footer[5] = (seq >> 16) & 0xff;
+    footer[6] = (seq >>  8) & 0xff;
+    footer[7] =  seq        & 0xff;
+}
+
+static void generic_build(unsigned char* block, const unsigned char* data,
+                          unsigned int size, unsigned int seq)
+{
+    unsigned char header[FIXED_HEADER_BYTE_SIZE];
+    unsigned char footer[FIXED_FOOTER_BYTE_SIZE];
+    generic_set_header(header, size);
+    generic_set_footer(footer, seq);
+    memcpy(block, header, FIXED_HEADER_BYTE_SIZE);
+    memcpy(block + FIXED_HEADER_BYTE_SIZE, data, size);
+    memcpy(block + FIXED_HEADER_BYTE_SIZE + size, footer,
+           FIXED_FOOTER_BYTE_SIZE);
+}
+
+static bool generic_check(const unsigned char* block, unsigned int block_size,
+                          unsigned int seq)
+{
+    const unsigned char* h = block;
+    const unsigned char* f = block + block_size - FIXED_FOOTER_BYTE_SIZE;
+    unsigned int size = (h[4] << 24) | (h[5] << 16) | (h[6] << 8) | h[7];
+    unsigned int s    = (f[4] << 24) | (f[5] << 16) | (f[6] << 8) | f[7];
+    return h[0] == FIXED_HEADER_MAGIC && h[1] == FIXED_HEADER_MAGIC &&
+           size == block_size - FIXED_HEADER_BYTE_SIZE - FIXED_FOOTER_BYTE_SIZE &&
+           f[0] == FIXED_FOOTER_MAGIC && f[1] == FIXED_FOOTER_MAGIC &&
+           s == seq;
+}
+
+struct Buffers {
+    unsigned char* block;                 /// 64 byte aligned + 8 for the data
+    unsigned char* raw;
+};
+
+/// n bytes that end where a PROT_NONE page begins; map is the mapping
+static unsigned char* alloc_guarded(unsigned int n, void*& map,
+                                    size_t& map_size)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t data_pages = (n + page - 1)/page*page;
+    map_size = data_pages + page;
+    map = mmap(0, map_size, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    unsigned char* base = (unsigned char*)map;
+    if (mprotect(base + data_pages, page, PROT_NONE) < 0) {
+        perror("mprotect");
+        exit(1);
+    }
+    unsigned char* src = base + data_pages - n;
+    for (unsigned int i = 0; i < n; i++) {
+        src[i] = i*7;
+    }
+    return src;
+}
+
+static double report(const char* name, unsigned int size,
+                     unsigned long long n, unsigned long long ns)
+{
+    double ns_block = (double)ns/n;
+    printf("  %-16s %12.1f ns/block %8.2f GB/s\n", name, ns_block,
+           size/ns_block);
+    return ns_block;
+}
+
+template <unsigned int N>
+static void bench_size(const Buffers& b)
+{
+    volatile unsigned int size = N;      // opaque to the generic code
+    unsigned long long n = s_bytes_per_test/N;
+    if (n < 1000) {
+        n = 1000;
+    }
+    unsigned char* data = b.block + FIXED_HEADER_BYTE_SIZE;
+    void* map;
+    size_t map_size;
+    unsigned char* src = alloc_guarded(N, map, map_size);
+
+    printf("%u kB, %llu blocks\n", N/1024, n);
+
+    unsigned long long t = now_ns();
+    for (unsigned long long i = 0; i < n; i++) {
+        memcpy(data, src, size);
+    }
+    report("memcpy", N, n, now_ns() - t);
+
+    t = now_ns();
+    for (unsigned long long i = 0; i < n; i++) {
+        copy_stream(data, src, N);
+    }
+    report("stream", N, n, now_ns() - t);
+
+    t = now_ns();
+    for (unsigned long long i = 0; i < n; i++) {
+        generic_build(b.block, src, size, i);
+    }
+    double generic = report("build generic", N, n, now_ns() - t);
+
+    t = now_ns();
+    for (unsigned long long i = 0; i < n; i++) {
+        FixedBlock<N>::fill(b.block, src, i);
+    }
+    double fixed = report("build fixed", N, n, now_ns() - t);
+    printf("  %-16s %12.2f x (%s)\n", "build speedup", generic/fixed,
+           N >= BLOCK_STREAM_MIN_BYTES ? "stream" : "memcpy");
+
+    // the check reads 16 bytes of the block: many more repetitions
+    unsigned long long m = n*64;
+    unsigned int ok = 0;
+    t = now_ns();
+    for (unsigned long long i = 0; i < m; i++) {
+        ok += generic_check(b.block, size + 16, n - 1);
+    }
+    double cg = (double)(now_ns() - t)/m;
+    t = now_ns();
+    for (unsigned long long i = 0; i < m; i++) {
+        ok += FixedBlock<N>::check(b.block, size + 16, true, n - 1);
+    }
+    double cf = (double)(now_ns() - t)/m;
+    if (ok != 2*m) {
+        printf("  ### check failed\n");
+    }
+    printf("  %-16s %12.2f ns generic %.2f ns fixed\n", "check", cg, cf);
+    s_sink = ok;
+
+    if (memcmp(data, src, N) != 0) {
+        printf("  ### copy mismatch\n");
+    }
+    munmap(map, map_size);
+}
+
+/// all classes from C on, or only class only if only >= 0
+template <int C>
+struct BenchClasses
+{
+    static void run(const Buffers& b, int only)
+    {
+        if (only < 0 || only == C) {
+            bench_size<1024U << C>(b);
+        }
+        BenchClasses<C + 1>::run(b, only);
+    }
+};
+
+template <>
+struct BenchClasses<FIXED_BLOCK_CLASSES>
+{
+    static void run(const Buffers&, int) {}
+};
+
+int main(int argc, char* argv[])
+{
+    int only = -1;
+    int c;
+    while ((c = getopt(argc, argv, "m:c:h")) != -1) {
+        switch (c) {
+        case 'm':
+            s_bytes_per_test = strtoull(optarg, NULL, 0)*1024*1024;
+            break;
+        case 'c':
+            only = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: tpether-blockbench [-m MB per measurement]"
+                    " [-c class 0 (1 kB) ... %d (4096 kB)]\n",
+                    FIXED_BLOCK_CLASSES - 1);
+            exit(1);
+        }
+    }
+
+    unsigned int max = 1024U << (FIXED_BLOCK_CLASSES - 1);
+    Buffers b;
+    b.raw = (unsigned char*)malloc(max + 128);
+    if (b.raw == 0) {
+        perror("malloc");
+        return 1;
+    }
+    b.block = (unsigned char*)(((uintptr_t)b.raw + 63) & ~(uintptr_t)63);
+    memset(b.raw, 0, max + 128);
+
+    BenchClasses<0>::run(b, only);
+    return 0;
+}
@@ -0,0 +1,232 @@
+// -*- C++ -*-
+/*!
+ * @file tpether-event.cpp
+ * @brief Look up events with the TPEtherLogger event index.
+ * @date
+ * @author
+ *
+ * TPEtherLogger with eventFraming writes an index next to the first
+ * data file of a run (e.g. 20110202T143748_000100_000.dat.idx).  This
+ * program prints the index entry of event N and optionally writes the
+ * event data, read from the data file branch it is in, to output.
+ * Without -n it prints the number of events in the index.
+ *
+ * Usage: tpether-event -i index [-n event_no] [-o output]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "EventIndex.h"
+
+/// EventIndexEntry without block_bytes
+static const unsigned int OLD_ENTRY_SIZE = 16;
+
+static void usage()
+{
+    std::cerr << "Usage: tpether-event -i index [-n event_no] [-o output]"
+              << std::endl;
+    std::cerr << "  -i  index file (data file name + .idx)" << std::endl;
+    std::cerr << "  -n  event number, from 0" << std::endl;
+    std::cerr << "  -o  write the event data to output" << std::endl;
+}
+
+// ..._BBB.dat.idx -> ..._NNN.dat
+static std::string data_file_name(const std::string& index, unsigned int branch)
+{
+    std::string name = index.substr(0, index.size() - 4);
+    std::string::size_type dot = name.rfind('.');
+    if (dot == std::string::npos || dot < 3) {
+        return name;
+    }
+    char br[8];
+    snprintf(br, sizeof(br), "%03u", branch);
+    return name.substr(0, dot - 3) + br + name.substr(dot);
+}
+
+static FILE* open_branch(const std::string& index, unsigned int branch,
+                         unsigned long long offset)
+{
+    std::string path = data_file_name(index, branch);
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (fp == NULL) {
+        perror(path.c_str());
+        return NULL;
+    }
+    if (fseeko(fp, offset, SEEK_SET) < 0) {
+        perror("fseeko");
+        fclose(fp);
+        return NULL;
+    }
+    return fp;
+}
+
+/// the header of the block at the file position, after skipping the
+/// footer of the previous block if skip_footer;
+/// 1: data_byte_size set, 0: end of the file, -1: not a block header
+static int next_block(FILE* fp, bool skip_footer, unsigned int& data_byte_size)
+{
+    unsigned char h[8];
+    if (skip_footer && fseeko(fp, 8, SEEK_CUR) < 0) {
+        perror("fseeko");
+        return -1;
+    }
+    size_t n = fread(h, 1, sizeof(h), fp);
+    if (n == 0) {
+        return 0;
+    }
+    if (n != sizeof(h) || h[0] != 0xe7 || h[1] != 0xe7) {
+        return -1;
+    }
+    data_byte_size = (h[4] << 24) | (h[5] << 16) | (h[6] << 8) | h[7];
+    return 1;
+}
+
+// The event may continue in the next block and in the next branch.
+// With block_bytes the file has the header and footer of each block
+// (saveHeaderFooter), which are not part of the event.
+static int read_event(const std::string& index, const EventIndexEntry& e,
+                      std::vector<unsigned char>& data)
+{
+    data.resize(e.byte_size);
+    bool framed = e.block_bytes > 0;
+    unsigned int branch = e.branch_no;
+    unsigned int in_block = e.block_bytes;    // framed: data left in the block
+    unsigned int done = 0;
+
+    FILE* fp = open_branch(index, branch, e.offset);
+    if (fp == NULL) {
+        return -1;
+    }
+    while (done < e.byte_size) {
+        unsigned int want = e.byte_size - done;
+        if (framed && want > in_block) {
+            want = in_block;
+        }
+        size_t n = fread(&data[done], 1, want, fp);
+        done += n;
+        if (done == e.byte_size) {
+            break;
+        }
+
+        int ret = 1;
+        if (!framed) {
+            ret = n < want ? 0 : 1;     // 0: end of the branch
+        }
+        else if (n < want) {            // blocks do not span branches
+            ret = -1;
+        }
+        else {
+            ret = next_block(fp, true, in_block);
+        }
+        if (ret == 0) {
+            fclose(fp);
+            fp = open_branch(index, ++branch, 0);
+            if (fp == NULL) {
+                return -1;
+            }
+            // a branch begins with a block header
+            ret = framed ? next_block(fp, false, in_block) : 1;
+        }
+        if (ret <= 0) {
+            std::cerr << data_file_name(index, branch)
+                      << ": event data ends early or bad block header"
+                      << std::endl;
+            fclose(fp);
+            return -1;
+        }
+    }
+    fclose(fp);
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    std::string index;
+    std::string output;
+    bool have_event = false;
+    unsigned long long event_no = 0;
+
+    int c;
+    while ((c = getopt(argc, argv, "i:n:o:h")) != -1) {
+        switch (c) {
+        case 'i':
+            index = optarg;
+            break;
+        case 'n':
+            event_no = strtoull(optarg, NULL, 0);
+            have_event = true;
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    if (index.size() <= 4) {
+        usage();
+        exit(1);
+    }
+
+    FILE* fp = fopen(index.c_str(), "rb");
+    if (fp == NULL) {
+        perror(index.c_str());
+        exit(1);
+    }
+    EventIndexHeader header;
+    if (fread(&header, sizeof(header), 1, fp) != 1 ||
+        memcmp(header.magic, EVENT_INDEX_MAGIC, sizeof(header.magic)) != 0 ||
+        (header.entry_size != sizeof(EventIndexEntry) &&
+         header.entry_size != OLD_ENTRY_SIZE)) {
+        std::cerr << index << ": not an event index" << std::endl;
+        exit(1);
+    }
+
+    if (!have_event) {
+        fseeko(fp, 0, SEEK_END);
+        unsigned long long n = (ftello(fp) - sizeof(header))/header.entry_size;
+        std::cout << "run " << header.run_no << " events " << n << std::endl;
+        fclose(fp);
+        return 0;
+    }
+
+    EventIndexEntry e;
+    memset(&e, 0, sizeof(e));           // old entries: no block_bytes
+    if (fseeko(fp, sizeof(header) + event_no*header.entry_size, SEEK_SET) < 0 ||
+        fread(&e, header.entry_size, 1, fp) != 1) {
+        std::cerr << "no event " << event_no << " in " << index << std::endl;
+        exit(1);
+    }
+    fclose(fp);
+
+    std::cout << "event " << event_no
+              << " file " << data_file_name(index, e.branch_no)
+              << " offset " << e.offset
+              << " byte_size " << e.byte_size << std::endl;
+
+    if (!output.empty()) {
+        std::vector<unsigned char> data;
+        if (read_event(index, e, data) < 0) {
+            exit(1);
+        }
+        FILE* out = fopen(output.c_str(), "wb");
+        if (out == NULL) {
+            perror(output.c_str());
+            exit(1);
+        }
+        if (fwrite(&data[0], 1, data.size(), out) != data.size()) {
+            perror("fwrite");
+            exit(1);
+        }
+        fclose(out);
+    }
+
+    return 0;
+}
@@ -0,0 +1,241 @@
+// -*- C++ -*-
+/*!
+ * @file tpether-extent.cpp
+ * @brief Format an extent store, list and extract its data files.
+ * @date
+ * @author
+ *
+ * TPEtherLogger with extentStore writes its data files as extents of
+ * one preallocated file or block device (common/ExtentStore.h).  This
+ * program prepares such a store and gets the files back out, with the
+ * names they would have had in dirName, so that tpether-verify and the
+ * analysis programs work on them unchanged.
+ *
+ * Usage: tpether-extent format [-n max_extents] [-p] store size_MB
+ *        tpether-extent list store
+ *        tpether-extent extract [-r run] [-b branch] [-o dir] store
+ *        tpether-extent verify store
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "ExtentStore.h"
+
+static void usage()
+{
+    std::cerr << "Usage: tpether-extent format [-n max_extents] [-p] store size_MB"
+              << std::endl;
+    std::cerr << "       tpether-extent list store" << std::endl;
+    std::cerr << "       tpether-extent extract [-r run] [-b branch] [-o dir] store"
+              << std::endl;
+    std::cerr << "       tpether-extent verify store" << std::endl;
+    std::cerr << "  format   new empty store, size_MB 0: size of the existing"
+              << " file or device" << std::endl;
+    std::cerr << "    -n  extent table entries (default 16384)" << std::endl;
+    std::cerr << "    -p  allocate the blocks of a regular file now"
+              << " (default: sparse)" << std::endl;
+    std::cerr << "  list     one line per data file" << std::endl;
+    std::cerr << "  extract  write the data files to dir (default .)"
+              << std::endl;
+    std::cerr << "  verify   check the CRC32C of every data file that has one"
+              << std::endl;
+}
+
+static const char* state_name(unsigned int state)
+{
+    switch (state) {
+    case EXTENT_OPEN:
+        return "open";
+    case EXTENT_CLOSED:
+        return "closed";
+    default:
+        return "free";
+    }
+}
+
+static int do_format(int argc, char* argv[])
+{
+    unsigned int max_extents = 16384;
+    bool preallocate = false;
+
+    int c;
+    while ((c = getopt(argc, argv, "n:ph")) != -1) {
+        switch (c) {
+        case 'n':
+            max_extents = strtoul(optarg, NULL, 0);
+            break;
+        case 'p':
+            preallocate = true;
+            break;
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    if (argc - optind != 2) {
+        usage();
+        exit(1);
+    }
+
+    std::string path = argv[optind];
+    unsigned long long size = strtoull(argv[optind + 1], NULL, 0)*1024*1024;
+    std::string error;
+    if (ExtentStore::format(path, size, max_extents, preallocate, error) < 0) {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+
+    ExtentStore store;
+    if (store.open(path, false) < 0) {
+        std::cerr << store.error() << std::endl;
+        return 1;
+    }
+    const ExtentSuperblock& sb = store.superblock();
+    printf("%s: %llu MB, %u extents, data from offset %llu\n", path.c_str(),
+           sb.store_size/1024/1024, sb.table_entries, sb.data_offset);
+    return 0;
+}
+
+static int do_list(int argc, char* argv[])
+{
+    if (argc - optind != 1) {
+        usage();
+        exit(1);
+    }
+    ExtentStore store;
+    if (store.open(argv[optind], false) < 0) {
+        std::cerr << store.error() << std::endl;
+        return 1;
+    }
+
+    std::vector<ExtentEntry> entries = store.list();
+    printf("%-32s %6s %6s %14s %14s %8s %s\n",
+           "name", "run", "branch", "offset", "bytes", "crc32c", "state");
+    unsigned long long used = 0;
+    for (unsigned int i = 0; i < entries.size(); i++) {
+        const ExtentEntry& e = entries[i];
+        char crc[16] = "-";
+        if (e.has_crc) {
+            snprintf(crc, sizeof(crc), "%08x", e.data_crc);
+        }
+        printf("%-32s %6u %6u %14llu %14llu %8s %s\n", e.name, e.run_no,
+               e.branch_no, e.offset, e.length, crc, state_name(e.state));
+        used += e.length;
+    }
+    const ExtentSuperblock& sb = store.superblock();
+    printf("%u of %u extents, %llu MB of data, %llu MB free\n",
+           (unsigned int)entries.size(), sb.table_entries,
+           used/1024/1024, store.free_bytes()/1024/1024);
+    return 0;
+}
+
+static int do_extract(int argc, char* argv[], bool verify_only)
+{
+    long run = -1;
+    long branch = -1;
+    std::string dir = ".";
+
+    int c;
+    while ((c = getopt(argc, argv, "r:b:o:h")) != -1) {
+        switch (c) {
+        case 'r':
+            run = strtol(optarg, NULL, 0);
+            break;
+        case 'b':
+            branch = strtol(optarg, NULL, 0);
+            break;
+        case 'o':
+            dir = optarg;
+            break;
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    if (argc - optind != 1) {
+        usage();
+        exit(1);
+    }
+    ExtentStore store;
+    if (store.open(argv[optind], false) < 0) {
+        std::cerr << store.error() << std::endl;
+        return 1;
+    }
+
+    int ret = 0;
+    std::vector<ExtentEntry> entries = store.list();
+    for (unsigned int i = 0; i < entries.size(); i++) {
+        const ExtentEntry& e = entries[i];
+        if ((run >= 0 && e.run_no != (unsigned long)run) ||
+            (branch >= 0 && e.branch_no != (unsigned long)branch)) {
+            continue;
+        }
+
+        int fd = -1;
+        std::string path = dir + "/" + e.name;
+        if (!verify_only) {
+            fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0) {
+                perror(path.c_str());
+                ret = 1;
+                continue;
+            }
+        }
+        unsigned int crc;
+        if (store.extract(e, fd, crc) < 0) {
+            std::cerr << store.error() << std::endl;
+            ret = 1;
+        }
+        else if (e.has_crc && crc != e.data_crc) {
+            printf("%s: FAILED, crc32c %08x, expected %08x\n",
+                   e.name, crc, e.data_crc);
+            ret = 1;
+        }
+        else {
+            printf("%s: %llu bytes%s%s\n", e.name, e.length,
+                   e.has_crc ? ", crc32c OK" : "",
+                   e.state == EXTENT_OPEN ? " (open, incomplete)" : "");
+        }
+        if (fd >= 0 && close(fd) < 0) {
+            perror(path.c_str());
+            ret = 1;
+        }
+    }
+    return ret;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        usage();
+        exit(1);
+    }
+    std::string command = argv[1];
+    // options of the command follow it
+    argc--;
+    argv++;
+
+    if (command == "format") {
+        return do_format(argc, argv);
+    }
+    if (command == "list") {
+        return do_list(argc, argv);
+    }
+    if (command == "extract") {
+        return do_extract(argc, argv, false);
+    }
+    if (command == "verify") {
+        return do_extract(argc, argv, true);
+    }
+    usage();
+    return 1;
+}
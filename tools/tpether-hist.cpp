@@ -0,0 +1,107 @@
+// -*- C++ -*-
+/*!
+ * @file tpether-hist.cpp
+ * @brief Print a TPEtherMonitor histogram snapshot.
+ * @date
+ * @author
+ *
+ * Prints entries, mean and rms (in sample units) of each channel of
+ * the snapshot file written by TPEtherMonitor, or with -c the bins of
+ * one channel as "bin_low count" lines for plotting.
+ *
+ * Usage: tpether-hist [-f snapshot_file] [-c channel]
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "HistSnapshot.h"
+
+static void usage()
+{
+    std::cerr << "Usage: tpether-hist [-f snapshot_file] [-c channel]"
+              << std::endl;
+    std::cerr << "  -f  snapshot file (default /dev/shm/tpethermonitor.hist)"
+              << std::endl;
+    std::cerr << "  -c  print the bins of this channel" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    std::string file = "/dev/shm/tpethermonitor.hist";
+    int channel = -1;
+
+    int c;
+    while ((c = getopt(argc, argv, "f:c:h")) != -1) {
+        switch (c) {
+        case 'f':
+            file = optarg;
+            break;
+        case 'c':
+            channel = atoi(optarg);
+            break;
+        default:
+            usage();
+            exit(1);
+        }
+    }
+
+    FILE* fp = fopen(file.c_str(), "rb");
+    if (fp == NULL) {
+        perror(file.c_str());
+        exit(1);
+    }
+    HistSnapshotHeader header;
+    if (fread(&header, sizeof(header), 1, fp) != 1 ||
+        memcmp(header.magic, HIST_SNAPSHOT_MAGIC, sizeof(header.magic)) != 0) {
+        std::cerr << file << ": not a histogram snapshot" << std::endl;
+        exit(1);
+    }
+    std::vector<unsigned long long> counts((size_t)header.n_channels*header.n_bins);
+    if (fread(&counts[0], sizeof(counts[0]), counts.size(), fp) != counts.size()) {
+        std::cerr << file << ": short file" << std::endl;
+        exit(1);
+    }
+    fclose(fp);
+
+    double width = 1 << header.bin_shift;
+
+    if (channel >= 0) {
+        if ((unsigned int)channel >= header.n_channels) {
+            std::cerr << "no channel " << channel << std::endl;
+            exit(1);
+        }
+        const unsigned long long* h = &counts[(size_t)channel*header.n_bins];
+        for (unsigned int b = 0; b < header.n_bins; b++) {
+            std::cout << b*width << " " << h[b] << std::endl;
+        }
+        return 0;
+    }
+
+    std::cout << "run " << header.run_no
+              << " snapshot " << header.snapshot_no
+              << " blocks " << header.blocks
+              << " samples " << header.samples << std::endl;
+    for (unsigned int ch = 0; ch < header.n_channels; ch++) {
+        const unsigned long long* h = &counts[(size_t)ch*header.n_bins];
+        double n = 0, sum = 0, sum2 = 0;
+        for (unsigned int b = 0; b < header.n_bins; b++) {
+            double x = (b + 0.5)*width;
+            n    += h[b];
+            sum  += h[b]*x;
+            sum2 += h[b]*x*x;
+        }
+        double mean = n > 0 ? sum/n : 0;
+        double rms  = n > 0 ? sqrt(sum2/n - mean*mean) : 0;
+        std::cout << "ch " << ch << " entries " << (unsigned long long)n
+                  << " mean " << mean << " rms " << rms << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,207 @@
+// -*- C++ -*-
+/*!
+ * @file tpether-merge.cpp
+ * @brief Merge fan-out logger files back into sequence order.
+ * @date
+ * @author
+ *
+ * TPEtherReader with numOutPorts > 1 spreads blocks over several
+ * TPEtherLoggers.  With saveHeaderFooter yes each logger file holds
+ * whole DAQ-Middleware blocks:
+ *
+ *   header (8 bytes): 0xe7 0xe7 0x00 0x00 data_byte_size (big endian)
+ *   data   (data_byte_size bytes)
+ *   footer (8 bytes): 0xcc 0xcc 0x00 0x00 sequence number (big endian)
+ *
+ * Every file is sorted by sequence number, so a k-way merge restores
+ * the original order.  The output holds data only (like a logger file
+ * with saveHeaderFooter no), or whole blocks with -k.
+ *
+ * Usage: tpether-merge [-k] -o output input...
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <queue>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+static const unsigned int  HEADER_BYTE_SIZE = 8;
+static const unsigned int  FOOTER_BYTE_SIZE = 8;
+static const unsigned char HEADER_MAGIC     = 0xe7;
+static const unsigned char FOOTER_MAGIC     = 0xcc;
+
+struct Block {
+    unsigned int seq_num;
+    std::vector<unsigned char> buf;   // header + data + footer
+};
+
+struct Input {
+    std::string name;
+    FILE* fp;
+    Block block;
+};
+
+static unsigned int get_be32(const unsigned char* p)
+{
+    return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/// returns 1 if a block was read, 0 at end of file, -1 on error
+static int read_block(Input& in)
+{
+    unsigned char header[HEADER_BYTE_SIZE];
+    size_t n = fread(header, 1, HEADER_BYTE_SIZE, in.fp);
+    if (n == 0) {
+        return 0;
+    }
+    if (n != HEADER_BYTE_SIZE ||
+        header[0] != HEADER_MAGIC || header[1] != HEADER_MAGIC) {
+        std::cerr << in.name << ": bad header at offset "
+                  << ftell(in.fp) - n << std::endl;
+        return -1;
+    }
+
+    unsigned int data_byte_size = get_be32(&header[4]);
+    std::vector<unsigned char>& buf = in.block.buf;
+    buf.resize(HEADER_BYTE_SIZE + data_byte_size + FOOTER_BYTE_SIZE);
+    memcpy(&buf[0], header, HEADER_BYTE_SIZE);
+    n = fread(&buf[HEADER_BYTE_SIZE], 1, data_byte_size + FOOTER_BYTE_SIZE,
+              in.fp);
+    if (n != data_byte_size + FOOTER_BYTE_SIZE) {
+        std::cerr << in.name << ": truncated block" << std::endl;
+        return -1;
+    }
+
+    unsigned char* footer = &buf[HEADER_BYTE_SIZE + data_byte_size];
+    if (footer[0] != FOOTER_MAGIC || footer[1] != FOOTER_MAGIC) {
+        std::cerr << in.name << ": bad footer at offset "
+                  << ftell(in.fp) - FOOTER_BYTE_SIZE << std::endl;
+        return -1;
+    }
+    in.block.seq_num = get_be32(&footer[4]);
+    return 1;
+}
+
+struct LaterSeq {
+    const std::vector<Input>* inputs;
+    bool operator()(int a, int b) const {
+        return (*inputs)[a].block.seq_num > (*inputs)[b].block.seq_num;
+    }
+};
+
+static void usage()
+{
+    std::cerr << "Usage: tpether-merge [-k] -o output input..." << std::endl;
+    std::cerr << "  -k  keep DAQ-Middleware header and footer" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    bool keep_header_footer = false;
+    std::string output;
+
+    int c;
+    while ((c = getopt(argc, argv, "ko:h")) != -1) {
+        switch (c) {
+        case 'k':
+            keep_header_footer = true;
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    if (output.empty() || optind >= argc) {
+        usage();
+        exit(1);
+    }
+
+    std::vector<Input> inputs(argc - optind);
+    for (int i = optind; i < argc; i++) {
+        Input& in = inputs[i - optind];
+        in.name = argv[i];
+        in.fp = fopen(argv[i], "rb");
+        if (in.fp == NULL) {
+            perror(argv[i]);
+            exit(1);
+        }
+    }
+
+    FILE* out = fopen(output.c_str(), "wb");
+    if (out == NULL) {
+        perror(output.c_str());
+        exit(1);
+    }
+
+    LaterSeq later;
+    later.inputs = &inputs;
+    std::priority_queue<int, std::vector<int>, LaterSeq> heap(later);
+    for (unsigned int i = 0; i < inputs.size(); i++) {
+        int ret = read_block(inputs[i]);
+        if (ret < 0) {
+            exit(1);
+        }
+        if (ret > 0) {
+            heap.push(i);
+        }
+    }
+
+    unsigned long long n_blocks = 0;
+    unsigned long long n_gaps   = 0;
+    bool first = true;
+    unsigned int expected = 0;
+
+    while (!heap.empty()) {
+        int i = heap.top();
+        heap.pop();
+        Block& block = inputs[i].block;
+
+        if (!first && block.seq_num != expected) {
+            std::cerr << "sequence gap: expected " << expected
+                      << " got " << block.seq_num << std::endl;
+            n_gaps++;
+        }
+        first = false;
+        expected = block.seq_num + 1;
+
+        const unsigned char* p = &block.buf[0];
+        size_t len = block.buf.size();
+        if (!keep_header_footer) {
+            p   += HEADER_BYTE_SIZE;
+            len -= HEADER_BYTE_SIZE + FOOTER_BYTE_SIZE;
+        }
+        if (fwrite(p, 1, len, out) != len) {
+            perror("fwrite");
+            exit(1);
+        }
+        n_blocks++;
+
+        int ret = read_block(inputs[i]);
+        if (ret < 0) {
+            exit(1);
+        }
+        if (ret > 0) {
+            heap.push(i);
+        }
+    }
+
+    for (unsigned int i = 0; i < inputs.size(); i++) {
+        fclose(inputs[i].fp);
+    }
+    if (fclose(out) != 0) {
+        perror("fclose");
+        exit(1);
+    }
+
+    std::cerr << "merged blocks: " << n_blocks
+              << " sequence gaps: " << n_gaps << std::endl;
+
+    return n_gaps > 0 ? 2 : 0;
+}
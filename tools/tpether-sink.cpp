@@ -0,0 +1,135 @@
+// -*- C++ -*-
+/*!
+ * @file tpether-sink.cpp
+ * @brief Receive the TPEtherForwarder stream and throw it away.
+ * @date
+ * @author
+ *
+ * Test receiver for TPEtherForwarder: connects to listenPort, reads
+ * and discards the data and prints the rate once per second.  With -d
+ * it sleeps after every read, to see how the forwarder treats a slow
+ * receiver (slowReceiverPolicy).
+ *
+ * Usage: tpether-sink [-b read_bytes] [-d delay_us] [-n seconds] host port
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+static void usage()
+{
+    std::cerr << "Usage: tpether-sink [-b read_bytes] [-d delay_us] "
+              << "[-n seconds] host port" << std::endl;
+    std::cerr << "  -b  bytes per recv() (default 1048576)" << std::endl;
+    std::cerr << "  -d  sleep after every recv(), simulates a slow receiver"
+              << std::endl;
+    std::cerr << "  -n  exit after seconds (default: until the forwarder "
+              << "closes)" << std::endl;
+}
+
+static double now_sec()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + 0.000001*tv.tv_usec;
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned int read_bytes = 1024*1024;
+    unsigned int delay_us = 0;
+    double duration = 0;
+
+    int c;
+    while ((c = getopt(argc, argv, "b:d:n:h")) != -1) {
+        switch (c) {
+        case 'b':
+            read_bytes = strtoul(optarg, NULL, 0);
+            break;
+        case 'd':
+            delay_us = strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            duration = strtod(optarg, NULL);
+            break;
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    if (argc - optind != 2 || read_bytes == 0) {
+        usage();
+        exit(1);
+    }
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* res;
+    int err = getaddrinfo(argv[optind], argv[optind + 1], &hints, &res);
+    if (err != 0) {
+        std::cerr << argv[optind] << ": " << gai_strerror(err) << std::endl;
+        exit(1);
+    }
+    int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (fd < 0 || connect(fd, res->ai_addr, res->ai_addrlen) < 0) {
+        perror("connect");
+        exit(1);
+    }
+    freeaddrinfo(res);
+
+    std::vector<char> buf(read_bytes);
+    unsigned long long total = 0;
+    unsigned long long interval = 0;
+    double t_start = now_sec();
+    double t_last  = t_start;
+
+    for (;;) {
+        ssize_t n = recv(fd, &buf[0], buf.size(), 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("recv");
+            break;
+        }
+        if (n == 0) {
+            break;
+        }
+        total    += n;
+        interval += n;
+        if (delay_us > 0) {
+            usleep(delay_us);
+        }
+
+        double t = now_sec();
+        if (t - t_last >= 1.0) {
+            printf("%.1f s: %.1f MB/s\n", t - t_start,
+                   interval/(t - t_last)/1024.0/1024.0);
+            fflush(stdout);
+            interval = 0;
+            t_last   = t;
+        }
+        if (duration > 0 && t - t_start >= duration) {
+            break;
+        }
+    }
+
+    double elapsed = now_sec() - t_start;
+    printf("total: %llu bytes in %.1f s", total, elapsed);
+    if (elapsed > 0) {
+        printf(", %.1f MB/s", total/elapsed/1024.0/1024.0);
+    }
+    printf("\n");
+    close(fd);
+    return 0;
+}
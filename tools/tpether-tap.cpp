@@ -0,0 +1,107 @@
+// -*- C++ -*-
+/*!
+ * @file tpether-tap.cpp
+ * @brief Read sampled blocks from the TPEtherLogger sample tap.
+ * @date
+ * @author
+ *
+ * Example monitoring client.  It follows the shared memory ring which
+ * TPEtherLogger fills when tapEveryNBlocks or tapIntervalMs is set,
+ * prints one line per sample and optionally appends the data to a
+ * file.  The logger never waits for this program.
+ *
+ * Usage: tpether-tap [-s shm_name] [-n count] [-o output]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "SampleTap.h"
+
+static void usage()
+{
+    std::cerr << "Usage: tpether-tap [-s shm_name] [-n count] [-o output]"
+              << std::endl;
+    std::cerr << "  -s  shared memory name (default /tpetherlogger_tap)"
+              << std::endl;
+    std::cerr << "  -n  exit after count samples" << std::endl;
+    std::cerr << "  -o  append sample data to output" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    std::string shm_name = "/tpetherlogger_tap";
+    std::string output;
+    unsigned long long max_samples = 0;
+
+    int c;
+    while ((c = getopt(argc, argv, "s:n:o:h")) != -1) {
+        switch (c) {
+        case 's':
+            shm_name = optarg;
+            break;
+        case 'n':
+            max_samples = strtoull(optarg, NULL, 0);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        default:
+            usage();
+            exit(1);
+        }
+    }
+
+    SampleTapReader tap;
+    if (tap.open(shm_name) < 0) {
+        exit(1);
+    }
+
+    FILE* out = NULL;
+    if (!output.empty()) {
+        out = fopen(output.c_str(), "ab");
+        if (out == NULL) {
+            perror(output.c_str());
+            exit(1);
+        }
+    }
+
+    TapSlotHeader info;
+    std::vector<unsigned char> data;
+    unsigned long long n_samples = 0;
+
+    while (max_samples == 0 || n_samples < max_samples) {
+        int ret = tap.read(info, data);
+        if (ret == 0) {
+            usleep(1000);
+            continue;
+        }
+        if (ret < 0) {
+            continue;
+        }
+        n_samples++;
+
+        std::cout << "sample " << info.sample_no
+                  << " block_seq " << info.block_seq
+                  << " byte_size " << info.byte_size
+                  << " copied " << info.copied_size
+                  << " lost " << tap.lost() << std::endl;
+
+        if (out && !data.empty()) {
+            if (fwrite(&data[0], 1, data.size(), out) != data.size()) {
+                perror("fwrite");
+                exit(1);
+            }
+        }
+    }
+
+    if (out) {
+        fclose(out);
+    }
+
+    return 0;
+}
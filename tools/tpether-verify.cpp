@@ -0,0 +1,232 @@
+// -*- C++ -*-
+/*!
+ * @file tpether-verify.cpp
+ * @brief Check data files against the CRC32C manifest of TPEtherLogger.
+ * @date
+ * @author
+ *
+ * Every file listed in the manifests is cut into pieces of 64 MB; the
+ * pieces of all files are checksummed by -j threads in parallel and the
+ * piece checksums of a file are merged with crc32c_combine().  The data
+ * files are looked up in the directory of their manifest.
+ *
+ * Prints "OK" or "FAILED" for every file and exits with 1 if any file
+ * is missing, has a different size or a different checksum.
+ *
+ * Usage: tpether-verify [-j threads] manifest...
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "Crc32c.h"
+
+static const unsigned long long PIECE_SIZE = 64ULL*1024*1024;
+static const size_t READ_SIZE = 4*1024*1024;
+
+struct DataFile {
+    std::string path;
+    unsigned int crc;                 /// from the manifest
+    unsigned long long size;
+    int fd;
+    bool read_error;
+};
+
+struct Piece {
+    int file;
+    unsigned long long offset;
+    unsigned long long len;
+    unsigned int crc;
+};
+
+static std::vector<DataFile> s_files;
+static std::vector<Piece> s_pieces;
+static unsigned long s_next_piece = 0;
+
+static void usage()
+{
+    std::cerr << "Usage: tpether-verify [-j threads] manifest..." << std::endl;
+    std::cerr << "  -j  number of threads (default: online CPUs)" << std::endl;
+}
+
+static void* worker(void*)
+{
+    std::vector<unsigned char> buf(READ_SIZE);
+
+    for (;;) {
+        unsigned long i = __atomic_fetch_add(&s_next_piece, 1, __ATOMIC_RELAXED);
+        if (i >= s_pieces.size()) {
+            break;
+        }
+        Piece& piece = s_pieces[i];
+        DataFile& file = s_files[piece.file];
+        unsigned int crc = 0;
+        unsigned long long done = 0;
+        while (done < piece.len) {
+            size_t want = piece.len - done < READ_SIZE ? piece.len - done
+                                                       : READ_SIZE;
+            ssize_t n = pread(file.fd, &buf[0], want, piece.offset + done);
+            if (n <= 0) {
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                file.read_error = true;   // only ever set to true
+                break;
+            }
+            crc = crc32c(crc, &buf[0], n);
+            done += n;
+        }
+        piece.crc = crc;
+    }
+    return 0;
+}
+
+static int read_manifest(const std::string& manifest)
+{
+    std::ifstream in(manifest.c_str());
+    if (!in) {
+        perror(manifest.c_str());
+        return -1;
+    }
+    std::string dir = ".";
+    std::string::size_type slash = manifest.rfind('/');
+    if (slash != std::string::npos) {
+        dir = manifest.substr(0, slash);
+    }
+
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream is(line);
+        std::string crc;
+        std::string name;
+        DataFile file;
+        if (!(is >> crc >> file.size >> name)) {
+            continue;
+        }
+        file.crc  = strtoul(crc.c_str(), NULL, 16);
+        file.path = dir + "/" + name;
+        file.fd   = -1;
+        file.read_error = false;
+        s_files.push_back(file);
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    long n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    int c;
+    while ((c = getopt(argc, argv, "j:h")) != -1) {
+        switch (c) {
+        case 'j':
+            n_threads = atoi(optarg);
+            break;
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    if (optind >= argc) {
+        usage();
+        exit(1);
+    }
+    if (n_threads < 1) {
+        n_threads = 1;
+    }
+
+    for (int i = optind; i < argc; i++) {
+        if (read_manifest(argv[i]) < 0) {
+            exit(1);
+        }
+    }
+
+    int failed = 0;
+    std::vector<bool> bad(s_files.size(), false);
+    for (size_t f = 0; f < s_files.size(); f++) {
+        DataFile& file = s_files[f];
+        struct stat st;
+        file.fd = open(file.path.c_str(), O_RDONLY);
+        if (file.fd < 0 || fstat(file.fd, &st) < 0) {
+            std::cout << file.path << ": FAILED (" << strerror(errno) << ")"
+                      << std::endl;
+            bad[f] = true;
+            continue;
+        }
+        if ((unsigned long long)st.st_size != file.size) {
+            std::cout << file.path << ": FAILED (size " << st.st_size
+                      << ", expected " << file.size << ")" << std::endl;
+            bad[f] = true;
+            continue;
+        }
+        posix_fadvise(file.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        for (unsigned long long off = 0; off < file.size; off += PIECE_SIZE) {
+            Piece piece;
+            piece.file   = f;
+            piece.offset = off;
+            piece.len    = file.size - off < PIECE_SIZE ? file.size - off
+                                                        : PIECE_SIZE;
+            piece.crc    = 0;
+            s_pieces.push_back(piece);
+        }
+    }
+
+    std::vector<pthread_t> threads(n_threads);
+    for (long i = 0; i < n_threads; i++) {
+        pthread_create(&threads[i], NULL, worker, NULL);
+    }
+    for (long i = 0; i < n_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    // pieces of a file are consecutive and in order
+    size_t p = 0;
+    for (size_t f = 0; f < s_files.size(); f++) {
+        DataFile& file = s_files[f];
+        if (bad[f]) {
+            failed++;
+            if (file.fd >= 0) {
+                close(file.fd);
+            }
+            continue;
+        }
+        unsigned int crc = 0;
+        for (; p < s_pieces.size() && s_pieces[p].file == (int)f; p++) {
+            crc = crc32c_combine(crc, s_pieces[p].crc, s_pieces[p].len);
+        }
+        close(file.fd);
+
+        if (file.read_error) {
+            std::cout << file.path << ": FAILED (read error)" << std::endl;
+            failed++;
+        }
+        else if (crc != file.crc) {
+            char msg[64];
+            snprintf(msg, sizeof(msg), "crc32c %08x, expected %08x",
+                     crc, file.crc);
+            std::cout << file.path << ": FAILED (" << msg << ")" << std::endl;
+            failed++;
+        }
+        else {
+            std::cout << file.path << ": OK" << std::endl;
+        }
+    }
+
+    if (failed > 0) {
+        std::cerr << "tpether-verify: " << failed << " of " << s_files.size()
+                  << " files FAILED" << std::endl;
+        return 1;
+    }
+    return 0;
+}